@@ -7,10 +7,12 @@
 #include "bench.h"
 
 #include "perf.h"
+#include "test/test_pivx.h"
 
 #include <assert.h>
 #include <iomanip>
 #include <iostream>
+#include <regex>
 
 benchmark::BenchRunner::BenchmarkMap &benchmark::BenchRunner::benchmarks() {
     static std::map<std::string, benchmark::BenchFunction> benchmarks_map;
@@ -23,8 +25,9 @@ benchmark::BenchRunner::BenchRunner(std::string name, benchmark::BenchFunction f
 }
 
 void
-benchmark::BenchRunner::RunAll(benchmark::duration elapsedTimeForOne)
+benchmark::BenchRunner::RunAll(const std::string& filter, benchmark::duration elapsedTimeForOne)
 {
+    const std::regex reFilter(filter);
     perf_init();
     if (std::ratio_less_equal<benchmark::clock::period, std::micro>::value) {
         std::cerr << "WARNING: Clock precision is worse than microsecond - benchmarks may be less accurate!\n";
@@ -33,6 +36,10 @@ benchmark::BenchRunner::RunAll(benchmark::duration elapsedTimeForOne)
               << "min_cycles" << "," << "max_cycles" << "," << "average_cycles" << "\n";
 
     for (const auto &p: benchmarks()) {
+        if (!std::regex_match(p.first, reFilter))
+            continue;
+        // Each benchmark gets a fresh regtest chainstate holding the genesis block
+        TestingSetup test(CBaseChainParams::REGTEST);
         State state(p.first, elapsedTimeForOne);
         p.second(state);
     }
@@ -85,7 +85,7 @@ namespace benchmark {
     public:
         BenchRunner(std::string name, BenchFunction func);
 
-        static void RunAll(duration elapsedTimeForOne = std::chrono::seconds(1));
+        static void RunAll(const std::string& filter = ".*", duration elapsedTimeForOne = std::chrono::seconds(1));
     };
 }
 
@@ -7,18 +7,15 @@
 
 #include "bench.h"
 
-#include "key.h"
-#include "main.h"
 #include "util.h"
 
 int
 main(int argc, char** argv)
 {
-    ECC_Start();
-    SetupEnvironment();
+    ParseParameters(argc, argv);
     g_logger->m_print_to_file = false; // don't want to write to debug.log file
 
-    benchmark::BenchRunner::RunAll();
-
-    ECC_Stop();
+    // -filter=<regex> runs only the benchmarks whose name matches, each one in
+    // a TestingSetup which starts the ECC context and the signature cache
+    benchmark::BenchRunner::RunAll(GetArg("-filter", ".*"));
 }
@@ -0,0 +1,135 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "coins.h"
+#include "random.h"
+
+#include <unordered_map>
+#include <vector>
+
+// Compares the pool allocated CCoinsMap with the same map using the default
+// allocator, for the operations done on the coins cache during IBD: inserting
+// the outputs of new blocks, looking up the inputs, and flushing.
+
+typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> DefaultCoinsMap;
+
+static const size_t NUM_COINS = 20000;
+
+static std::vector<COutPoint> CreateOutpoints()
+{
+    FastRandomContext rng(true);
+    std::vector<COutPoint> vOutpoints;
+    vOutpoints.reserve(NUM_COINS);
+    for (size_t i = 0; i < NUM_COINS; i++)
+        vOutpoints.emplace_back(rng.rand256(), i % 4);
+    return vOutpoints;
+}
+
+static CCoinsCacheEntry CreateEntry(size_t i)
+{
+    CCoinsCacheEntry entry;
+    entry.coin.out.nValue = i;
+    entry.coin.out.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i & 0xff) << OP_EQUALVERIFY << OP_CHECKSIG;
+    entry.coin.nHeight = i;
+    entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+    return entry;
+}
+
+template <typename Map>
+static void FillMap(Map& map, const std::vector<COutPoint>& vOutpoints)
+{
+    for (size_t i = 0; i < vOutpoints.size(); i++)
+        map.emplace(vOutpoints[i], CreateEntry(i));
+}
+
+template <typename Map>
+static void LookupMap(const Map& map, const std::vector<COutPoint>& vOutpoints)
+{
+    size_t nFound = 0;
+    for (const COutPoint& outpoint : vOutpoints)
+        nFound += map.count(outpoint);
+    assert(nFound == vOutpoints.size());
+}
+
+static void CoinsCacheInsertDefault(benchmark::State& state)
+{
+    const std::vector<COutPoint> vOutpoints = CreateOutpoints();
+    while (state.KeepRunning()) {
+        DefaultCoinsMap map;
+        FillMap(map, vOutpoints);
+    }
+}
+
+static void CoinsCacheInsertPool(benchmark::State& state)
+{
+    const std::vector<COutPoint> vOutpoints = CreateOutpoints();
+    while (state.KeepRunning()) {
+        CCoinsMapMemoryResource resource;
+        CCoinsMap map(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource);
+        FillMap(map, vOutpoints);
+    }
+}
+
+static void CoinsCacheLookupDefault(benchmark::State& state)
+{
+    const std::vector<COutPoint> vOutpoints = CreateOutpoints();
+    DefaultCoinsMap map;
+    FillMap(map, vOutpoints);
+    while (state.KeepRunning()) {
+        LookupMap(map, vOutpoints);
+    }
+}
+
+static void CoinsCacheLookupPool(benchmark::State& state)
+{
+    const std::vector<COutPoint> vOutpoints = CreateOutpoints();
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource);
+    FillMap(map, vOutpoints);
+    while (state.KeepRunning()) {
+        LookupMap(map, vOutpoints);
+    }
+}
+
+// Flushing a cache hands every entry to the parent view, erasing it from
+// the map (CCoinsViewCache::BatchWrite), then releases the memory.
+template <typename Map>
+static void FlushMap(Map& map)
+{
+    size_t nFlushed = 0;
+    for (typename Map::iterator it = map.begin(); it != map.end();) {
+        nFlushed += it->second.flags & CCoinsCacheEntry::DIRTY;
+        it = map.erase(it);
+    }
+    assert(nFlushed == NUM_COINS);
+}
+
+static void CoinsCacheFlushDefault(benchmark::State& state)
+{
+    const std::vector<COutPoint> vOutpoints = CreateOutpoints();
+    while (state.KeepRunning()) {
+        DefaultCoinsMap map;
+        FillMap(map, vOutpoints);
+        FlushMap(map);
+    }
+}
+
+static void CoinsCacheFlushPool(benchmark::State& state)
+{
+    const std::vector<COutPoint> vOutpoints = CreateOutpoints();
+    while (state.KeepRunning()) {
+        CCoinsMapMemoryResource resource;
+        CCoinsMap map(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource);
+        FillMap(map, vOutpoints);
+        FlushMap(map);
+    }
+}
+
+BENCHMARK(CoinsCacheInsertDefault);
+BENCHMARK(CoinsCacheInsertPool);
+BENCHMARK(CoinsCacheLookupDefault);
+BENCHMARK(CoinsCacheLookupPool);
+BENCHMARK(CoinsCacheFlushDefault);
+BENCHMARK(CoinsCacheFlushPool);
@@ -0,0 +1,412 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "consensus/merkle.h"
+#include "consensus/tx_verify.h"
+#include "kernel.h"
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "masternode.h"
+#include "masternodeman.h"
+#include "miner.h"
+#include "net.h"
+#include "netbase.h"
+#include "policy/policy.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "spork.h"
+#include "txmempool.h"
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+// Benchmarks of the work done when validating blocks and transactions, run
+// in the regtest TestingSetup of the benchmark runner. Blocks and mempool
+// transactions are validated on a chain mined on its chainstate, whose coins
+// are spent by a block worth of transactions with many inputs each, or by a
+// mempool of more transactions than fit in a block. The parts of validation
+// that don't need a chainstate run on an in-memory fixture: a chain of block
+// indexes past the PoS activation, a coins view holding the P2PKH outputs of
+// many keys, and masternode lists of various sizes.
+
+static const int FIXTURE_CHAIN_HEIGHT = 400;
+static const int FIXTURE_BLOCK_TXS = 20;
+static const int FIXTURE_TX_INPUTS = 100;
+static const int FIXTURE_MEMPOOL_TXS = 5000;
+
+namespace {
+
+class ChainFixture
+{
+public:
+    std::deque<uint256> vHashes;
+    std::deque<CBlockIndex> vIndexes;
+
+    ChainFixture()
+    {
+        FastRandomContext rng(true);
+        CBlockIndex* pprev = nullptr;
+        for (int nHeight = 0; nHeight <= FIXTURE_CHAIN_HEIGHT; nHeight++) {
+            vHashes.push_back(rng.rand256());
+            vIndexes.emplace_back();
+            CBlockIndex& index = vIndexes.back();
+            index.phashBlock = &vHashes.back();
+            index.pprev = pprev;
+            index.nHeight = nHeight;
+            index.nTime = Params().GenesisBlock().nTime + nHeight * 60;
+            index.nBits = Params().GenesisBlock().nBits;
+            index.SetStakeModifier(rng.rand256());
+            index.BuildSkip();
+            pprev = &index;
+        }
+        LOCK(cs_main);
+        for (CBlockIndex& index : vIndexes)
+            mapBlockIndex.emplace(index.GetBlockHash(), &index);
+        chainActive.SetTip(pprev);
+    }
+
+    ~ChainFixture()
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(nullptr);
+        for (const uint256& hash : vHashes)
+            mapBlockIndex.erase(hash);
+    }
+
+    CBlockIndex* Tip() { return &vIndexes.back(); }
+    const CBlockIndex* Tip() const { return &vIndexes.back(); }
+};
+
+class CoinsFixture
+{
+public:
+    CBasicKeyStore keystore;
+    CCoinsView viewDummy;
+    CCoinsViewCache view{&viewDummy};
+    std::vector<CTransaction> vFunding;
+    std::vector<CTransaction> vBlockTxs;
+
+    CoinsFixture()
+    {
+        for (int i = 0; i < FIXTURE_BLOCK_TXS; i++) {
+            CKey key;
+            key.MakeNewKey(true);
+            keystore.AddKey(key);
+            const CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+            CMutableTransaction funding;
+            funding.vin.resize(1);
+            funding.vin[0].prevout = COutPoint(GetRandHash(), 0);
+            for (int n = 0; n < FIXTURE_TX_INPUTS; n++)
+                funding.vout.emplace_back(10 * COIN, scriptPubKey);
+            vFunding.emplace_back(funding);
+            AddCoins(view, vFunding.back(), 1);
+
+            CMutableTransaction spend;
+            for (int n = 0; n < FIXTURE_TX_INPUTS; n++)
+                spend.vin.emplace_back(COutPoint(vFunding.back().GetHash(), n));
+            spend.vout.emplace_back(FIXTURE_TX_INPUTS * 10 * COIN - COIN, scriptPubKey);
+            for (int n = 0; n < FIXTURE_TX_INPUTS; n++) {
+                bool fSigned = SignSignature(keystore, vFunding.back(), spend, n, SIGHASH_ALL);
+                assert(fSigned);
+            }
+            vBlockTxs.emplace_back(spend);
+        }
+    }
+};
+
+void AcceptTransaction(const CTransactionRef& tx)
+{
+    LOCK(cs_main);
+    CValidationState state;
+    bool fAccepted = AcceptToMemoryPool(mempool, state, tx, false, nullptr);
+    assert(fAccepted);
+}
+
+// A PoW chain mined on the chainstate of the TestingSetup, the coinbases
+// paying the fixture key, and enough of them split in FIXTURE_TX_INPUTS
+// outputs to make nCoins mature coins
+class ChainstateFixture
+{
+public:
+    CBasicKeyStore keystore;
+    CScript scriptPubKey;
+    std::vector<CTransactionRef> vSplits;
+
+    explicit ChainstateFixture(int nCoins)
+    {
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+        scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+        const int nSplits = (nCoins + FIXTURE_TX_INPUTS - 1) / FIXTURE_TX_INPUTS;
+        std::vector<CTransactionRef> vCoinbases;
+        for (int i = 0; i < Params().GetConsensus().nCoinbaseMaturity + nSplits; i++)
+            vCoinbases.push_back(MineBlock().vtx[0]);
+
+        for (int i = 0; i < nSplits; i++) {
+            const CTransaction& txFrom = *vCoinbases[i];
+            CMutableTransaction tx;
+            tx.vin.emplace_back(COutPoint(txFrom.GetHash(), 0));
+            for (int n = 0; n < FIXTURE_TX_INPUTS; n++)
+                tx.vout.emplace_back((txFrom.vout[0].nValue - COIN) / FIXTURE_TX_INPUTS, scriptPubKey);
+            bool fSigned = SignSignature(keystore, txFrom, tx, 0, SIGHASH_ALL);
+            assert(fSigned);
+            vSplits.push_back(MakeTransactionRef(tx));
+            AcceptTransaction(vSplits.back());
+        }
+        MineBlock();
+        assert(mempool.size() == 0);
+    }
+
+    // Mine a block with the mempool transactions on top of the tip
+    CBlock MineBlock()
+    {
+        std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(scriptPubKey, nullptr, false));
+        assert(pblocktemplate);
+        CBlock& block = pblocktemplate->block;
+        block.hashMerkleRoot = BlockMerkleRoot(block);
+        CValidationState state;
+        bool fProcessed = ProcessNewBlock(state, nullptr, &block, nullptr, g_connman.get());
+        assert(fProcessed && state.IsValid());
+        return block;
+    }
+
+    // Spend nInputs of the split coins from the nFirst one, back to the fixture key
+    CTransactionRef Spend(int nFirst, int nInputs, CAmount nFee) const
+    {
+        CMutableTransaction tx;
+        CAmount nValueIn = 0;
+        for (int i = nFirst; i < nFirst + nInputs; i++) {
+            const CTransaction& txFrom = *vSplits[i / FIXTURE_TX_INPUTS];
+            tx.vin.emplace_back(COutPoint(txFrom.GetHash(), i % FIXTURE_TX_INPUTS));
+            nValueIn += txFrom.vout[i % FIXTURE_TX_INPUTS].nValue;
+        }
+        tx.vout.emplace_back(nValueIn - nFee, scriptPubKey);
+        for (int n = 0; n < nInputs; n++) {
+            bool fSigned = SignSignature(keystore, *vSplits[(nFirst + n) / FIXTURE_TX_INPUTS], tx, n, SIGHASH_ALL);
+            assert(fSigned);
+        }
+        return MakeTransactionRef(tx);
+    }
+
+    // A block worth of transactions spending FIXTURE_TX_INPUTS coins each
+    std::vector<CTransactionRef> SpendBlock() const
+    {
+        std::vector<CTransactionRef> vtx;
+        for (int i = 0; i < FIXTURE_BLOCK_TXS; i++)
+            vtx.push_back(Spend(i * FIXTURE_TX_INPUTS, FIXTURE_TX_INPUTS, COIN / 100));
+        return vtx;
+    }
+};
+
+// A stake whose origin block is in the fixture chain instead of on disk
+class CBenchStake : public CPivStake
+{
+private:
+    CBlockIndex* pindexFrom;
+
+public:
+    CBenchStake(const CTransaction& txFrom, unsigned int n, CBlockIndex* pindexFromIn) : pindexFrom(pindexFromIn)
+    {
+        SetPrevout(txFrom, n);
+    }
+    CBlockIndex* GetIndexFrom() override { return pindexFrom; }
+};
+
+} // namespace
+
+// Script verification of a transaction spending many inputs, the bulk of ConnectBlock and AcceptToMemoryPool
+static void CheckInputsManyInputs(benchmark::State& state)
+{
+    const ChainFixture chain;
+    CoinsFixture coins;
+    // the spend height is taken from the best block of the view
+    coins.view.SetBestBlock(chain.Tip()->GetBlockHash());
+    const CTransaction& tx = coins.vBlockTxs[0];
+    while (state.KeepRunning()) {
+        PrecomputedTransactionData txdata(tx);
+        CValidationState validationState;
+        bool fValid = CheckInputs(tx, validationState, coins.view, true, STANDARD_SCRIPT_VERIFY_FLAGS, false, txdata);
+        assert(fValid);
+    }
+}
+
+// ConnectBlock of a block spending many inputs on top of the tip, as
+// TestBlockValidity checks it. Its transactions went through the mempool, so
+// their signatures are in the cache as for a block relayed to us.
+static void ConnectBlockManyInputs(benchmark::State& state)
+{
+    ChainstateFixture chain(FIXTURE_BLOCK_TXS * FIXTURE_TX_INPUTS);
+    for (const CTransactionRef& tx : chain.SpendBlock())
+        AcceptTransaction(tx);
+    std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(chain.scriptPubKey, nullptr, false));
+    assert(pblocktemplate && (int)pblocktemplate->block.vtx.size() == FIXTURE_BLOCK_TXS + 1);
+    CBlock& block = pblocktemplate->block;
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+
+    LOCK(cs_main);
+    CBlockIndex index(block);
+    index.pprev = chainActive.Tip();
+    index.nHeight = index.pprev->nHeight + 1;
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(pcoinsTip);
+        CValidationState validationState;
+        bool fConnected = ConnectBlock(block, validationState, &index, view, true);
+        assert(fConnected);
+    }
+}
+
+// DisconnectBlock of the tip, a block spending many inputs, reading its undo data from disk
+static void DisconnectBlockManyInputs(benchmark::State& state)
+{
+    ChainstateFixture chain(FIXTURE_BLOCK_TXS * FIXTURE_TX_INPUTS);
+    for (const CTransactionRef& tx : chain.SpendBlock())
+        AcceptTransaction(tx);
+    CBlock block = chain.MineBlock();
+
+    LOCK(cs_main);
+    CBlockIndex* pindex = chainActive.Tip();
+    assert(pindex->GetBlockHash() == block.GetHash());
+    const int64_t nMoneySupplyTip = nMoneySupply;
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(pcoinsTip);
+        DisconnectResult res = DisconnectBlock(block, pindex, view);
+        assert(res == DISCONNECT_OK);
+    }
+    nMoneySupply = nMoneySupplyTip;
+}
+
+// AcceptToMemoryPool of a block worth of transactions spending many inputs,
+// the mempool cleared after each run. The signatures are checked in the first
+// run only, the next ones find them in the cache but still hash each input.
+static void AcceptToMemoryPoolManyInputs(benchmark::State& state)
+{
+    ChainstateFixture chain(FIXTURE_BLOCK_TXS * FIXTURE_TX_INPUTS);
+    const std::vector<CTransactionRef> vtx = chain.SpendBlock();
+
+    LOCK(cs_main);
+    while (state.KeepRunning()) {
+        for (const CTransactionRef& tx : vtx) {
+            CValidationState validationState;
+            bool fAccepted = AcceptToMemoryPool(mempool, validationState, tx, false, nullptr);
+            assert(fAccepted);
+        }
+        mempool.clear();
+    }
+}
+
+// CreateNewBlock with more transactions in the mempool than fit in a block,
+// with fees spread over a range. Unless fRebuild, the selection kept from the
+// last call is reused, as while the tip and the mempool don't change.
+static void CreateNewBlockFullMempool(benchmark::State& state, bool fRebuild)
+{
+    ChainstateFixture chain(FIXTURE_MEMPOOL_TXS);
+    for (int i = 0; i < FIXTURE_MEMPOOL_TXS; i++)
+        AcceptTransaction(chain.Spend(i, 1, (1 + i % 100) * 10000));
+
+    while (state.KeepRunning()) {
+        if (fRebuild)
+            mempool.AddTransactionsUpdated(1);
+        std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(chain.scriptPubKey, nullptr, false));
+        assert(pblocktemplate && (int)pblocktemplate->block.vtx.size() < FIXTURE_MEMPOOL_TXS + 1);
+    }
+}
+
+// Flush of a block worth of new and spent coins into the parent cache
+static void CoinsViewCacheFlush(benchmark::State& state)
+{
+    CoinsFixture coins;
+    while (state.KeepRunning()) {
+        CCoinsViewCache parent(&coins.view);
+        CCoinsViewCache cache(&parent);
+        for (const CTransaction& tx : coins.vBlockTxs)
+            UpdateCoins(tx, cache, 2);
+        bool fFlushed = cache.Flush();
+        assert(fFlushed);
+    }
+}
+
+// CheckTxFilter with filtered addresses set by spork, the parents of the inputs found in the mempool
+static void CheckTxFilterManyInputs(benchmark::State& state)
+{
+    const ChainFixture chain;
+    const CoinsFixture coins;
+    for (const CTransaction& tx : coins.vFunding)
+        mempool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(MakeTransactionRef(tx), 0, GetTime(), 0, 1, true, 0, false, 1));
+    for (int i = 0; i < 100; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        sporkManager.filter.mapFilterAddress.emplace(EncodeDestination(key.GetPubKey().GetID()), 0);
+    }
+
+    const CTransaction& tx = coins.vBlockTxs[0];
+    while (state.KeepRunning()) {
+        bool fAllowed = CheckTxFilter(tx);
+        assert(fAllowed);
+    }
+
+    sporkManager.filter.mapFilterAddress.clear();
+    mempool.clear();
+}
+
+// Stake kernel hash check, done by CheckProofOfStake and by the staker for every stakeable coin and time slot
+static void CheckStakeKernelHash(benchmark::State& state)
+{
+    ChainFixture chain;
+    const CoinsFixture coins;
+    CBenchStake stake(coins.vFunding[0], 0, &chain.vIndexes[FIXTURE_CHAIN_HEIGHT / 2]);
+    const CBlockIndex* pindexPrev = chain.Tip();
+    int nTime = pindexPrev->nTime;
+    while (state.KeepRunning()) {
+        CStakeKernel kernel(pindexPrev, &stake, pindexPrev->nBits, ++nTime);
+        kernel.CheckKernelHash(true);
+    }
+}
+
+static void MasternodeRanks(benchmark::State& state, int nMasternodes)
+{
+    const ChainFixture chain;
+    CMasternodeMan mnman;
+    for (int i = 0; i < nMasternodes; i++) {
+        CMasternode mn;
+        mn.vin = CTxIn(COutPoint(GetRandHash(), 0));
+        mn.addr = LookupNumeric(strprintf("10.%d.%d.%d", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff).c_str(), 51472);
+        CKey key;
+        key.MakeNewKey(true);
+        mn.pubKeyCollateralAddress = key.GetPubKey();
+        mn.pubKeyMasternode = key.GetPubKey();
+        bool fAdded = mnman.Add(mn);
+        assert(fAdded);
+    }
+    while (state.KeepRunning()) {
+        std::vector<std::pair<int, CMasternode> > vRanks = mnman.GetMasternodeRanks(FIXTURE_CHAIN_HEIGHT - 10);
+        assert((int)vRanks.size() == nMasternodes);
+    }
+    mnman.Clear();
+}
+
+static void CreateNewBlockRebuild(benchmark::State& state) { CreateNewBlockFullMempool(state, true); }
+static void CreateNewBlockUnchanged(benchmark::State& state) { CreateNewBlockFullMempool(state, false); }
+static void MasternodeRanks1000(benchmark::State& state) { MasternodeRanks(state, 1000); }
+static void MasternodeRanks10000(benchmark::State& state) { MasternodeRanks(state, 10000); }
+
+BENCHMARK(CheckInputsManyInputs);
+BENCHMARK(ConnectBlockManyInputs);
+BENCHMARK(DisconnectBlockManyInputs);
+BENCHMARK(AcceptToMemoryPoolManyInputs);
+BENCHMARK(CreateNewBlockRebuild);
+BENCHMARK(CreateNewBlockUnchanged);
+BENCHMARK(CoinsViewCacheFlush);
+BENCHMARK(CheckTxFilterManyInputs);
+BENCHMARK(CheckStakeKernelHash);
+BENCHMARK(MasternodeRanks1000);
+BENCHMARK(MasternodeRanks10000);
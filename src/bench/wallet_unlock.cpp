@@ -0,0 +1,61 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "key.h"
+#include "random.h"
+#include "script/standard.h"
+#include "util.h"
+#include "crypter.h"
+
+#include <vector>
+
+// Measures the check of the encrypted keys done at the first unlock of a
+// wallet, on one thread and spread over all cores, for wallets of various
+// sizes. Later unlocks only spot-check a few keys.
+
+struct CryptedKeys {
+    CKeyingMaterial vMasterKey;
+    std::vector<CryptedKeyMap::mapped_type> vKeys;
+    std::vector<const CryptedKeyMap::mapped_type*> vKeyPtrs;
+
+    explicit CryptedKeys(size_t nKeys) : vMasterKey(WALLET_CRYPTO_KEY_SIZE)
+    {
+        GetStrongRandBytes(vMasterKey.data(), WALLET_CRYPTO_KEY_SIZE);
+        vKeys.reserve(nKeys);
+        for (size_t i = 0; i < nKeys; i++) {
+            CKey key;
+            key.MakeNewKey(true);
+            CPubKey pubkey = key.GetPubKey();
+            CKeyingMaterial vchSecret(key.begin(), key.end());
+            std::vector<unsigned char> vchCryptedSecret;
+            EncryptSecret(vMasterKey, vchSecret, pubkey.GetHash(), vchCryptedSecret);
+            vKeys.emplace_back(pubkey, vchCryptedSecret);
+        }
+        for (const CryptedKeyMap::mapped_type& key : vKeys)
+            vKeyPtrs.push_back(&key);
+    }
+};
+
+static void VerifyKeys(benchmark::State& state, size_t nKeys, int nThreads)
+{
+    const CryptedKeys keys(nKeys);
+    while (state.KeepRunning()) {
+        size_t nPassed;
+        bool fPassed = VerifyCryptedKeys(keys.vMasterKey, keys.vKeyPtrs, nThreads, nPassed);
+        assert(fPassed && nPassed == nKeys);
+    }
+}
+
+static void WalletUnlock1000Serial(benchmark::State& state) { VerifyKeys(state, 1000, 1); }
+static void WalletUnlock1000Parallel(benchmark::State& state) { VerifyKeys(state, 1000, GetNumCores()); }
+static void WalletUnlock10000Serial(benchmark::State& state) { VerifyKeys(state, 10000, 1); }
+static void WalletUnlock10000Parallel(benchmark::State& state) { VerifyKeys(state, 10000, GetNumCores()); }
+static void WalletUnlock100000Parallel(benchmark::State& state) { VerifyKeys(state, 100000, GetNumCores()); }
+
+BENCHMARK(WalletUnlock1000Serial);
+BENCHMARK(WalletUnlock1000Parallel);
+BENCHMARK(WalletUnlock10000Serial);
+BENCHMARK(WalletUnlock10000Parallel);
+BENCHMARK(WalletUnlock100000Parallel);
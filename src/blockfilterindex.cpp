@@ -0,0 +1,306 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilterindex.h"
+
+#include "chain.h"
+#include "main.h"
+#include "util.h"
+
+#include <functional>
+
+/* The database holds, keyed by block hash, the encoded filter of each block
+ * indexed with its hash and header, and the hash of the best block indexed.
+ */
+static const char DB_FILTER = 'f';
+static const char DB_BEST_BLOCK = 'B';
+
+//! Write the best block at least every this many blocks during the initial sync
+static const int SYNC_BEST_BLOCK_INTERVAL = 1000;
+
+std::unique_ptr<BlockFilterIndex> g_blockfilterindex;
+
+namespace {
+
+struct DBVal {
+    uint256 hash;
+    uint256 header;
+    std::vector<unsigned char> filter;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(hash);
+        READWRITE(header);
+        READWRITE(filter);
+    }
+};
+
+//! CDBWrapper only creates the last directory of its path
+fs::path GetIndexPath(BlockFilterType filter_type)
+{
+    const fs::path path = GetDataDir() / "indexes" / "blockfilter";
+    fs::create_directories(path);
+    return path / BlockFilterTypeName(filter_type);
+}
+
+} // anon namespace
+
+BlockFilterIndex::DB::DB(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe) :
+    CDBWrapper(path, nCacheSize, fMemory, fWipe)
+{
+}
+
+BlockFilterIndex::BlockFilterIndex(BlockFilterType filter_type, size_t nCacheSize, bool fMemory, bool fWipe) :
+    m_filter_type(filter_type),
+    m_db(new DB(GetIndexPath(filter_type), nCacheSize, fMemory, fWipe))
+{
+}
+
+BlockFilterIndex::~BlockFilterIndex()
+{
+    Stop();
+}
+
+bool BlockFilterIndex::Start()
+{
+    uint256 hashBest;
+    if (m_db->Read(DB_BEST_BLOCK, hashBest)) {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hashBest);
+        DBVal entry;
+        if (it == mapBlockIndex.end() || !m_db->Read(std::make_pair(DB_FILTER, hashBest), entry)) {
+            // The block index was rebuilt without wiping the index (-reindex does it)
+            return error("%s: best block %s of the %s filter index not found, restart with -reindex",
+                         __func__, hashBest.ToString(), BlockFilterTypeName(m_filter_type));
+        }
+        LOCK(m_cs_best);
+        m_best_block_index = it->second;
+        m_last_header = entry.header;
+    }
+
+    RegisterValidationInterface(this);
+    m_thread_sync = std::thread(&TraceThread<std::function<void()>>, "blockfilter",
+                                std::function<void()>(std::bind(&BlockFilterIndex::ThreadSync, this)));
+    return true;
+}
+
+void BlockFilterIndex::Interrupt()
+{
+    m_interrupted = true;
+    std::lock_guard<std::mutex> lock(m_mutex_wake);
+    m_cond_wake.notify_all();
+}
+
+void BlockFilterIndex::Stop()
+{
+    if (!m_thread_sync.joinable())
+        return;
+    UnregisterValidationInterface(this);
+    Interrupt();
+    m_thread_sync.join();
+}
+
+void BlockFilterIndex::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    std::lock_guard<std::mutex> lock(m_mutex_wake);
+    m_wake = true;
+    m_cond_wake.notify_all();
+}
+
+int BlockFilterIndex::GetBestHeight() const
+{
+    LOCK(m_cs_best);
+    return m_best_block_index ? m_best_block_index->nHeight : -1;
+}
+
+void BlockFilterIndex::ThreadSync()
+{
+    int64_t nLastLogTime = 0;
+    int nUnsynced = 0;
+    bool fWaitedSnapshot = false;
+    while (!m_interrupted) {
+        const CBlockIndex* pindexBest = WITH_LOCK(m_cs_best, return m_best_block_index);
+        const CBlockIndex* pindexNext;
+        bool fRewind = false;
+        const CBlockIndex* pindexFork = nullptr;
+        bool fWaitSnapshot = false;
+        {
+            LOCK(cs_main);
+            if (!pindexBest) {
+                pindexNext = chainActive.Genesis();
+            } else if (chainActive.Contains(pindexBest)) {
+                pindexNext = chainActive.Next(pindexBest);
+            } else {
+                fRewind = true;
+                pindexFork = chainActive.FindFork(pindexBest);
+                pindexNext = pindexFork ? chainActive.Next(pindexFork) : chainActive.Genesis();
+            }
+            // The blocks up to a loaded UTXO set snapshot get their undo data
+            // from its background validation
+            fWaitSnapshot = pindexNext && pindexNext->pprev && pindexNext->nHeight <= nSnapshotHeight &&
+                            !(pindexNext->nStatus & BLOCK_HAVE_UNDO);
+        }
+
+        try {
+            if (fRewind && !Rewind(pindexFork))
+                return;
+
+            if (fWaitSnapshot) {
+                if (!fWaitedSnapshot) {
+                    LogPrintf("%s filter index is waiting for the validation of the UTXO set snapshot, at height %d\n",
+                              BlockFilterTypeName(m_filter_type), pindexNext->nHeight);
+                    fWaitedSnapshot = true;
+                }
+                std::unique_lock<std::mutex> lock(m_mutex_wake);
+                m_cond_wake.wait_for(lock, std::chrono::seconds(1), [this] { return m_interrupted.load(); });
+                continue;
+            }
+
+            if (!pindexNext) {
+                if (pindexBest && (nUnsynced || !m_synced)) {
+                    m_db->Write(DB_BEST_BLOCK, pindexBest->GetBlockHash(), true);
+                    nUnsynced = 0;
+                }
+                if (!m_synced) {
+                    LogPrintf("%s filter index is enabled at height %d\n", BlockFilterTypeName(m_filter_type),
+                              pindexBest ? pindexBest->nHeight : -1);
+                    m_synced = true;
+                }
+                // Wait for a new tip. New tips aren't notified during the initial
+                // block download, look for them every second.
+                std::unique_lock<std::mutex> lock(m_mutex_wake);
+                m_cond_wake.wait_for(lock, std::chrono::seconds(1), [this] { return m_wake || m_interrupted; });
+                m_wake = false;
+                continue;
+            }
+
+            if (!WriteBlock(pindexNext))
+                return;
+
+            if (++nUnsynced >= SYNC_BEST_BLOCK_INTERVAL) {
+                m_db->Write(DB_BEST_BLOCK, pindexNext->GetBlockHash());
+                nUnsynced = 0;
+            }
+        } catch (const std::exception& e) {
+            LogPrintf("ERROR: %s: %s filter index stopped: %s\n", __func__, BlockFilterTypeName(m_filter_type), e.what());
+            return;
+        }
+
+        if (!m_synced && GetTime() - nLastLogTime >= 30) {
+            LogPrintf("Syncing %s filter index with block chain from height %d\n",
+                      BlockFilterTypeName(m_filter_type), pindexNext->nHeight);
+            nLastLogTime = GetTime();
+        }
+    }
+}
+
+bool BlockFilterIndex::WriteBlock(const CBlockIndex* pindex)
+{
+    CDiskBlockPos posUndo;
+    bool fHaveUndo;
+    {
+        LOCK(cs_main);
+        fHaveUndo = pindex->nStatus & BLOCK_HAVE_UNDO;
+        posUndo = pindex->GetUndoPos();
+    }
+
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex))
+        return error("%s: failed to read block %s from disk", __func__, pindex->GetBlockHash().ToString());
+
+    // The genesis block spends nothing and has no undo data
+    CBlockUndo blockundo;
+    if (pindex->pprev) {
+        if (!fHaveUndo || !UndoReadFromDisk(blockundo, posUndo, pindex->pprev->GetBlockHash()))
+            return error("%s: failed to read undo data of block %s from disk", __func__, pindex->GetBlockHash().ToString());
+    }
+
+    BlockFilter filter(m_filter_type, block, blockundo);
+
+    LOCK(m_cs_best);
+    DBVal entry;
+    entry.hash = filter.GetHash();
+    entry.header = filter.ComputeHeader(m_last_header);
+    entry.filter = filter.GetEncodedFilter();
+    if (!m_db->Write(std::make_pair(DB_FILTER, pindex->GetBlockHash()), entry))
+        return error("%s: failed to write the filter of block %s", __func__, pindex->GetBlockHash().ToString());
+
+    m_best_block_index = pindex;
+    m_last_header = entry.header;
+    return true;
+}
+
+bool BlockFilterIndex::Rewind(const CBlockIndex* pindex)
+{
+    uint256 header;
+    if (pindex) {
+        DBVal entry;
+        if (!m_db->Read(std::make_pair(DB_FILTER, pindex->GetBlockHash()), entry))
+            return error("%s: filter of fork block %s not found", __func__, pindex->GetBlockHash().ToString());
+        header = entry.header;
+    }
+
+    LOCK(m_cs_best);
+    m_best_block_index = pindex;
+    m_last_header = header;
+    return true;
+}
+
+bool BlockFilterIndex::LookupFilter(const CBlockIndex* pindex, BlockFilter& filter_out) const
+{
+    DBVal entry;
+    if (!m_db->Read(std::make_pair(DB_FILTER, pindex->GetBlockHash()), entry))
+        return false;
+
+    try {
+        filter_out = BlockFilter(m_filter_type, pindex->GetBlockHash(), std::move(entry.filter));
+    } catch (const std::exception& e) {
+        return error("%s: invalid filter of block %s: %s", __func__, pindex->GetBlockHash().ToString(), e.what());
+    }
+    return true;
+}
+
+bool BlockFilterIndex::LookupFilterHeader(const CBlockIndex* pindex, uint256& header_out) const
+{
+    DBVal entry;
+    if (!m_db->Read(std::make_pair(DB_FILTER, pindex->GetBlockHash()), entry))
+        return false;
+
+    header_out = entry.header;
+    return true;
+}
+
+bool BlockFilterIndex::LookupFilterRange(int start_height, const CBlockIndex* stop_index,
+                                         std::vector<BlockFilter>& filters_out) const
+{
+    if (start_height < 0 || start_height > stop_index->nHeight)
+        return false;
+
+    filters_out.resize(stop_index->nHeight - start_height + 1);
+    for (const CBlockIndex* pindex = stop_index; pindex && pindex->nHeight >= start_height; pindex = pindex->pprev) {
+        if (!LookupFilter(pindex, filters_out[pindex->nHeight - start_height]))
+            return false;
+    }
+    return true;
+}
+
+bool BlockFilterIndex::LookupFilterHashRange(int start_height, const CBlockIndex* stop_index,
+                                             std::vector<uint256>& hashes_out) const
+{
+    if (start_height < 0 || start_height > stop_index->nHeight)
+        return false;
+
+    hashes_out.resize(stop_index->nHeight - start_height + 1);
+    for (const CBlockIndex* pindex = stop_index; pindex && pindex->nHeight >= start_height; pindex = pindex->pprev) {
+        DBVal entry;
+        if (!m_db->Read(std::make_pair(DB_FILTER, pindex->GetBlockHash()), entry))
+            return false;
+        hashes_out[pindex->nHeight - start_height] = entry.hash;
+    }
+    return true;
+}
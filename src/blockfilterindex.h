@@ -0,0 +1,118 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PIVX_BLOCKFILTERINDEX_H
+#define PIVX_BLOCKFILTERINDEX_H
+
+#include "blockfilter.h"
+#include "dbwrapper.h"
+#include "sync.h"
+#include "validationinterface.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+class CBlockIndex;
+
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+static const bool DEFAULT_PEERBLOCKFILTERS = false;
+
+/** Interval between compact filter checkpoints. See BIP 157. */
+static constexpr int CFCHECKPT_INTERVAL = 1000;
+
+/** Maximum number of compact filters that may be requested with one getcfilters. See BIP 157. */
+static constexpr uint32_t MAX_GETCFILTERS_SIZE = 1000;
+
+/** Maximum number of filter hashes that may be requested with one getcfheaders. See BIP 157. */
+static constexpr uint32_t MAX_GETCFHEADERS_SIZE = 2000;
+
+/**
+ * Index of the compact filters of the blocks of the active chain, with their
+ * hashes and headers, stored in its own database. Filters are computed from
+ * the blocks and undo data on disk by a background thread, which catches up
+ * with the chain at startup and then follows the new tips, so that serving a
+ * light client is only a read of precomputed data.
+ *
+ * Entries are keyed by block hash: the filters of blocks disconnected by a
+ * reorg stay in the database, only the best block of the index is moved back
+ * to the fork point.
+ */
+class BlockFilterIndex : public CValidationInterface
+{
+private:
+    class DB : public CDBWrapper
+    {
+    public:
+        DB(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe);
+    };
+
+    const BlockFilterType m_filter_type;
+    const std::unique_ptr<DB> m_db;
+
+    /** Last block indexed, and its filter header. */
+    mutable Mutex m_cs_best;
+    const CBlockIndex* m_best_block_index = nullptr;
+    uint256 m_last_header;
+
+    /** Whether the index has caught up with the active chain at least once. */
+    std::atomic<bool> m_synced{false};
+
+    std::thread m_thread_sync;
+    std::atomic<bool> m_interrupted{false};
+    std::mutex m_mutex_wake;
+    std::condition_variable m_cond_wake;
+    bool m_wake = false;
+
+    /** Loop of the background thread: index the blocks of the active chain up to its tip. */
+    void ThreadSync();
+
+    /** Compute the filter of a block connected after the current best block, and write it. */
+    bool WriteBlock(const CBlockIndex* pindex);
+
+    /** Move the best block back to a block indexed earlier, after a reorg. */
+    bool Rewind(const CBlockIndex* pindex);
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindex) override;
+
+public:
+    BlockFilterIndex(BlockFilterType filter_type, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~BlockFilterIndex();
+
+    BlockFilterType GetFilterType() const { return m_filter_type; }
+
+    /** Load the best block of the index, and start the background thread. */
+    bool Start();
+    /** Ask the background thread to stop. */
+    void Interrupt();
+    /** Stop the background thread and wait for it. */
+    void Stop();
+
+    bool IsSynced() const { return m_synced; }
+    /** Height of the last block indexed, -1 if none. */
+    int GetBestHeight() const;
+
+    /** Get a single filter by block. */
+    bool LookupFilter(const CBlockIndex* pindex, BlockFilter& filter_out) const;
+
+    /** Get a single filter header by block. */
+    bool LookupFilterHeader(const CBlockIndex* pindex, uint256& header_out) const;
+
+    /** Get a range of filters between two heights on a chain. */
+    bool LookupFilterRange(int start_height, const CBlockIndex* stop_index,
+                           std::vector<BlockFilter>& filters_out) const;
+
+    /** Get a range of filter hashes between two heights on a chain. */
+    bool LookupFilterHashRange(int start_height, const CBlockIndex* stop_index,
+                               std::vector<uint256>& hashes_out) const;
+};
+
+/** The basic block filter index, when enabled with -blockfilterindex. */
+extern std::unique_ptr<BlockFilterIndex> g_blockfilterindex;
+
+#endif // PIVX_BLOCKFILTERINDEX_H
@@ -20,7 +20,7 @@ bool SignBlock(CBlock& block, const CKeyStore& keystore)
     CKeyID keyID;
     if (block.IsProofOfWork()) {
         bool fFoundID = false;
-        for (const CTxOut& txout :block.vtx[0].vout) {
+        for (const CTxOut& txout :block.vtx[0]->vout) {
             if (!txout.GetKeyIDFromUTXO(keyID))
                 continue;
             fFoundID = true;
@@ -29,7 +29,7 @@ bool SignBlock(CBlock& block, const CKeyStore& keystore)
         if (!fFoundID)
             return error("%s: failed to find key for PoW", __func__);
     } else {
-        if (!block.vtx[1].vout[1].GetKeyIDFromUTXO(keyID))
+        if (!block.vtx[1]->vout[1].GetKeyIDFromUTXO(keyID))
             return error("%s: failed to find key for PoS", __func__);
     }
 
@@ -60,7 +60,7 @@ bool CheckBlockSignature(const CBlock& block, const bool enableP2PKH)
 
     txnouttype whichType;
     std::vector<valtype> vSolutions;
-    const CTxOut& txout = block.vtx[1].vout[1];
+    const CTxOut& txout = block.vtx[1]->vout[1];
     if (!Solver(txout.scriptPubKey, whichType, vSolutions))
         return false;
 
@@ -75,7 +75,7 @@ bool CheckBlockSignature(const CBlock& block, const bool enableP2PKH)
         valtype& vchPubKey = vSolutions[0];
         pubkey = CPubKey(vchPubKey);
     } else if (whichType == TX_PUBKEYHASH) {
-        const CTxIn& txin = block.vtx[1].vin[0];
+        const CTxIn& txin = block.vtx[1]->vin[0];
         // Check if the scriptSig is for a p2pk or a p2pkh
         if (txin.scriptSig.size() == 73) { // Sig size + DER signature size.
             // If the input is for a p2pk and the output is a p2pkh.
@@ -0,0 +1,105 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockstats.h"
+
+#include "amount.h"
+#include "chain.h"
+#include "main.h"
+#include "masternode.h"
+#include "txdb.h"
+#include "undo.h"
+#include "util.h"
+
+#include <algorithm>
+
+void CBlockStats::SetNull()
+{
+    hashBlock.SetNull();
+    nTxCount = 0;
+    nTxBytes = 0;
+    nFees = 0;
+    nMinFeeRate = 0;
+    nMedianFeeRate = 0;
+    nMaxFeeRate = 0;
+    nStakeReward = 0;
+    nMasternodePayment = 0;
+    masternodePayee.clear();
+    nCoinStakeValue = 0;
+}
+
+void ComputeBlockStats(const CBlock& block, const CBlockUndo& blockundo, int nHeight, CBlockStats& stats)
+{
+    stats.SetNull();
+    stats.hashBlock = block.GetHash();
+    stats.nTxCount = block.vtx.size();
+
+    CAmount nValueIn = 0;
+    CAmount nValueOut = 0;
+    std::vector<CAmount> vFeeRates;
+    vFeeRates.reserve(block.vtx.size());
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        const CAmount nTxValueOut = tx.GetValueOut();
+        nValueOut += nTxValueOut;
+        if (tx.IsCoinBase())
+            continue;
+
+        // the undo data of the transactions after the coinbase holds their spent coins
+        CAmount nTxValueIn = 0;
+        for (const Coin& coin : blockundo.vtxundo[i - 1].vprevout)
+            nTxValueIn += coin.out.nValue;
+        nValueIn += nTxValueIn;
+
+        if (tx.IsCoinStake()) {
+            stats.nCoinStakeValue = nTxValueOut;
+            continue;
+        }
+
+        const CAmount nFee = nTxValueIn - nTxValueOut;
+        const unsigned int nSize = ::GetSerializeSize(tx, SER_NETWORK, CLIENT_VERSION);
+        stats.nFees += nFee;
+        stats.nTxBytes += nSize;
+        vFeeRates.push_back(CFeeRate(nFee, nSize).GetFeePerK());
+    }
+
+    if (!vFeeRates.empty()) {
+        std::sort(vFeeRates.begin(), vFeeRates.end());
+        stats.nMinFeeRate = vFeeRates.front();
+        stats.nMedianFeeRate = vFeeRates[vFeeRates.size() / 2];
+        stats.nMaxFeeRate = vFeeRates.back();
+    }
+
+    // Minted as checked by ConnectBlock: proof of work blocks pay the fees to
+    // the miner, proof of stake blocks burn them
+    const CAmount nMint = (nValueOut - nValueIn) + stats.nFees;
+
+    const CAmount nMasternodePayment = CMasternode::GetMasternodePayment(nHeight);
+    stats.masternodePayee = block.GetPaidPayee(nHeight, nMasternodePayment);
+    if (!stats.masternodePayee.empty())
+        stats.nMasternodePayment = nMasternodePayment;
+    stats.nStakeReward = nMint - stats.nMasternodePayment;
+}
+
+bool GetBlockStats(const CBlockIndex* pindex, CBlockStats& stats)
+{
+    if (pblocktree->ReadBlockStats(pindex->nHeight, stats) && stats.hashBlock == pindex->GetBlockHash())
+        return true;
+
+    // Connected by an older version, or the record is of a block reorganized away
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex))
+        return error("%s: failed to read block %s from disk", __func__, pindex->GetBlockHash().ToString());
+
+    CBlockUndo blockundo;
+    if (pindex->pprev) {
+        const CDiskBlockPos pos = pindex->GetUndoPos();
+        if (pos.IsNull() || !UndoReadFromDisk(blockundo, pos, pindex->pprev->GetBlockHash()))
+            return error("%s: failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+
+    ComputeBlockStats(block, blockundo, pindex->nHeight, stats);
+    pblocktree->WriteBlockStats(pindex->nHeight, stats);
+    return true;
+}
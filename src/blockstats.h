@@ -0,0 +1,77 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PIVX_BLOCKSTATS_H
+#define PIVX_BLOCKSTATS_H
+
+#include "amount.h"
+#include "script/script.h"
+#include "serialize.h"
+#include "uint256.h"
+
+class CBlock;
+class CBlockIndex;
+class CBlockUndo;
+
+/**
+ * Summary of a connected block, written to the block tree database keyed by
+ * height by ConnectBlock, so that statistics over a range of blocks are read
+ * from small records instead of from the blocks and their inputs.
+ *
+ * Transaction counts, sizes, fees and feerates leave out the coinbase and
+ * the coinstake. The stake reward is the amount minted by the block less the
+ * masternode payment.
+ */
+class CBlockStats
+{
+public:
+    uint256 hashBlock;
+    uint32_t nTxCount;      //!< all the transactions of the block
+    uint64_t nTxBytes;
+    CAmount nFees;
+    CAmount nMinFeeRate;    //!< per kB
+    CAmount nMedianFeeRate; //!< per kB
+    CAmount nMaxFeeRate;    //!< per kB
+    CAmount nStakeReward;
+    CAmount nMasternodePayment;
+    CScript masternodePayee;
+    CAmount nCoinStakeValue; //!< value out of the coinstake, 0 for proof of work blocks
+
+    CBlockStats() { SetNull(); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(hashBlock);
+        READWRITE(VARINT(nTxCount));
+        READWRITE(VARINT(nTxBytes));
+        READWRITE(VARINT(nFees));
+        READWRITE(VARINT(nMinFeeRate));
+        READWRITE(VARINT(nMedianFeeRate));
+        READWRITE(VARINT(nMaxFeeRate));
+        READWRITE(nStakeReward);
+        READWRITE(VARINT(nMasternodePayment));
+        READWRITE(*(CScriptBase*)(&masternodePayee));
+        READWRITE(VARINT(nCoinStakeValue));
+    }
+
+    void SetNull();
+
+    /** Number of transactions other than the coinbase and the coinstake. */
+    uint32_t GetUserTxCount() const { return nTxCount - (nCoinStakeValue > 0 ? 2 : 1); }
+};
+
+/** Compute the stats of a block at nHeight from its undo data. */
+void ComputeBlockStats(const CBlock& block, const CBlockUndo& blockundo, int nHeight, CBlockStats& stats);
+
+/**
+ * Get the stats of a block of the active chain from the block tree database.
+ * Blocks connected before the stats were recorded are read from disk with
+ * their undo data once, and their stats written for the next lookup.
+ */
+bool GetBlockStats(const CBlockIndex* pindex, CBlockStats& stats);
+
+#endif // PIVX_BLOCKSTATS_H
@@ -30,7 +30,7 @@ static CBlock CreateGenesisBlock(const char* pszTimestamp, const CScript& genesi
     txNew.vout[0].scriptPubKey = genesisOutputScript;
 
     CBlock genesis;
-    genesis.vtx.push_back(txNew);
+    genesis.vtx.push_back(MakeTransactionRef(txNew));
     genesis.hashPrevBlock.SetNull();
     genesis.nVersion = nVersion;
     genesis.nTime    = nTime;
@@ -124,6 +124,18 @@ static const Checkpoints::CCheckpointData dataRegtest = {
     0,
     100};
 
+/**
+ * UTXO set snapshots that loadtxoutset accepts, by height: the hash
+ * dumptxoutset reported for it, and the tx=... number of its UpdateTip line.
+ * Pin one only once the release validated the chain up to it from genesis.
+ */
+static const MapSnapshots mapSnapshots = {};
+static const MapSnapshots mapSnapshotsTestnet = {};
+// The chain mined by test/functional/feature_utxo_snapshot.py
+static const MapSnapshots mapSnapshotsRegtest = {
+    {120, {uint256S("0x4bbb4cd9f079f5076effcb81f855320b614815caa7005bababd90e51e1bca59f"), 122}},
+};
+
 class CMainParams : public CChainParams
 {
 public:
@@ -3151,6 +3163,11 @@ public:
         return data;
     }
 
+    const MapSnapshots& Snapshots() const
+    {
+        return mapSnapshots;
+    }
+
 };
 static CMainParams mainParams;
 
@@ -3239,6 +3256,11 @@ public:
     {
         return dataTestnet;
     }
+
+    const MapSnapshots& Snapshots() const
+    {
+        return mapSnapshotsTestnet;
+    }
 };
 static CTestNetParams testNetParams;
 
@@ -3319,6 +3341,11 @@ public:
         return dataRegtest;
     }
 
+    const MapSnapshots& Snapshots() const
+    {
+        return mapSnapshotsRegtest;
+    }
+
     void UpdateNetworkUpgradeParameters(Consensus::UpgradeIndex idx, int nActivationHeight)
     {
         assert(idx > Consensus::BASE_NETWORK && idx < Consensus::MAX_NETWORK_UPGRADES);
@@ -32,6 +32,13 @@ struct SeedSpec6 {
     uint16_t port;
 };
 
+/** A UTXO set snapshot accepted by loadtxoutset, as written by dumptxoutset */
+struct CSnapshotData {
+    uint256 hashSerialized; //!< hash of the snapshot coins, as returned by dumptxoutset
+    unsigned int nChainTx;  //!< transactions in the chain up to and including the snapshot block
+};
+typedef std::map<int, CSnapshotData> MapSnapshots;
+
 /**
  * CChainParams defines various tweakable parameters of a given instance of the
  * SafeDeal system. There are three: the main network on which people trade goods
@@ -72,6 +79,8 @@ public:
     const std::vector<unsigned char>& Base58Prefix(Base58Type type) const { return base58Prefixes[type]; }
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     virtual const Checkpoints::CCheckpointData& Checkpoints() const = 0;
+    /** UTXO set snapshots a node may be bootstrapped from, by height */
+    virtual const MapSnapshots& Snapshots() const = 0;
 
     CBaseChainParams::Network NetworkID() const { return networkID; }
     bool IsRegTestNet() const { return NetworkID() == CBaseChainParams::REGTEST; }
@@ -128,6 +128,9 @@ private:
     }
 
 public:
+    //! Mutex to ensure only one concurrent CCheckQueueControl
+    boost::mutex ControlMutex;
+
     //! Create a new check queue
     CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
 
@@ -171,13 +174,16 @@ public:
 
 /** 
  * RAII-style controller object for a CCheckQueue that guarantees the passed
- * queue is finished before continuing.
+ * queue is finished before continuing. The queue is owned by the controller
+ * for its lifetime, so users from different threads (block connection and
+ * mempool acceptance) take turns.
  */
 template <typename T>
 class CCheckQueueControl
 {
 private:
     CCheckQueue<T>* pqueue;
+    boost::unique_lock<boost::mutex> lockControl;
     bool fDone;
 
 public:
@@ -185,6 +191,7 @@ public:
     {
         // passed queue is supposed to be unused, or NULL
         if (pqueue != NULL) {
+            lockControl = boost::unique_lock<boost::mutex>(pqueue->ControlMutex);
             bool isIdle = pqueue->IsIdle();
             assert(isIdle);
         }
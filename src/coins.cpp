@@ -12,26 +12,29 @@
 #include "random.h"
 #include "util.h"
 
+#include <algorithm>
 #include <assert.h>
 
 bool CCoinsView::GetCoin(const COutPoint& outpoint, Coin& coin) const { return false; }
 bool CCoinsView::HaveCoin(const COutPoint& outpoint) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return UINT256_ZERO; }
-bool CCoinsView::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) { return false; }
+std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
+bool CCoinsView::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase) { return false; }
 CCoinsViewCursor *CCoinsView::Cursor() const { return 0; }
 
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView* viewIn) : base(viewIn) {}
 bool CCoinsViewBacked::GetCoin(const COutPoint& outpoint, Coin& coin) const { return base->GetCoin(outpoint, coin); }
 bool CCoinsViewBacked::HaveCoin(const COutPoint& outpoint) const { return base->HaveCoin(outpoint); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
+std::vector<uint256> CCoinsViewBacked::GetHeadBlocks() const { return base->GetHeadBlocks(); }
 void CCoinsViewBacked::SetBackend(CCoinsView& viewIn) { base = &viewIn; }
-bool CCoinsViewBacked::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+bool CCoinsViewBacked::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase) { return base->BatchWrite(mapCoins, hashBlock, fErase); }
 CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
 size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
 SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cacheCoins(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &cacheCoinsMemoryResource), cachedCoinsUsage(0), accessTick(0), nCacheHits(0), nCacheMisses(0) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
@@ -40,12 +43,17 @@ size_t CCoinsViewCache::DynamicMemoryUsage() const {
 CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint& outpoint) const
 {
     CCoinsMap::iterator it = cacheCoins.find(outpoint);
-    if (it != cacheCoins.end())
+    if (it != cacheCoins.end()) {
+        it->second.lastAccess = ++accessTick;
+        nCacheHits++;
         return it;
+    }
+    nCacheMisses++;
     Coin tmp;
     if (!base->GetCoin(outpoint, tmp))
         return cacheCoins.end();
     CCoinsMap::iterator ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(tmp))).first;
+    ret->second.lastAccess = ++accessTick;
     if (ret->second.coin.IsSpent()) {
         // The parent only has an empty entry for this outpoint; we can consider our
         // version as fresh.
@@ -83,16 +91,29 @@ void CCoinsViewCache::AddCoin(const COutPoint& outpoint, Coin&& coin, bool possi
     }
     it->second.coin = std::move(coin);
     it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
+    it->second.lastAccess = ++accessTick;
+    cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+}
+
+bool CCoinsViewCache::PreloadCoin(const COutPoint& outpoint, Coin&& coin)
+{
+    if (coin.IsSpent() || cacheCoins.count(outpoint))
+        return false;
+    CCoinsMap::iterator it = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(coin))).first;
+    it->second.lastAccess = ++accessTick;
     cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+    return true;
 }
 
-void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight)
+void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight, bool fCheckForOverwrite)
 {
     bool fCoinbase = tx.IsCoinBase();
     bool fCoinstake = tx.IsCoinStake();
     const uint256& txid = tx.GetHash();
     for (size_t i = 0; i < tx.vout.size(); ++i) {
-        cache.AddCoin(COutPoint(txid, i), Coin(tx.vout[i], nHeight, fCoinbase, fCoinstake), false);
+        const COutPoint out(txid, i);
+        bool overwrite = fCheckForOverwrite && cache.HaveCoin(out);
+        cache.AddCoin(out, Coin(tx.vout[i], nHeight, fCoinbase, fCoinstake), overwrite);
     }
 }
 
@@ -148,7 +169,7 @@ void CCoinsViewCache::SetBestBlock(const uint256& hashBlockIn)
     hashBlock = hashBlockIn;
 }
 
-bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlockIn) {
+bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlockIn, bool fErase) {
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
             CCoinsMap::iterator itUs = cacheCoins.find(it->first);
@@ -159,9 +180,13 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlockIn
                     // Otherwise we will need to create it in the parent
                     // and move the data up and mark it as dirty
                     CCoinsCacheEntry& entry = cacheCoins[it->first];
-                    entry.coin = std::move(it->second.coin);
+                    if (fErase)
+                        entry.coin = std::move(it->second.coin);
+                    else
+                        entry.coin = it->second.coin;
                     cachedCoinsUsage += memusage::DynamicUsage(entry.coin);
                     entry.flags = CCoinsCacheEntry::DIRTY;
+                    entry.lastAccess = ++accessTick;
                     // We can mark it FRESH in the parent if it was FRESH in the child
                     // Otherwise it might have just been flushed from the parent's cache
                     // and already exist in the grandparent
@@ -186,9 +211,13 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlockIn
                 } else {
                     // A normal modification.
                     cachedCoinsUsage -= memusage::DynamicUsage(itUs->second.coin);
-                    itUs->second.coin = std::move(it->second.coin);
+                    if (fErase)
+                        itUs->second.coin = std::move(it->second.coin);
+                    else
+                        itUs->second.coin = it->second.coin;
                     cachedCoinsUsage += memusage::DynamicUsage(itUs->second.coin);
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                    itUs->second.lastAccess = ++accessTick;
                     // NOTE: It is possible the child has a FRESH flag here in
                     // the event the entry we found in the parent is pruned. But
                     // we must not copy that FRESH flag to the parent as that
@@ -197,8 +226,12 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlockIn
                 }
             }
         }
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase) {
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        } else {
+            it++;
+        }
     }
     hashBlock = hashBlockIn;
     return true;
@@ -209,9 +242,94 @@ bool CCoinsViewCache::Flush()
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
     cachedCoinsUsage = 0;
+    ReallocateCache();
+    return fOk;
+}
+
+void CCoinsViewCache::ReallocateCache()
+{
+    assert(cacheCoins.empty());
+    // Keep the hasher, to not draw a new salt on every flush.
+    SaltedOutpointHasher hasher = cacheCoins.hash_function();
+    cacheCoins.~CCoinsMap();
+    cacheCoinsMemoryResource.~CCoinsMapMemoryResource();
+    ::new (&cacheCoinsMemoryResource) CCoinsMapMemoryResource();
+    ::new (&cacheCoins) CCoinsMap(0, hasher, CCoinsMap::key_equal(), &cacheCoinsMemoryResource);
+}
+
+bool CCoinsViewCache::Sync()
+{
+    bool fOk = base->BatchWrite(cacheCoins, hashBlock, false);
+    // The base now holds every change: drop the spent entries and
+    // keep the others as clean copies of the base.
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end();) {
+        if (it->second.coin.IsSpent()) {
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            it = cacheCoins.erase(it);
+        } else {
+            it->second.flags = 0;
+            ++it;
+        }
+    }
+    CompactCache();
     return fOk;
 }
 
+size_t CCoinsViewCache::Trim(size_t nTargetUsage)
+{
+    // Entries are measured without the unused memory of the pool: evicting
+    // them only moves their nodes to the free lists of the pool.
+    auto UsedMemoryUsage = [this]() { return DynamicMemoryUsage() - cacheCoinsMemoryResource.UnusedBytes(); };
+    if (UsedMemoryUsage() <= nTargetUsage)
+        return 0;
+
+    // Collect the clean entries, oldest access first. Ages are measured relative
+    // to the current tick, so that wrapping of the counter does not matter.
+    std::vector<std::pair<uint32_t, CCoinsMap::iterator> > vClean;
+    vClean.reserve(cacheCoins.size());
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); ++it) {
+        if (it->second.flags == 0)
+            vClean.emplace_back(accessTick - it->second.lastAccess, it);
+    }
+    std::sort(vClean.begin(), vClean.end(), [](const std::pair<uint32_t, CCoinsMap::iterator>& a, const std::pair<uint32_t, CCoinsMap::iterator>& b) {
+        return a.first > b.first;
+    });
+
+    size_t nEvicted = 0;
+    for (const auto& item : vClean) {
+        if (UsedMemoryUsage() <= nTargetUsage)
+            break;
+        cachedCoinsUsage -= item.second->second.coin.DynamicMemoryUsage();
+        cacheCoins.erase(item.second);
+        nEvicted++;
+    }
+    // Hand the freed nodes back to the system.
+    CompactCache();
+    return nEvicted;
+}
+
+void CCoinsViewCache::CompactCache()
+{
+    // Only worth it when at least half of the pool, and at least a whole chunk, is unused.
+    const size_t nFreeBytes = cacheCoinsMemoryResource.UnusedBytes();
+    const size_t nChunkBytes = cacheCoinsMemoryResource.ChunkSizeBytes();
+    if (nFreeBytes < nChunkBytes || nFreeBytes * 2 < cacheCoinsMemoryResource.NumAllocatedChunks() * nChunkBytes)
+        return;
+
+    std::vector<std::pair<COutPoint, CCoinsCacheEntry> > vEntries;
+    vEntries.reserve(cacheCoins.size());
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it = cacheCoins.erase(it)) {
+        vEntries.emplace_back(it->first, std::move(it->second));
+    }
+    ReallocateCache();
+    cacheCoins.reserve(vEntries.size());
+    cachedCoinsUsage = 0;
+    for (auto& entry : vEntries) {
+        cachedCoinsUsage += entry.second.coin.DynamicMemoryUsage();
+        cacheCoins.emplace(entry.first, std::move(entry.second));
+    }
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& outpoint)
 {
     CCoinsMap::iterator it = cacheCoins.find(outpoint);
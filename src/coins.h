@@ -14,12 +14,15 @@
 #include "consensus/consensus.h"  // can be removed once policy/ established
 #include "script/standard.h"
 #include "serialize.h"
+#include "support/allocators/pool.h"
 #include "uint256.h"
 
 #include <assert.h>
 #include <stdint.h>
 
+#include <functional>
 #include <unordered_map>
+#include <vector>
 
 /**
  * A UTXO entry.
@@ -31,11 +34,8 @@
 class Coin
 {
 public:
-    //! whether the containing transaction was a coinbase
-    bool fCoinBase;
-
-    //! whether the containing transaction was a coinstake
-    bool fCoinStake;
+    // The members are ordered so that the height and the flags fill the tail
+    // padding of the CTxOut, keeping a cache node as small as possible.
 
     //! unspent transaction output
     CTxOut out;
@@ -43,9 +43,15 @@ public:
     //! at which height the containing transaction was included in the active block chain
     uint32_t nHeight;
 
+    //! whether the containing transaction was a coinbase
+    bool fCoinBase;
+
+    //! whether the containing transaction was a coinstake
+    bool fCoinStake;
+
     //! construct a Coin from a CTxOut and height/coinbase properties.
-    Coin(CTxOut&& outIn, int nHeightIn, bool fCoinBaseIn, bool fCoinStakeIn) : fCoinBase(fCoinBaseIn), fCoinStake(fCoinStakeIn), out(std::move(outIn)), nHeight(nHeightIn) {}
-    Coin(const CTxOut& outIn, int nHeightIn, bool fCoinBaseIn, bool fCoinStakeIn) : fCoinBase(fCoinBaseIn), fCoinStake(fCoinStakeIn), out(outIn), nHeight(nHeightIn) {}
+    Coin(CTxOut&& outIn, int nHeightIn, bool fCoinBaseIn, bool fCoinStakeIn) : out(std::move(outIn)), nHeight(nHeightIn), fCoinBase(fCoinBaseIn), fCoinStake(fCoinStakeIn) {}
+    Coin(const CTxOut& outIn, int nHeightIn, bool fCoinBaseIn, bool fCoinStakeIn) : out(outIn), nHeight(nHeightIn), fCoinBase(fCoinBaseIn), fCoinStake(fCoinStakeIn) {}
 
     void Clear() {
         out.SetNull();
@@ -55,7 +61,7 @@ public:
     }
 
     //! empty constructor
-    Coin() : fCoinBase(false), fCoinStake(false), nHeight(0) { }
+    Coin() : nHeight(0), fCoinBase(false), fCoinStake(false) { }
 
     bool IsCoinBase() const {
         return fCoinBase;
@@ -114,17 +120,28 @@ public:
 struct CCoinsCacheEntry {
     Coin coin; // The actual cached data.
     unsigned char flags;
+    uint32_t lastAccess; // Access tick of the owning cache, used for least-recently-used eviction.
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
         FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
     };
 
-    CCoinsCacheEntry() : flags(0) {}
-    explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
+    CCoinsCacheEntry() : flags(0), lastAccess(0) {}
+    explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0), lastAccess(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+/**
+ * The nodes of a CCoinsMap are allocated from a pool, in chunks: this avoids
+ * a malloc call and its overhead for every cached coin, and the memory is
+ * released all at once when the cache is flushed. The block size allows for
+ * the node bookkeeping of the standard library around the key/value pair.
+ */
+typedef PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry>,
+                      sizeof(std::pair<const COutPoint, CCoinsCacheEntry>) + sizeof(void*) * 4>
+    CCoinsMapAllocator;
+typedef CCoinsMapAllocator::ResourceType CCoinsMapMemoryResource;
+typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher, std::equal_to<COutPoint>, CCoinsMapAllocator> CCoinsMap;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -161,9 +178,16 @@ public:
     //! Retrieve the block hash whose state this CCoinsView currently represents
     virtual uint256 GetBestBlock() const;
 
+    //! Retrieve the range of blocks that may have been only partially written.
+    //! If the database is in a consistent state, the result is the empty vector.
+    //! Otherwise, a two-element vector is returned consisting of the new and
+    //! the old block hash, in that order.
+    virtual std::vector<uint256> GetHeadBlocks() const;
+
     //! Do a bulk modification (multiple Coin changes + BestBlock change).
-    //! The passed mapCoins can be modified.
-    virtual bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
+    //! The passed mapCoins can be modified. When fErase is false the entries
+    //! of mapCoins are left in place (only read), so the caller can keep them cached.
+    virtual bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase = true);
 
     //! Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor* Cursor() const;
@@ -187,8 +211,9 @@ public:
     bool GetCoin(const COutPoint& outpoint, Coin& coin) const override;
     bool HaveCoin(const COutPoint& outpoint) const override;
     uint256 GetBestBlock() const override;
+    std::vector<uint256> GetHeadBlocks() const override;
     void SetBackend(CCoinsView& viewIn);
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override;
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase = true) override;
     CCoinsViewCursor* Cursor() const override;
     size_t EstimateSize() const override;
 };
@@ -207,11 +232,20 @@ protected:
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    /* The pool the nodes of cacheCoins are allocated from; must outlive it. */
+    mutable CCoinsMapMemoryResource cacheCoinsMemoryResource;
     mutable CCoinsMap cacheCoins;
 
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Monotonic access counter, stamped on entries as they are used. */
+    mutable uint32_t accessTick;
+
+    /* Lookups answered from the cache, and lookups that went to the base view. */
+    mutable uint64_t nCacheHits;
+    mutable uint64_t nCacheMisses;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
 
@@ -220,7 +254,7 @@ public:
     bool HaveCoin(const COutPoint& outpoint) const override;
     uint256 GetBestBlock() const override;
     void SetBestBlock(const uint256& hashBlock);
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override;
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase = true) override;
 
     /**
      * Check if we have the given utxo already loaded in this cache.
@@ -242,6 +276,14 @@ public:
      */
     void AddCoin(const COutPoint& outpoint, Coin&& coin, bool potential_overwrite);
 
+    /**
+     * Insert a coin read from the base view as a non-dirty entry, unless the
+     * cache already has an entry for the outpoint. The caller must guarantee
+     * that coin is the current state of the outpoint in the base view.
+     * Returns whether the coin was added.
+     */
+    bool PreloadCoin(const COutPoint& outpoint, Coin&& coin);
+
     /**
      * Spend a coin. Pass moveto in order to get the deleted data.
      * If no unspent output exists for the passed outpoint, this call
@@ -256,6 +298,24 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base, like Flush(),
+     * but keep the unspent entries cached (as non-dirty) so that the cache stays warm.
+     * Spent entries are dropped, as the base no longer has them either, and their
+     * memory is released if they made up most of the cache.
+     * If false is returned, the state of this cache (and its backing view) will be undefined.
+     */
+    bool Sync();
+
+    /**
+     * Evict non-dirty entries, least recently used first, until the memory used by
+     * the remaining entries drops to nTargetUsage (or no non-dirty entries are left).
+     * The freed memory is then released, if it is a large share of the cache: the
+     * dynamic memory usage ends up within a chunk of the pool of nTargetUsage.
+     * Returns the number of evicted entries.
+     */
+    size_t Trim(size_t nTargetUsage);
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is not modified.
      */
@@ -267,6 +327,10 @@ public:
     //! Calculate the size of the cache (in bytes)
     size_t DynamicMemoryUsage() const;
 
+    //! Number of lookups answered from the cache, and of lookups that went to the base view
+    uint64_t GetCacheHits() const { return nCacheHits; }
+    uint64_t GetCacheMisses() const { return nCacheMisses; }
+
     /** 
      * Amount of safedeal coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
@@ -296,6 +360,18 @@ public:
 private:
     CCoinsMap::iterator FetchCoin(const COutPoint& outpoint) const;
 
+    /**
+     * Release the memory of the (empty) cache back to the system, by recreating
+     * the map and its pool.
+     */
+    void ReallocateCache();
+
+    /**
+     * Move the entries to a new pool, releasing the old one, when most of the pool
+     * is made of freed nodes. Erasing entries never shrinks the pool otherwise.
+     */
+    void CompactCache();
+
     /**
       * By making the copy constructor private, we prevent accidentally using it when one intends to create a cache on top of a base cache.
       */
@@ -303,8 +379,9 @@ private:
 };
 
 //! Utility function to add all of a transaction's outputs to a cache.
-// SafeDeal: It assumes that overwrites are never possible due to BIP34 always in effect
-void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight);
+// SafeDeal: It assumes that overwrites are never possible due to BIP34 always in effect,
+// unless fCheckForOverwrite is set (used when replaying blocks that may have been partially applied).
+void AddCoins(CCoinsViewCache& cache, const CTransaction& tx, int nHeight, bool fCheckForOverwrite = false);
 
 //! Utility function to find any unspent output with a given txid.
 const Coin& AccessByTxid(const CCoinsViewCache& cache, const uint256& txid);
@@ -0,0 +1,147 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinsprefetcher.h"
+
+#include "primitives/block.h"
+
+#include <set>
+
+CCoinsPrefetcher::CCoinsPrefetcher(size_t nMaxEntriesIn, unsigned int nBatchSizeIn) :
+    base(nullptr), nGeneration(0), nWorkers(0), nLookups(0), nMaxEntries(nMaxEntriesIn), nBatchSize(nBatchSizeIn) {}
+
+void CCoinsPrefetcher::SetBase(CCoinsView* baseIn)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    base = baseIn;
+    queue.clear();
+    mapPending.clear();
+    vStaged.clear();
+    nGeneration++;
+    condDone.notify_all();
+    while (nLookups > 0)
+        condDone.wait(lock);
+}
+
+void CCoinsPrefetcher::Prefetch(const CBlock& block)
+{
+    // Outputs created by the block itself cannot be in the database yet.
+    std::set<uint256> setBlockTxids;
+    std::vector<COutPoint> vPrevouts;
+    for (const CTransactionRef& ptx : block.vtx) {
+        const CTransaction& tx = *ptx;
+        setBlockTxids.insert(tx.GetHash());
+        if (tx.IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx.vin) {
+            if (!setBlockTxids.count(txin.prevout.hash))
+                vPrevouts.push_back(txin.prevout);
+        }
+    }
+    if (vPrevouts.empty())
+        return;
+
+    const uint256& hashBlock = block.GetHash();
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (!base || nWorkers == 0 || mapPending.count(hashBlock) || queue.size() + vPrevouts.size() > nMaxEntries)
+        return;
+    for (const COutPoint& prevout : vPrevouts)
+        queue.emplace_back(hashBlock, prevout);
+    mapPending[hashBlock] = vPrevouts.size();
+    if (vPrevouts.size() > nBatchSize)
+        condWorker.notify_all();
+    else
+        condWorker.notify_one();
+}
+
+size_t CCoinsPrefetcher::Apply(CCoinsViewCache& view, const uint256& hashBlock)
+{
+    std::vector<std::pair<COutPoint, Coin> > vReady;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (nWorkers > 0 && mapPending.count(hashBlock))
+            condDone.wait(lock);
+        vReady.swap(vStaged);
+    }
+    size_t nAdded = 0;
+    for (auto& item : vReady) {
+        if (view.PreloadCoin(item.first, std::move(item.second)))
+            nAdded++;
+    }
+    return nAdded;
+}
+
+void CCoinsPrefetcher::Invalidate()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    vStaged.clear();
+    nGeneration++;
+}
+
+void CCoinsPrefetcher::Thread()
+{
+    std::vector<std::pair<uint256, COutPoint> > vBatch;
+    std::vector<std::pair<COutPoint, Coin> > vFound;
+    vBatch.reserve(nBatchSize);
+    vFound.reserve(nBatchSize);
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    nWorkers++;
+    try {
+        while (true) {
+            // wait for work (this is an interruption point)
+            while (queue.empty())
+                condWorker.wait(lock);
+
+            CCoinsView* view = base;
+            uint64_t nGenerationStart = nGeneration;
+            while (!queue.empty() && vBatch.size() < nBatchSize) {
+                vBatch.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+
+            // do the lookups without holding the lock
+            nLookups++;
+            lock.unlock();
+            for (const auto& item : vBatch) {
+                Coin coin;
+                if (view && view->GetCoin(item.second, coin) && !coin.IsSpent())
+                    vFound.emplace_back(item.second, std::move(coin));
+            }
+            lock.lock();
+            nLookups--;
+
+            // stage the results, unless the base changed in the meantime
+            if (nGenerationStart == nGeneration) {
+                for (auto& found : vFound) {
+                    if (vStaged.size() >= nMaxEntries)
+                        break;
+                    vStaged.push_back(std::move(found));
+                }
+            }
+            for (const auto& item : vBatch) {
+                auto it = mapPending.find(item.first);
+                if (it != mapPending.end() && --it->second == 0) {
+                    mapPending.erase(it);
+                    condDone.notify_all();
+                }
+            }
+            if (nLookups == 0)
+                condDone.notify_all();
+            vBatch.clear();
+            vFound.clear();
+        }
+    } catch (...) {
+        // shutting down: do not leave anyone waiting in Apply()
+        nWorkers--;
+        if (nWorkers == 0) {
+            queue.clear();
+            mapPending.clear();
+        }
+        condDone.notify_all();
+        throw;
+    }
+}
+
+CCoinsPrefetcher coinsPrefetcher(100000);
@@ -0,0 +1,105 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PIVX_COINSPREFETCHER_H
+#define PIVX_COINSPREFETCHER_H
+
+#include "coins.h"
+#include "uint256.h"
+
+#include <deque>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CBlock;
+
+/** Default number of threads looking up block inputs in the coins database (-prefetchthreads) */
+static const int DEFAULT_PREFETCH_THREADS = 4;
+/** Maximum number of threads looking up block inputs in the coins database */
+static const int MAX_PREFETCH_THREADS = 16;
+
+/**
+ * Looks up the inputs of blocks that are about to be connected in the coins
+ * database from a pool of worker threads, so that the disk latency overlaps
+ * with other work instead of stalling ConnectBlock (which holds cs_main).
+ *
+ * The coins found are staged here, and moved into the tip cache by Apply()
+ * right before the block is connected. Only outpoints the tip cache doesn't
+ * hold are inserted: for those the database is authoritative, as long as no
+ * flush happened since the lookup. Flushes must therefore call Invalidate()
+ * before and after writing, which discards every lookup that overlapped them.
+ */
+class CCoinsPrefetcher
+{
+private:
+    //! Mutex to protect the inner state
+    boost::mutex mutex;
+
+    //! Worker threads block on this when out of work
+    boost::condition_variable condWorker;
+
+    //! Apply() blocks on this while the lookups of its block are in progress
+    boost::condition_variable condDone;
+
+    //! The view lookups are done in (must be safe to read from several threads)
+    CCoinsView* base;
+
+    //! Outpoints to look up, with the block they belong to
+    std::deque<std::pair<uint256, COutPoint> > queue;
+
+    //! Number of lookups not completed yet, per block
+    std::map<uint256, unsigned int> mapPending;
+
+    //! Coins found, waiting to be moved into the tip cache
+    std::vector<std::pair<COutPoint, Coin> > vStaged;
+
+    //! Bumped by Invalidate(): lookups started under an older generation are dropped
+    uint64_t nGeneration;
+
+    //! Number of running worker threads
+    int nWorkers;
+
+    //! Number of workers reading from base without holding the lock
+    int nLookups;
+
+    //! Upper bound on the number of queued lookups and on the number of staged coins
+    size_t nMaxEntries;
+
+    //! The maximum number of outpoints looked up by a worker in one batch
+    unsigned int nBatchSize;
+
+public:
+    explicit CCoinsPrefetcher(size_t nMaxEntriesIn, unsigned int nBatchSizeIn = 16);
+
+    /**
+     * Set the view lookups are done in (nullptr to disable prefetching). Waits
+     * for the lookups still reading from the previous view, which may then be
+     * deleted.
+     */
+    void SetBase(CCoinsView* baseIn);
+
+    //! Queue the lookup of all the inputs of the block that are not created by the block itself.
+    void Prefetch(const CBlock& block);
+
+    /**
+     * Move the staged coins into view, waiting for the lookups of block hashBlock
+     * to complete first. Returns the number of coins added to view.
+     */
+    size_t Apply(CCoinsViewCache& view, const uint256& hashBlock);
+
+    //! Drop all staged coins and in-progress lookups, as the base view is about to change or has changed.
+    void Invalidate();
+
+    //! Worker thread
+    void Thread();
+};
+
+extern CCoinsPrefetcher coinsPrefetcher;
+
+#endif // PIVX_COINSPREFETCHER_H
@@ -17,6 +17,9 @@
 
 #include "wallet/wallet.h"
 
+#include <atomic>
+#include <thread>
+
 int CCrypter::BytesToKeySHA512AES(const std::vector<unsigned char>& chSalt, const SecureString& strKeyData, int count, unsigned char *key,unsigned char *iv) const
 {
     // This mimics the behavior of openssl's EVP_BytesToKey with an aes256cbc
@@ -128,6 +131,51 @@ bool DecryptSecret(const CKeyingMaterial& vMasterKey, const std::vector<unsigned
     return cKeyCrypter.Decrypt(vchCiphertext, *((CKeyingMaterial*)&vchPlaintext));
 }
 
+static bool VerifyCryptedKey(const CKeyingMaterial& vMasterKey, const CPubKey& vchPubKey, const std::vector<unsigned char>& vchCryptedSecret)
+{
+    CKeyingMaterial vchSecret;
+    if (!DecryptSecret(vMasterKey, vchCryptedSecret, vchPubKey.GetHash(), vchSecret))
+        return false;
+    if (vchSecret.size() != 32)
+        return false;
+    CKey key;
+    key.Set(vchSecret.begin(), vchSecret.end(), vchPubKey.IsCompressed());
+    return key.GetPubKey() == vchPubKey;
+}
+
+//! Below this many keys per thread, starting the threads costs more than it saves
+static const size_t MIN_KEYS_PER_THREAD = 256;
+
+bool VerifyCryptedKeys(const CKeyingMaterial& vMasterKey, const std::vector<const CryptedKeyMap::mapped_type*>& vKeys, int nThreads, size_t& nPassed)
+{
+    std::atomic<bool> fFailed{false};
+    std::atomic<size_t> nPassedAll{0};
+    auto verify = [&](size_t nBegin, size_t nEnd) {
+        size_t nPassedThread = 0;
+        for (size_t i = nBegin; i < nEnd && !fFailed; i++) {
+            if (!VerifyCryptedKey(vMasterKey, vKeys[i]->first, vKeys[i]->second)) {
+                fFailed = true;
+                break;
+            }
+            nPassedThread++;
+        }
+        nPassedAll += nPassedThread;
+    };
+
+    // The calling thread verifies the first share of the keys
+    const size_t nShares = std::max<size_t>(1, std::min<size_t>(nThreads, vKeys.size() / MIN_KEYS_PER_THREAD));
+    const size_t nShareSize = (vKeys.size() + nShares - 1) / nShares;
+    std::vector<std::thread> vThreads;
+    for (size_t i = 1; i < nShares; i++)
+        vThreads.emplace_back(verify, i * nShareSize, std::min(vKeys.size(), (i + 1) * nShareSize));
+    verify(0, std::min(vKeys.size(), nShareSize));
+    for (std::thread& thread : vThreads)
+        thread.join();
+
+    nPassed = nPassedAll;
+    return !fFailed;
+}
+
 bool CCryptoKeyStore::SetCrypted()
 {
     LOCK(cs_KeyStore);
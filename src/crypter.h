@@ -129,6 +129,14 @@ public:
 bool EncryptSecret(const CKeyingMaterial& vMasterKey, const CKeyingMaterial& vchPlaintext, const uint256& nIV, std::vector<unsigned char>& vchCiphertext);
 bool DecryptSecret(const CKeyingMaterial& vMasterKey, const std::vector<unsigned char>& vchCiphertext, const uint256& nIV, CKeyingMaterial& vchPlaintext);
 
+/**
+ * Check that encrypted keys decrypt with vMasterKey to the secrets of their public keys.
+ * The keys are split between up to nThreads threads, which all stop at the first failure.
+ * @param[out]  nPassed   Number of keys found valid before stopping
+ * @return true if all the keys are valid
+ */
+bool VerifyCryptedKeys(const CKeyingMaterial& vMasterKey, const std::vector<const CryptedKeyMap::mapped_type*>& vKeys, int nThreads, size_t& nPassed);
+
 
 /** Keystore which keeps the private keys encrypted.
  * It derives from the basic key store, which is used if no encryption is active.
@@ -10,6 +10,7 @@
 #include "base58.h"
 #include "chainparams.h"
 #include "httpserver.h"
+#include "rpc/jsonstream.h"
 #include "rpc/protocol.h"
 #include "rpc/server.h"
 #include "random.h"
@@ -95,6 +96,24 @@ static bool RPCAuthorized(const std::string& strAuth, std::string& strAuthUserna
     return TimingResistantEqual(strUserPass, strRPCUserColonPass);
 }
 
+/**
+ * Complete a streamed reply whose handler failed once the reply was started.
+ * It's too late for an error status: the result written so far is closed, and
+ * the error reported next to it, so that the client can't take it as complete.
+ */
+static bool JSONStreamErrorEnd(HTTPRequest* req, JSONStreamWriter& writer, const UniValue& objError, const JSONRPCRequest& jreq)
+{
+    LogPrintf("%s: %s failed while streaming its result\n", __func__, jreq.strMethod);
+    writer.EndAll();
+    writer.Flush();
+    if (writer.IsAborted() || !req->WriteReplyChunk(",\"error\":" + objError.write() + ",\"id\":" + jreq.id.write() + "}\n")) {
+        req->WriteReplyAbort();
+        return false;
+    }
+    req->WriteReplyEnd();
+    return false;
+}
+
 static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
 {
     // JSONRPC handles only POST
@@ -136,7 +155,41 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
-            UniValue result = tableRPC.execute(jreq);
+            // The handlers able to stream their result send it as a chunked
+            // reply, started when the first piece of the result is ready
+            bool fReplyStarted = false;
+            JSONStreamWriter writer([req, &fReplyStarted](const std::string& strChunk) {
+                if (!fReplyStarted) {
+                    req->WriteHeader("Content-Type", "application/json");
+                    req->WriteReplyStart(HTTP_OK);
+                    fReplyStarted = true;
+                    if (!req->WriteReplyChunk("{\"result\":"))
+                        return false;
+                }
+                return req->WriteReplyChunk(strChunk);
+            });
+            jreq.jsonStream = &writer;
+
+            UniValue result;
+            try {
+                result = tableRPC.execute(jreq);
+            } catch (const UniValue& objError) {
+                if (!fReplyStarted)
+                    throw;
+                return JSONStreamErrorEnd(req, writer, objError, jreq);
+            } catch (const std::exception& e) {
+                if (!fReplyStarted)
+                    throw;
+                return JSONStreamErrorEnd(req, writer, JSONRPCError(RPC_MISC_ERROR, e.what()), jreq);
+            }
+
+            if (!writer.IsEmpty()) {
+                writer.Flush();
+                if (!writer.IsAborted())
+                    req->WriteReplyChunk(",\"error\":null,\"id\":" + jreq.id.write() + "}\n");
+                req->WriteReplyEnd();
+                return true;
+            }
 
             // Send reply
             strReply = JSONRPCReply(result, NullUniValue, jreq.id);
@@ -22,7 +22,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <signal.h>
+#include <atomic>
+#include <condition_variable>
 #include <future>
+#include <mutex>
 
 #include <event2/event.h>
 #include <event2/http.h>
@@ -41,6 +44,24 @@
 /** Maximum size of http request (request line + headers) */
 static const size_t MAX_HEADERS_SIZE = 8192;
 
+/** State of a chunked reply, shared by the worker thread writing it and the
+ * event thread sending it to the client.
+ */
+struct HTTPChunkedReply
+{
+    std::mutex cs;
+    std::condition_variable cond;
+    //! Bytes written by the worker and not sent to the client yet
+    size_t nQueued = 0;
+    //! Bytes of nQueued already handed to libevent
+    size_t nHandedOver = 0;
+    //! The connection to the client was closed
+    bool fClosed = false;
+};
+
+/** Set by InterruptHTTPServer, stops the writers of chunked replies waiting for their clients */
+static std::atomic<bool> fHTTPInterrupted(false);
+
 /** HTTP request work item */
 class HTTPWorkItem : public HTTPClosure
 {
@@ -487,6 +508,7 @@ void InterruptHTTPServer()
         }
         evhttp_set_gencb(eventHTTP, http_reject_request_cb, NULL);
     }
+    fHTTPInterrupted = true;
     if (workQueue)
         workQueue->Interrupt();
 }
@@ -563,7 +585,11 @@ HTTPRequest::HTTPRequest(struct evhttp_request* req) : req(req),
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (!replySent && chunkedReply) {
+        // A chunked reply can't be turned into an error anymore, cut it
+        LogPrintf("%s: Unfinished chunked reply\n", __func__);
+        WriteReplyAbort();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -628,6 +654,134 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = 0; // transferred back to main thread
 }
 
+/** The connection of a chunked reply was closed (event thread) */
+static void http_chunked_close_cb(struct evhttp_connection*, void* arg)
+{
+    HTTPChunkedReply* reply = (HTTPChunkedReply*)arg;
+    std::lock_guard<std::mutex> lock(reply->cs);
+    reply->fClosed = true;
+    reply->cond.notify_all();
+}
+
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+/** All the chunks handed to libevent were written to the socket (event thread) */
+static void http_chunked_sent_cb(struct evhttp_connection*, void* arg)
+{
+    HTTPChunkedReply* reply = (HTTPChunkedReply*)arg;
+    std::lock_guard<std::mutex> lock(reply->cs);
+    reply->nQueued -= reply->nHandedOver;
+    reply->nHandedOver = 0;
+    reply->cond.notify_all();
+}
+#endif
+
+void HTTPRequest::WriteReplyStart(int nStatus)
+{
+    assert(!replySent && req && !chunkedReply);
+    chunkedReply = std::make_shared<HTTPChunkedReply>();
+    struct evhttp_request* reqIn = req;
+    std::shared_ptr<HTTPChunkedReply> reply = chunkedReply;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [reqIn, nStatus, reply]() {
+        evhttp_connection* evcon = evhttp_request_get_connection(reqIn);
+        if (!evcon) {
+            http_chunked_close_cb(NULL, reply.get());
+            return;
+        }
+        evhttp_send_reply_start(reqIn, nStatus, NULL);
+        evhttp_connection_set_closecb(evcon, http_chunked_close_cb, reply.get());
+    });
+    ev->trigger(0);
+}
+
+bool HTTPRequest::WriteReplyChunk(const std::string& strChunk)
+{
+    assert(!replySent && req && chunkedReply);
+    std::shared_ptr<HTTPChunkedReply> reply = chunkedReply;
+    {
+        std::unique_lock<std::mutex> lock(reply->cs);
+        while (!reply->fClosed && !fHTTPInterrupted && reply->nQueued > MAX_HTTP_CHUNKED_QUEUED)
+            reply->cond.wait_for(lock, std::chrono::milliseconds(100));
+        if (reply->fClosed || fHTTPInterrupted)
+            return false;
+        if (strChunk.empty())
+            return true;
+        reply->nQueued += strChunk.size();
+    }
+
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, strChunk.data(), strChunk.size());
+    struct evhttp_request* reqIn = req;
+    const size_t nSize = strChunk.size();
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [reqIn, evb, nSize, reply]() {
+        // The request loses its connection when the client goes away
+        evhttp_connection* evcon = evhttp_request_get_connection(reqIn);
+        {
+            std::lock_guard<std::mutex> lock(reply->cs);
+            if (!evcon) {
+                reply->fClosed = true;
+                reply->cond.notify_all();
+            }
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+            // Accounted for once written to the socket
+            if (!reply->fClosed)
+                reply->nHandedOver += nSize;
+            else
+                reply->nQueued -= nSize;
+#else
+            reply->nQueued -= nSize;
+#endif
+        }
+        if (evcon) {
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+            evhttp_send_reply_chunk_with_cb(reqIn, evb, http_chunked_sent_cb, reply.get());
+#else
+            evhttp_send_reply_chunk(reqIn, evb);
+#endif
+        }
+        evbuffer_free(evb);
+    });
+    ev->trigger(0);
+    return true;
+}
+
+void HTTPRequest::WriteReplyEnd()
+{
+    assert(!replySent && req && chunkedReply);
+    struct evhttp_request* reqIn = req;
+    std::shared_ptr<HTTPChunkedReply> reply = chunkedReply;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [reqIn, reply]() {
+        evhttp_connection* evcon = evhttp_request_get_connection(reqIn);
+        if (evcon)
+            evhttp_connection_set_closecb(evcon, NULL, NULL);
+        evhttp_send_reply_end(reqIn);
+    });
+    ev->trigger(0);
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
+void HTTPRequest::WriteReplyAbort()
+{
+    assert(!replySent && req && chunkedReply);
+    struct evhttp_request* reqIn = req;
+    std::shared_ptr<HTTPChunkedReply> reply = chunkedReply;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [reqIn, reply]() {
+        evhttp_connection* evcon = evhttp_request_get_connection(reqIn);
+        if (!evcon) {
+            // The client is gone already, only the request is left to free
+            evhttp_send_reply_end(reqIn);
+            return;
+        }
+        // Freeing the connection frees the request with it
+        evhttp_connection_set_closecb(evcon, NULL, NULL);
+        evhttp_connection_free(evcon);
+    });
+    ev->trigger(0);
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
@@ -10,14 +10,18 @@
 #include <string>
 #include <stdint.h>
 #include <functional>
+#include <memory>
 
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
+/** Bytes of a chunked reply that may wait to be sent to the client before its writer is held back */
+static const size_t MAX_HTTP_CHUNKED_QUEUED = 4 * 1024 * 1024;
 
 struct evhttp_request;
 struct event_base;
 class CService;
+struct HTTPChunkedReply;
 class HTTPRequest;
 
 /** Initialize HTTP server.
@@ -61,6 +65,7 @@ class HTTPRequest
 private:
     struct evhttp_request* req;
     bool replySent;
+    std::shared_ptr<HTTPChunkedReply> chunkedReply;
 
 public:
     HTTPRequest(struct evhttp_request* req);
@@ -116,6 +121,43 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a chunked HTTP reply, for bodies produced piece by piece.
+     * nStatus is the HTTP status code to send. The body is then written with
+     * WriteReplyChunk, and the reply completed with WriteReplyEnd.
+     *
+     * @note Call WriteHeader before, WriteReply can't be used anymore.
+     */
+    void WriteReplyStart(int nStatus);
+
+    /**
+     * Write a piece of the body of a chunked reply. Blocks while more than
+     * MAX_HTTP_CHUNKED_QUEUED bytes of the reply wait to be sent, so that a slow
+     * client doesn't make the whole reply pile up in memory.
+     *
+     * @returns false if the client went away or the server is shutting down,
+     * the rest of the reply can then be skipped.
+     */
+    bool WriteReplyChunk(const std::string& strChunk);
+
+    /**
+     * Complete a chunked reply.
+     *
+     * @note As this will give the request back to the main thread, do not call
+     * any other HTTPRequest methods after calling this.
+     */
+    void WriteReplyEnd();
+
+    /**
+     * Abort a chunked reply that can't be completed: the connection is closed
+     * without the final chunk, so that the client doesn't take the truncated
+     * body for a complete one.
+     *
+     * @note As this will give the request back to the main thread, do not call
+     * any other HTTPRequest methods after calling this.
+     */
+    void WriteReplyAbort();
 };
 
 /** Event handler closure.
@@ -12,14 +12,15 @@ namespace interfaces {
 
     WalletBalances Wallet::getBalances() {
         WalletBalances result;
-        result.balance = m_wallet.GetAvailableBalance();
-        result.unconfirmed_balance = m_wallet.GetUnconfirmedBalance();
-        result.immature_balance = m_wallet.GetImmatureBalance();
+        const CWallet::Balances balances = m_wallet.GetBalances();
+        result.balance = balances.nTrusted;
+        result.unconfirmed_balance = balances.nUntrustedPending;
+        result.immature_balance = balances.nImmature;
         result.have_watch_only = m_wallet.HaveWatchOnly();
         if (result.have_watch_only) {
-            result.watch_only_balance = m_wallet.GetWatchOnlyBalance();
-            result.unconfirmed_watch_only_balance = m_wallet.GetUnconfirmedWatchOnlyBalance();
-            result.immature_watch_only_balance = m_wallet.GetImmatureWatchOnlyBalance();
+            result.watch_only_balance = balances.nWatchOnlyTrusted;
+            result.unconfirmed_watch_only_balance = balances.nWatchOnlyUntrustedPending;
+            result.immature_watch_only_balance = balances.nWatchOnlyImmature;
         }
         return result;
     }
@@ -36,6 +36,12 @@ static int FileWriteStr(const std::string &str, FILE *fp)
     return fwrite(str.data(), 1, str.size(), fp);
 }
 
+BCLog::Logger::~Logger()
+{
+    StopWriterThread();
+    if (m_fileout) fclose(m_fileout);
+}
+
 bool BCLog::Logger::OpenDebugLog()
 {
     std::lock_guard<std::mutex> scoped_lock(m_file_mutex);
@@ -82,11 +88,6 @@ bool BCLog::Logger::DisableCategory(const std::string& str)
     return true;
 }
 
-bool BCLog::Logger::WillLogCategory(BCLog::LogFlags category) const
-{
-    return (m_categories.load(std::memory_order_relaxed) & category) != 0;
-}
-
 bool BCLog::Logger::DefaultShrinkDebugFile() const
 {
     return m_categories == BCLog::NONE;
@@ -193,22 +194,17 @@ std::string BCLog::Logger::LogTimestampStr(const std::string &str)
     return strStamped;
 }
 
-int BCLog::Logger::LogPrintStr(const std::string &str)
+int BCLog::Logger::WriteStr(const std::string& str)
 {
     int ret = 0; // Returns total number of characters written
     if (m_print_to_console) {
         // print to console
         ret = fwrite(str.data(), 1, str.size(), stdout);
-        fflush(stdout);
     } else if (m_print_to_file) {
-        std::lock_guard<std::mutex> scoped_lock(m_file_mutex);
-
-        std::string strTimestamped = LogTimestampStr(str);
-
         // buffer if we haven't opened the log yet
         if (m_fileout == NULL) {
-            ret = strTimestamped.length();
-            m_msgs_before_open.push_back(strTimestamped);
+            ret = str.length();
+            m_msgs_before_open.push_back(str);
 
         } else {
             // reopen the log file, if requested
@@ -218,13 +214,113 @@ int BCLog::Logger::LogPrintStr(const std::string &str)
                     setbuf(m_fileout, NULL); // unbuffered
             }
 
-            ret = FileWriteStr(strTimestamped, m_fileout);
+            ret = FileWriteStr(str, m_fileout);
+        }
+    }
+
+    return ret;
+}
+
+int BCLog::Logger::LogPrintStr(const std::string &str)
+{
+    if (!m_print_to_console && !m_print_to_file)
+        return 0;
+
+    if (m_async.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> scoped_lock(m_queue_mutex);
+        // checked again, the writer thread may have stopped meanwhile
+        if (m_async) {
+            std::string strQueued = m_print_to_console ? str : LogTimestampStr(str);
+            if (m_queue_bytes + strQueued.size() > m_max_queue_bytes) {
+                ++m_dropped_pending;
+                ++m_dropped;
+                return 0;
+            }
+            m_queue_bytes += strQueued.size();
+            m_queue.push_back(std::move(strQueued));
+            ++m_queued_seq;
+            m_queue_cv.notify_one();
+            return str.size();
         }
     }
 
+    std::lock_guard<std::mutex> scoped_lock(m_file_mutex);
+    const int ret = WriteStr(m_print_to_console ? str : LogTimestampStr(str));
+    if (m_print_to_console) fflush(stdout);
     return ret;
 }
 
+void BCLog::Logger::WriterThread()
+{
+    std::vector<std::string> batch;
+    std::string strBatch;
+    std::unique_lock<std::mutex> lock(m_queue_mutex);
+    while (true) {
+        m_queue_cv.wait(lock, [this] { return m_writer_stop || !m_queue.empty() || m_dropped_pending > 0; });
+        if (m_queue.empty() && m_dropped_pending == 0) {
+            // stop requested and everything written: later messages are written synchronously
+            m_async = false;
+            m_flushed_cv.notify_all();
+            break;
+        }
+        batch.swap(m_queue);
+        m_queue_bytes = 0;
+        const uint64_t nDropped = m_dropped_pending;
+        m_dropped_pending = 0;
+        const uint64_t nSeq = m_queued_seq;
+        lock.unlock();
+
+        // one write per batch, the debug log file is unbuffered
+        strBatch.clear();
+        for (const std::string& str : batch)
+            strBatch += str;
+        if (nDropped > 0)
+            strBatch += strprintf("\n%s %u log messages dropped, the log writer could not keep up\n",
+                                  DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetTime()), nDropped);
+        batch.clear();
+        {
+            std::lock_guard<std::mutex> scoped_lock(m_file_mutex);
+            WriteStr(strBatch);
+            if (m_print_to_console) fflush(stdout);
+        }
+
+        lock.lock();
+        m_written_seq = nSeq;
+        m_flushed_cv.notify_all();
+    }
+}
+
+void BCLog::Logger::StartWriterThread()
+{
+    std::lock_guard<std::mutex> scoped_lock(m_queue_mutex);
+    if (m_async || m_writer_thread.joinable())
+        return;
+    m_writer_stop = false;
+    m_writer_thread = std::thread(&BCLog::Logger::WriterThread, this);
+    m_async = true;
+}
+
+void BCLog::Logger::StopWriterThread()
+{
+    {
+        std::lock_guard<std::mutex> scoped_lock(m_queue_mutex);
+        if (!m_writer_thread.joinable())
+            return;
+        m_writer_stop = true;
+        m_queue_cv.notify_one();
+    }
+    m_writer_thread.join();
+}
+
+void BCLog::Logger::Flush()
+{
+    std::unique_lock<std::mutex> lock(m_queue_mutex);
+    if (m_writer_thread.get_id() == std::this_thread::get_id())
+        return;
+    const uint64_t nSeq = m_queued_seq;
+    m_flushed_cv.wait(lock, [this, nSeq] { return !m_async || m_written_seq >= nSeq; });
+}
+
 void BCLog::Logger::ShrinkDebugFile()
 {
     // Amount of debug.log to save at end when shrinking (must fit in memory)
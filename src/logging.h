@@ -17,15 +17,20 @@
 #include "tinyformat.h"
 
 #include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <list>
 #include <mutex>
+#include <thread>
 #include <vector>
 
 
 static const bool DEFAULT_LOGTIMEMICROS = false;
 static const bool DEFAULT_LOGIPS        = false;
 static const bool DEFAULT_LOGTIMESTAMPS = true;
+static const bool DEFAULT_LOGASYNC      = true;
+//! Bytes of log messages that may wait for the writer thread before new messages are dropped
+static const size_t MAX_LOG_QUEUE_BYTES = 8 << 20;
 extern const char * const DEFAULT_DEBUGLOGFILE;
 
 extern bool fLogIPs;
@@ -83,7 +88,28 @@ namespace BCLog {
         /** Log categories bitfield. */
         std::atomic<uint32_t> m_categories{0};
 
+        /**
+         * Messages waiting for the writer thread. Logging threads only move
+         * their message in here, formatting and I/O happen on the writer.
+         */
+        std::mutex m_queue_mutex;
+        std::condition_variable m_queue_cv;
+        std::condition_variable m_flushed_cv;
+        std::vector<std::string> m_queue;
+        size_t m_queue_bytes{0};
+        uint64_t m_queued_seq{0};
+        uint64_t m_written_seq{0};
+        uint64_t m_dropped_pending{0};
+        bool m_writer_stop{false};
+        std::thread m_writer_thread;
+        /** Whether messages go through the writer thread, only changed with m_queue_mutex held */
+        std::atomic<bool> m_async{false};
+        std::atomic<uint64_t> m_dropped{0};
+
         std::string LogTimestampStr(const std::string& str);
+        /** Write to the console or the debug log, m_file_mutex must be held */
+        int WriteStr(const std::string& str);
+        void WriterThread();
 
     public:
         bool m_print_to_console = false;
@@ -94,6 +120,10 @@ namespace BCLog {
 
         fs::path m_file_path;
         std::atomic<bool> m_reopen_file{false};
+        /** Bytes of timestamped messages that may wait for the writer thread */
+        size_t m_max_queue_bytes = MAX_LOG_QUEUE_BYTES;
+
+        ~Logger();
 
         /** Send a string to the log output */
         int LogPrintStr(const std::string &str);
@@ -111,7 +141,23 @@ namespace BCLog {
         void DisableCategory(LogFlags flag);
         bool DisableCategory(const std::string& str);
 
-        bool WillLogCategory(LogFlags category) const;
+        bool WillLogCategory(LogFlags category) const
+        {
+            return (m_categories.load(std::memory_order_relaxed) & category) != 0;
+        }
+
+        /**
+         * Hand the output over to a writer thread, which writes the queued
+         * messages in batches. When more than MAX_LOG_QUEUE_BYTES are waiting,
+         * new messages are dropped and counted instead of blocking the caller.
+         */
+        void StartWriterThread();
+        /** Write all the queued messages, then go back to writing on the logging thread */
+        void StopWriterThread();
+        /** Block until every message logged before the call has been written */
+        void Flush();
+        /** Number of messages dropped because the writer thread could not keep up */
+        uint64_t GetDroppedMessages() const { return m_dropped.load(); }
 
         bool DefaultShrinkDebugFile() const;
     };
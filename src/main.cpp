@@ -14,10 +14,14 @@
 
 #include "addrman.h"
 #include "amount.h"
+#include "blockencodings.h"
+#include "blockfilterindex.h"
 #include "blocksignature.h"
+#include "blockstats.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinsprefetcher.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/tx_verify.h"
@@ -29,9 +33,11 @@
 #include "masternodeman.h"
 #include "merkleblock.h"
 #include "messagesigner.h"
+#include "metrics.h"
 #include "net.h"
 #include "netmessagemaker.h"
 #include "netbase.h"
+#include "policy/fees.h"
 #include "policy/policy.h"
 #include "pow.h"
 #include "spork.h"
@@ -50,6 +56,7 @@
 #include <boost/thread.hpp>
 #include <boost/foreach.hpp>
 #include <atomic>
+#include <functional>
 #include <queue>
 
 
@@ -87,6 +94,8 @@ uint256 g_best_block;
 int nScriptCheckThreads = 0;
 std::atomic<bool> fImporting{false};
 std::atomic<bool> fReindex{false};
+std::atomic<bool> fReindexChainState{false};
+int nSnapshotHeight = 0;
 bool fTxIndex = true;
 bool fCheckBlockIndex = false;
 bool fVerifyingBlocks = false;
@@ -104,14 +113,16 @@ CFeeRate minRelayTxFee = CFeeRate(10000);
 CTxMemPool mempool(::minRelayTxFee);
 
 struct COrphanTx {
-    CTransaction tx;
+    CTransactionRef tx;
     NodeId fromPeer;
 };
-std::map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);
-std::map<uint256, std::set<uint256> > mapOrphanTransactionsByPrev GUARDED_BY(cs_main);
+/** Guards the orphan transactions, so that peers can be finalized without cs_main. */
+RecursiveMutex g_cs_orphans;
+std::map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(g_cs_orphans);
+std::map<uint256, std::set<uint256> > mapOrphanTransactionsByPrev GUARDED_BY(g_cs_orphans);
 std::map<uint256, int64_t> mapRejectedBlocks;
 
-void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(g_cs_orphans);
 
 static void CheckBlockIndex();
 
@@ -153,8 +164,17 @@ CBlockIndex* pindexBestInvalid;
      * as good as our current tip or better. Entries may be failed, though.
      */
 std::set<CBlockIndex*, CBlockIndexWorkComparator> setBlockIndexCandidates;
+
+/**
+ * Guards what we know about the block sync of our peers: mapNodeState and the
+ * blocks in flight. Taken after cs_main when both are needed, and never held
+ * while waiting for cs_main, so the handling of messages that don't touch the
+ * chain doesn't wait for a block to be connected.
+ */
+RecursiveMutex cs_nodestate;
+
 /** Number of nodes with fSyncStarted. */
-int nSyncStarted = 0;
+int nSyncStarted GUARDED_BY(cs_nodestate) = 0;
 /** All pairs A->B, where A (or one if its ancestors) misses transactions, but B has transactions. */
 std::multimap<CBlockIndex*, CBlockIndex*> mapBlocksUnlinked;
 
@@ -199,21 +219,37 @@ std::map<uint256, NodeId> mapBlockSource;
 boost::scoped_ptr<CRollingBloomFilter> recentRejects;
 uint256 hashRecentRejectsChainTip;
 
-/** Blocks that are in flight, and that are in the queue to be downloaded. Protected by cs_main. */
+/** Blocks that are in flight, and that are in the queue to be downloaded. Protected by cs_nodestate. */
 struct QueuedBlock {
     uint256 hash;
     CBlockIndex* pindex;        //! Optional.
     int64_t nTime;              //! Time of "getdata" request in microseconds.
     int nValidatedQueuedBefore; //! Number of blocks queued with validated headers (globally) at the time this one is requested.
     bool fValidatedHeaders;     //! Whether this block has validated headers at the time of request.
+    std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //! Optional, used for cmpctblock downloads.
 };
-std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight;
+std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight GUARDED_BY(cs_nodestate);
+
+/** Peers asked to announce new blocks with cmpctblock messages, oldest first. Protected by cs_nodestate. */
+std::list<NodeId> lNodesAnnouncingHeaderAndIDs GUARDED_BY(cs_nodestate);
+
+/**
+ * Orphan and rejected transactions, which a block may still include, kept to
+ * rebuild compact blocks without a round trip. Ring buffer, protected by g_cs_orphans.
+ */
+std::vector<std::pair<uint256, CTransactionRef> > vExtraTxnForCompact GUARDED_BY(g_cs_orphans);
+size_t vExtraTxnForCompactIt GUARDED_BY(g_cs_orphans) = 0;
+
+/** The most recently connected block, and its compact encoding, to answer requests without a disk read. */
+Mutex cs_most_recent_block;
+std::shared_ptr<const CBlock> most_recent_block;
+std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_block;
 
 /** Number of blocks in flight with validated headers. */
-int nQueuedValidatedHeaders = 0;
+int nQueuedValidatedHeaders GUARDED_BY(cs_nodestate) = 0;
 
 /** Number of preferable block download peers. */
-int nPreferredDownload = 0;
+int nPreferredDownload GUARDED_BY(cs_nodestate) = 0;
 
 /** Dirty block index entries. */
 std::set<CBlockIndex*> setDirtyBlockIndex;
@@ -313,8 +349,8 @@ private:
 
 
  /**
- * Maintain validation-specific state about nodes, protected by cs_main, instead
- * by CNode's own locks. This simplifies asynchronous operation, where
+ * Maintain validation-specific state about nodes, protected by cs_nodestate,
+ * instead by CNode's own locks. This simplifies asynchronous operation, where
  * processing of incoming data is done after the ProcessMessage call returns,
  * and we're no longer holding the node's locks.
  */
@@ -345,6 +381,10 @@ struct CNodeState {
     int nBlocksInFlight;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Whether this peer can give us blocks as cmpctblock messages.
+    bool fProvidesHeaderAndIDs;
+    //! Whether this peer wants new blocks announced with a cmpctblock message rather than an inv.
+    bool fPreferHeaderAndIDs;
 
     CNodeBlocks nodeBlocks;
 
@@ -359,22 +399,25 @@ struct CNodeState {
         nStallingSince = 0;
         nBlocksInFlight = 0;
         fPreferredDownload = false;
+        fProvidesHeaderAndIDs = false;
+        fPreferHeaderAndIDs = false;
     }
 };
 
-/** Map maintaining per-node state. Requires cs_main. */
-std::map<NodeId, CNodeState> mapNodeState;
+/** Map maintaining per-node state. Requires cs_nodestate. */
+std::map<NodeId, CNodeState> mapNodeState GUARDED_BY(cs_nodestate);
 
-// Requires cs_main.
-CNodeState* State(NodeId pnode)
+// Requires cs_nodestate.
+CNodeState* State(NodeId pnode) EXCLUSIVE_LOCKS_REQUIRED(cs_nodestate)
 {
+    AssertLockHeld(cs_nodestate);
     std::map<NodeId, CNodeState>::iterator it = mapNodeState.find(pnode);
     if (it == mapNodeState.end())
         return NULL;
     return &it->second;
 }
 
-void UpdatePreferredDownload(CNode* node, CNodeState* state)
+void UpdatePreferredDownload(CNode* node, CNodeState* state) EXCLUSIVE_LOCKS_REQUIRED(cs_nodestate)
 {
     nPreferredDownload -= state->fPreferredDownload;
 
@@ -409,7 +452,7 @@ void InitializeNode(CNode *pnode, CConnman& connman) {
     std::string addrName = pnode->GetAddrName();
     NodeId nodeid = pnode->GetId();
     {
-        LOCK(cs_main);
+        LOCK(cs_nodestate);
         mapNodeState.emplace_hint(mapNodeState.end(), std::piecewise_construct, std::forward_as_tuple(nodeid), std::forward_as_tuple(addr, std::move(addrName)));
     }
     if(!pnode->fInbound)
@@ -419,27 +462,32 @@ void InitializeNode(CNode *pnode, CConnman& connman) {
 void FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTime)
 {
     fUpdateConnectionTime = false;
-    LOCK(cs_main);
-    CNodeState* state = State(nodeid);
+    {
+        LOCK(cs_nodestate);
+        CNodeState* state = State(nodeid);
+
+        if (state->fSyncStarted)
+            nSyncStarted--;
+
+        if (state->nMisbehavior == 0 && state->fCurrentlyConnected) {
+            fUpdateConnectionTime = true;
+        }
 
-    if (state->fSyncStarted)
-        nSyncStarted--;
+        for (const QueuedBlock& entry : state->vBlocksInFlight)
+            mapBlocksInFlight.erase(entry.hash);
+        nPreferredDownload -= state->fPreferredDownload;
+        lNodesAnnouncingHeaderAndIDs.remove(nodeid);
 
-    if (state->nMisbehavior == 0 && state->fCurrentlyConnected) {
-        fUpdateConnectionTime = true;
+        mapNodeState.erase(nodeid);
     }
 
-    for (const QueuedBlock& entry : state->vBlocksInFlight)
-        mapBlocksInFlight.erase(entry.hash);
+    LOCK(g_cs_orphans);
     EraseOrphansFor(nodeid);
-    nPreferredDownload -= state->fPreferredDownload;
-
-    mapNodeState.erase(nodeid);
 }
 
-// Requires cs_main.
 void MarkBlockAsReceived(const uint256& hash)
 {
+    LOCK(cs_nodestate);
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
     if (itInFlight != mapBlocksInFlight.end()) {
         CNodeState* state = State(itInFlight->second.first);
@@ -451,25 +499,72 @@ void MarkBlockAsReceived(const uint256& hash)
     }
 }
 
-// Requires cs_main.
-void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, CBlockIndex* pindex = NULL)
+// The queued entry is returned through pit, e.g. to attach a PartiallyDownloadedBlock to
+// it, and is only valid as long as the caller holds cs_nodestate.
+void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, CBlockIndex* pindex = NULL, std::list<QueuedBlock>::iterator* pit = NULL)
 {
+    LOCK(cs_nodestate);
     CNodeState* state = State(nodeid);
     assert(state != NULL);
 
     // Make sure it's not listed somewhere already.
     MarkBlockAsReceived(hash);
 
-    QueuedBlock newentry = {hash, pindex, GetTimeMicros(), nQueuedValidatedHeaders, pindex != NULL};
+    QueuedBlock newentry = {hash, pindex, GetTimeMicros(), nQueuedValidatedHeaders, pindex != NULL, nullptr};
     nQueuedValidatedHeaders += newentry.fValidatedHeaders;
-    std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), newentry);
+    std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), std::move(newentry));
     state->nBlocksInFlight++;
     mapBlocksInFlight[hash] = std::make_pair(nodeid, it);
+    if (pit)
+        *pit = it;
+}
+
+// Ask the peer, which just gave us a new block first, to announce the next ones with
+// cmpctblock messages, dropping the peer that did it the longest ago beyond
+// MAX_CMPCTBLOCK_HB_PEERS. The fastest peers then save us the getdata round trip.
+void MaybeSetPeerAsAnnouncingHeaderAndIDs(NodeId nodeid, CConnman& connman)
+{
+    NodeId nodeidStop = -1;
+    {
+        LOCK(cs_nodestate);
+        CNodeState* nodestate = State(nodeid);
+        if (!nodestate || !nodestate->fProvidesHeaderAndIDs)
+            return;
+
+        for (std::list<NodeId>::iterator it = lNodesAnnouncingHeaderAndIDs.begin(); it != lNodesAnnouncingHeaderAndIDs.end(); it++) {
+            if (*it == nodeid) {
+                lNodesAnnouncingHeaderAndIDs.erase(it);
+                lNodesAnnouncingHeaderAndIDs.push_back(nodeid);
+                return;
+            }
+        }
+
+        if (lNodesAnnouncingHeaderAndIDs.size() >= MAX_CMPCTBLOCK_HB_PEERS) {
+            // As per BIP152, only a few peers may be in high-bandwidth mode at once
+            nodeidStop = lNodesAnnouncingHeaderAndIDs.front();
+            lNodesAnnouncingHeaderAndIDs.pop_front();
+        }
+        lNodesAnnouncingHeaderAndIDs.push_back(nodeid);
+    }
+
+    // Sent without cs_nodestate, which is taken under the lock of the node list
+    if (nodeidStop != -1) {
+        connman.ForNode(nodeidStop, [&connman](CNode* pnodeStop) {
+            connman.PushMessage(pnodeStop, CNetMsgMaker(pnodeStop->GetSendVersion()).Make(NetMsgType::SENDCMPCT, false, CMPCTBLOCKS_VERSION));
+            return true;
+        });
+    }
+    connman.ForNode(nodeid, [&connman](CNode* pfrom) {
+        connman.PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::SENDCMPCT, true, CMPCTBLOCKS_VERSION));
+        return true;
+    });
 }
 
-/** Check whether the last unknown block a peer advertised is not yet known. */
-void ProcessBlockAvailability(NodeId nodeid)
+/** Check whether the last unknown block a peer advertised is not yet known. Requires cs_main. */
+void ProcessBlockAvailability(NodeId nodeid) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
+    AssertLockHeld(cs_main);
+    LOCK(cs_nodestate);
     CNodeState* state = State(nodeid);
     assert(state != NULL);
 
@@ -483,9 +578,11 @@ void ProcessBlockAvailability(NodeId nodeid)
     }
 }
 
-/** Update tracking information about which blocks a peer is assumed to have. */
-void UpdateBlockAvailability(NodeId nodeid, const uint256& hash)
+/** Update tracking information about which blocks a peer is assumed to have. Requires cs_main. */
+void UpdateBlockAvailability(NodeId nodeid, const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
+    AssertLockHeld(cs_main);
+    LOCK(cs_nodestate);
     CNodeState* state = State(nodeid);
     assert(state != NULL);
 
@@ -523,12 +620,14 @@ CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb)
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
-void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller)
+ *  at most count entries. Requires cs_main. */
+void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     if (count == 0)
         return;
 
+    AssertLockHeld(cs_main);
+    LOCK(cs_nodestate);
     vBlocks.reserve(vBlocks.size() + count);
     CNodeState* state = State(nodeid);
     assert(state != NULL);
@@ -610,7 +709,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
 
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats)
 {
-    LOCK(cs_main);
+    LOCK(cs_nodestate);
     CNodeState* state = State(nodeid);
     if (state == NULL)
         return false;
@@ -626,6 +725,8 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats)
 
 void RegisterNodeSignals(CNodeSignals& nodeSignals)
 {
+    nodeSignals.PreverifyMessages.connect(&PreverifyTransactions);
+    nodeSignals.PreverifyMessages.connect(&PreverifySignedMessages);
     nodeSignals.ProcessMessages.connect(&ProcessMessages);
     nodeSignals.SendMessages.connect(&SendMessages);
     nodeSignals.InitializeNode.connect(&InitializeNode);
@@ -634,6 +735,8 @@ void RegisterNodeSignals(CNodeSignals& nodeSignals)
 
 void UnregisterNodeSignals(CNodeSignals& nodeSignals)
 {
+    nodeSignals.PreverifyMessages.disconnect(&PreverifyTransactions);
+    nodeSignals.PreverifyMessages.disconnect(&PreverifySignedMessages);
     nodeSignals.ProcessMessages.disconnect(&ProcessMessages);
     nodeSignals.SendMessages.disconnect(&SendMessages);
     nodeSignals.InitializeNode.disconnect(&InitializeNode);
@@ -674,8 +777,20 @@ CSporkDB* pSporkDB = NULL;
 // mapOrphanTransactions
 //
 
-bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+void AddToCompactExtraTransactions(const CTransactionRef& tx) EXCLUSIVE_LOCKS_REQUIRED(g_cs_orphans)
+{
+    int64_t max_extra_txn = GetArg("-blockreconstructionextratxn", DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN);
+    if (max_extra_txn <= 0)
+        return;
+    if (!vExtraTxnForCompact.size())
+        vExtraTxnForCompact.resize(max_extra_txn);
+    vExtraTxnForCompact[vExtraTxnForCompactIt] = std::make_pair(tx->GetHash(), tx);
+    vExtraTxnForCompactIt = (vExtraTxnForCompactIt + 1) % max_extra_txn;
+}
+
+bool AddOrphanTx(const CTransactionRef& ptx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(g_cs_orphans)
 {
+    const CTransaction& tx = *ptx;
     uint256 hash = tx.GetHash();
     if (mapOrphanTransactions.count(hash))
         return false;
@@ -693,22 +808,24 @@ bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(c
         return false;
     }
 
-    mapOrphanTransactions[hash].tx = tx;
+    mapOrphanTransactions[hash].tx = ptx;
     mapOrphanTransactions[hash].fromPeer = peer;
     for (const CTxIn& txin : tx.vin)
         mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
 
+    AddToCompactExtraTransactions(ptx);
+
     LogPrint(BCLog::MEMPOOL, "stored orphan tx %s (mapsz %u prevsz %u)\n", hash.ToString(),
         mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
     return true;
 }
 
-void static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+void static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(g_cs_orphans)
 {
     std::map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
     if (it == mapOrphanTransactions.end())
         return;
-    for (const CTxIn& txin : it->second.tx.vin) {
+    for (const CTxIn& txin : it->second.tx->vin) {
         std::map<uint256, std::set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout.hash);
         if (itPrev == mapOrphanTransactionsByPrev.end())
             continue;
@@ -719,14 +836,14 @@ void static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
     mapOrphanTransactions.erase(it);
 }
 
-void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(g_cs_orphans)
 {
     int nErased = 0;
     std::map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
     while (iter != mapOrphanTransactions.end()) {
         std::map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
         if (maybeErase->second.fromPeer == peer) {
-            EraseOrphanTx(maybeErase->second.tx.GetHash());
+            EraseOrphanTx(maybeErase->second.tx->GetHash());
             ++nErased;
         }
     }
@@ -734,7 +851,7 @@ void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 }
 
 
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRED(g_cs_orphans)
 {
     unsigned int nEvicted = 0;
     while (mapOrphanTransactions.size() > nMaxOrphans) {
@@ -824,11 +941,81 @@ std::string FormatStateMessage(const CValidationState &state)
         state.GetRejectCode());
 }
 
-bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+
+/**
+ * Script or signature check of a transaction or masternode message done ahead
+ * of its processing: its only effect is to fill the signature caches, whether
+ * the transaction or message is valid is left to its processing. A failure is
+ * only recorded in *pfFailed, shared by the checks of the same item, which
+ * skips the remaining ones: the checks of the other items still run.
+ */
+class CPreverifyCheck
+{
+private:
+    std::function<bool()> check;
+    std::atomic<bool>* pfFailed;
+
+public:
+    CPreverifyCheck() : pfFailed(nullptr) {}
+    explicit CPreverifyCheck(std::function<bool()> checkIn, std::atomic<bool>* pfFailedIn = nullptr) :
+        check(std::move(checkIn)), pfFailed(pfFailedIn) {}
+
+    bool operator()()
+    {
+        if (pfFailed && pfFailed->load(std::memory_order_relaxed))
+            return true;
+        bool fOk = false;
+        try {
+            fOk = check();
+        } catch (const std::exception&) {
+        }
+        if (!fOk && pfFailed)
+            pfFailed->store(true, std::memory_order_relaxed);
+        return true;
+    }
+
+    void swap(CPreverifyCheck& other)
+    {
+        check.swap(other.check);
+        std::swap(pfFailed, other.pfFailed);
+    }
+};
+
+/**
+ * Separate from scriptcheckqueue, so that ConnectBlock never waits for a
+ * preverification batch. Only used by the message handler thread.
+ */
+static CCheckQueue<CPreverifyCheck> preverifycheckqueue(32);
+
+/**
+ * CheckInputs for mempool acceptance. The scripts of transactions with many
+ * inputs are verified by the script-checking threads; if any of them fails,
+ * the serial check is run again to report the exact failure in state.
+ */
+static bool CheckInputsMempool(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view, unsigned int flags, PrecomputedTransactionData& precomTxData)
+{
+    if (!nScriptCheckThreads || tx.vin.size() < MIN_PARALLEL_MEMPOOL_SCRIPT_CHECKS)
+        return CheckInputs(tx, state, view, true, flags, true, precomTxData);
+
+    std::vector<CScriptCheck> vChecks;
+    if (!CheckInputs(tx, state, view, true, flags, true, precomTxData, &vChecks))
+        return false;
+    {
+        CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+        control.Add(vChecks);
+        if (control.Wait())
+            return true;
+    }
+    return CheckInputs(tx, state, view, true, flags, true, precomTxData);
+}
+
+bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const CTransactionRef &ptx, bool fLimitFree,
                               bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee, bool ignoreFees,
                               std::vector<COutPoint>& coins_to_uncache)
 {
     AssertLockHeld(cs_main);
+    const CTransaction& tx = *ptx;
     if (pfMissingInputs)
         *pfMissingInputs = false;
 
@@ -977,7 +1164,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
             }
         }
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainHeight, pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbaseOrCoinstake, nSigOps);
+        CTxMemPoolEntry entry(ptx, nFees, GetTime(), dPriority, chainHeight, pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbaseOrCoinstake, nSigOps);
         unsigned int nSize = entry.GetTxSize();
 
         // Don't accept it if it can't get into a block
@@ -1048,7 +1235,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
             flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
 
         PrecomputedTransactionData precomTxData(tx);
-        if (!CheckInputs(tx, state, view, true, flags, true, precomTxData)) {
+        if (!CheckInputsMempool(tx, state, view, flags, precomTxData)) {
             return false;
         }
 
@@ -1064,7 +1251,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
         flags = MANDATORY_SCRIPT_VERIFY_FLAGS;
         if (fCLTVIsActivated)
             flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-        if (!CheckInputs(tx, state, view, true, flags, true, precomTxData)) {
+        if (!CheckInputsMempool(tx, state, view, flags, precomTxData)) {
             return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
                     __func__, hash.ToString(), FormatStateMessage(state));
         }
@@ -1089,7 +1276,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
     return true;
 }
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee, bool fIgnoreFees)
 {
     std::vector<COutPoint> coins_to_uncache;
@@ -1097,10 +1284,20 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     if (!res) {
         for (const COutPoint& outpoint: coins_to_uncache)
             pcoinsTip->Uncache(outpoint);
+        if (!state.GetRejectReason().empty())
+            CountMempoolReject(state.GetRejectReason());
+        else if (pfMissingInputs && *pfMissingInputs)
+            CountMempoolReject("missing-inputs");
     }
     return res;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee, bool fIgnoreFees)
+{
+    return AcceptToMemoryPool(pool, state, MakeTransactionRef(tx), fLimitFree, pfMissingInputs, fOverrideMempoolLimit, fRejectAbsurdFee, fIgnoreFees);
+}
+
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool isDSTX)
 {
     AssertLockHeld(cs_main);
@@ -1200,7 +1397,7 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
                 break;
             }
         }
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainHeight, mempool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbaseOrCoinstake, nSigOps);
+        CTxMemPoolEntry entry(MakeTransactionRef(tx), nFees, GetTime(), dPriority, chainHeight, mempool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbaseOrCoinstake, nSigOps);
         unsigned int nSize = entry.GetTxSize();
 
         // Don't accept it if it can't get into a block
@@ -1348,7 +1545,8 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
     if (pindexSlow) {
         CBlock block;
         if (ReadBlockFromDisk(block, pindexSlow)) {
-            for (const CTransaction& tx : block.vtx) {
+            for (const CTransactionRef& ptx : block.vtx) {
+                const CTransaction& tx = *ptx;
                 if (tx.GetHash() == hash) {
                     txOut = tx;
                     hashBlock = pindexSlow->GetBlockHash();
@@ -1388,21 +1586,46 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos)
     return true;
 }
 
+// Time spent reading blocks from disk and deserializing them, and the bytes read
+static std::atomic<int64_t> nTimeBlockRead{0};
+static std::atomic<int64_t> nTimeBlockDeserialize{0};
+static std::atomic<uint64_t> nBlockBytesRead{0};
+
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    // Open history file to read, at the index header's size in front of the block
+    int64_t nTime1 = GetTimeMicros();
+    if (pos.nPos < sizeof(unsigned int))
+        return error("ReadBlockFromDisk : invalid block position %u in file %d", pos.nPos, pos.nFile);
+    CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - sizeof(unsigned int)), true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
         return error("ReadBlockFromDisk : OpenBlockFile failed");
 
-    // Read block
+    // Read the whole block at once, then deserialize it from memory
+    CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
+    unsigned int nSize = 0;
     try {
-        filein >> block;
+        filein >> nSize;
+        if (nSize < 80 || nSize > MAX_BLOCK_SIZE_CURRENT)
+            return error("%s : invalid block size %u at position %u in file %d", __func__, nSize, pos.nPos, pos.nFile);
+        ssBlock.resize(nSize);
+        filein.read(&ssBlock[0], nSize);
     } catch (const std::exception& e) {
-        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        return error("%s : I/O error - %s", __func__, e.what());
+    }
+    int64_t nTime2 = GetTimeMicros();
+
+    try {
+        ssBlock >> block;
+    } catch (const std::exception& e) {
+        return error("%s : Deserialize error - %s", __func__, e.what());
     }
+    int64_t nTime3 = GetTimeMicros();
+    nTimeBlockRead += nTime2 - nTime1;
+    nTimeBlockDeserialize += nTime3 - nTime2;
+    nBlockBytesRead += nSize;
 
     // Check the header
     if (block.IsProofOfWork()) {
@@ -1562,12 +1785,12 @@ void CheckForkWarningConditionsOnNewFork(CBlockIndex* pindexNewForkTip)
     CheckForkWarningConditions();
 }
 
-// Requires cs_main.
-void Misbehaving(NodeId pnode, int howmuch) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+void Misbehaving(NodeId pnode, int howmuch)
 {
     if (howmuch == 0)
         return;
 
+    LOCK(cs_nodestate);
     CNodeState* state = State(pnode);
     if (state == NULL)
         return;
@@ -1605,14 +1828,13 @@ void static InvalidBlockFound(CBlockIndex* pindex, const CValidationState& state
     int nDoS = 0;
     if (state.IsInvalid(nDoS)) {
         std::map<uint256, NodeId>::iterator it = mapBlockSource.find(pindex->GetBlockHash());
+        LOCK(cs_nodestate);
         if (it != mapBlockSource.end() && State(it->second)) {
             assert (state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
             CBlockReject reject = {(unsigned char) state.GetRejectCode(), state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), pindex->GetBlockHash()};
             State(it->second)->rejects.push_back(reject);
-            if (nDoS > 0) {
-                LOCK(cs_main);
+            if (nDoS > 0)
                 Misbehaving(it->second, nDoS);
-            }
         }
     }
     if (!state.CorruptionPossible()) {
@@ -1819,6 +2041,8 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
+} // anon namespace
+
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
     // Open history file to read
@@ -1844,22 +2068,6 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
-} // anon namespace
-
-enum DisconnectResult
-{
-    DISCONNECT_OK,      // All good.
-    DISCONNECT_UNCLEAN, // Rolled back, but UTXO set was inconsistent with block.
-    DISCONNECT_FAILED   // Something else went wrong.
-};
-
-/**
- * Restore the UTXO in a Coin at a given COutPoint
- * @param undo The Coin to be restored.
- * @param view The coins view to which to apply the changes.
- * @param out The out point that corresponds to the tx input.
- * @return A DisconnectResult as an int
- */
 int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 {
     bool fClean = true;
@@ -1879,7 +2087,10 @@ int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
             return DISCONNECT_FAILED; // adding output for transaction without known metadata
         }
     }
-    view.AddCoin(out, std::move(undo), false);
+    // The potential_overwrite parameter to AddCoin is only allowed to be false if we know for
+    // sure that the coin did not already exist in the cache. As we have queried for that above
+    // using HaveCoin, we don't need to guess.
+    view.AddCoin(out, std::move(undo), !fClean);
 
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
@@ -1917,7 +2128,7 @@ DisconnectResult DisconnectBlock(CBlock& block, CBlockIndex* pindex, CCoinsViewC
 
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
-        const CTransaction& tx = block.vtx[i];
+        const CTransaction& tx = *block.vtx[i];
 
         nValueOut += tx.GetValueOut();
         uint256 hash = tx.GetHash();
@@ -2003,24 +2214,50 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
-
 void ThreadScriptCheck()
 {
     util::ThreadRename("pivx-scriptch");
     scriptcheckqueue.Thread();
 }
 
+void ThreadPreverifyCheck()
+{
+    util::ThreadRename("pivx-preverify");
+    preverifycheckqueue.Thread();
+}
+
+void ThreadCoinsPrefetch()
+{
+    util::ThreadRename("pivx-prefetch");
+    coinsPrefetcher.Thread();
+}
+
+static int64_t nTimeCheckBlock = 0;
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
+static int64_t nTimeUndoWrite = 0;
 static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, bool fAlreadyChecked)
+bool IsBurnedCoin(const Coin& coin, int nHeight)
+{
+    const Consensus::Params& consensus = Params().GetConsensus();
+    if (consensus.mBurnAddresses.empty())
+        return false;
+
+    CTxDestination source;
+    if (!ExtractDestination(coin.out.scriptPubKey, source))
+        return false;
+    const auto it = consensus.mBurnAddresses.find(EncodeDestination(source));
+    return it != consensus.mBurnAddresses.end() && it->second < nHeight;
+}
+
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, bool fAlreadyChecked, bool fActiveChain)
 {
     AssertLockHeld(cs_main);
     // Check it again in case a previous version let a bad block in
+    int64_t nTimeCheckStart = GetTimeMicros();
     if (!fAlreadyChecked && !CheckBlock(block, state, !fJustCheck, !fJustCheck)) {
         if (state.CorruptionPossible()) {
             // We don't write down blocks to disk if they may have been
@@ -2030,6 +2267,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
         return error("%s: CheckBlock failed for %s: %s", __func__, block.GetHash().ToString(), FormatStateMessage(state));
     }
+    if (!fAlreadyChecked) {
+        int64_t nTimeChecked = GetTimeMicros();
+        nTimeCheckBlock += nTimeChecked - nTimeCheckStart;
+        ObserveBlockConnectStage(BlockConnectStage::CHECK_BLOCK, nTimeChecked - nTimeCheckStart);
+        LogPrint(BCLog::BENCH, "    - CheckBlock: %.2fms [%.2fs]\n", 0.001 * (nTimeChecked - nTimeCheckStart), nTimeCheckBlock * 0.000001);
+    }
 
     // verify that the view's current state corresponds to the previous block
     uint256 hashPrevBlock = pindex->pprev == NULL ? UINT256_ZERO : pindex->pprev->GetBlockHash();
@@ -2084,7 +2327,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     std::vector<PrecomputedTransactionData> precomTxData;
     precomTxData.reserve(block.vtx.size()); // Required so that pointers to individual precomTxData don't get invalidated
     for (unsigned int i = 0; i < block.vtx.size(); i++) {
-        const CTransaction& tx = block.vtx[i];
+        const CTransaction& tx = *block.vtx[i];
 
         nInputs += tx.vin.size();
         nSigOps += GetLegacySigOpCount(tx);
@@ -2140,6 +2383,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     int64_t nTime1 = GetTimeMicros();
     nTimeConnect += nTime1 - nTimeStart;
+    ObserveBlockConnectStage(BlockConnectStage::CONNECT_INPUTS, nTime1 - nTimeStart);
     LogPrint(BCLog::BENCH, "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime1 - nTimeStart) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime1 - nTimeStart) / (nInputs - 1), nTimeConnect * 0.000001);
 
     //PoW phase redistributed fees to miner. PoS stage destroys fees.
@@ -2163,6 +2407,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         return state.DoS(100, error("%s: CheckQueue failed", __func__), REJECT_INVALID, "block-validation-failed");
     int64_t nTime2 = GetTimeMicros();
     nTimeVerify += nTime2 - nTimeStart;
+    ObserveBlockConnectStage(BlockConnectStage::VERIFY_SCRIPTS, nTime2 - nTime1);
     LogPrint(BCLog::BENCH, "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs - 1), nTimeVerify * 0.000001);
 
     //IMPORTANT NOTE: Nothing before this point should actually store to disk (or even memory)
@@ -2175,8 +2420,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             CDiskBlockPos diskPosBlock;
             if (!FindUndoPos(state, pindex->nFile, diskPosBlock, ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION) + 40))
                 return error("ConnectBlock() : FindUndoPos failed");
+            int64_t nTimeUndoStart = GetTimeMicros();
             if (!UndoWriteToDisk(blockundo, diskPosBlock, pindex->pprev->GetBlockHash()))
                 return AbortNode(state, "Failed to write undo data");
+            int64_t nTimeUndo = GetTimeMicros() - nTimeUndoStart;
+            nTimeUndoWrite += nTimeUndo;
+            ObserveBlockConnectStage(BlockConnectStage::UNDO_WRITE, nTimeUndo);
 
             // update nUndoPos in block index
             pindex->nUndoPos = diskPosBlock.nPos;
@@ -2192,26 +2441,37 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
-    if (!sporkManager.filter.txFilterState && sporkManager.filter.txFilterTarget > pindex->nHeight)
-        sporkManager.filter.BuildTxFilter();
+    CBlockStats blockstats;
+    ComputeBlockStats(block, blockundo, pindex->nHeight, blockstats);
+    if (!pblocktree->WriteBlockStats(pindex->nHeight, blockstats))
+        return AbortNode(state, "Failed to write block stats");
 
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
+    // A historical block connected by the background validation of a UTXO set snapshot
+    if (!fActiveChain)
+        return true;
+
+    if (!sporkManager.filter.txFilterState && sporkManager.filter.txFilterTarget > pindex->nHeight)
+        sporkManager.filter.BuildTxFilter();
+
     // Update SFD money supply
     nMoneySupply += (nValueOut - nValueIn);
 
     int64_t nTime3 = GetTimeMicros();
     nTimeIndex += nTime3 - nTime2;
+    ObserveBlockConnectStage(BlockConnectStage::INDEX, nTime3 - nTime2);
     LogPrint(BCLog::BENCH, "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime3 - nTime2), nTimeIndex * 0.000001);
 
     // Watch for changes to the previous coinbase transaction.
     static uint256 hashPrevBestCoinBase;
     GetMainSignals().UpdatedTransaction(hashPrevBestCoinBase);
-    hashPrevBestCoinBase = block.vtx[0].GetHash();
+    hashPrevBestCoinBase = block.vtx[0]->GetHash();
 
     int64_t nTime4 = GetTimeMicros();
     nTimeCallbacks += nTime4 - nTime3;
+    ObserveBlockConnectStage(BlockConnectStage::CALLBACKS, nTime4 - nTime3);
     LogPrint(BCLog::BENCH, "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime4 - nTime3), nTimeCallbacks * 0.000001);
     // Fill lastPaid
     auto amount = CMasternode::GetMasternodePayment(pindex->nHeight);
@@ -2311,10 +2571,22 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // Unspent coins stay cached, so validation does not resume on a cold cache.
+            // Lookups overlapping the write may have read stale coins: drop them.
+            coinsPrefetcher.Invalidate();
+            bool fSynced = pcoinsTip->Sync();
+            coinsPrefetcher.Invalidate();
+            if (!fSynced)
                 return AbortNode(state, "Failed to write to coin database");
+            // Then release the least recently used coins, if the cache outgrew its budget.
+            size_t nRetainUsage = (nCoinCacheUsage / DB_PEAK_USAGE_FACTOR) * COINS_CACHE_RETAIN_PERCENT / 100;
+            size_t nEvicted = pcoinsTip->Trim(nRetainUsage);
+            if (nEvicted > 0)
+                LogPrint(BCLog::COINDB, "Evicted %u coins from the cache (%.1fMiB left)\n", nEvicted, pcoinsTip->DynamicMemoryUsage() * (1.0 / (1<<20)));
             nLastFlush = nNow;
         }
+        if (fDoFullFlush || fPeriodicWrite)
+            ObserveFlushStateToDisk(fDoFullFlush, GetTimeMicros() - nNow);
         if ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000) {
             // Update best block in wallet (so we can detect restored wallets).
             GetMainSignals().SetBestChain(chainActive.GetLocator());
@@ -2399,11 +2671,12 @@ bool static DisconnectTip(CValidationState& state)
         return false;
     // Resurrect mempool transactions from the disconnected block.
     std::vector<uint256> vHashUpdate;
-    for (const CTransaction& tx : block.vtx) {
+    for (const CTransactionRef& ptx : block.vtx) {
+        const CTransaction& tx = *ptx;
         // ignore validation errors in resurrected transactions
-        std::list<CTransaction> removed;
+        std::list<CTransactionRef> removed;
         CValidationState stateDummy;
-        if (tx.IsCoinBase() || tx.IsCoinStake() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, nullptr, true)) {
+        if (tx.IsCoinBase() || tx.IsCoinStake() || !AcceptToMemoryPool(mempool, stateDummy, ptx, false, nullptr, true)) {
             mempool.remove(tx, removed, true);
         } else if (mempool.exists(tx.GetHash())) {
             vHashUpdate.push_back(tx.GetHash());
@@ -2419,23 +2692,89 @@ bool static DisconnectTip(CValidationState& state)
     UpdateTip(pindexDelete->pprev);
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
-    for (const CTransaction& tx : block.vtx) {
-        GetMainSignals().SyncTransaction(tx, pindexDelete->pprev, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
+    for (const CTransactionRef& ptx : block.vtx) {
+        GetMainSignals().SyncTransaction(*ptx, pindexDelete->pprev, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
     }
     return true;
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetchTotal = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
 static int64_t nTimePostConnect = 0;
 
+/** Snapshot of the chain tip and of the bench counters of block connection */
+struct ConnectBenchSnapshot {
+    int64_t nTime;
+    int nHeight;
+    unsigned int nChainTx;
+    uint64_t nBytesRead;
+    int64_t nTimeRead;
+    int64_t nTimeDeserialize;
+    int64_t nTimeCheckBlock;
+    int64_t nTimeInputs;
+    int64_t nTimeScripts;
+    int64_t nTimeUndoWrite;
+    int64_t nTimeIndex;
+    int64_t nTimeFlush;
+};
+
+static ConnectBenchSnapshot GetConnectBenchSnapshot()
+{
+    AssertLockHeld(cs_main);
+    ConnectBenchSnapshot snapshot;
+    snapshot.nTime = GetTimeMicros();
+    snapshot.nHeight = chainActive.Height();
+    snapshot.nChainTx = chainActive.Tip() ? chainActive.Tip()->nChainTx : 0;
+    snapshot.nBytesRead = nBlockBytesRead;
+    snapshot.nTimeRead = nTimeBlockRead;
+    snapshot.nTimeDeserialize = nTimeBlockDeserialize;
+    snapshot.nTimeCheckBlock = nTimeCheckBlock;
+    // Connecting the transactions is mostly fetching their inputs, either
+    // staged by the prefetcher or from the coins database. The script checks
+    // run on the script check threads, what remains of them after that is
+    // waited for in Verify.
+    snapshot.nTimeInputs = nTimePrefetchTotal + nTimeConnect;
+    snapshot.nTimeScripts = nTimeVerify - nTimeConnect;
+    snapshot.nTimeUndoWrite = nTimeUndoWrite;
+    snapshot.nTimeIndex = nTimeIndex - nTimeUndoWrite;
+    snapshot.nTimeFlush = nTimeFlush + nTimeChainState;
+    return snapshot;
+}
+
+/** Log the throughput and the time spent per stage of block connection since start. */
+static void LogConnectBench(const ConnectBenchSnapshot& start, const std::string& strWhat)
+{
+    const ConnectBenchSnapshot now = GetConnectBenchSnapshot();
+    const double nSeconds = std::max<int64_t>(now.nTime - start.nTime, 1) * 0.000001;
+    const int nBlocks = now.nHeight - start.nHeight;
+    const unsigned int nTx = now.nChainTx - start.nChainTx;
+    const uint64_t nBytes = now.nBytesRead - start.nBytesRead;
+    LogPrintf("%s: %d blocks (height=%d), %u transactions, %.1fMB in %.2fs: %.2f blocks/s, %.2f tx/s, %.2fMB/s\n",
+        strWhat, nBlocks, now.nHeight, nTx, nBytes * 0.000001, nSeconds, nBlocks / nSeconds, nTx / nSeconds, nBytes * 0.000001 / nSeconds);
+    LogPrintf("%s: read %.2fs, deserialize %.2fs, CheckBlock %.2fs, input fetch %.2fs, script checks %.2fs, undo write %.2fs, index %.2fs, flush %.2fs\n",
+        strWhat,
+        (now.nTimeRead - start.nTimeRead) * 0.000001,
+        (now.nTimeDeserialize - start.nTimeDeserialize) * 0.000001,
+        (now.nTimeCheckBlock - start.nTimeCheckBlock) * 0.000001,
+        (now.nTimeInputs - start.nTimeInputs) * 0.000001,
+        (now.nTimeScripts - start.nTimeScripts) * 0.000001,
+        (now.nTimeUndoWrite - start.nTimeUndoWrite) * 0.000001,
+        (now.nTimeIndex - start.nTimeIndex) * 0.000001,
+        (now.nTimeFlush - start.nTimeFlush) * 0.000001);
+}
+
+//! Counters at the start of -reindex-chainstate, and the time of its last progress report
+static ConnectBenchSnapshot benchReindexChainState;
+static int64_t nLastReindexChainStateReport = 0;
+
 /**
  * Connect a new block to chainActive. pblock is either NULL or a pointer to a CBlock
  * corresponding to pindexNew, to bypass loading it again from disk.
  */
-bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, const CBlock* pblock, bool fAlreadyChecked, std::list<CTransaction> &txConflicted, std::vector<std::tuple<CTransaction,CBlockIndex*,int>> &txChanged)
+bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, const CBlock* pblock, bool fAlreadyChecked, std::list<CTransactionRef> &txConflicted, std::vector<std::tuple<CTransactionRef,CBlockIndex*,int>> &txChanged)
 {
     assert(pindexNew->pprev == chainActive.Tip());
 
@@ -2453,8 +2792,17 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, const CB
     // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros();
     nTimeReadFromDisk += nTime2 - nTime1;
+    if (pblock == &block)
+        ObserveBlockConnectStage(BlockConnectStage::LOAD_BLOCK, nTime2 - nTime1);
     int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    // Move the inputs looked up ahead of time into the tip cache.
+    size_t nPrefetched = coinsPrefetcher.Apply(*pcoinsTip, pindexNew->GetBlockHash());
+    int64_t nTimePrefetch = GetTimeMicros();
+    nTimePrefetchTotal += nTimePrefetch - nTime2;
+    ObserveBlockConnectStage(BlockConnectStage::PREFETCH_APPLY, nTimePrefetch - nTime2);
+    LogPrint(BCLog::BENCH, "  - Prefetched inputs (%u): %.2fms [%.2fs]\n", nPrefetched, (nTimePrefetch - nTime2) * 0.001, nTimePrefetchTotal * 0.000001);
+    nTime2 = nTimePrefetch;
     {
         CCoinsViewCache view(pcoinsTip);
         bool rv = ConnectBlock(*pblock, state, pindexNew, view, false, fAlreadyChecked);
@@ -2472,6 +2820,7 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, const CB
     }
     int64_t nTime4 = GetTimeMicros();
     nTimeFlush += nTime4 - nTime3;
+    ObserveBlockConnectStage(BlockConnectStage::FLUSH_VIEW, nTime4 - nTime3);
     LogPrint(BCLog::BENCH, "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
 
     // Write the chain state to disk, if necessary. Always write to disk if this is the first of a new file.
@@ -2482,6 +2831,7 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, const CB
         return false;
     int64_t nTime5 = GetTimeMicros();
     nTimeChainState += nTime5 - nTime4;
+    ObserveBlockConnectStage(BlockConnectStage::WRITE_CHAINSTATE, nTime5 - nTime4);
     LogPrint(BCLog::BENCH, "  - Writing chainstate: %.2fms [%.2fs]\n", (nTime5 - nTime4) * 0.001, nTimeChainState * 0.000001);
 
     // Remove conflicting transactions from the mempool.
@@ -2496,8 +2846,15 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, const CB
     int64_t nTime6 = GetTimeMicros();
     nTimePostConnect += nTime6 - nTime5;
     nTimeTotal += nTime6 - nTime1;
+    ObserveBlockConnectStage(BlockConnectStage::POSTPROCESS, nTime6 - nTime5);
+    ObserveBlockConnectStage(BlockConnectStage::TOTAL, nTime6 - nTime1);
     LogPrint(BCLog::BENCH, "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
     LogPrint(BCLog::BENCH, "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
+
+    if (fReindexChainState && nTime6 - nLastReindexChainStateReport > REINDEX_CHAINSTATE_REPORT_INTERVAL * 1000000) {
+        LogConnectBench(benchReindexChainState, "Reindexing chainstate");
+        nLastReindexChainStateReport = nTime6;
+    }
     return true;
 }
 
@@ -2621,7 +2978,7 @@ static void PruneBlockIndexCandidates()
  * Try to make some progress towards making pindexMostWork the active block.
  * pblock is either NULL or a pointer to a CBlock corresponding to pindexMostWork.
  */
-static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMostWork, const CBlock* pblock, bool fAlreadyChecked, std::list<CTransaction>& txConflicted, std::vector<std::tuple<CTransaction,CBlockIndex*,int>>& txChanged)
+static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMostWork, const CBlock* pblock, bool fAlreadyChecked, std::list<CTransactionRef>& txConflicted, std::vector<std::tuple<CTransactionRef,CBlockIndex*,int>>& txChanged)
 {
     AssertLockHeld(cs_main);
     if (pblock == NULL)
@@ -2656,8 +3013,29 @@ static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMo
         nHeight = nTargetHeight;
 
         // Connect new blocks.
+        std::shared_ptr<CBlock> pblockAhead;
         BOOST_REVERSE_FOREACH (CBlockIndex* pindexConnect, vpindexToConnect) {
-            if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL, fAlreadyChecked, txConflicted, txChanged)) {
+            const CBlock* pblockConnect = pindexConnect == pindexMostWork ? pblock : NULL;
+            bool fConnectChecked = fAlreadyChecked;
+            if (!pblockConnect && pblockAhead && pblockAhead->GetHash() == pindexConnect->GetBlockHash()) {
+                pblockConnect = pblockAhead.get();
+                fConnectChecked = false;
+            }
+            // Read the next block ahead of time, so that its inputs are looked up while this one connects.
+            std::shared_ptr<CBlock> pblockCurrent = std::move(pblockAhead);
+            if (pindexConnect != vpindexToConnect.front()) {
+                CBlockIndex* pindexNext = pindexMostWork->GetAncestor(pindexConnect->nHeight + 1);
+                if (pindexNext == pindexMostWork && pblock) {
+                    coinsPrefetcher.Prefetch(*pblock);
+                } else {
+                    pblockAhead = std::make_shared<CBlock>();
+                    if (ReadBlockFromDisk(*pblockAhead, pindexNext))
+                        coinsPrefetcher.Prefetch(*pblockAhead);
+                    else
+                        pblockAhead.reset();
+                }
+            }
+            if (!ConnectTip(state, pindexConnect, pblockConnect, fConnectChecked, txConflicted, txChanged)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible())
@@ -2711,7 +3089,7 @@ bool ActivateBestChain(CValidationState& state, const CBlock* pblock, bool fAlre
 
     CBlockIndex* pindexNewTip = nullptr;
     CBlockIndex* pindexMostWork = nullptr;
-    std::vector<std::tuple<CTransaction,CBlockIndex*,int>> txChanged;
+    std::vector<std::tuple<CTransactionRef,CBlockIndex*,int>> txChanged;
     if (pblock)
         txChanged.reserve(pblock->vtx.size());
     do {
@@ -2719,7 +3097,7 @@ bool ActivateBestChain(CValidationState& state, const CBlock* pblock, bool fAlre
         boost::this_thread::interruption_point();
 
         const CBlockIndex *pindexFork;
-        std::list<CTransaction> txConflicted;
+        std::list<CTransactionRef> txConflicted;
         bool fInitialDownload;
         while (true) {
             TRY_LOCK(cs_main, lockMain);
@@ -2743,12 +3121,12 @@ bool ActivateBestChain(CValidationState& state, const CBlock* pblock, bool fAlre
             fInitialDownload = IsInitialBlockDownload();
 
             // throw all transactions though the signal-interface
-            for (const CTransaction &tx : txConflicted) {
-                GetMainSignals().SyncTransaction(tx, pindexNewTip, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
+            for (const CTransactionRef& ptx : txConflicted) {
+                GetMainSignals().SyncTransaction(*ptx, pindexNewTip, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
             }
             // ... and about transactions that got confirmed:
             for(unsigned int i = 0; i < txChanged.size(); i++) {
-                GetMainSignals().SyncTransaction(std::get<0>(txChanged[i]), std::get<1>(txChanged[i]), std::get<2>(txChanged[i]));
+                GetMainSignals().SyncTransaction(*std::get<0>(txChanged[i]), std::get<1>(txChanged[i]), std::get<2>(txChanged[i]));
             }
 
             break;
@@ -2771,10 +3149,36 @@ bool ActivateBestChain(CValidationState& state, const CBlock* pblock, bool fAlre
                 // Relay inventory, but don't relay old inventory during initial block download.
                 int nBlockEstimate = Checkpoints::GetTotalBlocksEstimate();
                 {
+                    // Keep the new tip at hand for cmpctblock and getblocktxn requests
+                    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock;
+                    if (pblock && pblock->GetHash() == hashNewTip) {
+                        std::shared_ptr<const CBlock> pblockShared = std::make_shared<const CBlock>(*pblock);
+                        pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs>(*pblockShared);
+                        LOCK(cs_most_recent_block);
+                        most_recent_block = pblockShared;
+                        most_recent_compact_block = pcmpctblock;
+                    }
                     if (connman) {
-                        connman->ForEachNode([pindexNewTip, nBlockEstimate, hashNewTip](CNode* pnode) {
+                        // High-bandwidth peers get the block itself as a cmpctblock, the others an inv
+                        connman->ForEachNode([pindexNewTip, nBlockEstimate, hashNewTip, &pcmpctblock, connman](CNode* pnode) {
                             if (pindexNewTip->nHeight > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate)) {
-                                pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                                bool fPreferHeaderAndIDs = false;
+                                {
+                                    LOCK(cs_nodestate);
+                                    CNodeState* state = State(pnode->GetId());
+                                    fPreferHeaderAndIDs = state && state->fPreferHeaderAndIDs;
+                                }
+                                if (pcmpctblock && fPreferHeaderAndIDs) {
+                                    {
+                                        LOCK(pnode->cs_inventory);
+                                        if (pnode->filterInventoryKnown.contains(hashNewTip))
+                                            return;
+                                    }
+                                    pnode->AddInventoryKnown(CInv(MSG_BLOCK, hashNewTip));
+                                    connman->PushMessage(pnode, CNetMsgMaker(pnode->GetSendVersion()).Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+                                } else {
+                                    pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                                }
                             }
                         });
                     }
@@ -2803,6 +3207,50 @@ bool ActivateBestChain(CValidationState& state, const CBlock* pblock, bool fAlre
     return true;
 }
 
+bool ReindexChainState()
+{
+    {
+        LOCK(cs_main);
+        benchReindexChainState = GetConnectBenchSnapshot();
+        nLastReindexChainStateReport = benchReindexChainState.nTime;
+    }
+    LogPrintf("Reindexing chainstate from the block files...\n");
+
+    CValidationState state;
+    bool fRet = ActivateBestChain(state);
+    if (fRet)
+        fRet = FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
+
+    LOCK(cs_main);
+    fReindexChainState = false;
+    LogConnectBench(benchReindexChainState, fRet ? "Reindexing chainstate finished" : "Reindexing chainstate failed");
+    return fRet;
+}
+
+void SetSnapshotTip(CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    assert(pcoinsTip->GetBestBlock() == pindex->GetBlockHash());
+
+    // The blocks up to the snapshot weren't connected to these coins: their
+    // undo data, if any, isn't trusted and is written again by the background
+    // validation, which also raises them to BLOCK_VALID_SCRIPTS
+    for (CBlockIndex* pindexWalk = pindex; pindexWalk->pprev; pindexWalk = pindexWalk->pprev) {
+        const unsigned int nStatus = (pindexWalk->nStatus & ~(BLOCK_VALID_MASK | BLOCK_HAVE_UNDO)) | BLOCK_VALID_CHAIN;
+        if (pindexWalk->nStatus != nStatus || pindexWalk->nUndoPos != 0) {
+            pindexWalk->nStatus = nStatus;
+            pindexWalk->nUndoPos = 0;
+            setDirtyBlockIndex.insert(pindexWalk);
+        }
+    }
+
+    // The mempool was checked against the coins of the previous tip
+    mempool.clear();
+    UpdateTip(pindex);
+    PruneBlockIndexCandidates();
+    nSnapshotHeight = pindex->nHeight;
+}
+
 bool InvalidateBlock(CValidationState& state, CBlockIndex* pindex)
 {
     AssertLockHeld(cs_main);
@@ -2907,7 +3355,7 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
 
         } else {
             // compute and set new V2 stake modifier (hash of prevout and prevModifier)
-            pindexNew->SetNewStakeModifier(block.vtx[1].vin[0].prevout.hash);
+            pindexNew->SetNewStakeModifier(block.vtx[1]->vin[0].prevout.hash);
         }
     }
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
@@ -3091,22 +3539,22 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         return state.DoS(100, false, REJECT_INVALID, "bad-blk-length", false, "size limits failed");
 
     // First transaction must be coinbase, the rest must not be
-    if (block.vtx.empty() || !block.vtx[0].IsCoinBase())
+    if (block.vtx.empty() || !block.vtx[0]->IsCoinBase())
         return state.DoS(100, false, REJECT_INVALID, "bad-cb-missing", false, "first tx is not coinbase");
     for (unsigned int i = 1; i < block.vtx.size(); i++)
-        if (block.vtx[i].IsCoinBase())
+        if (block.vtx[i]->IsCoinBase())
             return state.DoS(100, false, REJECT_INVALID, "bad-cb-multiple", false, "more than one coinbase");
 
     if (IsPoS) {
         // Coinbase output should be empty if proof-of-stake block
-        if (block.vtx[0].vout.size() != 1 || !block.vtx[0].vout[0].IsEmpty())
+        if (block.vtx[0]->vout.size() != 1 || !block.vtx[0]->vout[0].IsEmpty())
             return state.DoS(100, false, REJECT_INVALID, "bad-cb-pos", false, "coinbase output not empty for proof-of-stake block");
 
         // Second transaction must be coinstake, the rest must not be
-        if (block.vtx.empty() || !block.vtx[1].IsCoinStake())
+        if (block.vtx.empty() || !block.vtx[1]->IsCoinStake())
             return state.DoS(100, false, REJECT_INVALID, "bad-cs-missing", false, "second tx is not coinstake");
         for (unsigned int i = 2; i < block.vtx.size(); i++)
-            if (block.vtx[i].IsCoinStake())
+            if (block.vtx[i]->IsCoinStake())
                 return state.DoS(100, false, REJECT_INVALID, "bad-cs-multiple", false, "more than one coinstake");
     }
 
@@ -3147,7 +3595,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         bool validAddr = false;
         bool validAmount = false;
         CKeyID keyId;
-        const CTransaction& tx = block.vtx[1];
+        const CTransaction& tx = *block.vtx[1];
         for(const auto& txout : tx.vout) {
             if (!txout.GetKeyIDFromUTXO(keyId)) continue;
             auto addr = EncodeDestination(keyId);
@@ -3162,7 +3610,8 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     }
 
     // Check transactions
-    for (const CTransaction& tx : block.vtx) {
+    for (const CTransactionRef& ptx : block.vtx) {
+        const CTransaction& tx = *ptx;
         if (!CheckTransaction(
                 tx,
                 state
@@ -3173,7 +3622,8 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     }
 
     unsigned int nSigOps = 0;
-    for (const CTransaction& tx : block.vtx) {
+    for (const CTransactionRef& ptx : block.vtx) {
+        const CTransaction& tx = *ptx;
         nSigOps += GetLegacySigOpCount(tx);
     }
     unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_LEGACY;
@@ -3308,7 +3758,8 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     const Consensus::Params& consensus = Params().GetConsensus();
 
     // Check that all transactions are finalized
-    for (const CTransaction& tx : block.vtx) {
+    for (const CTransactionRef& ptx : block.vtx) {
+        const CTransaction& tx = *ptx;
         if (!IsFinalTx(tx, nHeight, block.GetBlockTime())) {
             return state.DoS(10, false, REJECT_INVALID, "bad-txns-nonfinal", false, "non-final transaction");
         }
@@ -3316,7 +3767,8 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
 
     // ----------- burn address scanning -----------
     if (!consensus.mBurnAddresses.empty()) {
-        for (const CTransaction& tx : block.vtx) {
+        for (const CTransactionRef& ptx : block.vtx) {
+            const CTransaction& tx = *ptx;
             if (!tx.IsCoinBase()) {
                 for (unsigned int i = 0; i < tx.vin.size(); ++i) {
                     uint256 hashBlock;
@@ -3338,7 +3790,8 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     int64_t nBlockTime = block.GetBlockTime();
     // Check tx filter
     if (!IsInitialBlockDownload()) {
-        for (const CTransaction& tx : block.vtx) {
+        for (const CTransactionRef& ptx : block.vtx) {
+            const CTransaction& tx = *ptx;
             if (!CheckTxFilter(tx, nBlockTime)) {
                 return state.DoS(100, error("CheckTransaction() : filtered address detected"),
                                 REJECT_INVALID, "filtered-address");
@@ -3348,8 +3801,8 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     // // Enforce block.nVersion=2 rule that the coinbase starts with serialized block height
     // if (pindexPrev) { // pindexPrev is only null on the first block which is a version 1 block.
     //     CScript expect = CScript() << nHeight;
-    //     if (block.vtx[0].vin[0].scriptSig.size() < expect.size() ||
-    //         !std::equal(expect.begin(), expect.end(), block.vtx[0].vin[0].scriptSig.begin())) {
+    //     if (block.vtx[0]->vin[0].scriptSig.size() < expect.size() ||
+    //         !std::equal(expect.begin(), expect.end(), block.vtx[0]->vin[0].scriptSig.begin())) {
     //         return state.DoS(100, false, REJECT_INVALID, "bad-cb-height", false, "block height mismatch in coinbase");
     //     }
     // }
@@ -3517,7 +3970,7 @@ bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockIndex** ppi
         bool isBlockFromFork = pindexPrev != nullptr && chainActive.Tip() != pindexPrev;
 
         // Coin stake
-        const CTransaction &stakeTxIn = block.vtx[1];
+        const CTransaction& stakeTxIn = *block.vtx[1];
 
         // Inputs
         std::vector<CTxIn> pivInputs;
@@ -3530,7 +3983,8 @@ bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockIndex** ppi
 
         // Check for serial double spent on the same block, TODO: Move this to the proper method..
 
-        for (const CTransaction& tx : block.vtx) {
+        for (const CTransactionRef& ptx : block.vtx) {
+            const CTransaction& tx = *ptx;
             for (const CTxIn& in: tx.vin) {
                 if(tx.IsCoinStake()) continue;
                 if(hasPIVInputs) {
@@ -3567,7 +4021,8 @@ bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockIndex** ppi
                 }
 
                 // Loop through every tx of this block
-                for (const CTransaction& t : bl.vtx) {
+                for (const CTransactionRef& pt : bl.vtx) {
+                    const CTransaction& t = *pt;
                     // Loop through every input of this tx
                     for (const CTxIn& in: t.vin) {
 
@@ -3718,6 +4173,7 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, const CBlock* pblock
         if (!ret) {
             // Check spamming
             if(pindex && pfrom && GetBoolArg("-blockspamfilter", DEFAULT_BLOCK_SPAM_FILTER)) {
+                LOCK(cs_nodestate);
                 CNodeState *nodestate = State(pfrom->GetId());
                 if(nodestate != nullptr) {
                     nodestate->nodeBlocks.onBlockReceived(pindex->nHeight);
@@ -3736,6 +4192,12 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, const CBlock* pblock
             }
             return error("%s : AcceptBlock FAILED", __func__);
         }
+
+        // Start looking up the block inputs in the coins database while the chain
+        // gets to it, only for a stored block that would become the new tip
+        if (pindex && (pindex->nStatus & BLOCK_HAVE_DATA) && chainActive.Tip() &&
+                pindex->nChainWork > chainActive.Tip()->nChainWork)
+            coinsPrefetcher.Prefetch(*pblock);
     }
 
     if (!ActivateBestChain(state, pblock, checked, connman))
@@ -3747,18 +4209,6 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, const CBlock* pblock
         }
     }
 
-    if (pwalletMain) {
-        /* disable multisend
-        // If turned on MultiSend will send a transaction (or more) on the after maturity of a stake
-        if (pwalletMain->isMultiSendEnabled())
-            pwalletMain->MultiSend();
-        */
-
-        // If turned on Auto Combine will scan wallet for dust to combine
-        if (pwalletMain->fCombineDust)
-            pwalletMain->AutoCombineDust(connman);
-    }
-
     LogPrintf("%s : ACCEPTED Block %ld in %ld milliseconds with size=%d\n", __func__, newHeight, GetTimeMillis() - nStartTime,
               GetSerializeSize(*pblock, SER_DISK, CLIENT_VERSION));
 
@@ -3863,6 +4313,100 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+/** Apply the effects of a block on the utxo cache, ignoring that it may already have been applied. */
+static bool RollforwardBlock(const CBlockIndex* pindex, CCoinsViewCache& inputs)
+{
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex)) {
+        return error("%s: failed to read block %s at height %d", __func__, pindex->GetBlockHash().ToString(), pindex->nHeight);
+    }
+
+    for (const CTransactionRef& ptx : block.vtx) {
+        const CTransaction& tx = *ptx;
+        if (!tx.IsCoinBase()) {
+            for (const CTxIn& txin : tx.vin) {
+                inputs.SpendCoin(txin.prevout);
+            }
+        }
+        // Pass check = true as every addition may be an overwrite.
+        AddCoins(inputs, tx, pindex->nHeight, true);
+    }
+    return true;
+}
+
+/**
+ * Bring the coins database back to a consistent state after a chainstate flush
+ * was interrupted mid-way: undo the old branch down to the fork point and
+ * re-apply the blocks of the new branch on top of it.
+ */
+static bool ReplayBlocks(CCoinsViewCache* view)
+{
+    LOCK(cs_main);
+
+    std::vector<uint256> hashHeads = view->GetHeadBlocks();
+    if (hashHeads.empty()) return true; // We're already in a consistent state.
+    if (hashHeads.size() != 2) return error("%s: unknown inconsistent state", __func__);
+
+    uiInterface.ShowProgress(_("Replaying blocks..."), 0);
+    LogPrintf("Replaying blocks\n");
+
+    CBlockIndex* pindexOld = nullptr;  // Old tip during the interrupted flush.
+    CBlockIndex* pindexNew;            // New tip during the interrupted flush.
+    CBlockIndex* pindexFork = nullptr; // Latest block common to both the old and the new tip.
+
+    BlockMap::iterator it = mapBlockIndex.find(hashHeads[0]);
+    if (it == mapBlockIndex.end()) {
+        return error("%s: reorganization to unknown block requested", __func__);
+    }
+    pindexNew = it->second;
+
+    if (!hashHeads[1].IsNull()) { // The old tip is allowed to be 0, indicating it's the first flush.
+        it = mapBlockIndex.find(hashHeads[1]);
+        if (it == mapBlockIndex.end()) {
+            return error("%s: reorganization from unknown block requested", __func__);
+        }
+        pindexOld = it->second;
+        pindexFork = LastCommonAncestor(pindexOld, pindexNew);
+        assert(pindexFork != nullptr);
+    }
+
+    CCoinsViewCache cache(view);
+
+    // Rollback along the old branch.
+    while (pindexOld != pindexFork) {
+        if (pindexOld->nHeight > 0) { // Never disconnect the genesis block.
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindexOld)) {
+                return error("%s: failed to read block %s at height %d", __func__, pindexOld->GetBlockHash().ToString(), pindexOld->nHeight);
+            }
+            LogPrintf("Rolling back %s (%i)\n", pindexOld->GetBlockHash().ToString(), pindexOld->nHeight);
+            cache.SetBestBlock(pindexOld->GetBlockHash());
+            DisconnectResult res = DisconnectBlock(block, pindexOld, cache);
+            if (res == DISCONNECT_FAILED) {
+                return error("%s: failed to disconnect block %s at height %d", __func__, pindexOld->GetBlockHash().ToString(), pindexOld->nHeight);
+            }
+            // If DISCONNECT_UNCLEAN is returned, it means a non-existing UTXO was deleted, or an existing UTXO was
+            // overwritten. It corresponds to cases where the block-to-be-disconnect never had all its operations
+            // applied to the UTXO set. However, as both writing a UTXO and deleting a UTXO are idempotent operations,
+            // the result is still a version of the UTXO set with the effects of that block undone.
+        }
+        pindexOld = pindexOld->pprev;
+    }
+
+    // Roll forward from the forking point to the new tip.
+    int nForkHeight = pindexFork ? pindexFork->nHeight : 0;
+    for (int nHeight = nForkHeight + 1; nHeight <= pindexNew->nHeight; ++nHeight) {
+        const CBlockIndex* pindex = pindexNew->GetAncestor(nHeight);
+        LogPrintf("Rolling forward %s (%i)\n", pindex->GetBlockHash().ToString(), nHeight);
+        if (!RollforwardBlock(pindex, cache)) return false;
+    }
+
+    cache.SetBestBlock(pindexNew->GetBlockHash());
+    bool fOk = cache.Flush() && view->Flush();
+    uiInterface.ShowProgress("", 100);
+    return fOk;
+}
+
 bool static LoadBlockIndexDB(std::string& strError)
 {
     if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex))
@@ -3953,9 +4497,31 @@ bool static LoadBlockIndexDB(std::string& strError)
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("LoadBlockIndexDB(): transaction index %s\n", fTxIndex ? "enabled" : "disabled");
 
+    // Check whether the chainstate is a UTXO set snapshot, fully written or not
+    bool fLoadingSnapshot = false;
+    pblocktree->ReadFlag("txoutsetloading", fLoadingSnapshot);
+    if (fReindexChainState) {
+        // Rebuilt from the genesis block, there's no snapshot left to validate
+        pblocktree->WriteFlag("txoutsetloading", false);
+        pblocktree->WriteInt("snapshotheight", 0);
+    } else if (fLoadingSnapshot) {
+        strError = "Loading a UTXO set snapshot was interrupted. You will need to rebuild the chainstate using -reindex-chainstate.";
+        return false;
+    }
+    nSnapshotHeight = 0;
+    pblocktree->ReadInt("snapshotheight", nSnapshotHeight);
+    if (nSnapshotHeight > 0)
+        LogPrintf("LoadBlockIndexDB(): chainstate loaded from the UTXO set snapshot at height %d, not validated yet\n", nSnapshotHeight);
+
     // If this is written true before the next client init, then we know the shutdown process failed
     pblocktree->WriteFlag("shutdown", false);
 
+    // Finish any chainstate flush that was interrupted
+    if (!ReplayBlocks(pcoinsTip)) {
+        strError = "Unable to replay blocks. You will need to rebuild the database using -reindex.";
+        return false;
+    }
+
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
@@ -4007,6 +4573,9 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainHeight - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
         if (pindex->nHeight < chainHeight - nCheckDepth)
             break;
+        // The chainstate was loaded from a snapshot of the coins of this block, it has no undo data yet
+        if (pindex->nHeight <= nSnapshotHeight)
+            break;
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex))
@@ -4072,21 +4641,27 @@ void UnloadBlockIndex()
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
     mempool.clear();
-    mapOrphanTransactions.clear();
-    mapOrphanTransactionsByPrev.clear();
-    nSyncStarted = 0;
+    {
+        LOCK(g_cs_orphans);
+        mapOrphanTransactions.clear();
+        mapOrphanTransactionsByPrev.clear();
+    }
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
     nLastBlockFile = 0;
     nBlockSequenceId = 1;
     mapBlockSource.clear();
-    mapBlocksInFlight.clear();
-    nQueuedValidatedHeaders = 0;
-    nPreferredDownload = 0;
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
-    mapNodeState.clear();
     recentRejects.reset(nullptr);
+    {
+        LOCK(cs_nodestate);
+        nSyncStarted = 0;
+        mapBlocksInFlight.clear();
+        nQueuedValidatedHeaders = 0;
+        nPreferredDownload = 0;
+        mapNodeState.clear();
+    }
 
     for (BlockMap::value_type& entry : mapBlockIndex) {
         delete entry.second;
@@ -4110,8 +4685,9 @@ bool InitBlockIndex()
     // Initialize global variables that cannot be constructed at startup.
     recentRejects.reset(new CRollingBloomFilter(120000, 0.000001));
 
-    // Check whether we're already initialized
-    if (chainActive.Genesis() != NULL)
+    // Check whether we're already initialized (with -reindex-chainstate the
+    // block index is loaded while the chain is still to be connected)
+    if (chainActive.Genesis() != NULL || mapBlockIndex.count(Params().GenesisBlock().GetHash()))
         return true;
 
     // Use the provided setting for -txindex in the new database
@@ -4310,7 +4886,7 @@ void static CheckBlockIndex()
         assert(pindexFirstNotTreeValid == NULL);                                                                     // All mapBlockIndex entries must at least be TREE valid
         if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TREE) assert(pindexFirstNotTreeValid == NULL);       // TREE valid implies all parents are TREE valid
         if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_CHAIN) assert(pindexFirstNotChainValid == NULL);     // CHAIN valid implies all parents are CHAIN valid
-        if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_SCRIPTS) assert(pindexFirstNotScriptsValid == NULL); // SCRIPTS valid implies all parents are SCRIPTS valid
+        if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_SCRIPTS) assert(pindexFirstNotScriptsValid == NULL || pindexFirstNotScriptsValid->nHeight <= nSnapshotHeight); // SCRIPTS valid implies all parents are SCRIPTS valid, but for those of a UTXO set snapshot not validated yet
         if (pindexFirstInvalid == NULL) {
             // Checks for not-invalid blocks.
             assert((pindex->nStatus & BLOCK_FAILED_MASK) == 0); // The failed mask cannot be set for blocks without invalid parents.
@@ -4426,10 +5002,12 @@ std::string GetWarnings(std::string strFor)
 //
 
 
-bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+/** Whether we have the object of inv. Transactions and blocks require cs_main, the masternode and spork messages don't. */
+bool static AlreadyHave(const CInv& inv)
 {
     switch (inv.type) {
     case MSG_TX: {
+        AssertLockHeld(cs_main);
         assert(recentRejects);
         if (chainActive.Tip()->GetBlockHash() != hashRecentRejectsChainTip) {
             // If the chain tip has changed previously rejected transactions
@@ -4441,31 +5019,37 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
         }
 
 
+        {
+            LOCK(g_cs_orphans);
+            if (mapOrphanTransactions.count(inv.hash))
+                return true;
+        }
+
         return recentRejects->contains(inv.hash) ||
                mempool.exists(inv.hash) ||
-               mapOrphanTransactions.count(inv.hash) ||
                pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) || // Best effort: only try output 0 and 1
                pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
     }
 
     case MSG_BLOCK:
+        AssertLockHeld(cs_main);
         return mapBlockIndex.count(inv.hash);
     case MSG_SPORK:
-        return mapSporks.count(inv.hash);
+        return sporkManager.HaveSpork(inv.hash);
     case MSG_MASTERNODE_WINNER:
-        if (masternodePayments.mapMasternodePayeeVotes.count(inv.hash)) {
+        if (WITH_LOCK(cs_mapMasternodePayeeVotes, return masternodePayments.mapMasternodePayeeVotes.count(inv.hash))) {
             masternodeSync.AddedMasternodeWinner(inv.hash);
             return true;
         }
         return false;
     case MSG_MASTERNODE_ANNOUNCE:
-        if (mnodeman.mapSeenMasternodeBroadcast.count(inv.hash)) {
+        if (mnodeman.HaveSeenBroadcast(inv.hash)) {
             masternodeSync.AddedMasternodeList(inv.hash);
             return true;
         }
         return false;
     case MSG_MASTERNODE_PING:
-        return mnodeman.mapSeenMasternodePing.count(inv.hash);
+        return mnodeman.HaveSeenPing(inv.hash);
     }
     // Don't know what it is, just say we already got one
     return true;
@@ -4514,7 +5098,6 @@ void static ProcessGetData(CNode* pfrom, CConnman& connman, std::atomic<bool>& i
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
     std::vector<CInv> vNotFound;
     CNetMsgMaker msgMaker(pfrom->GetSendVersion());
-    LOCK(cs_main);
 
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway
@@ -4527,7 +5110,9 @@ void static ProcessGetData(CNode* pfrom, CConnman& connman, std::atomic<bool>& i
                 return;
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK) {
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
+                // Only blocks are served under cs_main, transactions and masternode messages aren't held up by validation
+                LOCK(cs_main);
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end()) {
@@ -4544,6 +5129,20 @@ void static ProcessGetData(CNode* pfrom, CConnman& connman, std::atomic<bool>& i
                         }
                     }
                 }
+                // The new tip is usually what is asked for as a cmpctblock, it is kept in memory
+                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA) && inv.type == MSG_CMPCT_BLOCK &&
+                        pfrom->nVersion >= SHORT_IDS_BLOCKS_VERSION) {
+                    std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock;
+                    {
+                        LOCK(cs_most_recent_block);
+                        if (most_recent_block && most_recent_block->GetHash() == inv.hash)
+                            pcmpctblock = most_recent_compact_block;
+                    }
+                    if (pcmpctblock) {
+                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+                        send = false;
+                    }
+                }
                 // Don't send not-validated blocks
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
                     // Send block from disk
@@ -4552,6 +5151,13 @@ void static ProcessGetData(CNode* pfrom, CConnman& connman, std::atomic<bool>& i
                         assert(!"cannot load block from disk");
                     if (inv.type == MSG_BLOCK)
                         connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
+                    else if (inv.type == MSG_CMPCT_BLOCK) {
+                        // Peers rebuild recent blocks from their mempool, older ones are sent in full
+                        if (pfrom->nVersion >= SHORT_IDS_BLOCKS_VERSION && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH)
+                            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CMPCTBLOCK, CBlockHeaderAndShortTxIDs(block)));
+                        else
+                            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
                         bool send = false;
@@ -4603,49 +5209,54 @@ void static ProcessGetData(CNode* pfrom, CConnman& connman, std::atomic<bool>& i
                 }
 
                 if (!pushed && inv.type == MSG_TX) {
-                    CTransaction tx;
-                    if (mempool.lookup(inv.hash, tx)) {
+                    CTransactionRef ptx = mempool.get(inv.hash);
+                    if (ptx) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << tx;
+                        ss << *ptx;
                         connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::TX, ss));
                         pushed = true;
                     }
                 }
                 if (!pushed && inv.type == MSG_SPORK) {
-                    if (mapSporks.count(inv.hash)) {
+                    CSporkMessage spork;
+                    if (sporkManager.GetSporkByHash(inv.hash, spork)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mapSporks[inv.hash];
+                        ss << spork;
                         connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::SPORK, ss));
                         pushed = true;
                     }
                 }
                 if (!pushed && inv.type == MSG_MASTERNODE_WINNER) {
-                    if (masternodePayments.mapMasternodePayeeVotes.count(inv.hash)) {
+                    LOCK(cs_mapMasternodePayeeVotes);
+                    const auto mi = masternodePayments.mapMasternodePayeeVotes.find(inv.hash);
+                    if (mi != masternodePayments.mapMasternodePayeeVotes.end()) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << masternodePayments.mapMasternodePayeeVotes[inv.hash];
+                        ss << mi->second;
                         connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MNWINNER, ss));
                         pushed = true;
                     }
                 }
 
                 if (!pushed && inv.type == MSG_MASTERNODE_ANNOUNCE) {
-                    if (mnodeman.mapSeenMasternodeBroadcast.count(inv.hash)) {
+                    CMasternodeBroadcast mnb;
+                    if (mnodeman.GetSeenBroadcast(inv.hash, mnb)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mnodeman.mapSeenMasternodeBroadcast[inv.hash];
+                        ss << mnb;
                         connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MNBROADCAST, ss));
                         pushed = true;
                     }
                 }
 
                 if (!pushed && inv.type == MSG_MASTERNODE_PING) {
-                    if (mnodeman.mapSeenMasternodePing.count(inv.hash)) {
+                    CMasternodePing mnp;
+                    if (mnodeman.GetSeenPing(inv.hash, mnp)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mnodeman.mapSeenMasternodePing[inv.hash];
+                        ss << mnp;
                         connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::MNPING, ss));
                         pushed = true;
                     }
@@ -4676,25 +5287,250 @@ void static ProcessGetData(CNode* pfrom, CConnman& connman, std::atomic<bool>& i
 }
 
 bool fRequestedSporksIDB = false;
-bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vRecv, int64_t nTimeReceived, CConnman& connman, std::atomic<bool>& interruptMsgProc)
+/** Process a block received from a peer, in full or rebuilt from a cmpctblock. Requires cs_main not held. */
+void static ProcessBlockFromPeer(CNode* pfrom, const CBlock& block, const std::string& strCommand, CConnman& connman)
 {
-    LogPrint(BCLog::NET, "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
-    if (mapArgs.count("-dropmessagestest") && GetRand(atoi(mapArgs["-dropmessagestest"])) == 0) {
-        LogPrintf("dropmessagestest DROPPING RECV MESSAGE\n");
-        return true;
+    CValidationState state;
+    const uint256 hashBlock = block.GetHash();
+    bool fAccepted = ProcessNewBlock(state, pfrom, &block, nullptr, &connman);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        assert(state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
+        connman.PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::REJECT, strCommand, state.GetRejectCode(),
+                                       state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), hashBlock));
+        if (nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+    } else if (fAccepted) {
+        // The peer gave us the new tip first: ask it for cmpctblock announcements
+        LOCK(cs_main);
+        if (chainActive.Tip()->GetBlockHash() == hashBlock && !IsInitialBlockDownload())
+            MaybeSetPeerAsAnnouncingHeaderAndIDs(pfrom->GetId(), connman);
     }
+    //disconnect this node if its old protocol version
+    pfrom->DisconnectOldProtocol(pfrom->nVersion, ActiveProtocol(), strCommand);
+}
 
-    if (strCommand == NetMsgType::VERSION) {
-        // Each connection can only send one version message
-        if (pfrom->nVersion != 0) {
-            connman.PushMessage(pfrom, CNetMsgMaker(INIT_PROTO_VERSION).Make(NetMsgType::REJECT, strCommand, REJECT_DUPLICATE, std::string("Duplicate version message")));
-            LOCK(cs_main);
-            Misbehaving(pfrom->GetId(), 1);
-            return false;
-        }
+/**
+ * Check the header of a cmpctblock before reconstructing it: the header checks
+ * of AcceptBlockHeader, the work required and, for a PoS block, the stake of the
+ * prefilled coinstake. Nothing is added to the block index, a block we index
+ * is skipped when it arrives in full.
+ *
+ * @param[in]   cmpctblock      The compact block received
+ * @param[in]   pindexPrev      The index of its parent block
+ * @param[out]  state           The validation state, DoS set if the header is invalid
+ * @return                      True if the header is valid
+ */
+static bool CheckCompactBlockHeader(const CBlockHeaderAndShortTxIDs& cmpctblock, CBlockIndex* const pindexPrev, CValidationState& state)
+{
+    AssertLockHeld(cs_main);
+    const uint256 hashBlock = cmpctblock.header.GetHash();
 
-        int64_t nTime;
-        CAddress addrMe;
+    // The coinbase and the coinstake are prefilled, enough to tell PoS blocks apart and check their kernel
+    const CBlock block = cmpctblock.GetPrefilledBlock();
+    const bool isPoS = block.IsProofOfStake();
+
+    if (!CheckBlockHeader(block, state, !isPoS))
+        return error("%s: CheckBlockHeader failed for block %s: %s", __func__, hashBlock.ToString(), FormatStateMessage(state));
+
+    if (pindexPrev->nStatus & BLOCK_FAILED_MASK) {
+        const int level = mapRejectedBlocks.count(block.hashPrevBlock) ? 0 : 100; // let it be reconsidered
+        return state.DoS(level, error("%s : prev block %s is invalid, unable to add block %s", __func__, block.hashPrevBlock.GetHex(), hashBlock.GetHex()),
+                         REJECT_INVALID, "bad-prevblk");
+    }
+
+    if (!ContextualCheckBlockHeader(block, state, pindexPrev))
+        return error("%s: ContextualCheckBlockHeader failed for block %s: %s", __func__, hashBlock.ToString(), FormatStateMessage(state));
+
+    if (!CheckWork(block, pindexPrev))
+        return state.DoS(100, false, REJECT_INVALID, "bad-diffbits");
+
+    if (isPoS) {
+        std::string strError;
+        if (!CheckProofOfStake(block, strError, pindexPrev))
+            return state.DoS(100, error("%s: proof of stake check failed (%s)", __func__, strError));
+    }
+
+    return true;
+}
+
+/**
+ * Validate a getcfilters, getcfheaders or getcfcheckpt request, and find the
+ * stop block. Requests for a filter type the node doesn't serve, or for a
+ * range it can't serve, get the peer disconnected (BIP 157).
+ *
+ * @param[in]   pfrom           The peer that we received the request from
+ * @param[in]   filter_type     The filter type the request is for
+ * @param[in]   start_height    The start height for the request
+ * @param[in]   stop_hash       The stop_hash for the request
+ * @param[in]   max_height_diff The maximum number of items permitted to request, as specified in BIP 157
+ * @param[out]  stop_index      The CBlockIndex for the stop_hash block, if the request can be serviced
+ * @return                      True if the request can be serviced
+ */
+static bool PrepareBlockFilterRequest(CNode* pfrom, BlockFilterType filter_type, uint32_t start_height,
+                                      const uint256& stop_hash, uint32_t max_height_diff, const CBlockIndex*& stop_index)
+{
+    const bool fSupportedFilterType = g_blockfilterindex && filter_type == g_blockfilterindex->GetFilterType();
+    if (!fSupportedFilterType || !(pfrom->GetLocalServices() & NODE_COMPACT_FILTERS)) {
+        LogPrint(BCLog::NET, "peer %d requested unsupported block filter type: %d\n",
+                 pfrom->GetId(), static_cast<uint8_t>(filter_type));
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(stop_hash);
+
+        // Check that the stop block exists and was validated
+        if (it == mapBlockIndex.end() || !it->second->IsValid(BLOCK_VALID_SCRIPTS)) {
+            LogPrint(BCLog::NET, "peer %d requested invalid block hash: %s\n",
+                     pfrom->GetId(), stop_hash.ToString());
+            pfrom->fDisconnect = true;
+            return false;
+        }
+        stop_index = it->second;
+    }
+
+    uint32_t stop_height = stop_index->nHeight;
+    if (start_height > stop_height) {
+        LogPrint(BCLog::NET, "peer %d sent invalid getcfilters/getcfheaders with "
+                 "start height %d and stop height %d\n",
+                 pfrom->GetId(), start_height, stop_height);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    if (stop_height - start_height >= max_height_diff) {
+        LogPrint(BCLog::NET, "peer %d requested too many cfilters/cfheaders: %d / %d\n",
+                 pfrom->GetId(), stop_height - start_height + 1, max_height_diff);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    return true;
+}
+
+/** Handle a getcfilters request: one cfilter message per block of the range. */
+static void ProcessGetCFilters(CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+{
+    uint8_t filter_type_ser;
+    uint32_t start_height;
+    uint256 stop_hash;
+
+    vRecv >> filter_type_ser >> start_height >> stop_hash;
+
+    const BlockFilterType filter_type = static_cast<BlockFilterType>(filter_type_ser);
+
+    const CBlockIndex* stop_index;
+    if (!PrepareBlockFilterRequest(pfrom, filter_type, start_height, stop_hash,
+                                   MAX_GETCFILTERS_SIZE, stop_index)) {
+        return;
+    }
+
+    std::vector<BlockFilter> filters;
+    if (!g_blockfilterindex->LookupFilterRange(start_height, stop_index, filters)) {
+        LogPrint(BCLog::NET, "Failed to find block filter in index: filter_type=%s, start_height=%d, stop_hash=%s\n",
+                 BlockFilterTypeName(filter_type), start_height, stop_hash.ToString());
+        return;
+    }
+
+    CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    for (const BlockFilter& filter : filters) {
+        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CFILTER, filter));
+    }
+}
+
+/** Handle a getcfheaders request: the header before the range and the filter hashes of the range. */
+static void ProcessGetCFHeaders(CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+{
+    uint8_t filter_type_ser;
+    uint32_t start_height;
+    uint256 stop_hash;
+
+    vRecv >> filter_type_ser >> start_height >> stop_hash;
+
+    const BlockFilterType filter_type = static_cast<BlockFilterType>(filter_type_ser);
+
+    const CBlockIndex* stop_index;
+    if (!PrepareBlockFilterRequest(pfrom, filter_type, start_height, stop_hash,
+                                   MAX_GETCFHEADERS_SIZE, stop_index)) {
+        return;
+    }
+
+    uint256 prev_header;
+    if (start_height > 0) {
+        const CBlockIndex* const prev_block = stop_index->GetAncestor(static_cast<int>(start_height - 1));
+        if (!g_blockfilterindex->LookupFilterHeader(prev_block, prev_header)) {
+            LogPrint(BCLog::NET, "Failed to find block filter header in index: filter_type=%s, block_hash=%s\n",
+                     BlockFilterTypeName(filter_type), prev_block->GetBlockHash().ToString());
+            return;
+        }
+    }
+
+    std::vector<uint256> filter_hashes;
+    if (!g_blockfilterindex->LookupFilterHashRange(start_height, stop_index, filter_hashes)) {
+        LogPrint(BCLog::NET, "Failed to find block filter hashes in index: filter_type=%s, start_height=%d, stop_hash=%s\n",
+                 BlockFilterTypeName(filter_type), start_height, stop_hash.ToString());
+        return;
+    }
+
+    connman.PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::CFHEADERS,
+                        filter_type_ser, stop_index->GetBlockHash(), prev_header, filter_hashes));
+}
+
+/** Handle a getcfcheckpt request: the filter headers of every CFCHECKPT_INTERVAL blocks up to the stop block. */
+static void ProcessGetCFCheckPt(CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+{
+    uint8_t filter_type_ser;
+    uint256 stop_hash;
+
+    vRecv >> filter_type_ser >> stop_hash;
+
+    const BlockFilterType filter_type = static_cast<BlockFilterType>(filter_type_ser);
+
+    const CBlockIndex* stop_index;
+    if (!PrepareBlockFilterRequest(pfrom, filter_type, /*start_height=*/0, stop_hash,
+                                   /*max_height_diff=*/std::numeric_limits<uint32_t>::max(), stop_index)) {
+        return;
+    }
+
+    std::vector<uint256> headers(stop_index->nHeight / CFCHECKPT_INTERVAL);
+
+    // Populate headers.
+    const CBlockIndex* block_index = stop_index;
+    for (int i = headers.size() - 1; i >= 0; i--) {
+        int height = (i + 1) * CFCHECKPT_INTERVAL;
+        block_index = block_index->GetAncestor(height);
+
+        if (!g_blockfilterindex->LookupFilterHeader(block_index, headers[i])) {
+            LogPrint(BCLog::NET, "Failed to find block filter header in index: filter_type=%s, block_hash=%s\n",
+                     BlockFilterTypeName(filter_type), block_index->GetBlockHash().ToString());
+            return;
+        }
+    }
+
+    connman.PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::CFCHECKPT,
+                        filter_type_ser, stop_index->GetBlockHash(), headers));
+}
+
+bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vRecv, int64_t nTimeReceived, CConnman& connman, std::atomic<bool>& interruptMsgProc)
+{
+    LogPrint(BCLog::NET, "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
+    if (mapArgs.count("-dropmessagestest") && GetRand(atoi(mapArgs["-dropmessagestest"])) == 0) {
+        LogPrintf("dropmessagestest DROPPING RECV MESSAGE\n");
+        return true;
+    }
+
+    if (strCommand == NetMsgType::VERSION) {
+        // Each connection can only send one version message
+        if (pfrom->nVersion != 0) {
+            connman.PushMessage(pfrom, CNetMsgMaker(INIT_PROTO_VERSION).Make(NetMsgType::REJECT, strCommand, REJECT_DUPLICATE, std::string("Duplicate version message")));
+            Misbehaving(pfrom->GetId(), 1);
+            return false;
+        }
+
+        int64_t nTime;
+        CAddress addrMe;
         CAddress addrFrom;
         uint64_t nNonce = 1;
         uint64_t nServiceInt;
@@ -4719,7 +5555,6 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         }
 
         if (nServices == NODE_NONE && sporkManager.IsSporkActive(SPORK_101_SERVICES_ENFORCEMENT)) {
-            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 100);
             return error("No services on version message");
         }
@@ -4780,7 +5615,6 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         );
 
         if (shortName.find(shortFromName) == std::string::npos) {
-            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 100);
             pfrom->fDisconnect = true;
             return error("Wrong user agent %s", pfrom->cleanSubVer);
@@ -4798,7 +5632,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         pfrom->nVersion = nVersion;
 
         {
-            LOCK(cs_main);
+            LOCK(cs_nodestate);
             // Potentially mark this peer as a preferred download peer.
             UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
         }
@@ -4870,7 +5704,6 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
 
     else if (pfrom->nVersion == 0) {
         // Must have a version message before anything else
-        LOCK(cs_main);
         Misbehaving(pfrom->GetId(), 1);
         return false;
     }
@@ -4883,10 +5716,55 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
 
         // Mark this node as currently connected, so we update its timestamp later.
         if (pfrom->fNetworkNode) {
-            LOCK(cs_main);
+            LOCK(cs_nodestate);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
         pfrom->fSuccessfullyConnected = true;
+
+        if (pfrom->nVersion >= SHORT_IDS_BLOCKS_VERSION) {
+            // Tell our peer we are willing to provide version 1 cmpctblocks.
+            // However, we do not request new block announcements using
+            // cmpctblock messages: that is done in MaybeSetPeerAsAnnouncingHeaderAndIDs,
+            // for the peers which give us new blocks first.
+            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDCMPCT, false, CMPCTBLOCKS_VERSION));
+        }
+    }
+
+
+    else if (strCommand == NetMsgType::FEEFILTER) {
+        CAmount newFeeFilter = 0;
+        vRecv >> newFeeFilter;
+        if (Params().GetConsensus().MoneyRange(newFeeFilter)) {
+            pfrom->minFeeFilter = newFeeFilter;
+            LogPrint(BCLog::NET, "received: feefilter of %s from peer=%d\n", CFeeRate(newFeeFilter).ToString(), pfrom->id);
+        }
+    }
+
+
+    else if (strCommand == NetMsgType::GETCFILTERS) {
+        ProcessGetCFilters(pfrom, vRecv, connman);
+    }
+
+
+    else if (strCommand == NetMsgType::GETCFHEADERS) {
+        ProcessGetCFHeaders(pfrom, vRecv, connman);
+    }
+
+
+    else if (strCommand == NetMsgType::GETCFCHECKPT) {
+        ProcessGetCFCheckPt(pfrom, vRecv, connman);
+    }
+
+
+    else if (strCommand == NetMsgType::SENDCMPCT) {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        if (nCMPCTBLOCKVersion == CMPCTBLOCKS_VERSION) {
+            LOCK(cs_nodestate);
+            State(pfrom->GetId())->fProvidesHeaderAndIDs = true;
+            State(pfrom->GetId())->fPreferHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+        }
     }
 
 
@@ -4898,7 +5776,6 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         if (pfrom->nVersion < CADDR_TIME_VERSION && connman.GetAddressCount() > 1000)
             return true;
         if (vAddr.size() > 1000) {
-            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 20);
             return error("message addr size() = %u", vAddr.size());
         }
@@ -4938,15 +5815,13 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         std::vector<CInv> vInv;
         vRecv >> vInv;
         if (vInv.size() > MAX_INV_SZ) {
-            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 20);
             return error("message inv size() = %u", vInv.size());
         }
 
-        LOCK(cs_main);
-
-        std::vector<CInv> vToFetch;
-
+        // Masternode and spork announcements are looked up without cs_main, so that
+        // they aren't held up by the connection of a block
+        std::vector<CInv> vChainInv;
         for (unsigned int nInv = 0; nInv < vInv.size(); nInv++) {
             const CInv& inv = vInv[nInv];
 
@@ -4955,6 +5830,29 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
 
             pfrom->AddInventoryKnown(inv);
 
+            if (inv.type == MSG_TX || inv.type == MSG_BLOCK) {
+                vChainInv.push_back(inv);
+                continue;
+            }
+
+            bool fAlreadyHave = AlreadyHave(inv);
+            LogPrint(BCLog::NET, "got inv: %s  %s peer=%d\n", inv.ToString(), fAlreadyHave ? "have" : "new", pfrom->id);
+
+            if (!fAlreadyHave && !fImporting && !fReindex)
+                pfrom->AskFor(inv);
+        }
+
+        if (vChainInv.empty())
+            return true;
+
+        LOCK(cs_main);
+
+        std::vector<CInv> vToFetch;
+
+        for (const CInv& inv : vChainInv) {
+            if (interruptMsgProc)
+                return true;
+
             bool fAlreadyHave = AlreadyHave(inv);
             LogPrint(BCLog::NET, "got inv: %s  %s peer=%d\n", inv.ToString(), fAlreadyHave ? "have" : "new", pfrom->id);
 
@@ -4964,7 +5862,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
 
             if (inv.type == MSG_BLOCK) {
                 UpdateBlockAvailability(pfrom->GetId(), inv.hash);
-                if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
+                if (!fAlreadyHave && !fImporting && !fReindex && !WITH_LOCK(cs_nodestate, return mapBlocksInFlight.count(inv.hash))) {
                     // Add this to the list of blocks to request
                     vToFetch.push_back(inv);
                     LogPrint(BCLog::NET, "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
@@ -4972,6 +5870,11 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             }
         }
 
+        // A single new block announced while in sync is most likely a new tip, that we can
+        // rebuild from the mempool when the peer sends it as a cmpctblock.
+        if (vToFetch.size() == 1 && WITH_LOCK(cs_nodestate, return State(pfrom->GetId())->fProvidesHeaderAndIDs) && !IsInitialBlockDownload())
+            vToFetch[0].type = MSG_CMPCT_BLOCK;
+
         if (!vToFetch.empty())
             connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, vToFetch));
     }
@@ -4981,7 +5884,6 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         std::vector<CInv> vInv;
         vRecv >> vInv;
         if (vInv.size() > MAX_INV_SZ) {
-            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 20);
             return error("message getdata size() = %u", vInv.size());
         }
@@ -5081,26 +5983,27 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     else if (strCommand == NetMsgType::TX) {
         std::vector<uint256> vWorkQueue;
         std::vector<uint256> vEraseQueue;
-        CTransaction tx;
+        CTransactionRef ptx;
 
         //masternode signed transaction
         bool ignoreFees = false;
         CTxIn vin;
         std::vector<unsigned char> vchSig;
 
-        vRecv >> tx;
+        vRecv >> ptx;
+        const CTransaction& tx = *ptx;
 
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        LOCK(cs_main);
+        LOCK2(cs_main, g_cs_orphans);
 
         bool fMissingInputs = false;
         CValidationState state;
 
         mapAlreadyAskedFor.erase(inv);
 
-        if (AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs, false, ignoreFees)) {
+        if (AcceptToMemoryPool(mempool, state, ptx, true, &fMissingInputs, false, ignoreFees)) {
             mempool.check(pcoinsTip);
             RelayTransaction(tx, connman);
             vWorkQueue.push_back(inv.hash);
@@ -5119,7 +6022,8 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
                      mi != itByPrev->second.end();
                      ++mi) {
                     const uint256& orphanHash = *mi;
-                    const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
+                    const CTransactionRef& porphanTx = mapOrphanTransactions[orphanHash].tx;
+                    const CTransaction& orphanTx = *porphanTx;
                     NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
                     bool fMissingInputs2 = false;
                     // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
@@ -5130,7 +6034,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
 
                     if (setMisbehaving.count(fromPeer))
                         continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2)) {
+                    if (AcceptToMemoryPool(mempool, stateDummy, porphanTx, true, &fMissingInputs2)) {
                         LogPrint(BCLog::MEMPOOL, "   accepted orphan tx %s\n", orphanHash.ToString());
                         RelayTransaction(orphanTx, connman);
                         vWorkQueue.push_back(orphanHash);
@@ -5157,7 +6061,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             for (uint256 hash : vEraseQueue)
                 EraseOrphanTx(hash);
         } else if (fMissingInputs) {
-            AddOrphanTx(tx, pfrom->GetId());
+            AddOrphanTx(ptx, pfrom->GetId());
 
             // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
             unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
@@ -5171,6 +6075,9 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             if (!mempool.exists(tx.GetHash())) {
                 assert(recentRejects);
                 recentRejects->insert(tx.GetHash());
+                // Other nodes may still mine it, keep it around for compact blocks
+                if (::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION) <= MAX_STANDARD_TX_SIZE)
+                    AddToCompactExtraTransactions(ptx);
             }
             if (pfrom->fWhitelisted) {
                 // Always relay transactions received from whitelisted peers, even
@@ -5206,7 +6113,6 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         // Bypass the normal CBlock deserialization, as we don't want to risk deserializing 2000 full blocks.
         unsigned int nCount = ReadCompactSize(vRecv);
         if (nCount > MAX_HEADERS_RESULTS) {
-            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 20);
             return error("headers message size = %u", nCount);
         }
@@ -5280,25 +6186,199 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         } else {
             pfrom->AddInventoryKnown(inv);
 
-            CValidationState state;
             if (!mapBlockIndex.count(block.GetHash())) {
-                ProcessNewBlock(state, pfrom, &block, nullptr, &connman);
+                ProcessBlockFromPeer(pfrom, block, strCommand, connman);
+            } else {
+                LogPrint(BCLog::NET, "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, block.GetHash().GetHex());
+            }
+        }
+    }
+
+    else if (strCommand == NetMsgType::CMPCTBLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+        const uint256 hashBlock = cmpctblock.header.GetHash();
+        LogPrint(BCLog::NET, "received cmpctblock %s peer=%d\n", hashBlock.ToString(), pfrom->id);
+
+        bool fBlockReconstructed = false;
+        CBlock block;
+        {
+            LOCK2(cs_main, g_cs_orphans);
+
+            pfrom->AddInventoryKnown(CInv(MSG_BLOCK, hashBlock));
+            BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+            if (mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA))
+                return true; // Already have it
+
+            BlockMap::iterator miPrev = mapBlockIndex.find(cmpctblock.header.hashPrevBlock);
+            if (miPrev == mapBlockIndex.end()) {
+                // Doesn't connect, ask to sync to this block as for full blocks
+                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETBLOCKS, chainActive.GetLocator(), hashBlock));
+                pfrom->vBlockRequested.push_back(hashBlock);
+                return true;
+            }
+            CBlockIndex* const pindexPrev = miPrev->second;
+
+            CValidationState state;
+            if (!CheckCompactBlockHeader(cmpctblock, pindexPrev, state)) {
                 int nDoS;
-                if (state.IsInvalid(nDoS)) {
-                    assert(state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
-                    connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::REJECT, strCommand, state.GetRejectCode(),
-                                                   state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash));
-                    if (nDoS > 0) {
-                        TRY_LOCK(cs_main, lockMain);
-                        if (lockMain) Misbehaving(pfrom->GetId(), nDoS);
-                    }
+                if (state.IsInvalid(nDoS) && nDoS > 0)
+                    Misbehaving(pfrom->GetId(), nDoS);
+                LogPrint(BCLog::NET, "Peer %d sent us a cmpctblock with an invalid header %s\n", pfrom->id, hashBlock.ToString());
+                return true;
+            }
+
+            // Only reconstruct blocks that could become our tip, the others come in full if we ever need them
+            if (pindexPrev->nChainWork + GetBlockProof(CBlockIndex(cmpctblock.header)) < chainActive.Tip()->nChainWork) {
+                LogPrint(BCLog::NET, "Ignoring cmpctblock %s with less work than our tip, peer=%d\n", hashBlock.ToString(), pfrom->id);
+                return true;
+            }
+
+            LOCK(cs_nodestate);
+            std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator blockInFlightIt = mapBlocksInFlight.find(hashBlock);
+            const bool fAlreadyInFlight = blockInFlightIt != mapBlocksInFlight.end();
+            if (fAlreadyInFlight && blockInFlightIt->second.first == pfrom->GetId() && blockInFlightIt->second.second->partialBlock)
+                return true; // Duplicate, the missing transactions were already requested
+
+            PartiallyDownloadedBlock partialBlock(&mempool);
+            ReadStatus status = partialBlock.InitData(cmpctblock, vExtraTxnForCompact);
+            if (status == READ_STATUS_INVALID) {
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us invalid compact block\n", pfrom->id);
+                return true;
+            } else if (status == READ_STATUS_FAILED) {
+                // Short id collision, fall back to the full block
+                MarkBlockAsInFlight(pfrom->GetId(), hashBlock);
+                std::vector<CInv> vInv(1, CInv(MSG_BLOCK, hashBlock));
+                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, vInv));
+                return true;
+            }
+
+            BlockTransactionsRequest req;
+            for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                if (!partialBlock.IsTxAvailable(i))
+                    req.indexes.push_back(i);
+            }
+            if (req.indexes.empty()) {
+                // Everything was in the mempool, no round trip needed
+                status = partialBlock.FillBlock(block, std::vector<CTransactionRef>());
+                if (status == READ_STATUS_OK) {
+                    fBlockReconstructed = true;
+                } else {
+                    MarkBlockAsInFlight(pfrom->GetId(), hashBlock);
+                    std::vector<CInv> vInv(1, CInv(MSG_BLOCK, hashBlock));
+                    connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, vInv));
                 }
-                //disconnect this node if its old protocol version
-                pfrom->DisconnectOldProtocol(pfrom->nVersion, ActiveProtocol(), strCommand);
+            } else if (!fAlreadyInFlight || blockInFlightIt->second.first == pfrom->GetId()) {
+                std::list<QueuedBlock>::iterator queuedBlockIt;
+                MarkBlockAsInFlight(pfrom->GetId(), hashBlock, NULL, &queuedBlockIt);
+                queuedBlockIt->partialBlock.reset(new PartiallyDownloadedBlock(std::move(partialBlock)));
+                req.blockhash = hashBlock;
+                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETBLOCKTXN, req));
+            }
+            // else the block is being downloaded from another peer already
+        }
+
+        if (fBlockReconstructed)
+            ProcessBlockFromPeer(pfrom, block, strCommand, connman);
+    }
+
+
+    else if (strCommand == NetMsgType::BLOCKTXN && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        bool fBlockReconstructed = false;
+        CBlock block;
+        {
+            LOCK(cs_nodestate);
+
+            std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator it = mapBlocksInFlight.find(resp.blockhash);
+            if (it == mapBlocksInFlight.end() || !it->second.second->partialBlock ||
+                    it->second.first != pfrom->GetId()) {
+                LogPrint(BCLog::NET, "Peer %d sent us block transactions for block we weren't expecting\n", pfrom->id);
+                return true;
+            }
+
+            PartiallyDownloadedBlock& partialBlock = *it->second.second->partialBlock;
+            ReadStatus status = partialBlock.FillBlock(block, resp.txn);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(resp.blockhash); // Reset in-flight state in case of whitelist
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us invalid compact block/non-matching block transactions\n", pfrom->id);
+                return true;
+            } else if (status == READ_STATUS_FAILED) {
+                // Might have collided, fall back to getdata now :(
+                MarkBlockAsInFlight(pfrom->GetId(), resp.blockhash);
+                std::vector<CInv> vInv(1, CInv(MSG_BLOCK, resp.blockhash));
+                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, vInv));
             } else {
-                LogPrint(BCLog::NET, "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, block.GetHash().GetHex());
+                fBlockReconstructed = true;
+            }
+        }
+
+        if (fBlockReconstructed) {
+            pfrom->AddInventoryKnown(CInv(MSG_BLOCK, resp.blockhash));
+            ProcessBlockFromPeer(pfrom, block, strCommand, connman);
+        }
+    }
+
+
+    else if (strCommand == NetMsgType::GETBLOCKTXN) {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        std::shared_ptr<const CBlock> recent_block;
+        {
+            LOCK(cs_most_recent_block);
+            if (most_recent_block && most_recent_block->GetHash() == req.blockhash)
+                recent_block = most_recent_block;
+        }
+
+        CBlock block;
+        bool fSendFullBlock = false;
+        if (!recent_block) {
+            LOCK(cs_main);
+
+            BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
+            if (it == mapBlockIndex.end() || !(it->second->nStatus & BLOCK_HAVE_DATA)) {
+                LogPrint(BCLog::NET, "Peer %d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+                return true;
+            }
+
+            if (it->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+                // If an older block is requested (should never happen in practice,
+                // but can happen in tests) send a block response instead of a
+                // blocktxn response. Sending a full block response instead of a
+                // small blocktxn response is preferable in the case where a peer
+                // might maliciously send lots of getblocktxn requests to trigger
+                // expensive disk reads, because it will require the peer to
+                // actually receive all the data read from disk over the network.
+                LogPrint(BCLog::NET, "Peer %d sent us a getblocktxn for a block > %i deep\n", pfrom->id, MAX_BLOCKTXN_DEPTH);
+                fSendFullBlock = true;
+            } else if (!ReadBlockFromDisk(block, it->second)) {
+                assert(!"cannot load block from disk");
+            }
+        }
+        if (fSendFullBlock) {
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            ProcessGetData(pfrom, connman, interruptMsgProc);
+            return true;
+        }
+        const CBlock& blockToSend = recent_block ? *recent_block : block;
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= blockToSend.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us a getblocktxn with out-of-bounds tx indices\n", pfrom->id);
+                return true;
             }
+            resp.txn[i] = blockToSend.vtx[req.indexes[i]];
         }
+        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCKTXN, resp));
     }
 
     // This asymmetric behavior for inbound and outbound connections was introduced
@@ -5321,12 +6401,17 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         std::vector<uint256> vtxid;
         mempool.queryHashes(vtxid);
         std::vector<CInv> vInv;
+        const CAmount filterrate = pfrom->minFeeFilter;
         for (uint256& hash : vtxid) {
             CInv inv(MSG_TX, hash);
-            CTransaction tx;
-            bool fInMemPool = mempool.lookup(hash, tx);
-            if (!fInMemPool) continue; // another thread removed since queryHashes, maybe...
-            if ((pfrom->pfilter && pfrom->pfilter->IsRelevantAndUpdate(tx)) ||
+            CTransactionRef ptx = mempool.get(hash);
+            if (!ptx) continue; // another thread removed since queryHashes, maybe...
+            if (filterrate) {
+                CFeeRate feeRate;
+                if (!mempool.lookupFeeRate(hash, feeRate) || feeRate.GetFeePerK() < filterrate)
+                    continue;
+            }
+            if ((pfrom->pfilter && pfrom->pfilter->IsRelevantAndUpdate(*ptx)) ||
                 (!pfrom->pfilter))
                 vInv.push_back(inv);
             if (vInv.size() == MAX_INV_SZ) {
@@ -5420,7 +6505,6 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
                  strCommand == NetMsgType::FILTERADD ||
                  strCommand == NetMsgType::FILTERCLEAR)) {
         LogPrintf("bloom message=%s\n", strCommand);
-        LOCK(cs_main);
         Misbehaving(pfrom->GetId(), 100);
     }
 
@@ -5430,7 +6514,6 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
 
         if (!filter.IsWithinSizeConstraints()) {
             // There is no excuse for sending a too-large filter
-            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 100);
         } else {
             LOCK(pfrom->cs_filter);
@@ -5460,7 +6543,6 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             }
         }
         if (bad) {
-            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 100);
         }
     }
@@ -5529,6 +6611,256 @@ int ActiveProtocol()
     return std::min(PROTOCOL_VERSION, (int)sporkManager.GetSporkValue(SPORK_14_MIN_PROTOCOL_ACCEPTED));
 }
 
+/**
+ * Coins pulled into pcoinsTip by the preverification of a transaction, by txid.
+ * They stay cached for AcceptToMemoryPool, and are uncached afterwards unless the
+ * transaction made it to the mempool.
+ */
+static std::map<uint256, std::vector<COutPoint> > mapPreverifiedCoins;
+
+bool PreverifyLoadInputs(const CTransaction& tx, CCoinsViewCache& view)
+{
+    AssertLockHeld(cs_main);
+    std::vector<COutPoint>& vCoinsToUncache = mapPreverifiedCoins[tx.GetHash()];
+    for (const CTxIn& txin : tx.vin) {
+        const bool fInCache = pcoinsTip->HaveCoinInCache(txin.prevout);
+        if (!view.HaveCoin(txin.prevout))
+            return false;
+        if (!fInCache)
+            vCoinsToUncache.push_back(txin.prevout);
+    }
+    return true;
+}
+
+void UncachePreverifiedCoins()
+{
+    AssertLockHeld(cs_main);
+    for (const auto& it : mapPreverifiedCoins) {
+        if (mempool.exists(it.first))
+            continue;
+        for (const COutPoint& outpoint : it.second)
+            pcoinsTip->Uncache(outpoint);
+    }
+    mapPreverifiedCoins.clear();
+}
+
+void PreverifyTransactions(const std::vector<CNode*>& vNodes, CConnman& connman)
+{
+    // Each node processes at most one message per round of the message handler:
+    // gather the transactions that are next in line, do the cheap checks, then
+    // verify all their scripts at once on the preverification threads, without
+    // holding cs_main. The results end up in the signature cache, which makes
+    // the serial AcceptToMemoryPool that follows (under cs_main) cheap. Whether
+    // a transaction is accepted is still decided by AcceptToMemoryPool alone.
+    if (!nScriptCheckThreads || IsInitialBlockDownload())
+        return;
+
+    // The transactions of the previous batch have been through AcceptToMemoryPool by now.
+    {
+        LOCK(cs_main);
+        UncachePreverifiedCoins();
+    }
+
+    std::vector<CTransaction> vTx;
+    vTx.reserve(MAX_PREVERIFY_TX_BATCH);
+    for (CNode* pnode : vNodes) {
+        if (vTx.size() >= MAX_PREVERIFY_TX_BATCH)
+            break;
+        if (pnode->fDisconnect || pnode->fPauseSend || !pnode->vRecvGetData.empty())
+            continue;
+        LOCK(pnode->cs_vProcessMsg);
+        if (pnode->vProcessMsg.empty())
+            continue;
+        const CNetMessage& msg = pnode->vProcessMsg.front();
+        if (msg.hdr.GetCommand() != NetMsgType::TX)
+            continue;
+        try {
+            CDataStream vRecv(msg.vRecv.begin(), msg.vRecv.end(), SER_NETWORK, pnode->GetRecvVersion());
+            CTransaction tx;
+            vRecv >> tx;
+            vTx.push_back(tx);
+        } catch (const std::exception&) {
+            // left to ProcessMessages to deal with
+        }
+    }
+    if (vTx.empty())
+        return;
+
+    int64_t nTimeStart = GetTimeMicros();
+    std::vector<PrecomputedTransactionData> vPrecomTxData;
+    vPrecomTxData.reserve(vTx.size());
+    // Each transaction gets its own result, so that an invalid one doesn't
+    // cancel the checks of the others
+    std::vector<std::atomic<bool> > vFailed(vTx.size());
+    std::vector<bool> vChecked(vTx.size(), false);
+    std::vector<CPreverifyCheck> vChecks;
+    unsigned int nTxChecked = 0;
+    {
+        LOCK2(cs_main, mempool.cs);
+        int flags = STANDARD_SCRIPT_VERIFY_FLAGS;
+        if (Params().GetConsensus().NetworkUpgradeActive(chainActive.Height(), Consensus::UPGRADE_BIP65))
+            flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+
+        CCoinsView dummy;
+        CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+        std::vector<CScriptCheck> vScriptChecks;
+        for (size_t i = 0; i < vTx.size(); i++) {
+            const CTransaction& tx = vTx[i];
+            CValidationState state;
+            if (!CheckTransaction(tx, state) || tx.IsCoinBase() || tx.IsCoinStake() || mempool.exists(tx.GetHash()))
+                continue;
+
+            CCoinsViewCache view(&viewMemPool);
+            if (!PreverifyLoadInputs(tx, view))
+                continue;
+            view.GetBestBlock();
+            view.SetBackend(dummy);
+
+            // CheckInputs does the remaining cheap checks, and only hands out the
+            // script checks if they all pass.
+            vPrecomTxData.emplace_back(tx);
+            vScriptChecks.clear();
+            if (!CheckInputs(tx, state, view, true, flags, true, vPrecomTxData.back(), &vScriptChecks))
+                continue;
+            vChecked[i] = true;
+            nTxChecked++;
+            for (CScriptCheck& check : vScriptChecks)
+                vChecks.emplace_back([check]() mutable { return check(); }, &vFailed[i]);
+        }
+    }
+
+    const size_t nChecks = vChecks.size();
+    if (!vChecks.empty()) {
+        CCheckQueueControl<CPreverifyCheck> control(&preverifycheckqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+
+    // Only the coins of the transactions that passed stay cached for AcceptToMemoryPool
+    unsigned int nTxFailed = 0;
+    {
+        LOCK(cs_main);
+        for (size_t i = 0; i < vTx.size(); i++) {
+            if (vChecked[i] && !vFailed[i])
+                continue;
+            nTxFailed += vChecked[i];
+            auto it = mapPreverifiedCoins.find(vTx[i].GetHash());
+            if (it == mapPreverifiedCoins.end() || mempool.exists(it->first))
+                continue;
+            for (const COutPoint& outpoint : it->second)
+                pcoinsTip->Uncache(outpoint);
+            mapPreverifiedCoins.erase(it);
+        }
+    }
+
+    LogPrint(BCLog::MEMPOOL, "%s: verified %u scripts of %u/%u transactions in %.2fms, %u failed\n", __func__,
+        nChecks, nTxChecked, vTx.size(), 0.001 * (GetTimeMicros() - nTimeStart), nTxFailed);
+}
+
+/** Check of a signed message against the key of its masternode, or of the spork signer */
+static CPreverifyCheck MakeSignedMessageCheck(std::atomic<bool>* pfFailed, std::shared_ptr<const CSignedMessage> msg, const CPubKey& pubKeyIn = CPubKey())
+{
+    return CPreverifyCheck([msg, pubKeyIn]() {
+        CPubKey pubKey = pubKeyIn;
+        if (!pubKey.IsValid()) {
+            std::string strError;
+            pubKey = msg->GetPublicKey(strError);
+            if (!pubKey.IsValid())
+                return false;
+        }
+        return msg->CheckSignature(pubKey);
+    }, pfFailed);
+}
+
+void PreverifySignedMessages(const std::vector<CNode*>& vNodes, CConnman& connman)
+{
+    // A masternode list sync (dseg) answer queues thousands of broadcasts and
+    // pings, each costing a public key recovery on the message handler thread.
+    // Recover them all at once on the checking threads: the messages are then
+    // processed one at a time in the order they came, as before, and their
+    // signatures are found in the message signature cache. Each queued message
+    // is looked at once, the following rounds only pick up the new ones.
+    if (!nScriptCheckThreads || fLiteMode)
+        return;
+
+    std::vector<std::pair<std::string, CDataStream>> vMsgs;
+    for (CNode* pnode : vNodes) {
+        if (vMsgs.size() >= MAX_PREVERIFY_SIGNED_MESSAGES)
+            break;
+        if (pnode->fDisconnect)
+            continue;
+        LOCK(pnode->cs_vProcessMsg);
+        for (CNetMessage& msg : pnode->vProcessMsg) {
+            if (vMsgs.size() >= MAX_PREVERIFY_SIGNED_MESSAGES)
+                break;
+            if (msg.fPreverified)
+                continue;
+            msg.fPreverified = true;
+            const std::string strCommand = msg.hdr.GetCommand();
+            if (strCommand != NetMsgType::MNBROADCAST && strCommand != NetMsgType::MNPING &&
+                strCommand != NetMsgType::MNWINNER && strCommand != NetMsgType::SPORK)
+                continue;
+            vMsgs.emplace_back(strCommand, CDataStream(msg.vRecv.begin(), msg.vRecv.end(), SER_NETWORK, pnode->GetRecvVersion()));
+        }
+    }
+    if (vMsgs.empty())
+        return;
+
+    int64_t nTimeStart = GetTimeMicros();
+    std::vector<CPreverifyCheck> vChecks;
+    vChecks.reserve(vMsgs.size() + 1);
+    // Each message gets its own result, so that a bad signature doesn't cancel
+    // the checks of the other messages. Only valid signatures get cached.
+    std::vector<std::atomic<bool> > vFailed(vMsgs.size());
+    // The pings of the masternodes announced earlier in the batch are signed
+    // with the key of the broadcast, which isn't in the masternode list yet
+    std::map<COutPoint, CPubKey> mapBatchKeys;
+    for (size_t i = 0; i < vMsgs.size(); i++) {
+        const std::string& strCommand = vMsgs[i].first;
+        CDataStream& vRecv = vMsgs[i].second;
+        std::atomic<bool>* pfFailed = &vFailed[i];
+        try {
+            if (strCommand == NetMsgType::MNBROADCAST) {
+                auto mnb = std::make_shared<CMasternodeBroadcast>();
+                vRecv >> *mnb;
+                mapBatchKeys[mnb->vin.prevout] = mnb->pubKeyMasternode;
+                vChecks.emplace_back([mnb]() { return mnb->CheckSignature(); }, pfFailed);
+                if (!mnb->lastPing.IsNull())
+                    vChecks.push_back(MakeSignedMessageCheck(pfFailed, std::shared_ptr<const CSignedMessage>(mnb, &mnb->lastPing), mnb->pubKeyMasternode));
+            } else if (strCommand == NetMsgType::MNPING) {
+                auto mnp = std::make_shared<CMasternodePing>();
+                vRecv >> *mnp;
+                auto it = mapBatchKeys.find(mnp->vin.prevout);
+                vChecks.push_back(MakeSignedMessageCheck(pfFailed, mnp, it != mapBatchKeys.end() ? it->second : CPubKey()));
+            } else if (strCommand == NetMsgType::MNWINNER) {
+                auto winner = std::make_shared<CMasternodePaymentWinner>();
+                vRecv >> *winner;
+                vChecks.push_back(MakeSignedMessageCheck(pfFailed, winner));
+            } else {
+                auto spork = std::make_shared<CSporkMessage>();
+                vRecv >> *spork;
+                vChecks.push_back(MakeSignedMessageCheck(pfFailed, spork));
+            }
+        } catch (const std::exception&) {
+            // left to ProcessMessages to deal with
+        }
+    }
+
+    const size_t nChecks = vChecks.size();
+    if (!vChecks.empty()) {
+        CCheckQueueControl<CPreverifyCheck> control(&preverifycheckqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+
+    unsigned int nFailed = 0;
+    for (const std::atomic<bool>& fFailed : vFailed)
+        nFailed += fFailed;
+
+    LogPrint(BCLog::NET, "%s: verified %u signatures of %u messages in %.2fms, %u failed\n", __func__,
+        nChecks, vMsgs.size(), 0.001 * (GetTimeMicros() - nTimeStart), nFailed);
+}
+
 bool ProcessMessages(CNode* pfrom, CConnman& connman, std::atomic<bool>& interruptMsgProc)
 {
     // Message format
@@ -5668,18 +7000,22 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
             }
         }
 
-        TRY_LOCK(cs_main, lockMain); // Acquire cs_main for IsInitialBlockDownload() and CNodeState()
-        if (!lockMain)
-            return true;
-
-        CNodeState& state = *State(pto->GetId());
+        // Block rejections and ban scores are per-peer state, which doesn't wait for
+        // a block to be connected
+        std::vector<CBlockReject> vRejects;
+        bool fShouldBan = false;
+        {
+            LOCK(cs_nodestate);
+            CNodeState* state = State(pto->GetId());
+            vRejects.swap(state->rejects);
+            fShouldBan = state->fShouldBan;
+            state->fShouldBan = false;
+        }
 
-        for (const CBlockReject& reject : state.rejects)
+        for (const CBlockReject& reject : vRejects)
             connman.PushMessage(pto, msgMaker.Make(NetMsgType::REJECT, (std::string)NetMsgType::BLOCK, reject.chRejectCode, reject.strRejectReason, reject.hashBlock));
-        state.rejects.clear();
 
-        if (state.fShouldBan) {
-            state.fShouldBan = false;
+        if (fShouldBan) {
             if (pto->fWhitelisted)
                 LogPrintf("Warning: not punishing whitelisted peer %s!\n", pto->addr.ToString());
             else {
@@ -5693,12 +7029,7 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
             }
         }
 
-        // Address refresh broadcast
         int64_t nNow = GetTimeMicros();
-        if (!IsInitialBlockDownload() && pto->nNextLocalAddrSend < nNow) {
-            AdvertiseLocal(pto);
-            pto->nNextLocalAddrSend = PoissonNextSend(nNow, AVG_LOCAL_ADDRESS_BROADCAST_INTERVAL);
-        }
 
         //
         // Message: addr
@@ -5723,29 +7054,6 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
                 connman.PushMessage(pto, msgMaker.Make(NetMsgType::ADDR, vAddr));
         }
 
-        // Start block sync
-        if (pindexBestHeader == NULL)
-            pindexBestHeader = chainActive.Tip();
-        bool fFetch = state.fPreferredDownload || (nPreferredDownload == 0 && !pto->fClient && !pto->fOneShot); // Download if this is a nice peer, or we have no nice peers and this one might do.
-        if (!state.fSyncStarted && !pto->fClient && !fImporting && !fReindex) {
-            // Only actively request headers from a single peer, unless we're close to end of initial download.
-            if ((nSyncStarted == 0 && fFetch) || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 6 * 60 * 60) { // NOTE: was "close to today" and 24h in Bitcoin
-                state.fSyncStarted = true;
-                nSyncStarted++;
-                //CBlockIndex *pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
-                //LogPrint(BCLog::NET, "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
-                //pto->PushMessage(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexStart), UINT256_ZERO);
-                connman.PushMessage(pto, msgMaker.Make(NetMsgType::GETBLOCKS, chainActive.GetLocator(chainActive.Tip()), UINT256_ZERO));
-            }
-        }
-
-        // Resend wallet transactions that haven't gotten in a block yet
-        // Except during reindex, importing and IBD, when old wallet
-        // transactions become unconfirmed and spams other nodes.
-        if (!fReindex && !fImporting && !IsInitialBlockDownload()) {
-            GetMainSignals().Broadcast(&connman);
-        }
-
         //
         // Message: inventory
         //
@@ -5757,6 +7065,7 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
                 fSendTrickle = true;
                 pto->nNextInvSend = PoissonNextSend(nNow, AVG_INVENTORY_BROADCAST_INTERVAL);
             }
+            const CAmount filterrate = pto->minFeeFilter;
             LOCK(pto->cs_vSend);
             LOCK(pto->cs_inventory);
             vInv.reserve(pto->vInventoryToSend.size());
@@ -5765,6 +7074,13 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
                 if (inv.type == MSG_TX && pto->filterInventoryKnown.contains(inv.hash))
                     continue;
 
+                // Don't announce transactions the peer's mempool would reject
+                if (inv.type == MSG_TX && filterrate) {
+                    CFeeRate feeRate;
+                    if (mempool.lookupFeeRate(inv.hash, feeRate) && feeRate.GetFeePerK() < filterrate)
+                        continue;
+                }
+
                 // trickle out tx inv to protect privacy
                 if (inv.type == MSG_TX && !fSendTrickle) {
                     // 1/4 of tx invs blast to all immediately
@@ -5794,45 +7110,111 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
         if (!vInv.empty())
             connman.PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
 
-        // Detect whether we're stalling
-        nNow = GetTimeMicros();
-        if (state.nStallingSince && state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
-            // Stalling only triggers when the block download window cannot move. During normal steady state,
-            // the download window should be much larger than the to-be-downloaded set of blocks, so disconnection
-            // should only happen during initial block download.
-            LogPrintf("Peer=%d is stalling block download, disconnecting\n", pto->id);
-            pto->fDisconnect = true;
-            return true;
+        //
+        // Message: feefilter
+        //
+        // Whitelisted peers aren't filtered: we relay what they send even if our mempool rejects it
+        if (pto->nVersion >= FEEFILTER_VERSION && GetBoolArg("-feefilter", DEFAULT_FEEFILTER) && !pto->fWhitelisted) {
+            // The rolling minimum raised by TrimToSize when the mempool is full, never below the relay fee
+            CAmount currentFilter = mempool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFeePerK();
+            int64_t timeNow = GetTimeMicros();
+            if (timeNow > pto->nextSendTimeFeeFilter) {
+                static FeeFilterRounder filterRounder(::minRelayTxFee);
+                CAmount filterToSend = filterRounder.round(currentFilter);
+                filterToSend = std::max(filterToSend, ::minRelayTxFee.GetFeePerK());
+                if (filterToSend != pto->lastSentFeeFilter) {
+                    connman.PushMessage(pto, msgMaker.Make(NetMsgType::FEEFILTER, filterToSend));
+                    pto->lastSentFeeFilter = filterToSend;
+                }
+                pto->nextSendTimeFeeFilter = PoissonNextSend(timeNow, AVG_FEEFILTER_BROADCAST_INTERVAL);
+            }
+            // If the fee filter has changed substantially and it's still more than MAX_FEEFILTER_CHANGE_DELAY
+            // until scheduled broadcast, then move the broadcast to within MAX_FEEFILTER_CHANGE_DELAY.
+            else if (timeNow + MAX_FEEFILTER_CHANGE_DELAY * 1000000 < pto->nextSendTimeFeeFilter &&
+                     (currentFilter < 3 * pto->lastSentFeeFilter / 4 || currentFilter > 4 * pto->lastSentFeeFilter / 3)) {
+                pto->nextSendTimeFeeFilter = timeNow + GetRandInt(MAX_FEEFILTER_CHANGE_DELAY) * 1000000;
+            }
         }
-        // In case there is a block that has been in flight from this peer for (2 + 0.5 * N) times the block interval
-        // (with N the number of validated blocks that were in flight at the time it was requested), disconnect due to
-        // timeout. We compensate for in-flight blocks to prevent killing off peers due to our own downstream link
-        // being saturated. We only count validated in-flight blocks so peers can't advertise nonexisting block hashes
-        // to unreasonably increase our timeout.
-        if (state.vBlocksInFlight.size() > 0 && state.vBlocksInFlight.front().nTime < nNow - 500000 * Params().GetConsensus().nTargetSpacing * (4 + state.vBlocksInFlight.front().nValidatedQueuedBefore)) {
-            LogPrintf("Timeout downloading block %s from peer=%d, disconnecting\n", state.vBlocksInFlight.front().hash.ToString(), pto->id);
-            pto->fDisconnect = true;
+
+        // The address refresh and the block download need the chain: rather than
+        // wait for cs_main, leave them to the next iteration
+        TRY_LOCK(cs_main, lockMain);
+        if (!lockMain)
             return true;
+
+        // Address refresh broadcast
+        if (!IsInitialBlockDownload() && pto->nNextLocalAddrSend < nNow) {
+            AdvertiseLocal(pto);
+            pto->nNextLocalAddrSend = PoissonNextSend(nNow, AVG_LOCAL_ADDRESS_BROADCAST_INTERVAL);
+        }
+
+        // Resend wallet transactions that haven't gotten in a block yet
+        // Except during reindex, importing and IBD, when old wallet
+        // transactions become unconfirmed and spams other nodes.
+        if (!fReindex && !fImporting && !IsInitialBlockDownload()) {
+            GetMainSignals().Broadcast(&connman);
         }
 
-        //
-        // Message: getdata (blocks)
-        //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && fFetch && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
-            std::vector<CBlockIndex*> vToDownload;
-            NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
-            for (CBlockIndex* pindex : vToDownload) {
-                vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
-                MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), pindex);
-                LogPrintf("Requesting block %s (%d) peer=%d\n", pindex->GetBlockHash().ToString(),
-                    pindex->nHeight, pto->id);
+        {
+            LOCK(cs_nodestate);
+            CNodeState& state = *State(pto->GetId());
+
+            // Start block sync
+            if (pindexBestHeader == NULL)
+                pindexBestHeader = chainActive.Tip();
+            bool fFetch = state.fPreferredDownload || (nPreferredDownload == 0 && !pto->fClient && !pto->fOneShot); // Download if this is a nice peer, or we have no nice peers and this one might do.
+            if (!state.fSyncStarted && !pto->fClient && !fImporting && !fReindex) {
+                // Only actively request headers from a single peer, unless we're close to end of initial download.
+                if ((nSyncStarted == 0 && fFetch) || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 6 * 60 * 60) { // NOTE: was "close to today" and 24h in Bitcoin
+                    state.fSyncStarted = true;
+                    nSyncStarted++;
+                    //CBlockIndex *pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
+                    //LogPrint(BCLog::NET, "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
+                    //pto->PushMessage(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexStart), UINT256_ZERO);
+                    connman.PushMessage(pto, msgMaker.Make(NetMsgType::GETBLOCKS, chainActive.GetLocator(chainActive.Tip()), UINT256_ZERO));
+                }
             }
-            if (state.nBlocksInFlight == 0 && staller != -1) {
-                if (State(staller)->nStallingSince == 0) {
-                    State(staller)->nStallingSince = nNow;
-                    LogPrint(BCLog::NET, "Stall started peer=%d\n", staller);
+
+            // Detect whether we're stalling
+            nNow = GetTimeMicros();
+            if (state.nStallingSince && state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
+                // Stalling only triggers when the block download window cannot move. During normal steady state,
+                // the download window should be much larger than the to-be-downloaded set of blocks, so disconnection
+                // should only happen during initial block download.
+                LogPrintf("Peer=%d is stalling block download, disconnecting\n", pto->id);
+                pto->fDisconnect = true;
+                return true;
+            }
+            // In case there is a block that has been in flight from this peer for (2 + 0.5 * N) times the block interval
+            // (with N the number of validated blocks that were in flight at the time it was requested), disconnect due to
+            // timeout. We compensate for in-flight blocks to prevent killing off peers due to our own downstream link
+            // being saturated. We only count validated in-flight blocks so peers can't advertise nonexisting block hashes
+            // to unreasonably increase our timeout.
+            if (state.vBlocksInFlight.size() > 0 && state.vBlocksInFlight.front().nTime < nNow - 500000 * Params().GetConsensus().nTargetSpacing * (4 + state.vBlocksInFlight.front().nValidatedQueuedBefore)) {
+                LogPrintf("Timeout downloading block %s from peer=%d, disconnecting\n", state.vBlocksInFlight.front().hash.ToString(), pto->id);
+                pto->fDisconnect = true;
+                return true;
+            }
+
+            //
+            // Message: getdata (blocks)
+            //
+            if (!pto->fClient && fFetch && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                std::vector<CBlockIndex*> vToDownload;
+                NodeId staller = -1;
+                FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
+                for (CBlockIndex* pindex : vToDownload) {
+                    vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
+                    MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), pindex);
+                    LogPrintf("Requesting block %s (%d) peer=%d\n", pindex->GetBlockHash().ToString(),
+                        pindex->nHeight, pto->id);
+                }
+                if (state.nBlocksInFlight == 0 && staller != -1) {
+                    if (State(staller)->nStallingSince == 0) {
+                        State(staller)->nStallingSince = nNow;
+                        LogPrint(BCLog::NET, "Stall started peer=%d\n", staller);
+                    }
                 }
             }
         }
@@ -84,8 +84,12 @@ static const unsigned int DEFAULT_LIMITFREERELAY = 30;
 static const unsigned int MAX_STANDARD_TX_SIZE = 150000;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -blockreconstructionextratxn, number of orphan and rejected transactions kept for compact block reconstruction */
+static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
 /** Default for -checkblocks */
 static const signed int DEFAULT_CHECKBLOCKS = 10;
+/** Seconds between the progress reports of -reindex-chainstate */
+static const int64_t REINDEX_CHAINSTATE_REPORT_INTERVAL = 60;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -96,6 +100,12 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Minimum number of inputs for the scripts of a mempool transaction to be verified by the script-checking threads */
+static const unsigned int MIN_PARALLEL_MEMPOOL_SCRIPT_CHECKS = 8;
+/** Maximum number of relayed transactions whose signatures are verified together, ahead of mempool acceptance */
+static const unsigned int MAX_PREVERIFY_TX_BATCH = 64;
+/** Maximum number of queued masternode, winner and spork messages whose signatures are verified together */
+static const unsigned int MAX_PREVERIFY_SIGNED_MESSAGES = 1000;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -121,6 +131,20 @@ static const unsigned int AVG_ADDRESS_BROADCAST_INTERVAL = 30;
 /** Average delay between trickled inventory broadcasts in seconds.
  *  Blocks, whitelisted receivers, and a random 25% of transactions bypass this. */
 static const unsigned int AVG_INVENTORY_BROADCAST_INTERVAL = 5;
+/** Version of the compact block encoding, sent in sendcmpct messages */
+static const uint64_t CMPCTBLOCKS_VERSION = 1;
+/** Average delay between feefilter broadcasts in seconds. */
+static const unsigned int AVG_FEEFILTER_BROADCAST_INTERVAL = 10 * 60;
+/** Maximum feefilter broadcast delay after significant change. */
+static const unsigned int MAX_FEEFILTER_CHANGE_DELAY = 5 * 60;
+/** Default for -feefilter, whether to send feefilter messages to peers */
+static const bool DEFAULT_FEEFILTER = true;
+/** Maximum number of peers asked to announce new blocks directly with a cmpctblock message (high-bandwidth mode) */
+static const unsigned int MAX_CMPCTBLOCK_HB_PEERS = 3;
+/** Maximum depth of a block served as a cmpctblock when requested, deeper blocks are sent in full. */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** Maximum depth of a block whose transactions are served with blocktxn, deeper blocks are sent in full. */
+static const int MAX_BLOCKTXN_DEPTH = 10;
 
 /** Enable bloom filter */
  static const bool DEFAULT_PEERBLOOMFILTERS = true;
@@ -157,6 +181,9 @@ extern uint256 g_best_block;
 
 extern std::atomic<bool> fImporting;
 extern std::atomic<bool> fReindex;
+extern std::atomic<bool> fReindexChainState;
+/** Height of the UTXO set snapshot the chainstate was loaded from while its background validation is pending, 0 if none */
+extern int nSnapshotHeight;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
 extern bool fCheckBlockIndex;
@@ -211,6 +238,27 @@ bool LoadBlockIndex(std::string& strError);
 void UnloadBlockIndex();
 /** See whether the protocol update is enforced for connected nodes */
 int ActiveProtocol();
+/**
+ * Verify, in parallel, the signatures of the transactions at the front of the
+ * receive queue of the given nodes, so that their mempool acceptance finds them
+ * in the signature cache.
+ */
+void PreverifyTransactions(const std::vector<CNode*>& vNodes, CConnman& connman);
+/**
+ * Look up the inputs of a transaction to preverify through view, which must be
+ * backed by pcoinsTip. The coins this pulls into pcoinsTip are remembered, until
+ * UncachePreverifiedCoins. Returns false if an input is missing.
+ */
+bool PreverifyLoadInputs(const CTransaction& tx, CCoinsViewCache& view);
+/** Uncache the coins pulled in by PreverifyLoadInputs for the transactions that are not in the mempool. */
+void UncachePreverifiedCoins();
+/**
+ * Verify, in parallel, the signatures of the masternode broadcasts, pings,
+ * winner votes and sporks waiting in the receive queue of the given nodes, so
+ * that their processing, still serial and in arrival order, finds them in the
+ * message signature cache.
+ */
+void PreverifySignedMessages(const std::vector<CNode*>& vNodes, CConnman& connman);
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom, CConnman& connman, std::atomic<bool>& interrupt);
 /**
@@ -224,6 +272,10 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, std::atomic<bool>& interru
 bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interrupt);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the thread checking transactions and masternode messages ahead of their processing */
+void ThreadPreverifyCheck();
+/** Run an instance of the coins prefetcher thread */
+void ThreadCoinsPrefetch();
 
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
@@ -240,18 +292,40 @@ double ConvertBitsToDouble(unsigned int nBits);
 unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader* pblock, bool fProofOfStake);
 
 bool ActivateBestChain(CValidationState& state, const CBlock* pblock = NULL, bool fAlreadyChecked = false, CConnman* connman = nullptr);
+/**
+ * Connect the best chain of the loaded block index from the block files into
+ * the chainstate wiped by -reindex-chainstate, and log the throughput and the
+ * time spent per stage.
+ */
+bool ReindexChainState();
+
+/**
+ * Make pindex, whose UTXO set snapshot was just written to pcoinsTip and
+ * flushed, the tip of the active chain. The blocks up to it are connected by
+ * the background validation of the snapshot, their undo data is dropped until
+ * then.
+ */
+void SetSnapshotTip(CBlockIndex* pindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+/**
+ * Whether a coin pays a burn address disabled below nHeight, the height of the
+ * coins view it's in. Such coins are left out of the money supply.
+ */
+bool IsBurnedCoin(const Coin& coin, int nHeight);
 
 /** Create a new block index entry for a given block hash */
 CBlockIndex* InsertBlockIndex(uint256 hash);
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats);
 /** Increase a node's misbehavior score. */
-void Misbehaving(NodeId nodeid, int howmuch) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
 
 
-/** (try to) add transaction to memory pool **/
+/** (try to) add transaction to memory pool; the mempool entry shares tx **/
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransactionRef& tx, bool fLimitFree, bool* pfMissingInputs, bool fOverrideMempoolLimit = false, bool fRejectInsaneFee = false, bool ignoreFees = false);
+/** (try to) add a copy of transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fOverrideMempoolLimit = false, bool fRejectInsaneFee = false, bool ignoreFees = false);
 
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool isDSTX = false);
@@ -289,6 +363,24 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
+/** Same as above, keeping the spent coins in txundo */
+void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo& txundo, int nHeight);
+
+enum DisconnectResult
+{
+    DISCONNECT_OK,      // All good.
+    DISCONNECT_UNCLEAN, // Rolled back, but UTXO set was inconsistent with block.
+    DISCONNECT_FAILED   // Something else went wrong.
+};
+
+/**
+ * Restore the UTXO in a Coin at a given COutPoint
+ * @param undo The Coin to be restored.
+ * @param view The coins view to which to apply the changes.
+ * @param out The out point that corresponds to the tx input.
+ * @return A DisconnectResult as an int
+ */
+int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out);
 
 bool IsTransactionInChain(const uint256& txId, int& nHeightTx, CTransaction& tx);
 bool IsTransactionInChain(const uint256& txId, int& nHeightTx);
@@ -353,22 +445,25 @@ public:
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
 
 
 /** Functions for validating blocks and updating the block tree */
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
- *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
- *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+ *  When UNCLEAN or FAILED is returned, coins is left in an indeterminate state. */
+DisconnectResult DisconnectBlock(CBlock& block, CBlockIndex* pindex, CCoinsViewCache& coins);
 
 /** Reprocess a number of blocks to try and get on the correct chain again **/
 bool DisconnectBlocks(int nBlocks);
 void ReprocessBlocks(int nBlocks);
 
-/** Apply the effects of this block (with given index) on the UTXO set represented by coins */
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck, bool fAlreadyChecked = false);
+/**
+ * Apply the effects of this block (with given index) on the UTXO set represented by coins.
+ * Unless fActiveChain, coins isn't the chainstate of the active chain: the undo data and the
+ * indexes are written, but the money supply and the masternode payments are left alone.
+ */
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck, bool fAlreadyChecked = false, bool fActiveChain = true);
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
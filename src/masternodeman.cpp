@@ -8,6 +8,8 @@
 #include "masternodeman.h"
 
 #include "addrman.h"
+#include "consensus/merkle.h"
+#include "crypto/common.h"
 #include "fs.h"
 #include "masternode-payments.h"
 #include "masternode-sync.h"
@@ -330,6 +332,16 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
         }
     }
 
+    // check who's asked for the changes to the Masternode list
+    it1 = mAskedUsForMasternodeListDiff.begin();
+    while (it1 != mAskedUsForMasternodeListDiff.end()) {
+        if ((*it1).second < GetTime()) {
+            mAskedUsForMasternodeListDiff.erase(it1++);
+        } else {
+            ++it1;
+        }
+    }
+
     // check who we asked for the Masternode list
     it1 = mWeAskedForMasternodeList.begin();
     while (it1 != mWeAskedForMasternodeList.end()) {
@@ -394,6 +406,7 @@ void CMasternodeMan::Clear()
         it = vMasternodes.erase(it);
     }
     mAskedUsForMasternodeList.clear();
+    mAskedUsForMasternodeListDiff.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
     mapSeenMasternodeBroadcast.clear();
@@ -485,11 +498,132 @@ void CMasternodeMan::DsegUpdate(CNode* pnode)
         }
     }
 
-    g_connman->PushMessage(pnode, CNetMsgMaker(pnode->GetSendVersion()).Make(NetMsgType::GETMNLIST, CTxIn()));
-    int64_t askAgain = GetTime() + MASTERNODES_DSEG_SECONDS;
+    CNetMsgMaker msgMaker(pnode->GetSendVersion());
+    int64_t askAgain;
+    if (pnode->nVersion >= MNLIST_DIGEST_VERSION) {
+        // only the entries that changed come back, so asking again soon is cheap
+        CMasternodeListDigest digest;
+        std::vector<std::vector<CMasternode*> > vBuckets;
+        GetListDigest(digest, vBuckets);
+        g_connman->PushMessage(pnode, msgMaker.Make(NetMsgType::GETMNLISTDIFF, digest));
+        askAgain = GetTime() + MASTERNODES_DSEGDIFF_SECONDS;
+    } else {
+        g_connman->PushMessage(pnode, msgMaker.Make(NetMsgType::GETMNLIST, CTxIn()));
+        askAgain = GetTime() + MASTERNODES_DSEG_SECONDS;
+    }
     mWeAskedForMasternodeList[pnode->addr] = askAgain;
 }
 
+void CMasternodeMan::GetListDigest(CMasternodeListDigest& digest, std::vector<std::vector<CMasternode*> >& vBuckets)
+{
+    AssertLockHeld(cs);
+
+    vBuckets.assign(MASTERNODES_DIGEST_BUCKETS, std::vector<CMasternode*>());
+    for (auto mn : vMasternodes) {
+        if (mn->addr.IsRFC1918() || !mn->IsEnabled()) continue;
+        const COutPoint& outpoint = mn->vin.prevout;
+        vBuckets[(ReadLE64(outpoint.hash.begin()) + outpoint.n) % MASTERNODES_DIGEST_BUCKETS].push_back(mn);
+    }
+
+    digest.vBucketHashes.clear();
+    digest.vBucketHashes.reserve(MASTERNODES_DIGEST_BUCKETS);
+    std::vector<uint256> vLeaves;
+    for (auto& vBucket : vBuckets) {
+        std::sort(vBucket.begin(), vBucket.end(), [](const CMasternode* a, const CMasternode* b) {
+            return a->vin.prevout < b->vin.prevout;
+        });
+        vLeaves.clear();
+        for (const CMasternode* mn : vBucket) {
+            CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+            ss << mn->vin.prevout << mn->sigTime << mn->pubKeyCollateralAddress;
+            vLeaves.push_back(ss.GetHash());
+        }
+        digest.vBucketHashes.push_back(ComputeMerkleRoot(vLeaves));
+    }
+    digest.hashRoot = ComputeMerkleRoot(digest.vBucketHashes);
+}
+
+CMasternodeListDigest CMasternodeMan::GetListDigest()
+{
+    LOCK(cs);
+    CMasternodeListDigest digest;
+    std::vector<std::vector<CMasternode*> > vBuckets;
+    GetListDigest(digest, vBuckets);
+    return digest;
+}
+
+bool CMasternodeMan::AddSeenBroadcast(const CMasternodeBroadcast& mnb)
+{
+    LOCK(cs);
+    return mapSeenMasternodeBroadcast.emplace(mnb.GetHash(), mnb).second;
+}
+
+bool CMasternodeMan::HaveSeenBroadcast(const uint256& hash) const
+{
+    LOCK(cs);
+    return mapSeenMasternodeBroadcast.count(hash);
+}
+
+bool CMasternodeMan::GetSeenBroadcast(const uint256& hash, CMasternodeBroadcast& mnbRet) const
+{
+    LOCK(cs);
+    const auto it = mapSeenMasternodeBroadcast.find(hash);
+    if (it == mapSeenMasternodeBroadcast.end())
+        return false;
+    mnbRet = it->second;
+    return true;
+}
+
+void CMasternodeMan::EraseSeenBroadcast(const uint256& hash)
+{
+    LOCK(cs);
+    mapSeenMasternodeBroadcast.erase(hash);
+}
+
+void CMasternodeMan::UpdateSeenBroadcastPing(const uint256& hash, const CMasternodePing& mnp)
+{
+    LOCK(cs);
+    const auto it = mapSeenMasternodeBroadcast.find(hash);
+    if (it != mapSeenMasternodeBroadcast.end())
+        it->second.lastPing = mnp;
+}
+
+bool CMasternodeMan::AddSeenPing(const CMasternodePing& mnp)
+{
+    LOCK(cs);
+    return mapSeenMasternodePing.emplace(mnp.GetHash(), mnp).second;
+}
+
+bool CMasternodeMan::HaveSeenPing(const uint256& hash) const
+{
+    LOCK(cs);
+    return mapSeenMasternodePing.count(hash);
+}
+
+bool CMasternodeMan::GetSeenPing(const uint256& hash, CMasternodePing& mnpRet) const
+{
+    LOCK(cs);
+    const auto it = mapSeenMasternodePing.find(hash);
+    if (it == mapSeenMasternodePing.end())
+        return false;
+    mnpRet = it->second;
+    return true;
+}
+
+bool CMasternodeMan::PushListEntry(CNode* pfrom, CMasternode* mn)
+{
+    if (mn->addr.IsRFC1918() || !mn->IsEnabled()) return false; // local network or inactive
+
+    LogPrint(BCLog::MASTERNODE, "dseg - Sending Masternode entry - %s \n", mn->vin.prevout.ToStringShort());
+
+    // Seen first, so the broadcast can be served as soon as the peer asks for it
+    CMasternodeBroadcast mnb = CMasternodeBroadcast(*mn);
+    AddSeenBroadcast(mnb);
+    pfrom->PushInventory(CInv(MSG_MASTERNODE_ANNOUNCE, mnb.GetHash()));
+
+    return true;
+}
+
 CMasternode* CMasternodeMan::Find(const CScript& payee)
 {
     LOCK(cs_script);
@@ -751,16 +885,14 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         CMasternodeBroadcast mnb;
         vRecv >> mnb;
 
-        if (mapSeenMasternodeBroadcast.count(mnb.GetHash())) { //seen
+        if (!AddSeenBroadcast(mnb)) { //seen
             masternodeSync.AddedMasternodeList(mnb.GetHash());
             return;
         }
-        mapSeenMasternodeBroadcast.insert(std::make_pair(mnb.GetHash(), mnb));
 
         int nDoS = 0;
         if (!mnb.CheckAndUpdate(nDoS)) {
             if (nDoS > 0) {
-                LOCK(cs_main);
                 Misbehaving(pfrom->GetId(), nDoS);
             }
             //failed
@@ -771,7 +903,6 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         //  - this is expensive, so it's only done once per Masternode
         if (!mnb.IsInputAssociatedWithPubkey()) {
             LogPrintf("CMasternodeMan::ProcessMessage() : mnb - Got mismatched pubkey and vin\n");
-            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), 33);
             return;
         }
@@ -786,7 +917,6 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
             LogPrint(BCLog::MASTERNODE,"mnb - Rejected Masternode entry %s\n", mnb.vin.prevout.ToStringShort());
 
             if (nDoS > 0) {
-                LOCK(cs_main);
                 Misbehaving(pfrom->GetId(), nDoS);
             }
         }
@@ -798,15 +928,13 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
 
         LogPrint(BCLog::MNPING, "mnp - Masternode ping, vin: %s\n", mnp.vin.prevout.ToStringShort());
 
-        if (mapSeenMasternodePing.count(mnp.GetHash())) return; //seen
-        mapSeenMasternodePing.insert(std::make_pair(mnp.GetHash(), mnp));
+        if (!AddSeenPing(mnp)) return; //seen
 
         int nDoS = 0;
         if (mnp.CheckAndUpdate(nDoS)) return;
 
         if (nDoS > 0) {
             // if anything significant failed, mark that node
-            LOCK(cs_main);
             Misbehaving(pfrom->GetId(), nDoS);
         } else {
             // if nothing significant failed, search existing Masternode list
@@ -850,37 +978,13 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
                 LOCK(cs);
 
                 for (auto mn : vMasternodes) {
-                    if (mn->addr.IsRFC1918()) continue; // local network
-
-                    if (mn->IsEnabled()) {
-                        LogPrint(BCLog::MASTERNODE, "dseg - Sending Masternode entry - %s \n", mn->vin.prevout.ToStringShort());
-                        
-                        CMasternodeBroadcast mnb = CMasternodeBroadcast(*mn);
-                        uint256 hash = mnb.GetHash();
-                        pfrom->PushInventory(CInv(MSG_MASTERNODE_ANNOUNCE, hash));
-                        nInvCount++;
-
-                        if (!mapSeenMasternodeBroadcast.count(hash)) mapSeenMasternodeBroadcast.insert(std::make_pair(hash, mnb));
-
-                        if (vin == mn->vin) {
-                            LogPrint(BCLog::MASTERNODE, "dseg - Sent 1 Masternode entry to peer %i\n", pfrom->GetId());
-                            return;
-                        }
-                    }
+                    if (PushListEntry(pfrom, mn)) nInvCount++;
                 }
             } else { // send specific one
 
                 auto mn = Find(vin);
 
-                if(mn && mn->IsEnabled() && !mn->addr.IsRFC1918()) {
-                    LogPrint(BCLog::MASTERNODE, "dseg - Sending Masternode entry - %s \n", mn->vin.prevout.ToStringShort());
-
-                    CMasternodeBroadcast mnb = CMasternodeBroadcast(*mn);
-                    uint256 hash = mnb.GetHash();
-                    pfrom->PushInventory(CInv(MSG_MASTERNODE_ANNOUNCE, hash));
-
-                    if (!mapSeenMasternodeBroadcast.count(hash)) mapSeenMasternodeBroadcast.insert(std::make_pair(hash, mnb));
-
+                if (mn && PushListEntry(pfrom, mn)) {
                     LogPrint(BCLog::MASTERNODE, "dseg - Sent 1 Masternode entry to peer %i\n", pfrom->GetId());
                 }
 
@@ -892,6 +996,68 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
             g_connman->PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::SYNCSTATUSCOUNT, MASTERNODE_SYNC_LIST, nInvCount));
             LogPrint(BCLog::MASTERNODE, "dseg - Sent %d Masternode entries to peer %i\n", nInvCount, pfrom->GetId());
         }
+
+    } else if (strCommand == NetMsgType::GETMNLISTDIFF) { //Get the Masternode list entries that differ from a digest
+
+        CMasternodeListDigest digestPeer;
+        vRecv >> digestPeer;
+
+        if (digestPeer.vBucketHashes.size() != MASTERNODES_DIGEST_BUCKETS) {
+            LogPrintf("CMasternodeMan::ProcessMessage() : dsegdiff - invalid digest from peer %i\n", pfrom->GetId());
+            Misbehaving(pfrom->GetId(), 20);
+            return;
+        }
+
+        int nInvCount = 0;
+
+        {
+            LOCK(cs);
+
+            CMasternodeListDigest digest;
+            std::vector<std::vector<CMasternode*> > vBuckets;
+            GetListDigest(digest, vBuckets);
+
+            // the buckets that differ and that we have entries in
+            std::vector<unsigned int> vDiffBuckets;
+            if (digest.hashRoot != digestPeer.hashRoot) {
+                for (unsigned int i = 0; i < MASTERNODES_DIGEST_BUCKETS; i++) {
+                    if (digest.vBucketHashes[i] != digestPeer.vBucketHashes[i] && !vBuckets[i].empty())
+                        vDiffBuckets.push_back(i);
+                }
+            }
+
+            bool isLocal = (pfrom->addr.IsRFC1918() || pfrom->addr.IsLocal());
+
+            if (!isLocal && Params().NetworkID() == CBaseChainParams::MAIN) {
+                std::map<CNetAddr, int64_t>::iterator i = mAskedUsForMasternodeListDiff.find(pfrom->addr);
+                if (i != mAskedUsForMasternodeListDiff.end() && GetTime() < (*i).second) {
+                    LogPrintf("CMasternodeMan::ProcessMessage() : dsegdiff - peer already asked me for the list\n");
+                    return;
+                }
+                // an answer covering a large part of the list costs about as much
+                // as a full list, and is only given as often
+                if (vDiffBuckets.size() > MASTERNODES_DSEGDIFF_MAX_BUCKETS) {
+                    std::map<CNetAddr, int64_t>::iterator j = mAskedUsForMasternodeList.find(pfrom->addr);
+                    if (j != mAskedUsForMasternodeList.end() && GetTime() < (*j).second) {
+                        LogPrintf("CMasternodeMan::ProcessMessage() : dsegdiff - peer already asked me for most of the list\n");
+                        return;
+                    }
+                    mAskedUsForMasternodeList[pfrom->addr] = GetTime() + MASTERNODES_DSEG_SECONDS;
+                }
+                mAskedUsForMasternodeListDiff[pfrom->addr] = GetTime() + MASTERNODES_DSEGDIFF_SECONDS;
+            }
+
+            // announce the entries of the buckets that differ; the peer only
+            // downloads and verifies the broadcasts it hasn't seen
+            for (unsigned int i : vDiffBuckets) {
+                for (auto mn : vBuckets[i]) {
+                    if (PushListEntry(pfrom, mn)) nInvCount++;
+                }
+            }
+        }
+
+        g_connman->PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::SYNCSTATUSCOUNT, MASTERNODE_SYNC_LIST, nInvCount));
+        LogPrint(BCLog::MASTERNODE, "dsegdiff - Sent %d changed Masternode entries to peer %i\n", nInvCount, pfrom->GetId());
     }
 }
 
@@ -925,8 +1091,8 @@ void CMasternodeMan::Remove(CTxIn vin)
 
 void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
 {
-    mapSeenMasternodePing.insert(std::make_pair(mnb.lastPing.GetHash(), mnb.lastPing));
-    mapSeenMasternodeBroadcast.insert(std::make_pair(mnb.GetHash(), mnb));
+    AddSeenPing(mnb.lastPing);
+    AddSeenBroadcast(mnb);
     masternodeSync.AddedMasternodeList(mnb.GetHash());
 
     LogPrint(BCLog::MASTERNODE,"CMasternodeMan::UpdateMasternodeList() -- masternode=%s\n", mnb.vin.prevout.ToStringShort());
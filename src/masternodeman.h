@@ -20,6 +20,10 @@
 
 #define MASTERNODES_DUMP_SECONDS (15 * 60)
 #define MASTERNODES_DSEG_SECONDS (3 * 60 * 60)
+#define MASTERNODES_DSEGDIFF_SECONDS (5 * 60)
+#define MASTERNODES_DIGEST_BUCKETS 256
+// list diffs announcing more buckets than this are rate limited as full lists
+#define MASTERNODES_DSEGDIFF_MAX_BUCKETS (MASTERNODES_DIGEST_BUCKETS / 4)
 
 
 class CMasternodeMan;
@@ -54,6 +58,30 @@ public:
     ReadResult Read(CMasternodeMan& mnodemanToLoad, bool fDryRun = false);
 };
 
+/** Digest of the masternode list, sent with getmnlistdiff so that the peer
+ *  only announces the entries we are missing or hold an older version of.
+ *  Entries are keyed by collateral outpoint and spread over a fixed number of
+ *  buckets. Each entry hashes its outpoint with its broadcast, the broadcast
+ *  sigTime being the sequence number of the entry, and each bucket holds the
+ *  Merkle root of its entries ordered by outpoint. A new broadcast only
+ *  changes its own bucket.
+ */
+class CMasternodeListDigest
+{
+public:
+    uint256 hashRoot;
+    std::vector<uint256> vBucketHashes;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(hashRoot);
+        READWRITE(vBucketHashes);
+    }
+};
+
 class CMasternodeMan
 {
 private:
@@ -80,6 +108,17 @@ private:
     std::map<CNetAddr, int64_t> mWeAskedForMasternodeList;
     // which Masternodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForMasternodeListEntry;
+    // who's asked for the changes to the Masternode list and the last time (not persisted)
+    std::map<CNetAddr, int64_t> mAskedUsForMasternodeListDiff;
+    // Keep track of all broadcasts I've seen (cs must be held)
+    std::map<uint256, CMasternodeBroadcast> mapSeenMasternodeBroadcast;
+    // Keep track of all pings I've seen (cs must be held)
+    std::map<uint256, CMasternodePing> mapSeenMasternodePing;
+
+    // digest of the entries sent in list dumps, and the entries of each bucket (cs must be held)
+    void GetListDigest(CMasternodeListDigest& digest, std::vector<std::vector<CMasternode*> >& vBuckets);
+    // announce a list entry to a peer requesting the list, returns whether it was sent
+    bool PushListEntry(CNode* pfrom, CMasternode* mn);
 
     // find an entry in the masternode list that is next to be paid (internally)
     CMasternode* GetNextMasternodeInQueueForPayment(
@@ -88,11 +127,6 @@ private:
         bool fJustCount = false);
 
 public:
-    // Keep track of all broadcasts I've seen
-    std::map<uint256, CMasternodeBroadcast> mapSeenMasternodeBroadcast;
-    // Keep track of all pings I've seen
-    std::map<uint256, CMasternodePing> mapSeenMasternodePing;
-
     // keep track of dsq count to prevent masternodes from gaming obfuscation queue
     // TODO: Remove this from serialization
     int64_t nDsqCount;
@@ -160,6 +194,7 @@ public:
 
     void CountNetworks(int& ipv4, int& ipv6, int& onion);
 
+    /// Ask a peer for the Masternode list, or for the changes to ours if it supports list digests
     void DsegUpdate(CNode* pnode);
 
     /// Find an entry
@@ -208,6 +243,22 @@ public:
         return result;
     }
 
+    /// Digest of the entries we would send in a list dump
+    CMasternodeListDigest GetListDigest();
+
+    /// Broadcasts we've seen, Add returns whether it wasn't seen yet
+    bool AddSeenBroadcast(const CMasternodeBroadcast& mnb);
+    bool HaveSeenBroadcast(const uint256& hash) const;
+    bool GetSeenBroadcast(const uint256& hash, CMasternodeBroadcast& mnbRet) const;
+    void EraseSeenBroadcast(const uint256& hash);
+    /// Set the last ping of a seen broadcast, the one it was relayed with is probably outdated
+    void UpdateSeenBroadcastPing(const uint256& hash, const CMasternodePing& mnp);
+
+    /// Pings we've seen, Add returns whether it wasn't seen yet
+    bool AddSeenPing(const CMasternodePing& mnp);
+    bool HaveSeenPing(const uint256& hash) const;
+    bool GetSeenPing(const uint256& hash, CMasternodePing& mnpRet) const;
+
     std::vector<std::pair<int, CMasternode> > GetMasternodeRanks(int64_t nBlockHeight);
     int GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight);
 
@@ -7,9 +7,12 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include "support/allocators/pool.h"
+
 #include <stdlib.h>
 
 #include <map>
+#include <memory>
 #include <set>
 #include <vector>
 #include <unordered_map>
@@ -47,6 +50,7 @@ template<typename X, typename Y> static inline size_t DynamicUsage(std::pair<X,
 template<typename X> static size_t DynamicUsage(const std::vector<X>& v);
 template<typename X> static size_t DynamicUsage(const std::set<X>& s);
 template<typename X, typename Y> static size_t DynamicUsage(const std::map<X, Y>& m);
+template<typename X> static size_t DynamicUsage(const std::shared_ptr<X>& p);
 template<typename X> static size_t DynamicUsage(const X& x);
 
 template<typename X> static size_t RecursiveDynamicUsage(const std::vector<X>& v);
@@ -98,6 +102,23 @@ static inline size_t RecursiveDynamicUsage(const std::vector<X>& v)
     return usage;
 }
 
+// The control block of a std::shared_ptr created by std::make_shared, which
+// holds the object as well
+struct stl_shared_counter
+{
+private:
+    void* vtable;
+    int use_count;
+    int weak_count;
+};
+
+template<typename X>
+static inline size_t DynamicUsage(const std::shared_ptr<X>& p)
+{
+    // Only the owners of a shared object should count it: this assumes a single one.
+    return p ? MallocUsage(sizeof(X) + sizeof(stl_shared_counter)) : 0;
+}
+
 template<unsigned int N, typename X, typename S, typename D>
 static inline size_t DynamicUsage(const prevector<N, X, S, D>& v)
 {
@@ -181,6 +202,17 @@ static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+template<typename X, typename Y, typename Z, typename P, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const std::unordered_map<X, Y, Z, P, PoolAllocator<std::pair<const X, Y>, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> >& m)
+{
+    // The nodes live in the chunks of the pool, which are accounted for in full:
+    // freed nodes stay allocated until the pool is released. Only the bucket
+    // array is allocated separately.
+    const auto* resource = m.get_allocator().resource();
+    size_t usage_chunks = (MallocUsage(resource->ChunkSizeBytes()) + MallocUsage(sizeof(void*) * 3)) * resource->NumAllocatedChunks();
+    return usage_chunks + MallocUsage(sizeof(void*) * m.bucket_count());
+}
+
 // Dispatch to class method as fallback
 
 template<typename X>
@@ -11,6 +11,9 @@
 #include "key.h"
 #include "primitives/transaction.h" // for CTxIn
 
+/** Memory used by the cache of verified message signatures (over 100000 entries) */
+static const size_t MESSAGE_SIG_CACHE_SIZE = 4 << 20;
+
 enum MessageVersion {
         MESS_VER_STRMESS    = 0,
         MESS_VER_HASH       = 1,
@@ -0,0 +1,235 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "metrics.h"
+
+#include "chain.h"
+#include "coins.h"
+#include "httpserver.h"
+#include "main.h"
+#include "masternodeman.h"
+#include "net.h"
+#include "rpc/protocol.h"
+#include "rpc/server.h"
+#include "txmempool.h"
+#include "util.h"
+#include "utilstrencodings.h"
+
+#ifdef ENABLE_WALLET
+#include "wallet/wallet.h"
+#endif
+
+#include <map>
+
+//! Bucket upper bounds of the duration histograms, in seconds
+static const std::vector<double> vDurationBounds = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30};
+
+static const char* const BLOCK_CONNECT_STAGE_NAMES[] = {
+    "load_block",
+    "prefetch_apply",
+    "check_block",
+    "connect_inputs",
+    "verify_scripts",
+    "undo_write",
+    "index",
+    "callbacks",
+    "flush_view",
+    "write_chainstate",
+    "postprocess",
+    "total",
+};
+static_assert(ARRAYLEN(BLOCK_CONNECT_STAGE_NAMES) == (size_t)BlockConnectStage::COUNT, "missing block connect stage name");
+
+static CMetricsHistogram histBlockConnect[(size_t)BlockConnectStage::COUNT];
+static CMetricsHistogram histFlushFull;
+static CMetricsHistogram histFlushWrite;
+
+static Mutex csMempoolRejects;
+static std::map<std::string, uint64_t> mapMempoolRejects;
+
+CMetricsHistogram::CMetricsHistogram(const std::vector<double>& vBoundsIn) : vBounds(vBoundsIn), vCounts(vBoundsIn.size() + 1), nSum(0), nCount(0)
+{
+}
+
+CMetricsHistogram::CMetricsHistogram() : CMetricsHistogram(vDurationBounds)
+{
+}
+
+void CMetricsHistogram::Observe(double nSeconds)
+{
+    size_t nBucket = 0;
+    while (nBucket < vBounds.size() && nSeconds > vBounds[nBucket])
+        nBucket++;
+
+    LOCK(cs);
+    vCounts[nBucket]++;
+    nSum += nSeconds;
+    nCount++;
+}
+
+void CMetricsHistogram::Write(std::string& strOut, const std::string& strName, const std::string& strLabels) const
+{
+    const std::string strSep = strLabels.empty() ? "" : ",";
+    LOCK(cs);
+    uint64_t nCumulative = 0;
+    for (size_t i = 0; i < vBounds.size(); i++) {
+        nCumulative += vCounts[i];
+        strOut += strprintf("%s_bucket{%s%sle=\"%g\"} %u\n", strName, strLabels, strSep, vBounds[i], nCumulative);
+    }
+    strOut += strprintf("%s_bucket{%s%sle=\"+Inf\"} %u\n", strName, strLabels, strSep, nCount);
+    const std::string strBraced = strLabels.empty() ? "" : "{" + strLabels + "}";
+    strOut += strprintf("%s_sum%s %.6f\n", strName, strBraced, nSum);
+    strOut += strprintf("%s_count%s %u\n", strName, strBraced, nCount);
+}
+
+void ObserveBlockConnectStage(BlockConnectStage stage, int64_t nMicros)
+{
+    histBlockConnect[(size_t)stage].Observe(nMicros * 0.000001);
+}
+
+void ObserveFlushStateToDisk(bool fFull, int64_t nMicros)
+{
+    (fFull ? histFlushFull : histFlushWrite).Observe(nMicros * 0.000001);
+}
+
+void CountMempoolReject(const std::string& strReason)
+{
+    LOCK(csMempoolRejects);
+    mapMempoolRejects[strReason]++;
+}
+
+std::string MetricsEscapeLabel(const std::string& str)
+{
+    std::string strRet;
+    strRet.reserve(str.size());
+    for (char c : str) {
+        if (c == '\\' || c == '"') {
+            strRet += '\\';
+            strRet += c;
+        } else if (c == '\n') {
+            strRet += "\\n";
+        } else {
+            strRet += c;
+        }
+    }
+    return strRet;
+}
+
+static void WriteMetricHeader(std::string& strOut, const std::string& strName, const std::string& strType, const std::string& strHelp)
+{
+    strOut += strprintf("# HELP %s %s\n", strName, strHelp);
+    strOut += strprintf("# TYPE %s %s\n", strName, strType);
+}
+
+static void WriteMetric(std::string& strOut, const std::string& strName, const std::string& strType, const std::string& strHelp, uint64_t nValue)
+{
+    WriteMetricHeader(strOut, strName, strType, strHelp);
+    strOut += strprintf("%s %u\n", strName, nValue);
+}
+
+static void WriteMetricByLabel(std::string& strOut, const std::string& strName, const std::string& strType, const std::string& strHelp,
+                               const std::string& strLabel, const std::map<std::string, uint64_t>& mapValues)
+{
+    WriteMetricHeader(strOut, strName, strType, strHelp);
+    for (const auto& it : mapValues)
+        strOut += strprintf("%s{%s=\"%s\"} %u\n", strName, strLabel, MetricsEscapeLabel(it.first), it.second);
+}
+
+std::string GetMetricsText()
+{
+    std::string strOut;
+
+    // Validation
+    WriteMetricHeader(strOut, "safedeal_block_connect_seconds", "histogram", "Time spent per stage of connecting a block to the chain.");
+    for (size_t i = 0; i < ARRAYLEN(histBlockConnect); i++)
+        histBlockConnect[i].Write(strOut, "safedeal_block_connect_seconds", strprintf("stage=\"%s\"", BLOCK_CONNECT_STAGE_NAMES[i]));
+    WriteMetricHeader(strOut, "safedeal_flush_state_seconds", "histogram", "Time spent by the chain state flushes that wrote to disk, full ones including the coins.");
+    histFlushFull.Write(strOut, "safedeal_flush_state_seconds", "mode=\"full\"");
+    histFlushWrite.Write(strOut, "safedeal_flush_state_seconds", "mode=\"index\"");
+
+    {
+        LOCK(cs_main);
+        WriteMetric(strOut, "safedeal_block_height", "gauge", "Height of the active chain tip.", std::max(chainActive.Height(), 0));
+        if (pcoinsTip) {
+            WriteMetric(strOut, "safedeal_coins_cache_hits_total", "counter", "Coin lookups answered from the in-memory cache.", pcoinsTip->GetCacheHits());
+            WriteMetric(strOut, "safedeal_coins_cache_misses_total", "counter", "Coin lookups that went to the coins database.", pcoinsTip->GetCacheMisses());
+            WriteMetric(strOut, "safedeal_coins_cache_entries", "gauge", "Coins held by the in-memory cache.", pcoinsTip->GetCacheSize());
+            WriteMetric(strOut, "safedeal_coins_cache_memory_bytes", "gauge", "Memory used by the in-memory coins cache.", pcoinsTip->DynamicMemoryUsage());
+        }
+    }
+
+    // Mempool
+    WriteMetric(strOut, "safedeal_mempool_transactions", "gauge", "Transactions in the mempool.", mempool.size());
+    WriteMetric(strOut, "safedeal_mempool_bytes", "gauge", "Serialized size of the transactions in the mempool.", mempool.GetTotalTxSize());
+    WriteMetric(strOut, "safedeal_mempool_memory_bytes", "gauge", "Memory used by the mempool.", mempool.DynamicMemoryUsage());
+    {
+        LOCK(csMempoolRejects);
+        WriteMetricByLabel(strOut, "safedeal_mempool_rejections_total", "counter", "Transactions rejected from the mempool, by reject reason.", "reason", mapMempoolRejects);
+    }
+
+    // Network
+    if (g_connman) {
+        WriteMetric(strOut, "safedeal_peers", "gauge", "Connected peers.", g_connman->GetNodeCount(CConnman::CONNECTIONS_ALL));
+        WriteMetric(strOut, "safedeal_net_received_bytes_total", "counter", "Bytes received from peers.", g_connman->GetTotalBytesRecv());
+        WriteMetric(strOut, "safedeal_net_sent_bytes_total", "counter", "Bytes sent to peers.", g_connman->GetTotalBytesSent());
+
+        std::vector<CNodeStats> vstats;
+        g_connman->GetNodeStats(vstats);
+        std::map<std::string, uint64_t> mapRecvBytes, mapSendBytes;
+        for (const CNodeStats& stats : vstats) {
+            for (const mapMsgCmdSize::value_type& i : stats.mapRecvBytesPerMsgCmd)
+                mapRecvBytes[i.first] += i.second;
+            for (const mapMsgCmdSize::value_type& i : stats.mapSendBytesPerMsgCmd)
+                mapSendBytes[i.first] += i.second;
+        }
+        WriteMetricByLabel(strOut, "safedeal_peer_received_bytes", "gauge", "Bytes received from the connected peers, by message type.", "command", mapRecvBytes);
+        WriteMetricByLabel(strOut, "safedeal_peer_sent_bytes", "gauge", "Bytes sent to the connected peers, by message type.", "command", mapSendBytes);
+    }
+
+    // Masternodes
+    WriteMetricByLabel(strOut, "safedeal_masternodes", "gauge", "Masternodes in the list.", "state",
+        {{"all", (uint64_t)mnodeman.size()}, {"enabled", (uint64_t)mnodeman.CountEnabled()}});
+
+#ifdef ENABLE_WALLET
+    // Staking
+    if (pwalletMain && pwalletMain->pStakerStatus) {
+        const CStakerStatus* pStakerStatus = pwalletMain->pStakerStatus;
+        WriteMetric(strOut, "safedeal_stake_attempts_total", "counter", "Stake kernels tried.", pStakerStatus->GetTotalTries());
+        WriteMetric(strOut, "safedeal_stake_kernels_found_total", "counter", "Stake kernels found.", pStakerStatus->GetTotalKernels());
+        WriteMetric(strOut, "safedeal_stake_coins", "gauge", "Coins available for staking at the last attempt.", pStakerStatus->GetLastCoins());
+        WriteMetric(strOut, "safedeal_staking_active", "gauge", "Whether a stake was attempted in the last 30 seconds.", pStakerStatus->IsActive());
+    }
+#endif
+
+    return strOut;
+}
+
+static bool HTTPReq_Metrics(HTTPRequest* req, const std::string&)
+{
+    if (req->GetRequestMethod() != HTTPRequest::GET) {
+        req->WriteReply(HTTP_BAD_METHOD, "Only GET requests are allowed");
+        return false;
+    }
+    std::string statusmessage;
+    if (RPCIsInWarmup(&statusmessage)) {
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_SERVICE_UNAVAILABLE, "Service temporarily unavailable: " + statusmessage + "\r\n");
+        return false;
+    }
+
+    req->WriteHeader("Content-Type", "text/plain; version=0.0.4");
+    req->WriteReply(HTTP_OK, GetMetricsText());
+    return true;
+}
+
+bool StartMetrics()
+{
+    RegisterHTTPHandler("/metrics", true, HTTPReq_Metrics);
+    return true;
+}
+
+void StopMetrics()
+{
+    UnregisterHTTPHandler("/metrics", true);
+}
@@ -0,0 +1,79 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PIVX_METRICS_H
+#define PIVX_METRICS_H
+
+#include "sync.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** Default for -metrics */
+static const bool DEFAULT_METRICS_ENABLE = false;
+
+/** Stages of connecting a block to the chain, timed into histograms by ConnectTip and ConnectBlock */
+enum class BlockConnectStage {
+    LOAD_BLOCK,       //!< reading the block from disk, unless it was read ahead or received
+    PREFETCH_APPLY,   //!< moving the inputs looked up ahead of time into the tip cache
+    CHECK_BLOCK,      //!< context-free block checks, when not checked on receipt already
+    CONNECT_INPUTS,   //!< fetching the inputs and connecting the transactions
+    VERIFY_SCRIPTS,   //!< waiting for the script checks still running after that
+    UNDO_WRITE,       //!< writing the undo data
+    INDEX,            //!< transaction index, block stats and the rest of the index writing
+    CALLBACKS,
+    FLUSH_VIEW,       //!< flushing the block's view into the tip cache
+    WRITE_CHAINSTATE, //!< FlushStateToDisk, if it's time to
+    POSTPROCESS,      //!< mempool cleanup and updating the tip
+    TOTAL,
+    COUNT
+};
+
+/**
+ * Histogram of durations in seconds, written in the Prometheus text format:
+ * cumulative counts per bucket upper bound, plus the sum and the count.
+ */
+class CMetricsHistogram
+{
+private:
+    mutable Mutex cs;
+    std::vector<double> vBounds;
+    //! Observations per bucket, the last one for those above every bound
+    std::vector<uint64_t> vCounts;
+    double nSum;
+    uint64_t nCount;
+
+public:
+    explicit CMetricsHistogram(const std::vector<double>& vBoundsIn);
+    //! Buckets for durations from 100us to 30s
+    CMetricsHistogram();
+
+    void Observe(double nSeconds);
+
+    /** Append the samples of the histogram named strName, with the labels strLabels (like a="b", or empty). */
+    void Write(std::string& strOut, const std::string& strName, const std::string& strLabels) const;
+};
+
+/** Time spent in a stage of block connection */
+void ObserveBlockConnectStage(BlockConnectStage stage, int64_t nMicros);
+/** Time spent by a FlushStateToDisk that wrote the block index, and the coins if fFull */
+void ObserveFlushStateToDisk(bool fFull, int64_t nMicros);
+/** A transaction rejected from the mempool, by reject reason */
+void CountMempoolReject(const std::string& strReason);
+
+/** Escape a label value of the Prometheus text format */
+std::string MetricsEscapeLabel(const std::string& str);
+
+/** All the metrics, in the Prometheus text format */
+std::string GetMetricsText();
+
+/** Start serving the metrics at /metrics on the HTTP server.
+ * Precondition; HTTP has been initialized.
+ */
+bool StartMetrics();
+/** Stop serving the metrics */
+void StopMetrics();
+
+#endif // PIVX_METRICS_H
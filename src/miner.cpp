@@ -35,8 +35,8 @@
 #include "policy/policy.h"
 
 
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -47,50 +47,590 @@
 //
 // Unconfirmed transactions in the memory pool often depend on other
 // transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
+// pool, we select by highest priority or by the fee rate of each transaction
+// with its unconfirmed ancestors (its "package"), so that a transaction is
+// only considered together with the parents it needs in the block.
 //
-class COrphan
-{
-public:
-    const CTransaction* ptx;
-    std::set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
 
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
+// Container for tracking updates to ancestor feerate as we include (parent)
+// transactions in a block
+struct CTxMemPoolModifiedEntry {
+    CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
     {
+        iter = entry;
+        nSizeWithAncestors = entry->GetSizeWithAncestors();
+        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
+        nSigOpCountWithAncestors = entry->GetSigOpCountWithAncestors();
     }
+
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    unsigned int nSigOpCountWithAncestors;
 };
 
-uint64_t nLastBlockTx = 0;
-uint64_t nLastBlockSize = 0;
+/** Comparator for CTxMemPool::txiter objects.
+ *  It simply compares the internal memory address of the CTxMemPoolEntry object
+ *  pointed to. This means it has no meaning, and is only useful for using them
+ *  as key in other indexes.
+ */
+struct CompareCTxMemPoolIter {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        return &(*a) < &(*b);
+    }
+};
+
+struct modifiedentry_iter {
+    typedef CTxMemPool::txiter result_type;
+    result_type operator() (const CTxMemPoolModifiedEntry &entry) const
+    {
+        return entry.iter;
+    }
+};
+
+// This matches the calculation in CompareTxMemPoolEntryByAncestorFee,
+// except operating on CTxMemPoolModifiedEntry.
+struct CompareModifiedEntry {
+    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b) const
+    {
+        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
+        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
+        if (f1 == f2) {
+            return CTxMemPool::CompareIteratorByHash()(a.iter, b.iter);
+        }
+        return f1 > f2;
+    }
+};
+
+// A comparator that sorts transactions based on number of ancestors.
+// This is sufficient to sort an ancestor package in an order that is valid
+// to appear in a block.
+struct CompareTxIterByAncestorCount {
+    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
+
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            modifiedentry_iter,
+            CompareCTxMemPoolIter
+        >,
+        // sorted by modified ancestor fee rate
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareModifiedEntry
+        >
+    >
+> indexed_modified_transaction_set;
+
+typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
+typedef indexed_modified_transaction_set::nth_index<1>::type::iterator modtxscoreiter;
+
+struct update_for_parent_inclusion
+{
+    update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
+
+    void operator() (CTxMemPoolModifiedEntry &e)
+    {
+        e.nModFeesWithAncestors -= iter->GetModifiedFee();
+        e.nSizeWithAncestors -= iter->GetTxSize();
+        e.nSigOpCountWithAncestors -= iter->GetSigOpCount();
+    }
+
+    CTxMemPool::txiter iter;
+};
 
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
+// Limit of the packages failing in a row when the block is nearly full
+static const int MAX_CONSECUTIVE_FAILURES = 1000;
+
+/**
+ * The mempool transactions selected for the next block, kept between calls
+ * to CreateNewBlock. While the tip and the block settings stay the same, the
+ * transactions entering the mempool are appended to the selection, and the
+ * selection is only rebuilt from the mempool for changes it can't follow:
+ * a selected transaction leaving the mempool, a prioritisation, a new
+ * transaction that would compete for the space left or that needs parents
+ * left out of the block.
+ *
+ * Guarded by mempool.cs, which the mempool holds when notifying changes.
+ */
+class CBlockTemplateAssembler
 {
-    bool byFee;
+private:
+    // What the selection was made for
+    const CBlockIndex* pindexPrev;
+    int nHeight;
+    const CCoinsViewCache* pcoinsBase;
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockPrioritySize;
+    unsigned int nBlockMinSize;
+
+    // Mempool changes since the selection was last updated
+    bool fConnected;
+    unsigned int nTransactionsUpdated;
+    unsigned int nChangesNotified;
+    std::vector<uint256> vAdded;
+    bool fStale;
+    // Earliest lock time of the transactions left out for not being final yet
+    int64_t nNextLockTime;
+
+    // The selection: the coins after its transactions and block totals
+    std::unique_ptr<CCoinsViewCache> view;
+    CTxMemPool::setEntries inBlock;
+    std::set<uint256> setInBlock;
+    std::vector<CTransactionRef> vtx;
+    std::vector<CAmount> vTxFees;
+    std::vector<int64_t> vTxSigOps;
+    uint64_t nBlockSize;
+    unsigned int nBlockSigOps;
+    CAmount nFees;
+    // Whether a transaction was left out for the size or sigops limits
+    bool fLimitReached;
+    bool fPrintPriority;
+
+    void TransactionAdded(const CTransactionRef& ptx)
+    {
+        nChangesNotified++;
+        vAdded.push_back(ptx->GetHash());
+    }
+
+    void TransactionRemoved(const CTransactionRef& ptx)
+    {
+        nChangesNotified++;
+        if (setInBlock.count(ptx->GetHash()))
+            fStale = true;
+    }
+
+    /** Test whether the package still fits in the block, from its ancestor state */
+    bool TestPackage(uint64_t packageSize, unsigned int packageSigOps)
+    {
+        if (nBlockSize + packageSize >= nBlockMaxSize || nBlockSigOps + packageSigOps >= MAX_BLOCK_SIGOPS_CURRENT) {
+            fLimitReached = true;
+            return false;
+        }
+        return true;
+    }
+
+    /** Check the transactions of a package, sorted for the block, against the
+     *  coins of the selection, and update these coins if they're all valid.
+     *  The fees and sigops of the transactions are returned in vPackageFees
+     *  and vPackageSigOps. */
+    bool TestPackageTransactions(const std::vector<CTxMemPool::txiter>& package, std::vector<CAmount>& vPackageFees, std::vector<int64_t>& vPackageSigOps)
+    {
+        CCoinsViewCache packageView(view.get());
+        uint64_t nPackageSize = 0;
+        unsigned int nPackageSigOps = 0;
+        for (const CTxMemPool::txiter& it : package) {
+            const CTransaction& tx = it->GetTx();
+            if (tx.IsCoinBase() || tx.IsCoinStake())
+                return false;
+            if (!IsFinalTx(tx, nHeight)) {
+                if (tx.nLockTime >= LOCKTIME_THRESHOLD)
+                    nNextLockTime = std::min(nNextLockTime, (int64_t)tx.nLockTime);
+                return false;
+            }
+
+            // Size limits
+            nPackageSize += it->GetTxSize();
+            if (nBlockSize + nPackageSize >= nBlockMaxSize) {
+                fLimitReached = true;
+                return false;
+            }
+
+            // Legacy limits on sigOps:
+            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+            if (nBlockSigOps + nPackageSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS_CURRENT) {
+                fLimitReached = true;
+                return false;
+            }
+
+            if (!packageView.HaveInputs(tx))
+                return false;
+
+            nTxSigOps += GetP2SHSigOpCount(tx, packageView);
+            if (nBlockSigOps + nPackageSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS_CURRENT) {
+                fLimitReached = true;
+                return false;
+            }
+
+            // Note that flags: we don't want to set mempool/IsStandard()
+            // policy here, but we still have to ensure that the block we
+            // create only contains transactions that are valid in new blocks.
+            CValidationState state;
+            PrecomputedTransactionData precomTxData(tx);
+            if (!CheckInputs(tx, state, packageView, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, precomTxData))
+                return false;
+
+            vPackageFees.push_back(packageView.GetValueIn(tx) - tx.GetValueOut());
+            vPackageSigOps.push_back(nTxSigOps);
+            nPackageSigOps += nTxSigOps;
+            UpdateCoins(tx, packageView, nHeight);
+        }
+        packageView.Flush();
+        return true;
+    }
+
+    void AddToBlock(CTxMemPool::txiter iter, CAmount nTxFees, int64_t nTxSigOps)
+    {
+        // Added, sharing the transaction with its mempool entry
+        vtx.push_back(iter->GetSharedTx());
+        vTxFees.push_back(nTxFees);
+        vTxSigOps.push_back(nTxSigOps);
+        nBlockSize += iter->GetTxSize();
+        nBlockSigOps += nTxSigOps;
+        nFees += nTxFees;
+        inBlock.insert(iter);
+        setInBlock.insert(iter->GetTx().GetHash());
+
+        if (fPrintPriority) {
+            LogPrintf("fee %s txid %s\n",
+                CFeeRate(iter->GetModifiedFee(), iter->GetTxSize()).ToString(), iter->GetTx().GetHash().ToString());
+        }
+    }
+
+    /** Test a single transaction and add it to the block if it is valid there */
+    bool TestAndAddToBlock(CTxMemPool::txiter iter)
+    {
+        std::vector<CAmount> vPackageFees;
+        std::vector<int64_t> vPackageSigOps;
+        if (!TestPackageTransactions({iter}, vPackageFees, vPackageSigOps))
+            return false;
+        AddToBlock(iter, vPackageFees[0], vPackageSigOps[0]);
+        return true;
+    }
+
+    // Whether some in-mempool parent of the transaction is not in the block yet
+    bool IsStillDependent(CTxMemPool::txiter iter)
+    {
+        for (const CTxMemPool::txiter& parent : mempool.GetMemPoolParents(iter)) {
+            if (!inBlock.count(parent))
+                return true;
+        }
+        return false;
+    }
+
+    /** Add transactions by coin age priority, until the priority size of the block is filled */
+    void AddPriorityTxs()
+    {
+        if (nBlockPrioritySize == 0)
+            return;
+
+        // The priority of a transaction is the one it had when entering the mempool,
+        // aged with its inputs that were already in the chain then
+        std::vector<TxCoinAgePriority> vecPriority;
+        TxCoinAgePriorityCompare pricomparer;
+        std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
+        vecPriority.reserve(mempool.mapTx.size());
+        for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
+             mi != mempool.mapTx.end(); ++mi) {
+            double dPriority = mi->GetPriority(nHeight);
+            CAmount dummy;
+            mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+            vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+        }
+        std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+
+        while (!vecPriority.empty()) {
+            // Take highest priority transaction off the priority queue:
+            CTxMemPool::txiter iter = vecPriority.front().second;
+            double dPriority = vecPriority.front().first;
+            std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+            vecPriority.pop_back();
+
+            // Has to wait for dependencies
+            if (IsStillDependent(iter)) {
+                waitPriMap.emplace(iter, dPriority);
+                continue;
+            }
+
+            if (!TestAndAddToBlock(iter))
+                continue;
+
+            if (fPrintPriority)
+                LogPrintf("priority %.1f txid %s\n", dPriority, iter->GetTx().GetHash().ToString());
+
+            // Prioritise by fee once past the priority size or we run out of high-priority
+            // transactions
+            if (nBlockSize >= nBlockPrioritySize || !AllowFree(dPriority))
+                break;
+
+            // Add transactions that depend on this one to the priority queue
+            for (const CTxMemPool::txiter& child : mempool.GetMemPoolChildren(iter)) {
+                auto wpiter = waitPriMap.find(child);
+                if (wpiter != waitPriMap.end()) {
+                    vecPriority.push_back(TxCoinAgePriority(wpiter->second, child));
+                    std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                    waitPriMap.erase(wpiter);
+                }
+            }
+        }
+    }
+
+    /** Add descendants of given transactions to mapModifiedTx with ancestor
+      * state updated assuming given transactions are inBlock. */
+    void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set& mapModifiedTx)
+    {
+        for (const CTxMemPool::txiter& it : alreadyAdded) {
+            CTxMemPool::setEntries descendants;
+            mempool.CalculateDescendants(it, descendants);
+            // Insert all descendants (not yet in block) into the modified set
+            for (const CTxMemPool::txiter& desc : descendants) {
+                if (alreadyAdded.count(desc))
+                    continue;
+                modtxiter mit = mapModifiedTx.find(desc);
+                if (mit == mapModifiedTx.end()) {
+                    CTxMemPoolModifiedEntry modEntry(desc);
+                    modEntry.nSizeWithAncestors -= it->GetTxSize();
+                    modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
+                    modEntry.nSigOpCountWithAncestors -= it->GetSigOpCount();
+                    mapModifiedTx.insert(modEntry);
+                } else {
+                    mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
+                }
+            }
+        }
+    }
+
+    /** Add transactions by the fee rate of their package with their ancestors
+     *  not in the block yet, walking the ancestor score index of the mempool
+     *  and the entries whose packages shrank as their ancestors were added. */
+    void AddPackageTxs()
+    {
+        // mapModifiedTx will store sorted packages after they are modified
+        // because some of their txs are already in the block
+        indexed_modified_transaction_set mapModifiedTx;
+        // Keep track of entries that failed inclusion, to avoid duplicate work
+        CTxMemPool::setEntries failedTx;
+
+        // Start by adding all descendants of previously added txs to mapModifiedTx
+        // and modifying them for their already included ancestors
+        UpdatePackagesForAdded(inBlock, mapModifiedTx);
+
+        CTxMemPool::indexed_transaction_set::nth_index<4>::type::iterator mi = mempool.mapTx.get<4>().begin();
+        CTxMemPool::txiter iter;
+        int nConsecutiveFailed = 0;
+
+        while (mi != mempool.mapTx.get<4>().end() || !mapModifiedTx.empty()) {
+            // First try to find a new transaction in mapTx to evaluate.
+            if (mi != mempool.mapTx.get<4>().end()) {
+                CTxMemPool::txiter it = mempool.mapTx.project<0>(mi);
+                if (mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it)) {
+                    ++mi;
+                    continue;
+                }
+            }
+
+            // Now that mi is not stale, determine which transaction to evaluate:
+            // the next entry from mapTx, or the best from mapModifiedTx?
+            bool fUsingModified = false;
+
+            modtxscoreiter modit = mapModifiedTx.get<1>().begin();
+            if (mi == mempool.mapTx.get<4>().end()) {
+                // We're out of entries in mapTx; use the entry from mapModifiedTx
+                iter = modit->iter;
+                fUsingModified = true;
+            } else {
+                // Try to compare the mapTx entry to the mapModifiedTx entry
+                iter = mempool.mapTx.project<0>(mi);
+                if (modit != mapModifiedTx.get<1>().end() &&
+                        CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                    // The best entry in mapModifiedTx has higher score
+                    // than the one from mapTx.
+                    // Switch which transaction (package) to consider
+                    iter = modit->iter;
+                    fUsingModified = true;
+                } else {
+                    // Either no entry in mapModifiedTx, or it's worse than mapTx.
+                    // Increment mi for the next loop iteration.
+                    ++mi;
+                }
+            }
+
+            // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
+            // contain anything that is inBlock.
+            assert(!inBlock.count(iter));
+
+            uint64_t packageSize = iter->GetSizeWithAncestors();
+            CAmount packageFees = iter->GetModFeesWithAncestors();
+            unsigned int packageSigOps = iter->GetSigOpCountWithAncestors();
+            if (fUsingModified) {
+                packageSize = modit->nSizeWithAncestors;
+                packageFees = modit->nModFeesWithAncestors;
+                packageSigOps = modit->nSigOpCountWithAncestors;
+            }
+
+            // Skip free transactions if we're past the minimum block size:
+            // everything else we might consider has a lower fee rate
+            if (packageFees < ::minRelayTxFee.GetFee(packageSize) && nBlockSize + packageSize >= nBlockMinSize)
+                return;
+
+            if (!TestPackage(packageSize, packageSigOps)) {
+                if (fUsingModified) {
+                    // Since we always look at the best entry in mapModifiedTx,
+                    // we must erase failed entries so that we can consider the
+                    // next best entry on the next loop iteration
+                    mapModifiedTx.get<1>().erase(modit);
+                    failedTx.insert(iter);
+                }
+
+                ++nConsecutiveFailed;
+                if (nConsecutiveFailed > MAX_CONSECUTIVE_FAILURES && nBlockSize > nBlockMaxSize - 1000) {
+                    // Give up if we're close to full and haven't succeeded in a while
+                    break;
+                }
+                continue;
+            }
+
+            CTxMemPool::setEntries ancestors;
+            uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+            std::string dummy;
+            mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+            for (auto it = ancestors.begin(); it != ancestors.end(); ) {
+                // Only test txs not already in the block
+                if (inBlock.count(*it))
+                    it = ancestors.erase(it);
+                else
+                    ++it;
+            }
+            ancestors.insert(iter);
+
+            // Package can be added. Sort the entries in a valid order.
+            std::vector<CTxMemPool::txiter> sortedEntries(ancestors.begin(), ancestors.end());
+            std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
+
+            // Test if all tx's are final, valid and fit the block
+            std::vector<CAmount> vPackageFees;
+            std::vector<int64_t> vPackageSigOps;
+            if (!TestPackageTransactions(sortedEntries, vPackageFees, vPackageSigOps)) {
+                if (fUsingModified) {
+                    mapModifiedTx.get<1>().erase(modit);
+                    failedTx.insert(iter);
+                }
+                continue;
+            }
+
+            // This transaction will make it in; reset the failed counter.
+            nConsecutiveFailed = 0;
+
+            for (size_t i = 0; i < sortedEntries.size(); ++i) {
+                AddToBlock(sortedEntries[i], vPackageFees[i], vPackageSigOps[i]);
+                // Erase from the modified set, if present
+                mapModifiedTx.erase(sortedEntries[i]);
+            }
+
+            // Update transactions that depend on each of these
+            UpdatePackagesForAdded(ancestors, mapModifiedTx);
+        }
+    }
+
+    /** Append the transactions that entered the mempool since the last update,
+     *  false if one can't be appended as a rebuild of the selection would
+     *  include it: the selection must be rebuilt then. */
+    bool AppendAdded()
+    {
+        for (const uint256& hash : vAdded) {
+            CTxMemPool::txiter iter = mempool.mapTx.find(hash);
+            if (iter == mempool.mapTx.end())
+                continue;
+            // It would compete with the selected transactions for the space left
+            if (fLimitReached)
+                return false;
+            // It would be selected with its parents, or by priority
+            if (IsStillDependent(iter) || iter->GetModifiedFee() < ::minRelayTxFee.GetFee(iter->GetTxSize()))
+                return false;
+            // Invalid or non-final transactions are left out, like in a rebuild
+            TestAndAddToBlock(iter);
+            if (fLimitReached)
+                return false;
+        }
+        return true;
+    }
+
+    void Rebuild()
+    {
+        view.reset(new CCoinsViewCache(pcoinsTip));
+        inBlock.clear();
+        setInBlock.clear();
+        vtx.clear();
+        vTxFees.clear();
+        vTxSigOps.clear();
+        nBlockSize = 1000;
+        nBlockSigOps = 100;
+        nFees = 0;
+        fLimitReached = false;
+        nNextLockTime = std::numeric_limits<int64_t>::max();
+        fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
+
+        AddPriorityTxs();
+        AddPackageTxs();
+    }
 
 public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) {}
+    CBlockTemplateAssembler() : pindexPrev(nullptr), fConnected(false), fStale(true) {}
 
-    bool operator()(const TxPriority& a, const TxPriority& b)
+    /** Bring the selection up to date for a block on top of pindexPrevIn */
+    void Update(const CBlockIndex* pindexPrevIn, unsigned int nBlockMaxSizeIn, unsigned int nBlockPrioritySizeIn, unsigned int nBlockMinSizeIn)
     {
-        if (byFee) {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        } else {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
+        AssertLockHeld(cs_main);
+        AssertLockHeld(mempool.cs);
+        if (!fConnected) {
+            mempool.NotifyEntryAdded.connect(boost::bind(&CBlockTemplateAssembler::TransactionAdded, this, _1));
+            mempool.NotifyEntryRemoved.connect(boost::bind(&CBlockTemplateAssembler::TransactionRemoved, this, _1));
+            fConnected = true;
+            fStale = true;
         }
+
+        // Changes the selection doesn't follow: a different block, chain state or
+        // limits, mempool changes that were not notified, lock times passing
+        bool fRebuild = fStale ||
+                        pindexPrev != pindexPrevIn || nHeight != pindexPrevIn->nHeight + 1 || pcoinsBase != pcoinsTip ||
+                        nBlockMaxSize != nBlockMaxSizeIn || nBlockPrioritySize != nBlockPrioritySizeIn || nBlockMinSize != nBlockMinSizeIn ||
+                        mempool.GetTransactionsUpdated() != nTransactionsUpdated + nChangesNotified ||
+                        GetAdjustedTime() > nNextLockTime;
+        if (!fRebuild && !AppendAdded())
+            fRebuild = true;
+
+        if (fRebuild) {
+            pindexPrev = pindexPrevIn;
+            nHeight = pindexPrevIn->nHeight + 1;
+            pcoinsBase = pcoinsTip;
+            nBlockMaxSize = nBlockMaxSizeIn;
+            nBlockPrioritySize = nBlockPrioritySizeIn;
+            nBlockMinSize = nBlockMinSizeIn;
+            Rebuild();
+        }
+
+        fStale = false;
+        vAdded.clear();
+        nTransactionsUpdated = mempool.GetTransactionsUpdated();
+        nChangesNotified = 0;
+    }
+
+    /** Append the selected transactions to the block template */
+    void FillBlockTemplate(CBlockTemplate& blocktemplate, CAmount& nFeesOut) const
+    {
+        blocktemplate.block.vtx.insert(blocktemplate.block.vtx.end(), vtx.begin(), vtx.end());
+        blocktemplate.vTxFees.insert(blocktemplate.vTxFees.end(), vTxFees.begin(), vTxFees.end());
+        blocktemplate.vTxSigOps.insert(blocktemplate.vTxSigOps.end(), vTxSigOps.begin(), vTxSigOps.end());
+        nFeesOut = nFees;
     }
+
+    uint64_t GetBlockSize() const { return nBlockSize; }
+    uint64_t GetBlockTx() const { return vtx.size(); }
 };
 
+static CBlockTemplateAssembler blockTemplateAssembler;
+
+uint64_t nLastBlockTx = 0;
+uint64_t nLastBlockSize = 0;
+
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
     pblock->nTime = std::max(pindexPrev->GetMedianTimePast() + 1, GetAdjustedTime());
@@ -118,7 +658,7 @@ bool CreateCoinbaseTx(CBlock* pblock, const CScript& scriptPubKeyIn, CBlockIndex
         txNew.vout[0].nValue = CMasternode::GetBlockValue(pindexPrev->nHeight + 1);
     }
 
-    pblock->vtx.emplace_back(txNew);
+    pblock->vtx.emplace_back(MakeTransactionRef(txNew));
     return true;
 }
 
@@ -139,8 +679,8 @@ bool SolveProofOfStake(CBlock* pblock, CBlockIndex* pindexPrev, CWallet* pwallet
     emptyTx.vin[0].scriptSig = CScript() << pindexPrev->nHeight + 1 << OP_0;
     emptyTx.vout.resize(1);
     emptyTx.vout[0].SetEmpty();
-    pblock->vtx.emplace_back(emptyTx);
-    pblock->vtx.emplace_back(txCoinStake);
+    pblock->vtx.emplace_back(MakeTransactionRef(emptyTx));
+    pblock->vtx.emplace_back(MakeTransactionRef(txCoinStake));
     return true;
 }
 
@@ -211,179 +751,17 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
 
     {
         LOCK2(cs_main, mempool.cs);
-        CCoinsViewCache view(pcoinsTip);
-
-        // Priority order to process transactions
-        std::list<COrphan> vOrphan; // list memory doesn't move
-        std::map<uint256, std::vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
-
-        // This vector will be sorted into a priority queue:
-        std::vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->GetTx();
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight)){
-                continue;
-            }
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-
-            for (const CTxIn& txin : tx.vin) {
-                // Read prev transaction
-                if (!view.HaveCoin(txin.prevout)) {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash)) {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan) {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx.find(txin.prevout.hash)->GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-
-                const Coin& coin = view.AccessCoin(txin.prevout);
-                assert(!coin.IsSpent());
-
-                CAmount nValueIn = coin.out.nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coin.nHeight;
-
-                dPriority = double_safe_addition(dPriority, ((double)nValueIn * nConf));
-            }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
-
-            if (porphan) {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            } else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->GetTx()));
-        }
-
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
 
-        while (!vecPriority.empty()) {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_CURRENT;
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
-
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))) {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
-
-            if (!view.HaveInputs(tx))
-                continue;
-
-            CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
-
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-
-            CValidationState state;
-            PrecomputedTransactionData precomTxData(tx);
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, precomTxData))
-                continue;
-
-            UpdateCoins(tx, view, nHeight);
-
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            if (fPrintPriority) {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
-
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash)) {
-                for (COrphan* porphan : mapDependers[hash]) {
-                    if (!porphan->setDependsOn.empty()) {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty()) {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
-        }
+        blockTemplateAssembler.Update(pindexPrev, nBlockMaxSize, nBlockPrioritySize, nBlockMinSize);
+        blockTemplateAssembler.FillBlockTemplate(*pblocktemplate, nFees);
+        uint64_t nBlockTx = blockTemplateAssembler.GetBlockTx();
+        uint64_t nBlockSize = blockTemplateAssembler.GetBlockSize();
 
         if (!fProofOfStake) {
             // Coinbase can get the fees.
-            pblock->vtx[0].vout[0].nValue += nFees;
+            CMutableTransaction txCoinbase(*pblock->vtx[0]);
+            txCoinbase.vout[0].nValue += nFees;
+            pblock->vtx[0] = MakeTransactionRef(txCoinbase);
             pblocktemplate->vTxFees[0] = -nFees;
         }
 
@@ -398,7 +776,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
         pblock->nBits = GetNextWorkRequired(pindexPrev, pblock);
         pblock->nNonce = 0;
 
-        pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
+        pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(*pblock->vtx[0]);
 
         if (fProofOfStake) {
             pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
@@ -430,11 +808,11 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
     }
     ++nExtraNonce;
     unsigned int nHeight = pindexPrev->nHeight + 1; // Height first in coinbase required for block.version=2
-    CMutableTransaction txCoinbase(pblock->vtx[0]);
+    CMutableTransaction txCoinbase(*pblock->vtx[0]);
     txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
     assert(txCoinbase.vin[0].scriptSig.size() <= 100);
 
-    pblock->vtx[0] = txCoinbase;
+    pblock->vtx[0] = MakeTransactionRef(txCoinbase);
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
 
@@ -470,7 +848,7 @@ CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey, CWallet* pwallet)
 bool ProcessBlockFound(CBlock* pblock, CWallet& wallet, Optional<CReserveKey>& reservekey)
 {
     LogPrintf("%s\n", pblock->ToString());
-    LogPrintf("generated %s\n", FormatMoney(pblock->vtx[0].vout[0].nValue));
+    LogPrintf("generated %s\n", FormatMoney(pblock->vtx[0]->vout[0].nValue));
 
     // Found a solution
     {
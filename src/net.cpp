@@ -736,6 +736,7 @@ void CNode::copyStats(CNodeStats& stats)
     // Leave string empty if addrLocal invalid (not filled in yet)
     CService addrLocalUnlocked = GetAddrLocal();
     stats.addrLocal = addrLocalUnlocked.IsValid() ? addrLocalUnlocked.ToString() : "";
+    X(minFeeFilter);
 }
 #undef X
 
@@ -1932,6 +1933,11 @@ void CConnman::ThreadMessageHandler()
 
         bool fMoreWork = false;
 
+        // Let the messages about to be processed be checked as a batch first
+        GetNodeSignals().PreverifyMessages(vNodesCopy, *this);
+        if (flagInterruptMsgProc)
+            return;
+
         for (CNode* pnode : vNodesCopy) {
             if (pnode->fDisconnect)
                 continue;
@@ -2531,6 +2537,9 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nPingUsecStart = 0;
     nPingUsecTime = 0;
     fPingQueued = false;
+    minFeeFilter = 0;
+    lastSentFeeFilter = 0;
+    nextSendTimeFeeFilter = 0;
     nMinPingUsecTime = std::numeric_limits<int64_t>::max();
     fPauseRecv = false;
     fPauseSend = false;
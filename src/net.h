@@ -11,6 +11,7 @@
 
 #include "addrdb.h"
 #include "addrman.h"
+#include "amount.h"
 #include "bloom.h"
 #include "compat.h"
 #include "fs.h"
@@ -412,6 +413,7 @@ struct CombinerAll {
 // Signals for message handling
 struct CNodeSignals
 {
+    boost::signals2::signal<void (const std::vector<CNode*>&, CConnman&)> PreverifyMessages;
     boost::signals2::signal<bool (CNode*, CConnman&, std::atomic<bool>&), CombinerAll> ProcessMessages;
     boost::signals2::signal<bool (CNode*, CConnman&, std::atomic<bool>&), CombinerAll> SendMessages;
     boost::signals2::signal<void (CNode*, CConnman&)> InitializeNode;
@@ -494,6 +496,7 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    CAmount minFeeFilter;
 };
 
 
@@ -511,12 +514,15 @@ public:
 
     int64_t nTime; // time (in microseconds) of message receipt.
 
+    bool fPreverified; // signature already looked at by PreverifySignedMessages
+
     CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         hdrbuf.resize(24);
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
+        fPreverified = false;
     }
 
     bool complete() const
@@ -635,6 +641,11 @@ public:
     std::atomic<int64_t> nMinPingUsecTime;
     // Whether a ping is requested.
     std::atomic<bool> fPingQueued;
+    // Minimum fee rate (per kB) of the transactions the peer wants announced, from its feefilter.
+    std::atomic<CAmount> minFeeFilter;
+    // The last feefilter we sent, and when the next one is due (in microseconds). Only used by SendMessages.
+    CAmount lastSentFeeFilter;
+    int64_t nextSendTimeFeeFilter;
 
     CNode(NodeId id, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn, SOCKET hSocketIn, const CAddress& addrIn, uint64_t nKeyedNetGroupIn, uint64_t nLocalHostNonceIn, const std::string& addrNameIn = "", bool fInboundIn = false);
     ~CNode();
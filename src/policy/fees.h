@@ -8,9 +8,11 @@
 #define BITCOIN_POLICYESTIMATOR_H
 
 #include "amount.h"
+#include "random.h"
 #include "uint256.h"
 
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -262,4 +264,23 @@ private:
     /** Classes to track historical data on transaction confirmations */
     TxConfirmStats feeStats;
 };
+
+/**
+ * Rounds the minimum feerate announced to peers in feefilter messages to one of
+ * the fee estimation buckets, chosen at random between the two surrounding it, so
+ * that the exact mempool state can't be used to fingerprint the node.
+ */
+class FeeFilterRounder
+{
+public:
+    /** Create new FeeFilterRounder */
+    FeeFilterRounder(const CFeeRate& minIncrementalFee);
+
+    /** Quantize a minimum fee for privacy purpose before broadcast **/
+    CAmount round(CAmount currentMinFee);
+
+private:
+    std::set<double> feeset;
+    FastRandomContext insecure_rand;
+};
 #endif /*BITCOIN_POLICYESTIMATOR_H */
@@ -40,7 +40,7 @@ CScript CBlock::GetPaidPayee(int nHeight, CAmount nAmount) const
 {
     const auto& tx = vtx[IsProofOfWork() ? 0 : 1];
 
-    for (const CTxOut& out : tx.vout) {
+    for (const CTxOut& out : tx->vout) {
         if (out.nValue == nAmount) return out.scriptPubKey;
     }
 
@@ -59,7 +59,7 @@ std::string CBlock::ToString() const
         vtx.size());
     for (unsigned int i = 0; i < vtx.size(); i++)
     {
-        s << "  " << vtx[i].ToString() << "\n";
+        s << "  " << vtx[i]->ToString() << "\n";
     }
     return s.str();
 }
@@ -96,14 +96,14 @@ void TxDetailDialog::setData(WalletModel *model, const QModelIndex &index)
         QString hash = QString::fromStdString(tx->GetHash().GetHex());
         ui->textId->setText(hash.left(20) + "..." + hash.right(20));
         ui->textId->setTextInteractionFlags(Qt::TextSelectableByMouse);
-        if (tx->vout.size() == 1) {
+        if (tx->tx->vout.size() == 1) {
             ui->textSendLabel->setText(address);
         } else {
-            ui->textSendLabel->setText(QString::number(tx->vout.size()) + " recipients");
+            ui->textSendLabel->setText(QString::number(tx->tx->vout.size()) + " recipients");
         }
         ui->textSend->setVisible(false);
 
-        ui->textInputs->setText(QString::number(tx->vin.size()));
+        ui->textInputs->setText(QString::number(tx->tx->vin.size()));
         ui->textConfirmations->setText(QString::number(rec->status.depth));
         ui->textDate->setText(GUIUtil::dateTimeStrWithSeconds(date));
         ui->textStatus->setText(QString::fromStdString(rec->statusToString()));
@@ -166,9 +166,9 @@ void TxDetailDialog::onInputsClicked()
             inputsLoaded = true;
             const CWalletTx* tx = (this->tx) ? this->tx->getTransaction() : model->getTx(this->txHash);
             if (tx) {
-                ui->gridInputs->setMinimumHeight(50 + (50 * tx->vin.size()));
+                ui->gridInputs->setMinimumHeight(50 + (50 * tx->tx->vin.size()));
                 int i = 1;
-                for (const CTxIn &in : tx->vin) {
+                for (const CTxIn &in : tx->tx->vin) {
                     QString hash = QString::fromStdString(in.prevout.hash.GetHex());
                     QLabel *label_txid = new QLabel(hash.left(18) + "..." + hash.right(18));
                     QLabel *label_txidn = new QLabel(QString::number(in.prevout.n));
@@ -199,7 +199,7 @@ void TxDetailDialog::onOutputsClicked()
             const CWalletTx* tx = (this->tx) ? this->tx->getTransaction() : model->getTx(this->txHash);
             if (tx) {
                 int i = 0;
-                for (const CTxOut &out : tx->vout) {
+                for (const CTxOut &out : tx->tx->vout) {
                     QString labelRes;
                     CTxDestination dest;
                     if (ExtractDestination(out.scriptPubKey, dest)) {
@@ -32,11 +32,11 @@ bool TransactionRecord::decomposeCoinStake(const CWallet* wallet, const CWalletT
     }
 
     const uint256& hash = wtx.GetHash();
-    TransactionRecord sub(hash, wtx.GetTxTime(), wtx.GetTotalSize());
-     if (isminetype mine = wallet->IsMine(wtx.vout[1])) {
+    TransactionRecord sub(hash, wtx.GetTxTime(), wtx.tx->GetTotalSize());
+     if (isminetype mine = wallet->IsMine(wtx.tx->vout[1])) {
         // SFD stake reward
         CTxDestination address;
-        if (!ExtractDestination(wtx.vout[1].scriptPubKey, address))
+        if (!ExtractDestination(wtx.tx->vout[1].scriptPubKey, address))
             return true;
 
         sub.involvesWatchAddress = mine & ISMINE_WATCH_ONLY;
@@ -46,12 +46,12 @@ bool TransactionRecord::decomposeCoinStake(const CWallet* wallet, const CWalletT
     } else {
         //Masternode reward
         CTxDestination destMN;
-        int nIndexMN = (int) wtx.vout.size() - 1;
-        if (ExtractDestination(wtx.vout[nIndexMN].scriptPubKey, destMN) && (mine = IsMine(*wallet, destMN)) ) {
+        int nIndexMN = (int) wtx.tx->vout.size() - 1;
+        if (ExtractDestination(wtx.tx->vout[nIndexMN].scriptPubKey, destMN) && (mine = IsMine(*wallet, destMN)) ) {
             sub.involvesWatchAddress = mine & ISMINE_WATCH_ONLY;
             sub.type = TransactionRecord::MNReward;
             sub.address = EncodeDestination(destMN);
-            sub.credit = wtx.vout[nIndexMN].nValue;
+            sub.credit = wtx.tx->vout[nIndexMN].nValue;
         }
     }
 
@@ -64,9 +64,9 @@ bool TransactionRecord::decomposeCoinStake(const CWallet* wallet, const CWalletT
  */
 bool TransactionRecord::decomposeCreditTransaction(const CWallet* wallet, const CWalletTx& wtx, QList<TransactionRecord>& parts)
 {
-    TransactionRecord sub(wtx.GetHash(), wtx.GetTxTime(), wtx.GetTotalSize());
-    for (unsigned int nOut = 0; nOut < wtx.vout.size(); nOut++) {
-        const CTxOut& txout = wtx.vout[nOut];
+    TransactionRecord sub(wtx.GetHash(), wtx.GetTxTime(), wtx.tx->GetTotalSize());
+    for (unsigned int nOut = 0; nOut < wtx.tx->vout.size(); nOut++) {
+        const CTxOut& txout = wtx.tx->vout[nOut];
         isminetype mine = wallet->IsMine(txout);
         if (mine) {
             CTxDestination address;
@@ -98,14 +98,14 @@ bool TransactionRecord::decomposeSendToSelfTransaction(const CWalletTx& wtx, con
                                                        QList<TransactionRecord>& parts)
 {
     // Payment to self tx is presented as a single record.
-    TransactionRecord sub(wtx.GetHash(), wtx.GetTxTime(), wtx.GetTotalSize());
+    TransactionRecord sub(wtx.GetHash(), wtx.GetTxTime(), wtx.tx->GetTotalSize());
     // Payment to self by default
     sub.type = TransactionRecord::SendToSelf;
     sub.address = "";
 
     // Label for payment to self
     CTxDestination address;
-    if (ExtractDestination(wtx.vout[0].scriptPubKey, address)) {
+    if (ExtractDestination(wtx.tx->vout[0].scriptPubKey, address)) {
         sub.address = EncodeDestination(address);
     }
 
@@ -126,17 +126,17 @@ bool TransactionRecord::decomposeDebitTransaction(const CWallet* wallet, const C
                                                   QList<TransactionRecord>& parts)
 {
     // Return early if there are no outputs.
-    if (wtx.vout.empty()) {
+    if (wtx.tx->vout.empty()) {
         return false;
     }
 
-    CAmount nTxFee = nDebit - wtx.GetValueOut();
-    unsigned int txSize = wtx.GetTotalSize();
+    CAmount nTxFee = nDebit - wtx.tx->GetValueOut();
+    unsigned int txSize = wtx.tx->GetTotalSize();
     const uint256& txHash = wtx.GetHash();
     const int64_t txTime = wtx.GetTxTime();
 
-    for (unsigned int nOut = 0; nOut < wtx.vout.size(); nOut++) {
-        const CTxOut& txout = wtx.vout[nOut];
+    for (unsigned int nOut = 0; nOut < wtx.tx->vout.size(); nOut++) {
+        const CTxOut& txout = wtx.tx->vout[nOut];
 
         if (wallet->IsMine(txout)) {
             // Ignore parts sent to self, as this is usually the change
@@ -207,14 +207,14 @@ QList<TransactionRecord> TransactionRecord::decomposeTransaction(const CWallet*
 
     bool involvesWatchAddress = false;
     isminetype fAllFromMe = ISMINE_SPENDABLE;
-    for (const CTxIn& txin : wtx.vin) {
+    for (const CTxIn& txin : wtx.tx->vin) {
         isminetype mine = wallet->IsMine(txin);
         if (mine & ISMINE_WATCH_ONLY) involvesWatchAddress = true;
         if (fAllFromMe > mine) fAllFromMe = mine;
     }
 
     isminetype fAllToMe = ISMINE_SPENDABLE;
-    for (const CTxOut& txout : wtx.vout) {
+    for (const CTxOut& txout : wtx.tx->vout) {
         isminetype mine = wallet->IsMine(txout);
         if (mine & ISMINE_WATCH_ONLY) involvesWatchAddress = true;
         if (fAllToMe > mine) fAllToMe = mine;
@@ -236,7 +236,7 @@ QList<TransactionRecord> TransactionRecord::decomposeTransaction(const CWallet*
     }
 
     // if we get to this point, we have a mixed debit transaction, can't break down payees.
-    TransactionRecord record(wtx.GetHash(), wtx.GetTxTime(), wtx.GetTotalSize(), TransactionRecord::Other, "", nNet, 0);
+    TransactionRecord record(wtx.GetHash(), wtx.GetTxTime(), wtx.tx->GetTotalSize(), TransactionRecord::Other, "", nNet, 0);
     record.involvesWatchAddress = involvesWatchAddress;
     parts.append(record);
     return parts;
@@ -292,12 +292,12 @@ void TransactionRecord::updateStatus(const CWalletTx& wtx)
     status.depth = depth;
 
     if (!IsFinalTx(wtx, chainHeight + 1)) {
-        if (wtx.nLockTime < LOCKTIME_THRESHOLD) {
+        if (wtx.tx->nLockTime < LOCKTIME_THRESHOLD) {
             status.status = TransactionStatus::OpenUntilBlock;
-            status.open_for = wtx.nLockTime - chainHeight;
+            status.open_for = wtx.tx->nLockTime - chainHeight;
         } else {
             status.status = TransactionStatus::OpenUntilDate;
-            status.open_for = wtx.nLockTime;
+            status.open_for = wtx.tx->nLockTime;
         }
     }
     // For generated transactions, determine maturity
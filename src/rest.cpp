@@ -11,6 +11,7 @@
 #include "primitives/transaction.h"
 #include "main.h"
 #include "httpserver.h"
+#include "rpc/jsonstream.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
@@ -66,6 +67,8 @@ extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue&
 extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
 extern UniValue mempoolInfoToJSON();
 extern UniValue mempoolToJSON(bool fVerbose = false);
+extern void mempoolToJSON(JSONStreamWriter& writer, bool fVerbose);
+extern void blockToJSON(JSONStreamWriter& writer, const CBlock& block, const UniValue& objBlock, bool txDetails);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
 
@@ -76,6 +79,27 @@ static bool RESTERR(HTTPRequest* req, enum HTTPStatusCode status, std::string me
     return false;
 }
 
+/** Send a JSON reply written piece by piece by writeFn, as it's produced */
+static bool RESTStreamJSON(HTTPRequest* req, const std::function<void(JSONStreamWriter&)>& writeFn)
+{
+    req->WriteHeader("Content-Type", "application/json");
+    req->WriteReplyStart(HTTP_OK);
+    JSONStreamWriter writer([req](const std::string& strChunk) { return req->WriteReplyChunk(strChunk); });
+    try {
+        writeFn(writer);
+    } catch (const std::exception& e) {
+        // Too late for an error status, the client must not get a truncated body as a complete one
+        LogPrintf("%s: %s failed while streaming its reply: %s\n", __func__, req->GetURI(), e.what());
+        req->WriteReplyAbort();
+        return false;
+    }
+    writer.Flush();
+    if (!writer.IsAborted())
+        req->WriteReplyChunk("\n");
+    req->WriteReplyEnd();
+    return true;
+}
+
 static enum RetFormat ParseDataFormat(std::vector<std::string>& params, const std::string& strReq)
 {
     boost::split(params, strReq, boost::is_any_of("."));
@@ -243,11 +267,15 @@ static bool rest_block(HTTPRequest* req,
     }
 
     case RF_JSON: {
-        UniValue objBlock = blockToJSON(block, pblockindex, showTxDetails);
-        std::string strJSON = objBlock.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
-        return true;
+        // The transactions are described while the reply is sent
+        UniValue objBlock;
+        {
+            LOCK(cs_main);
+            objBlock = blockToJSON(block, pblockindex, false);
+        }
+        return RESTStreamJSON(req, [&](JSONStreamWriter& writer) {
+            blockToJSON(writer, block, objBlock, showTxDetails);
+        });
     }
 
     default: {
@@ -329,12 +357,9 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
 
     switch (rf) {
     case RF_JSON: {
-        UniValue mempoolObject = mempoolToJSON(true);
-
-        std::string strJSON = mempoolObject.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
-        return true;
+        return RESTStreamJSON(req, [](JSONStreamWriter& writer) {
+            mempoolToJSON(writer, true);
+        });
     }
     default: {
         return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
@@ -8,13 +8,17 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "base58.h"
+#include "blockfilterindex.h"
+#include "blockstats.h"
 #include "checkpoints.h"
 #include "clientversion.h"
 #include "consensus/upgrades.h"
 #include "kernel.h"
 #include "main.h"
 #include "policy/policy.h"
+#include "rpc/jsonstream.h"
 #include "rpc/server.h"
+#include "snapshot.h"
 #include "sync.h"
 #include "txdb.h"
 #include "util.h"
@@ -116,7 +120,8 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     result.push_back(Pair("version", block.nVersion));
     result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
     UniValue txs(UniValue::VARR);
-    for (const CTransaction& tx : block.vtx) {
+    for (const CTransactionRef& ptx : block.vtx) {
+        const CTransaction& tx = *ptx;
         if (txDetails) {
             UniValue objTx(UniValue::VOBJ);
             TxToJSON(tx, UINT256_ZERO, objTx);
@@ -156,6 +161,35 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     return result;
 }
 
+/**
+ * Write the description of a block made by blockToJSON(block, blockindex),
+ * with the details of its transactions if txDetails. Only the transactions
+ * are described while writing, no lock needs to be held.
+ */
+void blockToJSON(JSONStreamWriter& writer, const CBlock& block, const UniValue& objBlock, bool txDetails)
+{
+    const std::vector<std::string>& keys = objBlock.getKeys();
+    const std::vector<UniValue>& values = objBlock.getValues();
+    writer.BeginObject();
+    for (size_t i = 0; i < keys.size() && !writer.IsAborted(); i++) {
+        if (!txDetails || keys[i] != "tx") {
+            writer.KV(keys[i], values[i]);
+            continue;
+        }
+        writer.Key("tx");
+        writer.BeginArray();
+        for (const CTransactionRef& ptx : block.vtx) {
+            if (writer.IsAborted())
+                break;
+            UniValue objTx(UniValue::VOBJ);
+            TxToJSON(*ptx, UINT256_ZERO, objTx);
+            writer.Value(objTx);
+        }
+        writer.EndArray();
+    }
+    writer.EndObject();
+}
+
 UniValue getblockcount(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 0)
@@ -349,38 +383,43 @@ UniValue getdifficulty(const JSONRPCRequest& request)
 }
 
 
+static UniValue MempoolEntryToJSON(const CTxMemPoolEntry& e)
+{
+    AssertLockHeld(mempool.cs);
+    UniValue info(UniValue::VOBJ);
+    info.push_back(Pair("size", (int)e.GetTxSize()));
+    info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
+    info.push_back(Pair("modifiedfee", ValueFromAmount(e.GetModifiedFee())));
+    info.push_back(Pair("time", e.GetTime()));
+    info.push_back(Pair("height", (int)e.GetHeight()));
+    info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
+    info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
+    info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
+    info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
+    info.push_back(Pair("descendantfees", e.GetFeesWithDescendants()));
+    const CTransaction& tx = e.GetTx();
+    std::set<std::string> setDepends;
+    for (const CTxIn& txin : tx.vin) {
+        if (mempool.exists(txin.prevout.hash))
+            setDepends.insert(txin.prevout.hash.ToString());
+    }
+
+    UniValue depends(UniValue::VARR);
+    for (const std::string& dep : setDepends) {
+        depends.push_back(dep);
+    }
+
+    info.push_back(Pair("depends", depends));
+    return info;
+}
+
 UniValue mempoolToJSON(bool fVerbose = false)
 {
     if (fVerbose) {
         LOCK(mempool.cs);
         UniValue o(UniValue::VOBJ);
         for (const CTxMemPoolEntry& e : mempool.mapTx) {
-            const uint256& hash = e.GetTx().GetHash();
-            UniValue info(UniValue::VOBJ);
-            info.push_back(Pair("size", (int)e.GetTxSize()));
-            info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
-            info.push_back(Pair("modifiedfee", ValueFromAmount(e.GetModifiedFee())));
-            info.push_back(Pair("time", e.GetTime()));
-            info.push_back(Pair("height", (int)e.GetHeight()));
-            info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
-            info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
-            info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
-            info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
-            info.push_back(Pair("descendantfees", e.GetFeesWithDescendants()));
-            const CTransaction& tx = e.GetTx();
-            std::set<std::string> setDepends;
-            for (const CTxIn& txin : tx.vin) {
-                if (mempool.exists(txin.prevout.hash))
-                    setDepends.insert(txin.prevout.hash.ToString());
-            }
-
-            UniValue depends(UniValue::VARR);
-            for (const std::string& dep : setDepends) {
-                depends.push_back(dep);
-            }
-
-            info.push_back(Pair("depends", depends));
-            o.push_back(Pair(hash.ToString(), info));
+            o.push_back(Pair(e.GetTx().GetHash().ToString(), MempoolEntryToJSON(e)));
         }
         return o;
     } else {
@@ -395,6 +434,49 @@ UniValue mempoolToJSON(bool fVerbose = false)
     }
 }
 
+/** Number of mempool entries described per hold of the locks, when writing them to a stream */
+static const size_t MEMPOOL_STREAM_BATCH_SIZE = 1000;
+
+/**
+ * Write the mempool as mempoolToJSON(fVerbose) does. The entries are described
+ * by batches, the locks being released while they are written: the
+ * transactions removed from the mempool meanwhile are left out.
+ */
+void mempoolToJSON(JSONStreamWriter& writer, bool fVerbose)
+{
+    std::vector<uint256> vtxid;
+    mempool.queryHashes(vtxid);
+
+    if (!fVerbose) {
+        writer.BeginArray();
+        for (const uint256& hash : vtxid) {
+            if (writer.IsAborted())
+                break;
+            writer.Value(hash.ToString());
+        }
+        writer.EndArray();
+        return;
+    }
+
+    writer.BeginObject();
+    std::vector<std::pair<std::string, UniValue>> vBatch;
+    for (size_t nStart = 0; nStart < vtxid.size() && !writer.IsAborted(); nStart += MEMPOOL_STREAM_BATCH_SIZE) {
+        const size_t nEnd = std::min(nStart + MEMPOOL_STREAM_BATCH_SIZE, vtxid.size());
+        vBatch.clear();
+        {
+            LOCK2(cs_main, mempool.cs);
+            for (size_t i = nStart; i < nEnd; i++) {
+                auto it = mempool.mapTx.find(vtxid[i]);
+                if (it != mempool.mapTx.end())
+                    vBatch.emplace_back(vtxid[i].ToString(), MempoolEntryToJSON(*it));
+            }
+        }
+        for (const auto& entry : vBatch)
+            writer.KV(entry.first, entry.second);
+    }
+    writer.EndObject();
+}
+
 UniValue getrawmempool(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() > 1)
@@ -433,12 +515,16 @@ UniValue getrawmempool(const JSONRPCRequest& request)
             "\nExamples\n" +
             HelpExampleCli("getrawmempool", "true") + HelpExampleRpc("getrawmempool", "true"));
 
-    LOCK(cs_main);
-
     bool fVerbose = false;
     if (request.params.size() > 0)
         fVerbose = request.params[0].get_bool();
 
+    if (request.jsonStream) {
+        mempoolToJSON(*request.jsonStream, fVerbose);
+        return NullUniValue;
+    }
+
+    LOCK(cs_main);
     return mempoolToJSON(fVerbose);
 }
 
@@ -591,6 +677,65 @@ UniValue getblockheader(const JSONRPCRequest& request)
     return blockheaderToJSON(pblockindex);
 }
 
+UniValue getblockfilter(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw std::runtime_error(
+            "getblockfilter \"blockhash\" ( \"filtertype\" )\n"
+            "\nRetrieve a BIP 157 content filter for a particular block.\n"
+            "Requires the block filter index, enabled with -blockfilterindex.\n"
+
+            "\nArguments:\n"
+            "1. \"blockhash\"     (string, required) The hash of the block\n"
+            "2. \"filtertype\"    (string, optional, default=\"basic\") The type name of the filter\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"filter\" : \"xxxx\",  (string) the hex-encoded filter data\n"
+            "  \"header\" : \"xxxx\",  (string) the hex-encoded filter header\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\" \"basic\"") +
+            HelpExampleRpc("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\", \"basic\""));
+
+    uint256 block_hash(ParseHashV(request.params[0], "blockhash"));
+    std::string filtertype_name = "basic";
+    if (request.params.size() > 1)
+        filtertype_name = request.params[1].get_str();
+
+    BlockFilterType filtertype;
+    if (!BlockFilterTypeByName(filtertype_name, filtertype))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown filtertype");
+
+    if (!g_blockfilterindex || g_blockfilterindex->GetFilterType() != filtertype)
+        throw JSONRPCError(RPC_MISC_ERROR, "Index is not enabled for filtertype " + filtertype_name);
+
+    const CBlockIndex* block_index;
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(block_hash);
+        if (it == mapBlockIndex.end())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        block_index = it->second;
+    }
+
+    BlockFilter filter;
+    uint256 filter_header;
+    if (!g_blockfilterindex->LookupFilter(block_index, filter) ||
+        !g_blockfilterindex->LookupFilterHeader(block_index, filter_header)) {
+        // The index catches up with new tips in the background
+        if (!g_blockfilterindex->IsSynced() || block_index->nHeight > g_blockfilterindex->GetBestHeight())
+            throw JSONRPCError(RPC_MISC_ERROR, "Filter not found. Block filters are still in the process of being indexed.");
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Filter not found. This error is unexpected and indicates index corruption.");
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("filter", HexStr(filter.GetEncodedFilter()));
+    ret.pushKV("header", filter_header.GetHex());
+    return ret;
+}
+
 struct CCoinsStats
 {
     int nHeight;
@@ -624,7 +769,6 @@ static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash,
 //! Calculate statistics about the unspent transaction output set
 static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
 {
-    const Consensus::Params& consensus = Params().GetConsensus();
     std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
@@ -642,15 +786,9 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
         Coin coin;
         if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
             // ----------- burn address scanning -----------
-            CTxDestination source;
-            if (ExtractDestination(coin.out.scriptPubKey, source)) {
-                const std::string addr = EncodeDestination(source);
-                if (consensus.mBurnAddresses.find(addr) != consensus.mBurnAddresses.end() &&
-                    consensus.mBurnAddresses.at(addr) < stats.nHeight) 
-                {
-                    pcursor->Next();
-                    continue;
-                }
+            if (IsBurnedCoin(coin, stats.nHeight)) {
+                pcursor->Next();
+                continue;
             }
             if (!outputs.empty() && key.hash != prevkey) {
                 ApplyStats(stats, ss, prevkey, outputs);
@@ -748,6 +886,92 @@ UniValue gettxoutsetinfo(const JSONRPCRequest& request)
     return ret;
 }
 
+UniValue dumptxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrite the unspent transaction output set of the chain tip to a snapshot file, with the money supply\n"
+            "and the stake modifier of the tip. Nodes may be bootstrapped from it with loadtxoutset once its hash\n"
+            "is known to their release. To dump the set at an older height, invalidateblock the block after it first.\n"
+            "Note this call may take some time.\n"
+
+            "\nArguments:\n"
+            "1. \"path\"      (string, required) The file to write, absolute or relative to the data directory. It must not exist.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_written\": n,   (numeric) The number of coins written\n"
+            "  \"base_hash\": \"hex\",   (string) The hash of the block of the set\n"
+            "  \"base_height\": n,     (numeric) The height of the block of the set\n"
+            "  \"money_supply\": x.xxx, (numeric) The money supply at that height\n"
+            "  \"txoutset_hash\": \"hex\", (string) The hash of the snapshot, as known to the releases loading it\n"
+            "  \"path\": \"path\"        (string) The absolute path of the file\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("dumptxoutset", "\"utxo.dat\"") + HelpExampleRpc("dumptxoutset", "\"utxo.dat\""));
+
+    const fs::path path = AbsPathForConfigVal(request.params[0].get_str());
+    CSnapshotMetadata metadata;
+    uint256 hashSnapshot;
+    std::string strError;
+    if (!DumpTxOutSet(path, metadata, hashSnapshot, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("coins_written", (int64_t)metadata.nCoinsCount));
+    ret.push_back(Pair("base_hash", metadata.hashBaseBlock.GetHex()));
+    ret.push_back(Pair("base_height", metadata.nBaseHeight));
+    ret.push_back(Pair("money_supply", ValueFromAmount(metadata.nMoneySupply)));
+    ret.push_back(Pair("txoutset_hash", hashSnapshot.GetHex()));
+    ret.push_back(Pair("path", path.string()));
+    return ret;
+}
+
+UniValue loadtxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "loadtxoutset \"path\"\n"
+            "\nReplace the chainstate with a snapshot file written by dumptxoutset, whose hash is known to this release,\n"
+            "and follow the chain from its block on. The blocks up to it must be in the block files already: they are\n"
+            "validated in the background, and the node shuts down if they don't lead to the coins of the snapshot.\n"
+            "The active chain must be behind the block of the snapshot. Restart with -rescan to update the wallet.\n"
+            "Note this call may take some time.\n"
+
+            "\nArguments:\n"
+            "1. \"path\"      (string, required) The snapshot file, absolute or relative to the data directory\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_loaded\": n,    (numeric) The number of coins loaded\n"
+            "  \"base_hash\": \"hex\",   (string) The hash of the block of the snapshot, the new tip\n"
+            "  \"base_height\": n      (numeric) The height of the block of the snapshot\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("loadtxoutset", "\"utxo.dat\"") + HelpExampleRpc("loadtxoutset", "\"utxo.dat\""));
+
+    const fs::path path = AbsPathForConfigVal(request.params[0].get_str());
+    CSnapshotMetadata metadata;
+    std::string strError;
+    if (!LoadTxOutSet(path, metadata, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    // Connect the blocks received after the one of the snapshot
+    CValidationState state;
+    ActivateBestChain(state, nullptr, false, g_connman.get());
+    if (!state.IsValid())
+        throw JSONRPCError(RPC_DATABASE_ERROR, state.GetRejectReason());
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("coins_loaded", (int64_t)metadata.nCoinsCount));
+    ret.push_back(Pair("base_hash", metadata.hashBaseBlock.GetHex()));
+    ret.push_back(Pair("base_height", metadata.nBaseHeight));
+    return ret;
+}
+
 UniValue gettxout(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 2 || request.params.size() > 3)
@@ -997,6 +1221,7 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
             "  \"difficulty\": xxxxxx,     (numeric) the current difficulty\n"
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"snapshotheight\": xxxxxx,  (numeric) height of the UTXO set snapshot loaded, while the blocks up to it are validated in the background, 0 otherwise\n"
             "  \"upgrades\": {                (object) status of network upgrades\n"
             "     \"name\" : {                (string) name of upgrade\n"
             "        \"activationheight\": xxxxxx,  (numeric) block height of activation\n"
@@ -1022,6 +1247,7 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
     obj.push_back(Pair("difficulty", (double)GetDifficulty()));
     obj.push_back(Pair("verificationprogress", Checkpoints::GuessVerificationProgress(pChainTip)));
     obj.push_back(Pair("chainwork", pChainTip ? pChainTip->nChainWork.GetHex() : ""));
+    obj.push_back(Pair("snapshotheight", nSnapshotHeight));
     UniValue upgrades(UniValue::VOBJ);
     
     if(nTipHeight >= 0) {
@@ -1339,6 +1565,10 @@ UniValue getblockindexstats(const JSONRPCRequest& request) {
                 "  \"txbytes\": xxxxx                (numeric) Sum of the size of all txes over block range\n"
                 "  \"ttlfee\": xxxxx                 (numeric) Sum of the fee amount of all txes over block range\n"
                 "  \"feeperkb\": xxxxx               (numeric) Average fee per kb\n"
+                "  \"minfeeperkb\": xxxxx            (numeric) Lowest fee per kb of a tx (omitted if fFeeOnly)\n"
+                "  \"maxfeeperkb\": xxxxx            (numeric) Highest fee per kb of a tx (omitted if fFeeOnly)\n"
+                "  \"ttlstakereward\": xxxxx         (numeric) Sum of the amounts minted, less masternode payments (omitted if fFeeOnly)\n"
+                "  \"ttlmnpayment\": xxxxx           (numeric) Sum of the masternode payments (omitted if fFeeOnly)\n"
                 "}\n"
 
                 "\nExamples:\n" +
@@ -1361,6 +1591,11 @@ UniValue getblockindexstats(const JSONRPCRequest& request) {
     int64_t nBytes = 0;
     int64_t nTxCount = 0;
     int64_t nTxCount_all = 0;
+    CAmount nMinFeeRate = 0;
+    CAmount nMaxFeeRate = 0;
+    bool fHaveFeeRates = false;
+    CAmount nStakeRewards = 0;
+    CAmount nMasternodePayments = 0;
 
     CBlockIndex* pindex = nullptr;
     {
@@ -1371,44 +1606,24 @@ UniValue getblockindexstats(const JSONRPCRequest& request) {
     if (!pindex)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "invalid block height");
 
+    // the stats recorded when the blocks were connected
     while (true) {
-        CBlock block;
-        if (!ReadBlockFromDisk(block, pindex)) {
+        CBlockStats stats;
+        if (!GetBlockStats(pindex, stats)) {
             throw JSONRPCError(RPC_DATABASE_ERROR, "failed to read block from disk");
         }
 
-        CAmount nValueIn = 0;
-        CAmount nValueOut = 0;
-        const int ntx = block.vtx.size();
-        nTxCount_all += ntx;
-        nTxCount = block.IsProofOfStake() ? nTxCount + ntx - 2 : nTxCount + ntx - 1;
-
-        // loop through each tx in block and save size and fee
-        for (const CTransaction& tx : block.vtx) {
-            if (tx.IsCoinBase() || tx.IsCoinStake())
-                continue;
-
-            // fetch input value from prevouts and count spends
-            for (unsigned int j = 0; j < tx.vin.size(); j++) {
-
-                COutPoint prevout = tx.vin[j].prevout;
-                CTransaction txPrev;
-                uint256 hashBlock;
-                if(!GetTransaction(prevout.hash, txPrev, hashBlock, true))
-                    throw JSONRPCError(RPC_DATABASE_ERROR, "failed to read tx from disk");
-                nValueIn += txPrev.vout[prevout.n].nValue;
-            }
-
-            // sum output values in nValueOut
-            for (unsigned int j = 0; j < tx.vout.size(); j++) {
-                nValueOut += tx.vout[j].nValue;
-            }
-
-            // update sums
-            nFees += nValueIn - nValueOut;
-            nBytes += GetSerializeSize(tx, SER_NETWORK, CLIENT_VERSION);
-
+        nTxCount_all += stats.nTxCount;
+        nTxCount += stats.GetUserTxCount();
+        nFees += stats.nFees;
+        nBytes += stats.nTxBytes;
+        if (stats.GetUserTxCount() > 0) {
+            nMinFeeRate = fHaveFeeRates ? std::min(nMinFeeRate, stats.nMinFeeRate) : stats.nMinFeeRate;
+            nMaxFeeRate = fHaveFeeRates ? std::max(nMaxFeeRate, stats.nMaxFeeRate) : stats.nMaxFeeRate;
+            fHaveFeeRates = true;
         }
+        nStakeRewards += stats.nStakeReward;
+        nMasternodePayments += stats.nMasternodePayment;
 
         if (pindex->nHeight < heightEnd) {
             LOCK(cs_main);
@@ -1427,8 +1642,81 @@ UniValue getblockindexstats(const JSONRPCRequest& request) {
     ret.push_back(Pair("txbytes", (int64_t)nBytes));
     ret.push_back(Pair("ttlfee", FormatMoney(nFees)));
     ret.push_back(Pair("feeperkb", FormatMoney(nFeeRate.GetFeePerK())));
+    if (!fFeeOnly) {
+        ret.push_back(Pair("minfeeperkb", FormatMoney(nMinFeeRate)));
+        ret.push_back(Pair("maxfeeperkb", FormatMoney(nMaxFeeRate)));
+        ret.push_back(Pair("ttlstakereward", FormatMoney(nStakeRewards)));
+        ret.push_back(Pair("ttlmnpayment", FormatMoney(nMasternodePayments)));
+    }
 
     return ret;
 
 }
 
+UniValue getblockstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+                "getblockstats height\n"
+                "\nReturns the statistics recorded for a block of the active chain.\n"
+                "Counts, sizes, fees and fee rates leave out the coinbase and the coinstake.\n"
+
+                "\nArguments:\n"
+                "1. height             (numeric, required) the height of the block.\n"
+
+                "\nResult:\n"
+                "{\n"
+                "  \"height\": n                     (numeric) The height of the block\n"
+                "  \"hash\": \"hash\"                (string) The hash of the block\n"
+                "  \"txcount\": n                    (numeric) tx count (excluding coinbase/coinstake)\n"
+                "  \"txcount_all\": n                (numeric) tx count (including coinbase/coinstake)\n"
+                "  \"txbytes\": n                    (numeric) Sum of the size of the txes\n"
+                "  \"ttlfee\": x.xxx                 (numeric) Sum of the fees of the txes\n"
+                "  \"minfeeperkb\": x.xxx            (numeric) Lowest fee per kb of a tx\n"
+                "  \"medianfeeperkb\": x.xxx         (numeric) Median fee per kb of the txes\n"
+                "  \"maxfeeperkb\": x.xxx            (numeric) Highest fee per kb of a tx\n"
+                "  \"stakereward\": x.xxx            (numeric) Amount minted by the block, less the masternode payment\n"
+                "  \"mnpayment\": x.xxx              (numeric) Masternode payment\n"
+                "  \"mnpayee\": \"address\"          (string, optional) Masternode paid by the block\n"
+                "  \"coinstakevalue\": x.xxx         (numeric) Value out of the coinstake\n"
+                "}\n"
+
+                "\nExamples:\n" +
+                HelpExampleCli("getblockstats", "1200000") +
+                HelpExampleRpc("getblockstats", "1200000"));
+
+    const int nHeight = request.params[0].get_int();
+
+    CBlockIndex* pindex = nullptr;
+    {
+        LOCK(cs_main);
+        pindex = chainActive[nHeight];
+    }
+
+    if (!pindex)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+
+    CBlockStats stats;
+    if (!GetBlockStats(pindex, stats))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "failed to read block from disk");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("height", nHeight));
+    ret.push_back(Pair("hash", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("txcount", (int64_t)stats.GetUserTxCount()));
+    ret.push_back(Pair("txcount_all", (int64_t)stats.nTxCount));
+    ret.push_back(Pair("txbytes", (int64_t)stats.nTxBytes));
+    ret.push_back(Pair("ttlfee", ValueFromAmount(stats.nFees)));
+    ret.push_back(Pair("minfeeperkb", ValueFromAmount(stats.nMinFeeRate)));
+    ret.push_back(Pair("medianfeeperkb", ValueFromAmount(stats.nMedianFeeRate)));
+    ret.push_back(Pair("maxfeeperkb", ValueFromAmount(stats.nMaxFeeRate)));
+    ret.push_back(Pair("stakereward", ValueFromAmount(stats.nStakeReward)));
+    ret.push_back(Pair("mnpayment", ValueFromAmount(stats.nMasternodePayment)));
+    CTxDestination dest;
+    if (!stats.masternodePayee.empty() && ExtractDestination(stats.masternodePayee, dest))
+        ret.push_back(Pair("mnpayee", EncodeDestination(dest)));
+    ret.push_back(Pair("coinstakevalue", ValueFromAmount(stats.nCoinStakeValue)));
+
+    return ret;
+}
+
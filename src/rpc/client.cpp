@@ -97,6 +97,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
         {"listunspent", 3},
         {"logging", 0},
         {"logging", 1},
+        {"getlockstats", 0},
+        {"getlockstats", 1},
         {"getblock", 1},
         {"getblockheader", 1},
         {"gettransaction", 1},
@@ -140,6 +142,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
         {"getblockindexstats", 0},
         {"getblockindexstats", 1},
         {"getblockindexstats", 2},
+        {"getblockstats", 0},
         {"getserials", 0},
         {"getserials", 1},
         {"getserials", 2},
@@ -0,0 +1,107 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpc/jsonstream.h"
+
+#include <cassert>
+
+JSONStreamWriter::JSONStreamWriter(Sink sinkIn, size_t nFlushSizeIn) :
+    sink(std::move(sinkIn)),
+    nFlushSize(nFlushSizeIn),
+    nWritten(0),
+    fAborted(false),
+    fAfterKey(false)
+{
+}
+
+void JSONStreamWriter::Separate()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+        return;
+    }
+    if (vHasElement.empty())
+        return;
+    if (vHasElement.back())
+        strBuffer += ',';
+    vHasElement.back() = true;
+}
+
+void JSONStreamWriter::Write(const std::string& str)
+{
+    if (fAborted)
+        return;
+    strBuffer += str;
+    if (strBuffer.size() >= nFlushSize)
+        Flush();
+}
+
+void JSONStreamWriter::BeginObject()
+{
+    Separate();
+    vHasElement.push_back(false);
+    strClosers += '}';
+    Write("{");
+}
+
+void JSONStreamWriter::EndObject()
+{
+    assert(!strClosers.empty() && strClosers.back() == '}' && !fAfterKey);
+    vHasElement.pop_back();
+    strClosers.pop_back();
+    Write("}");
+}
+
+void JSONStreamWriter::BeginArray()
+{
+    Separate();
+    vHasElement.push_back(false);
+    strClosers += ']';
+    Write("[");
+}
+
+void JSONStreamWriter::EndArray()
+{
+    assert(!strClosers.empty() && strClosers.back() == ']' && !fAfterKey);
+    vHasElement.pop_back();
+    strClosers.pop_back();
+    Write("]");
+}
+
+void JSONStreamWriter::Key(const std::string& key)
+{
+    assert(!vHasElement.empty() && !fAfterKey);
+    Separate();
+    // A string UniValue writes itself quoted and escaped
+    Write(UniValue(key).write() + ":");
+    fAfterKey = true;
+}
+
+void JSONStreamWriter::Value(const UniValue& val)
+{
+    Separate();
+    Write(val.write());
+}
+
+void JSONStreamWriter::EndAll()
+{
+    if (fAfterKey)
+        Value(NullUniValue);
+    while (!strClosers.empty()) {
+        if (strClosers.back() == '}')
+            EndObject();
+        else
+            EndArray();
+    }
+}
+
+void JSONStreamWriter::Flush()
+{
+    if (fAborted || strBuffer.empty())
+        return;
+    nWritten += strBuffer.size();
+    if (!sink(strBuffer))
+        fAborted = true;
+    strBuffer.clear();
+}
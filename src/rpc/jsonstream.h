@@ -0,0 +1,83 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PIVX_RPC_JSONSTREAM_H
+#define PIVX_RPC_JSONSTREAM_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <univalue.h>
+
+/** Output buffered by a JSONStreamWriter before it is handed to its sink */
+static const size_t DEFAULT_JSON_STREAM_FLUSH_SIZE = 64 * 1024;
+
+/**
+ * Writer of a JSON document emitted piece by piece, for the replies too large
+ * to be built as a whole UniValue tree first (the mempool, blocks with the
+ * details of their transactions). Containers are opened and closed explicitly,
+ * the values in them are written as UniValue. The output is handed to the sink
+ * every DEFAULT_JSON_STREAM_FLUSH_SIZE bytes, and once more by Flush().
+ *
+ * Writing doesn't block on the sink but while flushing: callers holding a lock
+ * should only write once it's released.
+ */
+class JSONStreamWriter
+{
+public:
+    /** Receives the output, returns false when the reader went away */
+    typedef std::function<bool(const std::string&)> Sink;
+
+    explicit JSONStreamWriter(Sink sinkIn, size_t nFlushSizeIn = DEFAULT_JSON_STREAM_FLUSH_SIZE);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+
+    /** Write the key of the next member of the current object */
+    void Key(const std::string& key);
+    /** Write a value, in the current array or after a Key */
+    void Value(const UniValue& val);
+    /** Write a member of the current object */
+    void KV(const std::string& key, const UniValue& val)
+    {
+        Key(key);
+        Value(val);
+    }
+
+    /**
+     * Close all the open containers, for a document that can't be completed:
+     * a key still waiting for its value gets a null one. What's written then
+     * parses as JSON, whatever point the document was cut at.
+     */
+    void EndAll();
+
+    /** Hand the buffered output to the sink */
+    void Flush();
+
+    /** Whether the sink refused some output: what's written is then dropped. */
+    bool IsAborted() const { return fAborted; }
+    /** Whether anything was written so far */
+    bool IsEmpty() const { return nWritten == 0 && strBuffer.empty(); }
+
+private:
+    Sink sink;
+    size_t nFlushSize;
+    std::string strBuffer;
+    size_t nWritten;
+    bool fAborted;
+    //! For each open container, whether it has an element yet
+    std::vector<bool> vHasElement;
+    //! The closing characters of the open containers, innermost last
+    std::string strClosers;
+    //! A key was written, its value is next
+    bool fAfterKey;
+
+    void Separate();
+    void Write(const std::string& str);
+};
+
+#endif // PIVX_RPC_JSONSTREAM_H
@@ -96,6 +96,9 @@ UniValue getinfo(const JSONRPCRequest& request)
                 case NODE_BLOOM_WITHOUT_MN:
                     services+= "BLOOM/";
                     break;
+                case NODE_COMPACT_FILTERS:
+                    services+= "COMPACT_FILTERS/";
+                    break;
                 default:
                     services+= "UNKNOWN/";
             }
@@ -667,6 +670,84 @@ UniValue logging(const JSONRPCRequest& request)
     return result;
 }
 
+UniValue getlockstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 2)
+        throw std::runtime_error(
+            "getlockstats ( count reset )\n"
+            "\nReturns the contention counters of the lock sites (LOCK, TRY_LOCK, ...) taken since\n"
+            "startup or the last reset, sorted by the total time spent waiting for the lock.\n"
+            "Hold times are sampled once every " + std::to_string(LOCK_HOLD_SAMPLE_INTERVAL) + " acquisitions of a site.\n"
+
+            "\nArguments:\n"
+            "1. count    (numeric, optional, default=25) The number of sites to return, 0 for all\n"
+            "2. reset    (boolean, optional, default=false) Reset all the counters after reporting them\n"
+
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"site\": \"file:line\",       (string) where the lock is taken\n"
+            "    \"lock\": \"name\",            (string) the locked mutex expression, e.g. cs_main\n"
+            "    \"acquisitions\": n,         (numeric) number of times the lock was taken\n"
+            "    \"contended\": n,            (numeric) number of times the lock had to be waited for\n"
+            "    \"wait_us\": n,              (numeric) total time spent waiting, in microseconds\n"
+            "    \"max_wait_us\": n,          (numeric) longest wait, in microseconds\n"
+            "    \"hold_us\": {               (json object) sampled hold times, by upper bound in microseconds\n"
+            "      \"10\": n, \"100\": n, \"1000\": n, \"10000\": n, \"100000\": n, \"1000000\": n, \"inf\": n\n"
+            "    }\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getlockstats", "") + HelpExampleCli("getlockstats", "0 true") + HelpExampleRpc("getlockstats", "10, false"));
+
+    int nCount = 25;
+    if (request.params.size() > 0) {
+        nCount = request.params[0].get_int();
+        if (nCount < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+    }
+    const bool fReset = request.params.size() > 1 && request.params[1].get_bool();
+
+    // sort and report a copy, the live counters change while this runs
+    std::vector<std::pair<const CLockSiteStats*, CLockSiteStats::Counters>> vSites;
+    for (CLockSiteStats* site : GetLockSiteStats()) {
+        const CLockSiteStats::Counters counters = site->Read(fReset);
+        if (counters.nAcquisitions > 0)
+            vSites.emplace_back(site, counters);
+    }
+    std::sort(vSites.begin(), vSites.end(), [](const std::pair<const CLockSiteStats*, CLockSiteStats::Counters>& a,
+                                               const std::pair<const CLockSiteStats*, CLockSiteStats::Counters>& b) {
+        return a.second.nWaitMicros > b.second.nWaitMicros;
+    });
+    if (nCount > 0 && (int)vSites.size() > nCount)
+        vSites.resize(nCount);
+
+    UniValue ret(UniValue::VARR);
+    for (const auto& entry : vSites) {
+        const CLockSiteStats* site = entry.first;
+        const CLockSiteStats::Counters& counters = entry.second;
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("site", strprintf("%s:%d", site->pszFile, site->nLine)));
+        obj.push_back(Pair("lock", site->pszName));
+        obj.push_back(Pair("acquisitions", counters.nAcquisitions));
+        obj.push_back(Pair("contended", counters.nContended));
+        obj.push_back(Pair("wait_us", counters.nWaitMicros));
+        obj.push_back(Pair("max_wait_us", counters.nMaxWaitMicros));
+        UniValue hold(UniValue::VOBJ);
+        int64_t nLimit = 10;
+        for (int i = 0; i < CLockSiteStats::HOLD_BUCKETS; i++, nLimit *= 10) {
+            const std::string strBucket = i < CLockSiteStats::HOLD_BUCKETS - 1 ? std::to_string(nLimit) : "inf";
+            hold.push_back(Pair(strBucket, counters.nHoldHistogram[i]));
+        }
+        obj.push_back(Pair("hold_us", hold));
+        ret.push_back(obj);
+    }
+
+    return ret;
+}
+
 #ifdef ENABLE_WALLET
 UniValue getstakingstatus(const JSONRPCRequest& request)
 {
@@ -33,6 +33,12 @@
 
 #include <univalue.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
 
 static bool fRPCRunning = false;
 static bool fRPCInWarmup = true;
@@ -280,8 +286,8 @@ UniValue stop(const JSONRPCRequest& jsonRequest)
  */
 static const CRPCCommand vRPCCommands[] =
     {
-        //  category              name                      actor (function)         okSafeMode
-        //  --------------------- ------------------------  -----------------------  ----------
+        //  category              name                      actor (function)         okSafeMode  okConcurrent
+        //  --------------------- ------------------------  -----------------------  ----------  ------------
         /* Overall control/query calls */
         {"control", "getinfo", &getinfo, true }, /* uses wallet if enabled */
         {"control", "help", &help, true },
@@ -303,18 +309,22 @@ static const CRPCCommand vRPCCommands[] =
         /* Block chain and UTXO */
         {"blockchain", "getblockindexstats", &getblockindexstats, true },
         {"blockchain", "getblockchaininfo", &getblockchaininfo, true },
-        {"blockchain", "getbestblockhash", &getbestblockhash, true },
-        {"blockchain", "getblockcount", &getblockcount, true },
-        {"blockchain", "getblock", &getblock, true },
-        {"blockchain", "getblockhash", &getblockhash, true },
-        {"blockchain", "getblockheader", &getblockheader, false },
+        {"blockchain", "getbestblockhash", &getbestblockhash, true, true },
+        {"blockchain", "getblockcount", &getblockcount, true, true },
+        {"blockchain", "getblock", &getblock, true, true },
+        {"blockchain", "getblockhash", &getblockhash, true, true },
+        {"blockchain", "getblockheader", &getblockheader, false, true },
+        {"blockchain", "getblockfilter", &getblockfilter, true, true },
+        {"blockchain", "getblockstats", &getblockstats, true },
         {"blockchain", "getchaintips", &getchaintips, true },
-        {"blockchain", "getdifficulty", &getdifficulty, true },
+        {"blockchain", "getdifficulty", &getdifficulty, true, true },
         {"blockchain", "getfeeinfo", &getfeeinfo, true },
-        {"blockchain", "getmempoolinfo", &getmempoolinfo, true },
+        {"blockchain", "getmempoolinfo", &getmempoolinfo, true, true },
         {"blockchain", "getrawmempool", &getrawmempool, true },
-        {"blockchain", "gettxout", &gettxout, true },
+        {"blockchain", "gettxout", &gettxout, true, true },
         {"blockchain", "gettxoutsetinfo", &gettxoutsetinfo, true },
+        {"blockchain", "dumptxoutset", &dumptxoutset, true },
+        {"blockchain", "loadtxoutset", &loadtxoutset, true },
         {"blockchain", "invalidateblock", &invalidateblock, true },
         {"blockchain", "reconsiderblock", &reconsiderblock, true },
         {"blockchain", "verifychain", &verifychain, true },
@@ -337,9 +347,9 @@ static const CRPCCommand vRPCCommands[] =
 
         /* Raw transactions */
         {"rawtransactions", "createrawtransaction", &createrawtransaction, true },
-        {"rawtransactions", "decoderawtransaction", &decoderawtransaction, true },
-        {"rawtransactions", "decodescript", &decodescript, true },
-        {"rawtransactions", "getrawtransaction", &getrawtransaction, true },
+        {"rawtransactions", "decoderawtransaction", &decoderawtransaction, true, true },
+        {"rawtransactions", "decodescript", &decodescript, true, true },
+        {"rawtransactions", "getrawtransaction", &getrawtransaction, true, true },
         {"rawtransactions", "fundrawtransaction", &fundrawtransaction, false},
         {"rawtransactions", "sendrawtransaction", &sendrawtransaction, false },
         {"rawtransactions", "signrawtransaction", &signrawtransaction, false }, /* uses wallet if enabled */
@@ -347,6 +357,7 @@ static const CRPCCommand vRPCCommands[] =
         /* Utility functions */
         {"util", "createmultisig", &createmultisig, true },
         {"util", "logging", &logging, true },
+        {"util", "getlockstats", &getlockstats, true },
         {"util", "validateaddress", &validateaddress, true }, /* uses wallet if enabled */
         {"util", "verifymessage", &verifymessage, true },
         {"util", "estimatefee", &estimatefee, true },
@@ -422,9 +433,107 @@ bool CRPCTable::appendCommand(const std::string& name, const CRPCCommand* pcmd)
     return true;
 }
 
+namespace {
+/**
+ * Threads helping the HTTP workers with the entries of their JSON-RPC batches
+ * which can run concurrently. The worker executes entries as well, so that a
+ * batch progresses even when all the threads are busy with other batches.
+ */
+class CRPCBatchPool
+{
+private:
+    std::mutex cs;
+    std::condition_variable cond;
+    std::deque<std::function<void()>> queue;
+    std::vector<std::thread> threads;
+    bool fStop = false;
+
+    void Run()
+    {
+        util::ThreadRename("pivx-rpcbatch");
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(cs);
+                cond.wait(lock, [this] { return fStop || !queue.empty(); });
+                if (fStop)
+                    return;
+                task = std::move(queue.front());
+                queue.pop_front();
+            }
+            task();
+        }
+    }
+
+public:
+    void Start(int nThreads)
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fStop = false;
+        for (int i = 0; i < nThreads; i++)
+            threads.emplace_back(&CRPCBatchPool::Run, this);
+    }
+
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            fStop = true;
+            // The workers of the batches execute what's left themselves
+            queue.clear();
+        }
+        cond.notify_all();
+        for (std::thread& thread : threads)
+            thread.join();
+        threads.clear();
+    }
+
+    int GetSize()
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        return fStop ? 0 : threads.size();
+    }
+
+    void Post(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            if (fStop)
+                return;
+            queue.push_back(std::move(task));
+        }
+        cond.notify_one();
+    }
+};
+
+/** A run of consecutive entries of a batch executed concurrently */
+struct CRPCBatchRun
+{
+    const UniValue* pvReq;
+    std::vector<UniValue>* pvResults;
+    std::atomic<size_t> nNext;
+    size_t nEnd;
+    size_t nCount;
+
+    std::mutex cs;
+    std::condition_variable cond;
+    size_t nDone = 0;
+
+    CRPCBatchRun(const UniValue& vReq, std::vector<UniValue>& vResults, size_t nBegin, size_t nEndIn) :
+        pvReq(&vReq), pvResults(&vResults), nNext(nBegin), nEnd(nEndIn), nCount(nEndIn - nBegin) {}
+};
+}
+
+static CRPCBatchPool rpcBatchPool;
+static std::atomic<int> nRPCBatchConcurrency(DEFAULT_RPC_BATCH_CONCURRENCY);
+
 bool StartRPC()
 {
     LogPrint(BCLog::RPC, "Starting RPC\n");
+    const int nBatchThreads = std::max(0, (int)GetArg("-rpcbatchthreads", DEFAULT_RPC_BATCH_THREADS));
+    nRPCBatchConcurrency = std::max(1, (int)GetArg("-rpcbatchconcurrency", DEFAULT_RPC_BATCH_CONCURRENCY));
+    LogPrint(BCLog::RPC, "Using %d threads to execute JSON-RPC batches, up to %d entries at a time\n", nBatchThreads, (int)nRPCBatchConcurrency);
+    rpcBatchPool.Start(nBatchThreads);
     fRPCRunning = true;
     g_rpcSignals.Started();
     return true;
@@ -440,6 +549,7 @@ void InterruptRPC()
 void StopRPC()
 {
     LogPrint(BCLog::RPC, "Stopping RPC\n");
+    rpcBatchPool.Stop();
     deadlineTimers.clear();
     g_rpcSignals.Stopped();
 }
@@ -527,12 +637,73 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
+/** Whether an entry of a batch calls a command which can run concurrently */
+static bool IsConcurrentRequest(const UniValue& req)
+{
+    if (!req.isObject())
+        return false;
+    const UniValue& method = find_value(req, "method");
+    if (!method.isStr())
+        return false;
+    const CRPCCommand* pcmd = tableRPC[method.get_str()];
+    return pcmd && pcmd->okConcurrent;
+}
+
+/** Execute the entries of a run not taken yet by another thread */
+static void ExecBatchRun(const std::shared_ptr<CRPCBatchRun>& run)
+{
+    size_t nIdx;
+    while ((nIdx = run->nNext++) < run->nEnd) {
+        (*run->pvResults)[nIdx] = JSONRPCExecOne((*run->pvReq)[nIdx]);
+        std::lock_guard<std::mutex> lock(run->cs);
+        if (++run->nDone == run->nCount)
+            run->cond.notify_all();
+    }
+}
+
 std::string JSONRPCExecBatch(const UniValue& vReq)
 {
+    int64_t nTimeStart = GetTimeMicros();
+    std::vector<UniValue> vResults(vReq.size());
+    size_t nConcurrent = 0;
+    const int nMaxConcurrency = std::max(1, std::min((int)nRPCBatchConcurrency, rpcBatchPool.GetSize() + 1));
+
+    // The commands which can run concurrently are executed together when they
+    // follow each other. The other ones are executed alone, once the entries
+    // before them are done, so that the effects of the batch keep its order.
+    size_t nIdx = 0;
+    while (nIdx < vReq.size()) {
+        size_t nEnd = nIdx;
+        if (nMaxConcurrency > 1) {
+            while (nEnd < vReq.size() && IsConcurrentRequest(vReq[nEnd]))
+                nEnd++;
+        }
+        if (nEnd - nIdx < 2) {
+            vResults[nIdx] = JSONRPCExecOne(vReq[nIdx]);
+            nIdx++;
+            continue;
+        }
+
+        auto run = std::make_shared<CRPCBatchRun>(vReq, vResults, nIdx, nEnd);
+        const size_t nHelpers = std::min(run->nCount, (size_t)nMaxConcurrency) - 1;
+        for (size_t i = 0; i < nHelpers; i++)
+            rpcBatchPool.Post(std::bind(&ExecBatchRun, run));
+        ExecBatchRun(run);
+        {
+            // Wait for the entries taken by the helpers
+            std::unique_lock<std::mutex> lock(run->cs);
+            run->cond.wait(lock, [&run] { return run->nDone == run->nCount; });
+        }
+        nConcurrent += run->nCount;
+        nIdx = nEnd;
+    }
+
     UniValue ret(UniValue::VARR);
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    for (const UniValue& result : vResults)
+        ret.push_back(result);
 
+    LogPrint(BCLog::RPC, "%s: %u requests (%u concurrent) executed in %.2fms\n", __func__,
+        vReq.size(), nConcurrent, 0.001 * (GetTimeMicros() - nTimeStart));
     return ret.write() + "\n";
 }
 
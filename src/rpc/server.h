@@ -22,6 +22,11 @@
 
 class CRPCCommand;
 
+/** -rpcbatchthreads default (threads executing the entries of JSON-RPC batches concurrently) */
+static const int DEFAULT_RPC_BATCH_THREADS = 4;
+/** -rpcbatchconcurrency default (entries of one JSON-RPC batch executed at the same time) */
+static const int DEFAULT_RPC_BATCH_CONCURRENCY = 4;
+
 namespace RPCServer
 {
     void OnStarted(std::function<void ()> slot);
@@ -32,6 +37,7 @@ namespace RPCServer
 
 class CBlockIndex;
 class CNetAddr;
+class JSONStreamWriter;
 
 class JSONRPCRequest
 {
@@ -42,8 +48,11 @@ public:
     bool fHelp;
     std::string URI;
     std::string authUser;
+    /** When set, the handler may write its result there as it's produced,
+     *  instead of returning it (it then returns NullUniValue). */
+    JSONStreamWriter* jsonStream;
 
-    JSONRPCRequest() { id = NullUniValue; params = NullUniValue; fHelp = false; }
+    JSONRPCRequest() { id = NullUniValue; params = NullUniValue; fHelp = false; jsonStream = nullptr; }
     void parse(const UniValue& valRequest);
 };
 
@@ -126,6 +135,9 @@ public:
     std::string name;
     rpcfn_type actor;
     bool okSafeMode;
+    /** Read-only command whose entries of a JSON-RPC batch may be executed
+     *  concurrently with their neighbours, see JSONRPCExecBatch. */
+    bool okConcurrent = false;
 };
 
 /**
@@ -239,14 +251,18 @@ extern UniValue getrawmempool(const JSONRPCRequest& request);
 extern UniValue getblockhash(const JSONRPCRequest& request);
 extern UniValue getblock(const JSONRPCRequest& request);
 extern UniValue getblockheader(const JSONRPCRequest& request);
+extern UniValue getblockfilter(const JSONRPCRequest& request);
 extern UniValue getfeeinfo(const JSONRPCRequest& request);
 extern UniValue gettxoutsetinfo(const JSONRPCRequest& request);
+extern UniValue dumptxoutset(const JSONRPCRequest& request);
+extern UniValue loadtxoutset(const JSONRPCRequest& request);
 extern UniValue gettxout(const JSONRPCRequest& request);
 extern UniValue verifychain(const JSONRPCRequest& request);
 extern UniValue getchaintips(const JSONRPCRequest& request);
 extern UniValue invalidateblock(const JSONRPCRequest& request);
 extern UniValue reconsiderblock(const JSONRPCRequest& request);
 extern UniValue getblockindexstats(const JSONRPCRequest& request);
+extern UniValue getblockstats(const JSONRPCRequest& request);
 extern UniValue getburnaddresses(const JSONRPCRequest& request);
 extern void validaterange(const UniValue& params, int& heightStart, int& heightEnd, int minHeightStart=1);
 
@@ -268,6 +284,7 @@ extern UniValue getmasternodescores(const JSONRPCRequest& request);
 
 extern UniValue getinfo(const JSONRPCRequest& request); // in rpc/misc.cpp
 extern UniValue logging(const JSONRPCRequest& request);
+extern UniValue getlockstats(const JSONRPCRequest& request);
 extern UniValue mnsync(const JSONRPCRequest& request);
 extern UniValue spork(const JSONRPCRequest& request);
 extern UniValue validateaddress(const JSONRPCRequest& request);
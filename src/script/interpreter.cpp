@@ -1102,13 +1102,96 @@ uint256 GetOutputsHash(const CTransaction& txTo) {
     return ss.GetHash();
 }
 
+/** Serialization stream appending to a byte vector */
+class CVectorAppender
+{
+private:
+    std::vector<unsigned char>& vch;
+
+public:
+    explicit CVectorAppender(std::vector<unsigned char>& vchIn) : vch(vchIn) {}
+
+    int GetType() const { return SER_GETHASH; }
+    int GetVersion() const { return 0; }
+
+    void write(const char* pch, size_t size)
+    {
+        vch.insert(vch.end(), (const unsigned char*)pch, (const unsigned char*)pch + size);
+    }
+
+    template <typename T>
+    CVectorAppender& operator<<(const T& obj)
+    {
+        ::Serialize(*this, obj);
+        return (*this);
+    }
+};
+
+/** CHashWriter resuming from a SHA256 midstate */
+class CMidstateHashWriter
+{
+private:
+    CSHA256 sha;
+
+public:
+    explicit CMidstateHashWriter(const CSHA256& midstate) : sha(midstate) {}
+
+    int GetType() const { return SER_GETHASH; }
+    int GetVersion() const { return 0; }
+
+    void write(const char* pch, size_t size)
+    {
+        sha.Write((const unsigned char*)pch, size);
+    }
+
+    template <typename T>
+    CMidstateHashWriter& operator<<(const T& obj)
+    {
+        ::Serialize(*this, obj);
+        return (*this);
+    }
+
+    // invalidates the object
+    uint256 GetHash()
+    {
+        unsigned char buf[CSHA256::OUTPUT_SIZE];
+        sha.Finalize(buf);
+        uint256 result;
+        CSHA256().Write(buf, CSHA256::OUTPUT_SIZE).Finalize(result.begin());
+        return result;
+    }
+};
+
 } // anon namespace
 
 PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
 {
-    hashPrevouts = GetPrevoutHash(txTo);
-    hashSequence = GetSequenceHash(txTo);
-    hashOutputs = GetOutputsHash(txTo);
+    const size_t nInputs = txTo.vin.size();
+
+    vchBlankInputs.reserve(nInputs * BLANK_INPUT_SIZE);
+    CVectorAppender inputs(vchBlankInputs);
+    for (const CTxIn& txin : txTo.vin)
+        inputs << txin.prevout << CScriptBase() << txin.nSequence;
+    assert(vchBlankInputs.size() == nInputs * BLANK_INPUT_SIZE);
+
+    CVectorAppender outputs(vchOutputs);
+    WriteCompactSize(outputs, txTo.vout.size());
+    for (const CTxOut& txout : txTo.vout)
+        outputs << txout;
+    outputs << txTo.nLockTime;
+
+    std::vector<unsigned char> vchHeader;
+    CVectorAppender header(vchHeader);
+    header << txTo.nVersion;
+    WriteCompactSize(header, nInputs);
+
+    vInputMidstates.reserve(nInputs);
+    CSHA256 sha;
+    sha.Write(vchHeader.data(), vchHeader.size());
+    for (size_t i = 0; i < nInputs; i++) {
+        vInputMidstates.push_back(sha);
+        sha.Write(vchBlankInputs.data() + i * BLANK_INPUT_SIZE, BLANK_INPUT_SIZE);
+    }
 }
 
 uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CAmount& amount, SigVersion sigversion, const PrecomputedTransactionData* cache)
@@ -1125,15 +1208,15 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
         uint256 hashOutputs;
 
         if (!(nHashType & SIGHASH_ANYONECANPAY)) {
-            hashPrevouts = cache ? cache->hashPrevouts : GetPrevoutHash(txTo);
+            hashPrevouts = GetPrevoutHash(txTo);
         }
 
         if (!(nHashType & SIGHASH_ANYONECANPAY) && (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
-            hashSequence = cache ? cache->hashSequence : GetSequenceHash(txTo);
+            hashSequence = GetSequenceHash(txTo);
         }
 
         if ((nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
-            hashOutputs = cache ? cache->hashOutputs : GetOutputsHash(txTo);
+            hashOutputs = GetOutputsHash(txTo);
         } else if ((nHashType & 0x1f) == SIGHASH_SINGLE && nIn < txTo.vout.size()) {
             CHashWriter ss(SER_GETHASH, 0);
             ss << txTo.vout[nIn];
@@ -1174,6 +1257,20 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
+    // All inputs and outputs committed to: resume from the hash of what precedes
+    // the input being signed and append the precomputed serialization of the rest
+    const bool fAllCommitted = !(nHashType & SIGHASH_ANYONECANPAY) &&
+                               (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE;
+    if (fAllCommitted && cache && cache->vInputMidstates.size() == txTo.vin.size()) {
+        CMidstateHashWriter ss(cache->vInputMidstates[nIn]);
+        txTmp.SerializeInput(ss, nIn);
+        const size_t nAfter = (nIn + 1) * PrecomputedTransactionData::BLANK_INPUT_SIZE;
+        ss.write((const char*)cache->vchBlankInputs.data() + nAfter, cache->vchBlankInputs.size() - nAfter);
+        ss.write((const char*)cache->vchOutputs.data(), cache->vchOutputs.size());
+        ss << nHashType;
+        return ss.GetHash();
+    }
+
     // Serialize and hash
     CHashWriter ss(SER_GETHASH, 0);
     ss << txTmp << nHashType;
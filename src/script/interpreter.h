@@ -10,6 +10,7 @@
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
 #include "script_error.h"
+#include "crypto/sha256.h"
 #include "primitives/transaction.h"
 
 #include <vector>
@@ -88,9 +89,22 @@ enum
 
 bool CheckSignatureEncoding(const std::vector<unsigned char> &vchSig, unsigned int flags, ScriptError* serror);
 
+/**
+ * Data shared by the SIGVERSION_BASE signature hashes of all the inputs of a
+ * transaction, for the hash types committing to every input and output
+ * (i.e. neither SIGHASH_ANYONECANPAY, SIGHASH_SINGLE nor SIGHASH_NONE): every
+ * input serialized with a blank script, the outputs and locktime serialized,
+ * and the SHA256 midstate after the version and the inputs before each input.
+ * A signature hash then only serializes the input being signed.
+ */
 struct PrecomputedTransactionData
 {
-    uint256 hashPrevouts, hashSequence, hashOutputs;
+    //! Serialized size of an input with a blank script: prevout, empty script, nSequence
+    static const size_t BLANK_INPUT_SIZE = 32 + 4 + 1 + 4;
+
+    std::vector<CSHA256> vInputMidstates;
+    std::vector<unsigned char> vchBlankInputs;
+    std::vector<unsigned char> vchOutputs;
 
     PrecomputedTransactionData(const CTransaction& tx);
 };
@@ -15,6 +15,7 @@
 #include <ios>
 #include <limits>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string.h>
@@ -579,6 +580,12 @@ template<typename Stream, typename K, typename T, typename Pred, typename A> voi
 template<typename Stream, typename K, typename Pred, typename A> void Serialize(Stream& os, const std::set<K, Pred, A>& m);
 template<typename Stream, typename K, typename Pred, typename A> void Unserialize(Stream& is, std::set<K, Pred, A>& m);
 
+/**
+ * shared_ptr
+ */
+template<typename Stream, typename T> void Serialize(Stream& os, const std::shared_ptr<const T>& p);
+template<typename Stream, typename T> void Unserialize(Stream& os, std::shared_ptr<const T>& p);
+
 
 /**
  * If none of the specialized versions above matched, default to calling member function.
@@ -820,6 +827,25 @@ void Unserialize(Stream& is, std::set<K, Pred, A>& m)
 }
 
 
+
+/**
+ * shared_ptr
+ */
+template<typename Stream, typename T>
+void Serialize(Stream& os, const std::shared_ptr<const T>& p)
+{
+    Serialize(os, *p);
+}
+
+template<typename Stream, typename T>
+void Unserialize(Stream& is, std::shared_ptr<const T>& p)
+{
+    std::shared_ptr<T> obj = std::make_shared<T>();
+    Unserialize(is, *obj);
+    p = std::move(obj);
+}
+
+
 /**
  * Support for ADD_SERIALIZE_METHODS and READWRITE macro
  */
@@ -0,0 +1,544 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "snapshot.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "coinsprefetcher.h"
+#include "consensus/validation.h"
+#include "guiinterface.h"
+#include "init.h"
+#include "main.h"
+#include "streams.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+
+//! Memory of the coins cache of the background validation, flushed when it's full
+static const size_t SNAPSHOT_VALIDATION_COINS_CACHE = 64 << 20;
+//! Cache of the coins database of the background validation
+static const size_t SNAPSHOT_VALIDATION_DB_CACHE = 8 << 20;
+
+CSnapshotHasher::CSnapshotHasher(const uint256& hashBaseBlock) : ss(SER_GETHASH, PROTOCOL_VERSION)
+{
+    ss << hashBaseBlock;
+}
+
+void CSnapshotHasher::Add(const COutPoint& outpoint, const Coin& coin)
+{
+    ss << outpoint << coin;
+}
+
+uint256 CSnapshotHasher::GetHash()
+{
+    return ss.GetHash();
+}
+
+bool DumpTxOutSet(const fs::path& path, CSnapshotMetadata& metadata, uint256& hashSnapshot, std::string& strError)
+{
+    if (fs::exists(path)) {
+        strError = path.string() + " already exists";
+        return false;
+    }
+
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    metadata.SetNull();
+    {
+        LOCK(cs_main);
+        // Write the coins of the tip to the database, and iterate over the
+        // database as it is now while new blocks get connected
+        FlushStateToDisk();
+        pcursor.reset(pcoinsTip->Cursor());
+        BlockMap::const_iterator it = mapBlockIndex.find(pcursor->GetBestBlock());
+        if (it == mapBlockIndex.end()) {
+            strError = "no chainstate to dump";
+            return false;
+        }
+        const CBlockIndex* pindex = it->second;
+        memcpy(metadata.pchMessageStart, Params().MessageStart(), sizeof(metadata.pchMessageStart));
+        metadata.hashBaseBlock = pindex->GetBlockHash();
+        metadata.nBaseHeight = pindex->nHeight;
+        metadata.nChainTx = pindex->nChainTx;
+        metadata.vStakeModifier = pindex->vStakeModifier;
+    }
+
+    const fs::path pathTemp = path.string() + ".incomplete";
+    CAutoFile fileout(fsbridge::fopen(pathTemp, "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull()) {
+        strError = "unable to open " + pathTemp.string() + " for writing";
+        return false;
+    }
+
+    try {
+        fileout << metadata;
+
+        CSnapshotHasher hasher(metadata.hashBaseBlock);
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            COutPoint key;
+            Coin coin;
+            if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+                fileout.fclose();
+                fs::remove(pathTemp);
+                strError = "unable to read the coins database";
+                return false;
+            }
+            hasher.Add(key, coin);
+            fileout << key << coin;
+            metadata.nCoinsCount++;
+            if (!IsBurnedCoin(coin, metadata.nBaseHeight))
+                metadata.nMoneySupply += coin.out.nValue;
+            pcursor->Next();
+        }
+        hashSnapshot = hasher.GetHash();
+
+        // Now that the coins are counted, write the header over the first one
+        if (fseek(fileout.Get(), 0, SEEK_SET) != 0)
+            throw std::ios_base::failure("unable to seek to the start of the file");
+        fileout << metadata;
+        FileCommit(fileout.Get());
+        fileout.fclose();
+    } catch (...) {
+        fileout.fclose();
+        fs::remove(pathTemp);
+        throw;
+    }
+
+    if (!RenameOver(pathTemp, path)) {
+        strError = "unable to rename " + pathTemp.string() + " to " + path.string();
+        return false;
+    }
+
+    LogPrintf("Dumped the UTXO set at height %d (%s) to %s: %u coins, hash %s\n", metadata.nBaseHeight,
+              metadata.hashBaseBlock.ToString(), path.string(), metadata.nCoinsCount, hashSnapshot.ToString());
+    return true;
+}
+
+/** Open a snapshot file at path and read its metadata, leaving the file at the first coin. */
+static bool OpenSnapshot(const fs::path& path, CAutoFile& filein, CSnapshotMetadata& metadata, std::string& strError)
+{
+    if (filein.IsNull()) {
+        strError = "unable to open " + path.string();
+        return false;
+    }
+    try {
+        filein >> metadata;
+    } catch (const std::exception& e) {
+        strError = strprintf("unable to read the metadata of %s: %s", path.string(), e.what());
+        return false;
+    }
+    if (metadata.nVersion != SNAPSHOT_VERSION) {
+        strError = strprintf("unsupported snapshot version %d", metadata.nVersion);
+        return false;
+    }
+    if (memcmp(metadata.pchMessageStart, Params().MessageStart(), sizeof(metadata.pchMessageStart)) != 0) {
+        strError = "the snapshot is of another network";
+        return false;
+    }
+    return true;
+}
+
+bool ReadSnapshotMetadata(const fs::path& path, CSnapshotMetadata& metadata, std::string& strError)
+{
+    CAutoFile filein(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    return OpenSnapshot(path, filein, metadata, strError);
+}
+
+/** Read the coins of a snapshot file opened with OpenSnapshot, passing them to fn, and return their hash. */
+static bool ReadSnapshotCoins(CAutoFile& filein, const CSnapshotMetadata& metadata, const std::function<void(const COutPoint&, Coin&&)>& fn,
+                              uint256& hashSnapshot, std::string& strError)
+{
+    CSnapshotHasher hasher(metadata.hashBaseBlock);
+    try {
+        for (uint64_t i = 0; i < metadata.nCoinsCount; i++) {
+            if (i % 100000 == 0)
+                boost::this_thread::interruption_point();
+            COutPoint outpoint;
+            Coin coin;
+            filein >> outpoint >> coin;
+            if (coin.IsSpent() || coin.nHeight > (uint32_t)metadata.nBaseHeight) {
+                strError = strprintf("bad coin %s in the snapshot", outpoint.ToString());
+                return false;
+            }
+            hasher.Add(outpoint, coin);
+            fn(outpoint, std::move(coin));
+        }
+    } catch (const std::ios_base::failure& e) {
+        strError = strprintf("unable to read the coins of the snapshot: %s", e.what());
+        return false;
+    }
+    hashSnapshot = hasher.GetHash();
+    return true;
+}
+
+/** Replace the coins of pcoinsTip with those of the snapshot, and make its base block the tip. Throws on failure. */
+static void ActivateSnapshot(CAutoFile& filein, const CSnapshotMetadata& metadata, const uint256& hashExpected, CBlockIndex* pindexBase)
+{
+    AssertLockHeld(cs_main);
+
+    // Until the snapshot is fully written, the chainstate is neither the old
+    // one nor the snapshot: -reindex-chainstate is needed after a crash
+    FlushStateToDisk();
+    coinsPrefetcher.Invalidate();
+    pblocktree->WriteFlag("txoutsetloading", true);
+
+    std::unique_ptr<CCoinsViewCursor> pcursor(pcoinsTip->Cursor());
+    while (pcursor->Valid()) {
+        COutPoint key;
+        if (pcursor->GetKey(key))
+            pcoinsTip->SpendCoin(key);
+        if (pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage && !pcoinsTip->Flush())
+            throw std::runtime_error("failed to write to the coins database");
+        pcursor->Next();
+    }
+    pcursor.reset();
+
+    uint256 hashSnapshot;
+    std::string strError;
+    bool fFlushed = true;
+    if (!ReadSnapshotCoins(filein, metadata, [&fFlushed](const COutPoint& outpoint, Coin&& coin) {
+            pcoinsTip->AddCoin(outpoint, std::move(coin), true);
+            if (pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage)
+                fFlushed &= pcoinsTip->Flush();
+        }, hashSnapshot, strError))
+        throw std::runtime_error(strError);
+    if (!fFlushed)
+        throw std::runtime_error("failed to write to the coins database");
+    // The file was checked before, but it was read again
+    if (hashSnapshot != hashExpected)
+        throw std::runtime_error("the snapshot file changed while it was being loaded");
+
+    pcoinsTip->SetBestBlock(pindexBase->GetBlockHash());
+    FlushStateToDisk();
+    coinsPrefetcher.Invalidate();
+    if (pcoinsTip->GetBestBlock() != pindexBase->GetBlockHash())
+        throw std::runtime_error("failed to write to the coins database");
+
+    pblocktree->WriteHash("snapshothash", hashSnapshot);
+    pblocktree->WriteInt("snapshotheight", pindexBase->nHeight);
+    pblocktree->WriteFlag("txoutsetloading", false);
+
+    nMoneySupply = metadata.nMoneySupply;
+    SetSnapshotTip(pindexBase);
+    FlushStateToDisk();
+}
+
+bool LoadTxOutSet(const fs::path& path, CSnapshotMetadata& metadata, std::string& strError)
+{
+    const MapSnapshots& snapshots = Params().Snapshots();
+    uint256 hashSnapshot;
+    {
+        // Check the whole file before touching the chainstate
+        CAutoFile filein(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        if (!OpenSnapshot(path, filein, metadata, strError))
+            return false;
+
+        LogPrintf("Checking the UTXO set snapshot %s at height %d (%s)...\n", path.string(), metadata.nBaseHeight, metadata.hashBaseBlock.ToString());
+        CAmount nSupply = 0;
+        const int nBaseHeight = metadata.nBaseHeight;
+        if (!ReadSnapshotCoins(filein, metadata, [&nSupply, nBaseHeight](const COutPoint&, Coin&& coin) {
+                if (!IsBurnedCoin(coin, nBaseHeight))
+                    nSupply += coin.out.nValue;
+            }, hashSnapshot, strError))
+            return false;
+
+        MapSnapshots::const_iterator it = snapshots.find(metadata.nBaseHeight);
+        if (it == snapshots.end()) {
+            strError = strprintf("no snapshot at height %d is known to this release", metadata.nBaseHeight);
+            return false;
+        }
+        if (hashSnapshot != it->second.hashSerialized) {
+            strError = strprintf("hash %s of the snapshot differs from the one known for height %d", hashSnapshot.ToString(), metadata.nBaseHeight);
+            return false;
+        }
+        if (metadata.nChainTx != it->second.nChainTx || nSupply != metadata.nMoneySupply) {
+            strError = "bad metadata in the snapshot";
+            return false;
+        }
+    }
+
+    CBlockIndex* pindexBase;
+    {
+        LOCK(cs_main);
+        if (nSnapshotHeight > 0) {
+            strError = strprintf("the snapshot at height %d is still being validated", nSnapshotHeight);
+            return false;
+        }
+        BlockMap::const_iterator it = mapBlockIndex.find(metadata.hashBaseBlock);
+        if (it == mapBlockIndex.end() || it->second->nHeight != metadata.nBaseHeight) {
+            strError = strprintf("base block %s of the snapshot not found, its blocks are needed first", metadata.hashBaseBlock.ToString());
+            return false;
+        }
+        pindexBase = it->second;
+        // The blocks up to the base block are connected by the background validation
+        if (pindexBase->nChainTx != metadata.nChainTx || (pindexBase->nStatus & BLOCK_FAILED_MASK)) {
+            strError = "some blocks up to the base block of the snapshot are missing or invalid";
+            return false;
+        }
+        if (pindexBase->vStakeModifier != metadata.vStakeModifier) {
+            strError = "the stake modifier of the snapshot differs from the one of the base block";
+            return false;
+        }
+        const CBlockIndex* pindexTip = chainActive.Tip();
+        if (pindexTip && (pindexTip->nHeight >= pindexBase->nHeight || pindexBase->GetAncestor(pindexTip->nHeight) != pindexTip)) {
+            strError = "the active chain is past the snapshot, or on a fork of it";
+            return false;
+        }
+
+        LogPrintf("Loading the UTXO set snapshot at height %d: %u coins\n", metadata.nBaseHeight, metadata.nCoinsCount);
+        CAutoFile filein(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        CSnapshotMetadata metadataAgain;
+        if (!OpenSnapshot(path, filein, metadataAgain, strError))
+            return false;
+        try {
+            ActivateSnapshot(filein, metadata, hashSnapshot, pindexBase);
+        } catch (const std::exception& e) {
+            // The chainstate is neither the old one nor the snapshot
+            strError = strprintf("failed to load the snapshot: %s", e.what());
+            strMiscWarning = strError;
+            LogPrintf("*** %s\n", strError);
+            uiInterface.ThreadSafeMessageBox(
+                _("Error: Loading the UTXO set snapshot failed, restart with -reindex-chainstate"),
+                "", CClientUIInterface::MSG_ERROR);
+            StartShutdown();
+            return false;
+        }
+    }
+
+    LogPrintf("Loaded the UTXO set snapshot at height %d (%s), validating the blocks up to it in the background\n",
+              metadata.nBaseHeight, metadata.hashBaseBlock.ToString());
+    uiInterface.NotifyBlockTip(IsInitialBlockDownload(), pindexBase);
+    if (!StartSnapshotValidation()) {
+        strError = "failed to start the background validation of the snapshot";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Connects the blocks up to the base block of a loaded snapshot to a separate
+ * chainstate, writing their undo data and indexes, then checks that the coins
+ * it ends up with are those of the snapshot. Resumes from where it stopped.
+ */
+class SnapshotValidation
+{
+private:
+    CBlockIndex* const m_pindexBase;
+    const uint256 m_hashSnapshot;
+    std::unique_ptr<CCoinsViewDB> m_db;
+    std::unique_ptr<CCoinsViewCache> m_view;
+    const CBlockIndex* m_pindexBest = nullptr;
+
+    std::thread m_thread;
+    std::atomic<bool> m_interrupted{false};
+
+    /** Loop of the background thread: connect the blocks up to the base block. */
+    void ThreadValidate();
+    /** Write the coins connected so far, after the undo data of their blocks. */
+    bool Flush();
+    /** Check the coins of the base block against the snapshot. */
+    bool Finish();
+    bool Fail(const std::string& strMessage);
+
+public:
+    SnapshotValidation(CBlockIndex* pindexBase, const uint256& hashSnapshot);
+    ~SnapshotValidation();
+
+    /** Load the best block of the background chainstate, and start the background thread. */
+    bool Start();
+    void Interrupt() { m_interrupted = true; }
+    void Stop();
+};
+
+static std::unique_ptr<SnapshotValidation> g_snapshotvalidation;
+
+SnapshotValidation::SnapshotValidation(CBlockIndex* pindexBase, const uint256& hashSnapshot) :
+    m_pindexBase(pindexBase),
+    m_hashSnapshot(hashSnapshot)
+{
+}
+
+SnapshotValidation::~SnapshotValidation()
+{
+    Stop();
+}
+
+bool SnapshotValidation::Start()
+{
+    m_db.reset(new CCoinsViewDB(SNAPSHOT_VALIDATION_DB_CACHE, false, false, SNAPSHOT_VALIDATION_DIR));
+    const uint256 hashBest = m_db->GetBestBlock();
+    if (hashBest.IsNull() && !m_db->GetHeadBlocks().empty()) {
+        // A flush was interrupted, start over
+        m_db.reset();
+        m_db.reset(new CCoinsViewDB(SNAPSHOT_VALIDATION_DB_CACHE, false, true, SNAPSHOT_VALIDATION_DIR));
+    } else if (!hashBest.IsNull()) {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hashBest);
+        if (it == mapBlockIndex.end() || m_pindexBase->GetAncestor(it->second->nHeight) != it->second)
+            return error("%s: best block %s of the background chainstate is not an ancestor of the snapshot, restart with -reindex-chainstate",
+                         __func__, hashBest.ToString());
+        m_pindexBest = it->second;
+    }
+    m_view.reset(new CCoinsViewCache(m_db.get()));
+
+    LogPrintf("Validating the UTXO set snapshot at height %d in the background, from height %d\n",
+              m_pindexBase->nHeight, m_pindexBest ? m_pindexBest->nHeight + 1 : 0);
+    m_thread = std::thread(&TraceThread<std::function<void()>>, "snapshot",
+                           std::function<void()>(std::bind(&SnapshotValidation::ThreadValidate, this)));
+    return true;
+}
+
+void SnapshotValidation::Stop()
+{
+    if (!m_thread.joinable())
+        return;
+    Interrupt();
+    m_thread.join();
+}
+
+void SnapshotValidation::ThreadValidate()
+{
+    int64_t nLastLogTime = GetTime();
+    try {
+        while (!m_interrupted) {
+            if (m_pindexBest == m_pindexBase) {
+                Finish();
+                return;
+            }
+
+            CBlockIndex* pindex = m_pindexBase->GetAncestor(m_pindexBest ? m_pindexBest->nHeight + 1 : 0);
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindex)) {
+                Fail(strprintf("failed to read block %s from disk", pindex->GetBlockHash().ToString()));
+                return;
+            }
+
+            {
+                LOCK(cs_main);
+                CValidationState state;
+                if (!CheckBlock(block, state) || !ConnectBlock(block, state, pindex, *m_view, false, true, false)) {
+                    Fail(strprintf("block %s at height %d is invalid: %s", pindex->GetBlockHash().ToString(), pindex->nHeight, FormatStateMessage(state)));
+                    return;
+                }
+            }
+            m_pindexBest = pindex;
+
+            if (m_view->DynamicMemoryUsage() > SNAPSHOT_VALIDATION_COINS_CACHE && !Flush()) {
+                Fail("failed to write the background chainstate");
+                return;
+            }
+            if (GetTime() - nLastLogTime >= 30) {
+                LogPrintf("Validating the UTXO set snapshot at height %d in the background: height %d\n", m_pindexBase->nHeight, pindex->nHeight);
+                nLastLogTime = GetTime();
+            }
+        }
+        Flush();
+    } catch (const std::exception& e) {
+        Fail(e.what());
+    }
+}
+
+bool SnapshotValidation::Flush()
+{
+    // The block index must point to the undo data of the blocks connected first
+    FlushStateToDisk();
+    return m_view->Flush();
+}
+
+bool SnapshotValidation::Finish()
+{
+    if (!Flush())
+        return Fail("failed to write the background chainstate");
+
+    LogPrintf("Background validation reached the UTXO set snapshot at height %d, checking its coins...\n", m_pindexBase->nHeight);
+    CSnapshotHasher hasher(m_pindexBase->GetBlockHash());
+    std::unique_ptr<CCoinsViewCursor> pcursor(m_db->Cursor());
+    for (; pcursor->Valid(); pcursor->Next()) {
+        if (m_interrupted)
+            return false;
+        COutPoint key;
+        Coin coin;
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin))
+            return Fail("unable to read the background chainstate");
+        hasher.Add(key, coin);
+    }
+    pcursor.reset();
+    const uint256 hashSnapshot = hasher.GetHash();
+    if (hashSnapshot != m_hashSnapshot)
+        return Fail(strprintf("the coins at height %d hash to %s instead of %s", m_pindexBase->nHeight, hashSnapshot.ToString(), m_hashSnapshot.ToString()));
+
+    {
+        // Every block of the chain has its undo data and indexes now
+        LOCK(cs_main);
+        nSnapshotHeight = 0;
+        pblocktree->WriteInt("snapshotheight", 0);
+    }
+    m_view.reset();
+    m_db.reset();
+    fs::remove_all(GetDataDir() / SNAPSHOT_VALIDATION_DIR);
+    LogPrintf("UTXO set snapshot at height %d validated\n", m_pindexBase->nHeight);
+    return true;
+}
+
+bool SnapshotValidation::Fail(const std::string& strMessage)
+{
+    strMiscWarning = "Validation of the UTXO set snapshot failed: " + strMessage;
+    LogPrintf("*** %s\n", strMiscWarning);
+    uiInterface.ThreadSafeMessageBox(
+        _("Error: Validation of the UTXO set snapshot failed, see debug.log for details. Restart with -reindex-chainstate to validate the chain from the genesis block."),
+        "", CClientUIInterface::MSG_ERROR);
+    StartShutdown();
+    return false;
+}
+
+bool StartSnapshotValidation()
+{
+    // The validation of a previous snapshot may be done, but not stopped yet
+    StopSnapshotValidation();
+
+    CBlockIndex* pindexBase = nullptr;
+    uint256 hashSnapshot;
+    {
+        LOCK(cs_main);
+        if (nSnapshotHeight > 0) {
+            pindexBase = chainActive[nSnapshotHeight];
+            if (!pindexBase || !pblocktree->ReadHash("snapshothash", hashSnapshot))
+                return error("%s: the UTXO set snapshot at height %d is not in the active chain", __func__, nSnapshotHeight);
+        }
+    }
+
+    if (!pindexBase) {
+        // Left over by a validation made moot by -reindex-chainstate
+        if (fs::exists(GetDataDir() / SNAPSHOT_VALIDATION_DIR))
+            fs::remove_all(GetDataDir() / SNAPSHOT_VALIDATION_DIR);
+        return true;
+    }
+
+    g_snapshotvalidation.reset(new SnapshotValidation(pindexBase, hashSnapshot));
+    if (!g_snapshotvalidation->Start()) {
+        g_snapshotvalidation.reset();
+        return false;
+    }
+    return true;
+}
+
+void InterruptSnapshotValidation()
+{
+    if (g_snapshotvalidation)
+        g_snapshotvalidation->Interrupt();
+}
+
+void StopSnapshotValidation()
+{
+    if (g_snapshotvalidation) {
+        g_snapshotvalidation->Stop();
+        g_snapshotvalidation.reset();
+    }
+}
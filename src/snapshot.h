@@ -0,0 +1,122 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PIVX_SNAPSHOT_H
+#define PIVX_SNAPSHOT_H
+
+#include "amount.h"
+#include "fs.h"
+#include "hash.h"
+#include "protocol.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+class Coin;
+class COutPoint;
+
+/** Version of the UTXO set snapshot files written by dumptxoutset */
+static const int SNAPSHOT_VERSION = 1;
+
+/** Directory of the chainstate the blocks up to a loaded snapshot are connected to in the background */
+static const char* const SNAPSHOT_VALIDATION_DIR = "chainstate_background";
+
+/**
+ * Header of a UTXO set snapshot file, followed by nCoinsCount pairs of
+ * outpoint and coin in the order of the coins database.
+ */
+class CSnapshotMetadata
+{
+public:
+    int nVersion;
+    CMessageHeader::MessageStartChars pchMessageStart;
+    uint256 hashBaseBlock;
+    int nBaseHeight;
+    uint64_t nChainTx;
+    uint64_t nCoinsCount;
+    //! Value of the coins, those of the burn addresses aside
+    CAmount nMoneySupply;
+    //! Stake modifier of the base block, checked against the block index
+    std::vector<unsigned char> vStakeModifier;
+
+    CSnapshotMetadata()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        nVersion = SNAPSHOT_VERSION;
+        memset(pchMessageStart, 0, sizeof(pchMessageStart));
+        hashBaseBlock.SetNull();
+        nBaseHeight = 0;
+        nChainTx = 0;
+        nCoinsCount = 0;
+        nMoneySupply = 0;
+        vStakeModifier.clear();
+    }
+
+    // Fixed width fields: the header is written again once the coins are counted
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(nVersion);
+        READWRITE(FLATDATA(pchMessageStart));
+        READWRITE(hashBaseBlock);
+        READWRITE(nBaseHeight);
+        READWRITE(nChainTx);
+        READWRITE(nCoinsCount);
+        READWRITE(nMoneySupply);
+        READWRITE(vStakeModifier);
+    }
+};
+
+/**
+ * Hash of a UTXO set snapshot, as pinned in the chain parameters: the base
+ * block hash, then every outpoint and coin in the order of the coins database.
+ */
+class CSnapshotHasher
+{
+private:
+    CHashWriter ss;
+
+public:
+    explicit CSnapshotHasher(const uint256& hashBaseBlock);
+
+    void Add(const COutPoint& outpoint, const Coin& coin);
+    uint256 GetHash();
+};
+
+/**
+ * Write the coins of the active chain tip to a snapshot file at path, which
+ * must not exist yet. Returns the metadata written and the snapshot hash.
+ */
+bool DumpTxOutSet(const fs::path& path, CSnapshotMetadata& metadata, uint256& hashSnapshot, std::string& strError);
+
+/** Read the metadata of the snapshot file at path. */
+bool ReadSnapshotMetadata(const fs::path& path, CSnapshotMetadata& metadata, std::string& strError);
+
+/**
+ * Replace the chainstate with the snapshot file at path, whose hash must be
+ * the one pinned for its height in the chain parameters, and make its base
+ * block the tip of the active chain. The blocks of the chain up to the base
+ * block must be in the block files already; they are connected again to a
+ * separate chainstate by a background thread, until the coins it ends up with
+ * are checked to be those of the snapshot.
+ */
+bool LoadTxOutSet(const fs::path& path, CSnapshotMetadata& metadata, std::string& strError);
+
+/** Start the background validation of the loaded snapshot, if there's one not validated yet. */
+bool StartSnapshotValidation();
+/** Ask the background validation to stop. */
+void InterruptSnapshotValidation();
+/** Stop the background validation and wait for it, keeping its progress. */
+void StopSnapshotValidation();
+
+#endif // PIVX_SNAPSHOT_H
@@ -54,7 +54,6 @@ std::vector<CSporkDef> sporkDefs = {
 };
 
 CSporkManager sporkManager;
-std::map<uint256, CSporkMessage> mapSporks;
 
 CSporkManager::CSporkManager()
 {
@@ -82,8 +81,11 @@ void CSporkManager::LoadSporksFromDB()
         }
 
         // add spork to memory
-        mapSporks[spork.GetHash()] = spork;
-        mapSporksActive[spork.nSporkID] = spork;
+        {
+            LOCK(cs);
+            mapSporksByHash[spork.GetHash()] = spork;
+            mapSporksActive[spork.nSporkID] = spork;
+        }
         std::time_t result = spork.nValue;
         // If SPORK Value is greater than 1,000,000 assume it's actually a Date and then convert to a more readable format
         std::string sporkName = sporkManager.GetSporkNameByID(spork.nSporkID);
@@ -112,7 +114,6 @@ void CSporkManager::ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStr
 
         // Do not accept sporks signed way too far into the future
         if (spork.nTimeSigned > GetAdjustedTime() + 2 * 60 * 60) {
-            LOCK(cs_main);
             LogPrintf("%s : ERROR: too far into the future\n", __func__);
             Misbehaving(pfrom->GetId(), 100);
             return;
@@ -162,7 +163,6 @@ void CSporkManager::ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStr
         }
 
         if (!fValidSig) {
-            LOCK(cs_main);
             LogPrintf("%s : Invalid Signature\n", __func__);
             Misbehaving(pfrom->GetId(), 100);
             return;
@@ -170,7 +170,7 @@ void CSporkManager::ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStr
 
         {
             LOCK(cs);
-            mapSporks[hash] = spork;
+            mapSporksByHash[hash] = spork;
             mapSporksActive[spork.nSporkID] = spork;
         }
         spork.Relay();
@@ -200,7 +200,7 @@ bool CSporkManager::UpdateSpork(SporkId nSporkID, int64_t nValue)
     if(spork.Sign(strMasterPrivKey)){
         spork.Relay();
         LOCK(cs);
-        mapSporks[spork.GetHash()] = spork;
+        mapSporksByHash[spork.GetHash()] = spork;
         mapSporksActive[nSporkID] = spork;
         return true;
     }
@@ -208,6 +208,22 @@ bool CSporkManager::UpdateSpork(SporkId nSporkID, int64_t nValue)
     return false;
 }
 
+bool CSporkManager::HaveSpork(const uint256& hash) const
+{
+    LOCK(cs);
+    return mapSporksByHash.count(hash);
+}
+
+bool CSporkManager::GetSporkByHash(const uint256& hash, CSporkMessage& sporkRet) const
+{
+    LOCK(cs);
+    const auto it = mapSporksByHash.find(hash);
+    if (it == mapSporksByHash.end())
+        return false;
+    sporkRet = it->second;
+    return true;
+}
+
 // grab the spork value, and see if it's off
 bool CSporkManager::IsSporkActive(SporkId nSporkID)
 {
@@ -1436,9 +1452,9 @@ void CTxFilterManager::BuildTxFilter()
         for (unsigned int i = 0; i < referenceBlock.vtx.size(); i++) {
             // The mask can support up to 32 transaction indexes (as it is 32-bit)
             if (((sporkMask >> i) & 0x1) != 0) {
-                for (unsigned int j = 0; j < referenceBlock.vtx[i].vout.size(); j++) {
-                    if (referenceBlock.vtx[i].vout[j].nValue > 0) {
-                        ExtractDestination(referenceBlock.vtx[i].vout[j].scriptPubKey, Dest);
+                for (unsigned int j = 0; j < referenceBlock.vtx[i]->vout.size(); j++) {
+                    if (referenceBlock.vtx[i]->vout[j].nValue > 0) {
+                        ExtractDestination(referenceBlock.vtx[i]->vout[j].scriptPubKey, Dest);
                         Address = EncodeDestination(Dest);
                         auto it  = mapFilterAddress.emplace(Address, referenceBlock.GetBlockTime());
                         nAddressCount++;
@@ -26,7 +26,6 @@ class CSporkManager;
 class CTxFilterManager;
 
 extern std::vector<CSporkDef> sporkDefs;
-extern std::map<uint256, CSporkMessage> mapSporks;
 extern CSporkManager sporkManager;
 
 //
@@ -107,6 +106,8 @@ private:
     std::map<SporkId, CSporkDef*> sporkDefsById;
     std::map<std::string, CSporkDef*> sporkDefsByName;
     std::map<SporkId, CSporkMessage> mapSporksActive;
+    // all the spork messages received, by hash, for relay
+    std::map<uint256, CSporkMessage> mapSporksByHash;
 
 public:
     CSporkManager();
@@ -128,6 +129,9 @@ public:
     void ExecuteSpork(SporkId nSporkID, int nValue);
     bool UpdateSpork(SporkId nSporkID, int64_t nValue);
 
+    bool HaveSpork(const uint256& hash) const;
+    bool GetSporkByHash(const uint256& hash, CSporkMessage& sporkRet) const;
+
     bool IsSporkActive(SporkId nSporkID);
     std::string GetSporkNameByID(SporkId id);
     SporkId GetSporkIDByName(std::string strName);
@@ -0,0 +1,252 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PIVX_SUPPORT_ALLOCATORS_POOL_H
+#define PIVX_SUPPORT_ALLOCATORS_POOL_H
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * A memory resource that hands out small blocks from large chunks, for node based
+ * containers that allocate one node at a time (e.g. std::unordered_map).
+ *
+ * Blocks of up to MAX_BLOCK_SIZE_BYTES are carved out of chunks of chunk_size_bytes,
+ * rounded up to a multiple of ALIGN_BYTES. Freed blocks are kept in one singly linked
+ * free list per size, and are reused by the next allocation of the same size. Memory
+ * is only given back to the system when the resource is destroyed, all at once.
+ * Chunks are allocated on demand, the first one on the first allocation.
+ *
+ * Larger blocks (e.g. the bucket array of a hash map) are forwarded to operator new.
+ *
+ * This makes allocations and deallocations a few instructions in the common case,
+ * removes the per-allocation overhead of malloc, and allows computing the exact
+ * amount of memory used (see memusage::DynamicUsage).
+ *
+ * The resource is not thread safe, and must outlive all containers using it.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource
+{
+    static_assert(ALIGN_BYTES > 0 && (ALIGN_BYTES & (ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two");
+    static_assert(ALIGN_BYTES <= alignof(std::max_align_t), "operator new does not guarantee more than max_align_t alignment");
+
+    /** A free block, with the pointer to the next free block of the same size stored in place. */
+    struct ListNode {
+        ListNode* m_next;
+        explicit ListNode(ListNode* next) : m_next(next) {}
+    };
+    static_assert(std::is_trivially_destructible<ListNode>::value, "ListNode is never destroyed");
+
+    /** Internally, all sizes are multiples of ELEM_ALIGN_BYTES, large enough to store a ListNode. */
+    static constexpr std::size_t ELEM_ALIGN_BYTES = ALIGN_BYTES > alignof(ListNode) ? ALIGN_BYTES : alignof(ListNode);
+    static_assert(ELEM_ALIGN_BYTES >= sizeof(ListNode), "blocks must be able to hold a ListNode");
+    static_assert(MAX_BLOCK_SIZE_BYTES >= ELEM_ALIGN_BYTES, "MAX_BLOCK_SIZE_BYTES too small");
+    static_assert(MAX_BLOCK_SIZE_BYTES % ELEM_ALIGN_BYTES == 0, "MAX_BLOCK_SIZE_BYTES must be a multiple of the alignment");
+
+    /** Index of the free list for blocks of bytes bytes, assuming bytes is at most MAX_BLOCK_SIZE_BYTES. */
+    static constexpr std::size_t NumElemAlignBytes(std::size_t bytes)
+    {
+        return (bytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + (bytes == 0);
+    }
+
+    /** Whether an allocation of bytes with alignment alignment can be served by the pool. */
+    static constexpr bool IsFreeListUsable(std::size_t bytes, std::size_t alignment)
+    {
+        return alignment <= ELEM_ALIGN_BYTES && bytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    /** Free lists, indexed by block size in multiples of ELEM_ALIGN_BYTES. */
+    std::array<ListNode*, MAX_BLOCK_SIZE_BYTES / ELEM_ALIGN_BYTES + 1> m_free_lists;
+
+    /** All chunks allocated so far, released in the destructor. */
+    std::list<void*> m_allocated_chunks;
+
+    const std::size_t m_chunk_size_bytes;
+
+    /** Total size of the blocks in the free lists. */
+    std::size_t m_free_list_bytes = 0;
+
+    /** The part of the current chunk that has not been handed out yet. */
+    char* m_available_memory_it = nullptr;
+    char* m_available_memory_end = nullptr;
+
+    /** Push the block of num_alignments * ELEM_ALIGN_BYTES bytes at p onto its free list. */
+    void PlacementAddToList(void* p, std::size_t num_alignments)
+    {
+        m_free_lists[num_alignments] = new (p) ListNode{m_free_lists[num_alignments]};
+        m_free_list_bytes += num_alignments * ELEM_ALIGN_BYTES;
+    }
+
+    /**
+     * Allocate a new chunk. The remainder of the current chunk, if any, is put
+     * in the free list of its size so it isn't wasted.
+     */
+    void AllocateChunk()
+    {
+        if (m_available_memory_end != m_available_memory_it) {
+            const std::size_t remaining = m_available_memory_end - m_available_memory_it;
+            PlacementAddToList(m_available_memory_it, remaining / ELEM_ALIGN_BYTES);
+        }
+        void* storage = ::operator new(m_chunk_size_bytes);
+        m_available_memory_it = static_cast<char*>(storage);
+        m_available_memory_end = m_available_memory_it + m_chunk_size_bytes;
+        m_allocated_chunks.emplace_back(storage);
+    }
+
+public:
+    /** Number of bytes in a chunk, when not specified. */
+    static constexpr std::size_t DEFAULT_CHUNK_SIZE_BYTES = 256 << 10;
+
+    explicit PoolResource(std::size_t chunk_size_bytes = DEFAULT_CHUNK_SIZE_BYTES)
+        : m_chunk_size_bytes(NumElemAlignBytes(chunk_size_bytes) * ELEM_ALIGN_BYTES)
+    {
+        assert(m_chunk_size_bytes >= MAX_BLOCK_SIZE_BYTES);
+        m_free_lists.fill(nullptr);
+        // The first chunk is allocated on first use, so that short lived
+        // containers that stay empty don't cost a chunk.
+    }
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    /** Release all the memory at once. Nothing allocated from the resource may be used afterwards. */
+    ~PoolResource()
+    {
+        for (void* chunk : m_allocated_chunks) {
+            ::operator delete(chunk);
+        }
+    }
+
+    /** Allocate bytes bytes with the given alignment, from the pool when possible. */
+    void* Allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (IsFreeListUsable(bytes, alignment)) {
+            const std::size_t num_alignments = NumElemAlignBytes(bytes);
+            if (m_free_lists[num_alignments] != nullptr) {
+                // reuse a block freed earlier
+                ListNode* node = m_free_lists[num_alignments];
+                m_free_lists[num_alignments] = node->m_next;
+                m_free_list_bytes -= num_alignments * ELEM_ALIGN_BYTES;
+                return node;
+            }
+            const std::size_t round_bytes = num_alignments * ELEM_ALIGN_BYTES;
+            if (round_bytes > static_cast<std::size_t>(m_available_memory_end - m_available_memory_it)) {
+                AllocateChunk();
+            }
+            void* p = m_available_memory_it;
+            m_available_memory_it += round_bytes;
+            return p;
+        }
+        return ::operator new(bytes);
+    }
+
+    /** Give back a block obtained from Allocate() with the same bytes and alignment. */
+    void Deallocate(void* p, std::size_t bytes, std::size_t alignment) noexcept
+    {
+        if (IsFreeListUsable(bytes, alignment)) {
+            PlacementAddToList(p, NumElemAlignBytes(bytes));
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+    /** Number of chunks allocated from the system so far. */
+    std::size_t NumAllocatedChunks() const
+    {
+        return m_allocated_chunks.size();
+    }
+
+    /** Size of a chunk, in bytes. */
+    std::size_t ChunkSizeBytes() const
+    {
+        return m_chunk_size_bytes;
+    }
+
+    /**
+     * Number of bytes in the free lists: allocated from the system, but not in
+     * use and available to the next allocations of the same size.
+     */
+    std::size_t FreeListBytes() const
+    {
+        return m_free_list_bytes;
+    }
+
+    /**
+     * Number of bytes allocated from the system but not in use: the free lists,
+     * and the part of the current chunk not handed out yet.
+     */
+    std::size_t UnusedBytes() const
+    {
+        return m_free_list_bytes + static_cast<std::size_t>(m_available_memory_end - m_available_memory_it);
+    }
+};
+
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+constexpr std::size_t PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>::DEFAULT_CHUNK_SIZE_BYTES;
+
+/**
+ * Standard allocator that allocates from a PoolResource. The resource is not owned,
+ * so copies of the allocator (e.g. those rebound to the node type of a container)
+ * share it.
+ */
+template <class T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES = alignof(T)>
+class PoolAllocator
+{
+    PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>* m_resource;
+
+    template <typename U, std::size_t M, std::size_t A>
+    friend class PoolAllocator;
+
+public:
+    typedef T value_type;
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    PoolAllocator(ResourceType* resource) noexcept : m_resource(resource) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) noexcept : m_resource(other.resource()) {}
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(m_resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        m_resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ResourceType* resource() const noexcept
+    {
+        return m_resource;
+    }
+};
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return a.resource() == b.resource();
+}
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return !(a == b);
+}
+
+#endif // PIVX_SUPPORT_ALLOCATORS_POOL_H
@@ -27,6 +27,79 @@ void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 }
 #endif /* DEBUG_LOCKCONTENTION */
 
+/**
+ * Registry of the lock sites. Leaked on exit like g_logger, locks are still
+ * taken by destructors of other globals.
+ */
+static std::mutex& LockSitesMutex()
+{
+    static std::mutex* const mutex = new std::mutex();
+    return *mutex;
+}
+
+static std::vector<CLockSiteStats*>& LockSites()
+{
+    static std::vector<CLockSiteStats*>* const sites = new std::vector<CLockSiteStats*>();
+    return *sites;
+}
+
+CLockSiteStats::CLockSiteStats(const char* pszNameIn, const char* pszFileIn, int nLineIn) : pszName(pszNameIn), pszFile(pszFileIn), nLine(nLineIn)
+{
+    for (auto& bucket : nHoldHistogram)
+        bucket.store(0, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(LockSitesMutex());
+    LockSites().push_back(this);
+}
+
+void CLockSiteStats::AddWait(int64_t nMicros)
+{
+    const uint64_t nWait = nMicros > 0 ? nMicros : 0;
+    nContended.fetch_add(1, std::memory_order_relaxed);
+    nWaitMicros.fetch_add(nWait, std::memory_order_relaxed);
+    uint64_t nMax = nMaxWaitMicros.load(std::memory_order_relaxed);
+    while (nWait > nMax && !nMaxWaitMicros.compare_exchange_weak(nMax, nWait, std::memory_order_relaxed)) {}
+}
+
+void CLockSiteStats::AddHold(int64_t nMicros)
+{
+    int nBucket = 0;
+    for (int64_t nLimit = 10; nBucket < HOLD_BUCKETS - 1 && nMicros >= nLimit; nLimit *= 10)
+        nBucket++;
+    nHoldHistogram[nBucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void CLockSiteStats::Reset()
+{
+    nAcquisitions.store(0, std::memory_order_relaxed);
+    nContended.store(0, std::memory_order_relaxed);
+    nWaitMicros.store(0, std::memory_order_relaxed);
+    nMaxWaitMicros.store(0, std::memory_order_relaxed);
+    for (auto& bucket : nHoldHistogram)
+        bucket.store(0, std::memory_order_relaxed);
+}
+
+CLockSiteStats::Counters CLockSiteStats::Read(bool fReset)
+{
+    // exchange, so nothing counted between reading and resetting is lost
+    auto read = [fReset](std::atomic<uint64_t>& counter) {
+        return fReset ? counter.exchange(0, std::memory_order_relaxed) : counter.load(std::memory_order_relaxed);
+    };
+    Counters counters;
+    counters.nAcquisitions = read(nAcquisitions);
+    counters.nContended = read(nContended);
+    counters.nWaitMicros = read(nWaitMicros);
+    counters.nMaxWaitMicros = read(nMaxWaitMicros);
+    for (int i = 0; i < HOLD_BUCKETS; i++)
+        counters.nHoldHistogram[i] = read(nHoldHistogram[i]);
+    return counters;
+}
+
+std::vector<CLockSiteStats*> GetLockSiteStats()
+{
+    std::lock_guard<std::mutex> lock(LockSitesMutex());
+    return LockSites();
+}
+
 #ifdef DEBUG_LOCKORDER
 //
 // Early deadlock detection.
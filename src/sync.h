@@ -12,9 +12,13 @@
 #include "threadsafety.h"
 #include "util/macros.h"
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <stdint.h>
 #include <thread>
 #include <mutex>
+#include <vector>
 
 
 /////////////////////////////////////////////////
@@ -117,22 +121,85 @@ typedef AnnotatedMixin<std::mutex> Mutex;
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/** Hold times are measured for one in this many acquisitions of a lock site */
+static const uint64_t LOCK_HOLD_SAMPLE_INTERVAL = 64;
+
+/**
+ * Contention counters of one LOCK/TRY_LOCK/WAIT_LOCK site, always enabled.
+ * Every acquisition is counted, the wait is timed only when the mutex was
+ * not immediately available and hold times are sampled, so an uncontended
+ * acquisition costs a single relaxed atomic increment.
+ */
+class CLockSiteStats
+{
+public:
+    //! Hold time histogram buckets: < 10us, < 100us, < 1ms, < 10ms, < 100ms, < 1s, >= 1s
+    static const int HOLD_BUCKETS = 7;
+
+    const char* const pszName;
+    const char* const pszFile;
+    const int nLine;
+
+    std::atomic<uint64_t> nAcquisitions{0};
+    std::atomic<uint64_t> nContended{0};
+    std::atomic<uint64_t> nWaitMicros{0};
+    std::atomic<uint64_t> nMaxWaitMicros{0};
+    std::atomic<uint64_t> nHoldHistogram[HOLD_BUCKETS];
+
+    //! Plain copy of the counters, they keep changing while they are reported
+    struct Counters {
+        uint64_t nAcquisitions;
+        uint64_t nContended;
+        uint64_t nWaitMicros;
+        uint64_t nMaxWaitMicros;
+        uint64_t nHoldHistogram[HOLD_BUCKETS];
+    };
+
+    //! Registers the site, see GetLockSiteStats()
+    CLockSiteStats(const char* pszNameIn, const char* pszFileIn, int nLineIn);
+
+    void AddWait(int64_t nMicros);
+    void AddHold(int64_t nMicros);
+    void Reset();
+    //! Copy the counters, zeroing each one as it is read if fReset is set
+    Counters Read(bool fReset);
+
+    static int64_t NowMicros()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+/** All the lock sites that were entered at least once */
+std::vector<CLockSiteStats*> GetLockSiteStats();
+
 /** Wrapper around std::unique_lock style lock for Mutex. */
 template <typename Mutex, typename Base = typename Mutex::UniqueLock>
 class SCOPED_LOCKABLE UniqueLock  : public Base
 {
 private:
+    CLockSiteStats* m_site{nullptr};
+    int64_t m_hold_start{0};
+
+    void Acquired()
+    {
+        if (m_site && m_site->nAcquisitions.fetch_add(1, std::memory_order_relaxed) % LOCK_HOLD_SAMPLE_INTERVAL == 0)
+            m_hold_start = CLockSiteStats::NowMicros();
+    }
+
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(Base::mutex()));
-#ifdef DEBUG_LOCKCONTENTION
         if (!Base::try_lock()) {
+#ifdef DEBUG_LOCKCONTENTION
             PrintLockContention(pszName, pszFile, nLine);
 #endif
-        Base::lock();
-#ifdef DEBUG_LOCKCONTENTION
+            const int64_t nWaitStart = m_site ? CLockSiteStats::NowMicros() : 0;
+            Base::lock();
+            if (m_site)
+                m_site->AddWait(CLockSiteStats::NowMicros() - nWaitStart);
         }
-#endif
+        Acquired();
     }
 
     bool TryEnter(const char* pszName, const char* pszFile, int nLine)
@@ -141,11 +208,13 @@ private:
         Base::try_lock();
         if (!Base::owns_lock())
             LeaveCritical();
+        else
+            Acquired();
         return Base::owns_lock();
     }
 
 public:
-    UniqueLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : Base(mutexIn, std::defer_lock)
+    UniqueLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false, CLockSiteStats* pSite = nullptr) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : Base(mutexIn, std::defer_lock), m_site(pSite)
     {
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
@@ -153,7 +222,7 @@ public:
             Enter(pszName, pszFile, nLine);
     }
 
-    UniqueLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(pmutexIn)
+    UniqueLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false, CLockSiteStats* pSite = nullptr) EXCLUSIVE_LOCK_FUNCTION(pmutexIn) : m_site(pSite)
     {
         if (!pmutexIn) return;
 
@@ -166,8 +235,12 @@ public:
 
     ~UniqueLock() UNLOCK_FUNCTION()
     {
-        if (Base::owns_lock())
+        if (Base::owns_lock()) {
+            // includes the time released in condition variable waits, the histogram is an upper bound
+            if (m_hold_start)
+                m_site->AddHold(CLockSiteStats::NowMicros() - m_hold_start);
             LeaveCritical();
+        }
     }
 
     operator bool()
@@ -179,16 +252,19 @@ public:
 template<typename MutexArg>
 using DebugLock = UniqueLock<typename std::remove_reference<typename std::remove_pointer<MutexArg>::type>::type>;
 
-#define LOCK(cs) DebugLock<decltype(cs)> PASTE2(criticalblock, __COUNTER__)(cs, #cs, __FILE__, __LINE__)
+//! The statistics of the lock site this is expanded at, created on first use
+#define LOCK_SITE(cs) ([]() -> CLockSiteStats* { static CLockSiteStats site(#cs, __FILE__, __LINE__); return &site; }())
+
+#define LOCK(cs) DebugLock<decltype(cs)> PASTE2(criticalblock, __COUNTER__)(cs, #cs, __FILE__, __LINE__, false, LOCK_SITE(cs))
 #define LOCK2(cs1, cs2)                                               \
-    DebugLock<decltype(cs1)> criticalblock1(cs1, #cs1, __FILE__, __LINE__); \
-    DebugLock<decltype(cs2)> criticalblock2(cs2, #cs2, __FILE__, __LINE__);
+    DebugLock<decltype(cs1)> criticalblock1(cs1, #cs1, __FILE__, __LINE__, false, LOCK_SITE(cs1)); \
+    DebugLock<decltype(cs2)> criticalblock2(cs2, #cs2, __FILE__, __LINE__, false, LOCK_SITE(cs2));
 #define LOCK3(cs1, cs2, cs3)                                               \
-    DebugLock<decltype(cs1)> criticalblock1(cs1, #cs1, __FILE__, __LINE__); \
-    DebugLock<decltype(cs2)> criticalblock2(cs2, #cs2, __FILE__, __LINE__); \
-    DebugLock<decltype(cs3)> criticalblock3(cs3, #cs3, __FILE__, __LINE__);
-#define TRY_LOCK(cs, name) DebugLock<decltype(cs)> name(cs, #cs, __FILE__, __LINE__, true)
-#define WAIT_LOCK(cs, name) DebugLock<decltype(cs)> name(cs, #cs, __FILE__, __LINE__)
+    DebugLock<decltype(cs1)> criticalblock1(cs1, #cs1, __FILE__, __LINE__, false, LOCK_SITE(cs1)); \
+    DebugLock<decltype(cs2)> criticalblock2(cs2, #cs2, __FILE__, __LINE__, false, LOCK_SITE(cs2)); \
+    DebugLock<decltype(cs3)> criticalblock3(cs3, #cs3, __FILE__, __LINE__, false, LOCK_SITE(cs3));
+#define TRY_LOCK(cs, name) DebugLock<decltype(cs)> name(cs, #cs, __FILE__, __LINE__, true, LOCK_SITE(cs))
+#define WAIT_LOCK(cs, name) DebugLock<decltype(cs)> name(cs, #cs, __FILE__, __LINE__, false, LOCK_SITE(cs))
 
 #define ENTER_CRITICAL_SECTION(cs)                            \
     {                                                         \
@@ -0,0 +1,90 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockstats.h"
+
+#include "masternode.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "undo.h"
+
+#include "test/test_pivx.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockstats_tests, BasicTestingSetup)
+
+// Add a transaction spending a coin of nValueIn and paying nValueIn - nFee
+static CTransactionRef AddTx(CBlock& block, CBlockUndo& blockundo, CAmount nValueIn, CAmount nFee)
+{
+    CMutableTransaction tx;
+    tx.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+    tx.vout.emplace_back(nValueIn - nFee, CScript() << OP_TRUE);
+    block.vtx.push_back(MakeTransactionRef(tx));
+    blockundo.vtxundo.emplace_back();
+    blockundo.vtxundo.back().vprevout.emplace_back(CTxOut(nValueIn, CScript() << OP_TRUE), 1, false, false);
+    return block.vtx.back();
+}
+
+BOOST_AUTO_TEST_CASE(compute_block_stats)
+{
+    const int nHeight = 1000;
+    const CAmount nSubsidy = CMasternode::GetBlockValue(nHeight);
+    const CAmount nMasternodePayment = CMasternode::GetMasternodePayment(nHeight);
+    const CScript payee = CScript() << OP_2;
+
+    CBlock block;
+    CBlockUndo blockundo;
+    block.vtx.emplace_back();
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(AddTx(block, blockundo, 10 * COIN, 3000));
+    vtx.push_back(AddTx(block, blockundo, 20 * COIN, 1000));
+    vtx.push_back(AddTx(block, blockundo, 30 * COIN, 2000));
+    const CAmount nFees = 6000;
+
+    // proof of work: the coinbase collects the fees
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    coinbase.vout.emplace_back(nSubsidy - nMasternodePayment + nFees, CScript() << OP_TRUE);
+    coinbase.vout.emplace_back(nMasternodePayment, payee);
+    block.vtx[0] = MakeTransactionRef(coinbase);
+
+    CBlockStats stats;
+    ComputeBlockStats(block, blockundo, nHeight, stats);
+    BOOST_CHECK(stats.hashBlock == block.GetHash());
+    BOOST_CHECK_EQUAL(stats.nTxCount, 4U);
+    BOOST_CHECK_EQUAL(stats.GetUserTxCount(), 3U);
+    BOOST_CHECK_EQUAL(stats.nFees, nFees);
+
+    uint64_t nTxBytes = 0;
+    std::vector<CAmount> vFeeRates;
+    for (unsigned int i = 0; i < vtx.size(); i++) {
+        const unsigned int nSize = ::GetSerializeSize(*vtx[i], SER_NETWORK, CLIENT_VERSION);
+        nTxBytes += nSize;
+        vFeeRates.push_back(CFeeRate(i == 0 ? 3000 : i * 1000, nSize).GetFeePerK());
+    }
+    BOOST_CHECK_EQUAL(stats.nTxBytes, nTxBytes);
+    BOOST_CHECK_EQUAL(stats.nMinFeeRate, vFeeRates[1]);
+    BOOST_CHECK_EQUAL(stats.nMedianFeeRate, vFeeRates[2]);
+    BOOST_CHECK_EQUAL(stats.nMaxFeeRate, vFeeRates[0]);
+
+    BOOST_CHECK(stats.masternodePayee == payee);
+    BOOST_CHECK_EQUAL(stats.nMasternodePayment, nMasternodePayment);
+    BOOST_CHECK_EQUAL(stats.nStakeReward, nSubsidy - nMasternodePayment + nFees);
+    BOOST_CHECK_EQUAL(stats.nCoinStakeValue, 0);
+
+    // The record survives a round trip through the database serialization
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << stats;
+    CBlockStats stats2;
+    ss >> stats2;
+    BOOST_CHECK(stats2.hashBlock == stats.hashBlock);
+    BOOST_CHECK_EQUAL(stats2.nTxBytes, stats.nTxBytes);
+    BOOST_CHECK_EQUAL(stats2.nMedianFeeRate, stats.nMedianFeeRate);
+    BOOST_CHECK_EQUAL(stats2.nStakeReward, stats.nStakeReward);
+    BOOST_CHECK(stats2.masternodePayee == stats.masternodePayee);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
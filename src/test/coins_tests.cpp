@@ -61,7 +61,7 @@ public:
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase = true)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
@@ -72,7 +72,10 @@ public:
                     map_.erase(it->first);
                 }
             }
-            mapCoins.erase(it++);
+            if (fErase)
+                mapCoins.erase(it++);
+            else
+                ++it;
         }
         if (!hashBlock.IsNull())
             hashBestBlock_ = hashBlock;
@@ -100,6 +103,7 @@ public:
 
     CCoinsMap& map() { return cacheCoins; }
     size_t& usage() { return cachedCoinsUsage; }
+    const CCoinsMapMemoryResource& resource() const { return cacheCoinsMemoryResource; }
 };
 
 }
@@ -551,7 +555,8 @@ void GetCoinsMapEntry(const CCoinsMap& map, CAmount& value, char& flags)
 
 void WriteCoinsViewEntry(CCoinsView& view, CAmount value, char flags)
 {
-    CCoinsMap map;
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource);
     InsertCoinsMapEntry(map, value, flags);
     view.BatchWrite(map, {});
 }
@@ -813,4 +818,93 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(ccoins_sync_and_trim)
+{
+    CCoinsView root;
+    CCoinsViewCacheTest base{&root};
+    CCoinsViewCacheTest cache{&base};
+
+    // Add a few coins, and spend one of them.
+    std::vector<COutPoint> outpoints;
+    for (uint32_t i = 0; i < 10; i++) {
+        COutPoint outpoint(InsecureRand256(), i);
+        Coin coin;
+        SetCoinsValue(VALUE1 + i, coin);
+        cache.AddCoin(outpoint, std::move(coin), false);
+        outpoints.push_back(outpoint);
+    }
+    cache.SpendCoin(outpoints[0]);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 9U);
+
+    // Sync pushes every change to the base, but keeps the unspent coins cached as clean entries.
+    BOOST_CHECK(cache.Sync());
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 9U);
+    BOOST_CHECK_EQUAL(base.GetCacheSize(), 9U);
+    for (const auto& entry : cache.map()) {
+        BOOST_CHECK_EQUAL(entry.second.flags, 0);
+        BOOST_CHECK(base.HaveCoinInCache(entry.first));
+    }
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoints[0]));
+
+    // Touch the most recent coin again, then trim: the least recently used coins go first.
+    cache.AccessCoin(outpoints[1]);
+    size_t nTarget = cache.DynamicMemoryUsage() - 1;
+    BOOST_CHECK(cache.Trim(nTarget) > 0);
+    cache.SelfTest();
+    BOOST_CHECK(cache.DynamicMemoryUsage() - cache.resource().UnusedBytes() <= nTarget);
+    BOOST_CHECK(cache.HaveCoinInCache(outpoints[1]));
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoints[2]));
+
+    // Dirty entries are never evicted.
+    Coin coin;
+    SetCoinsValue(VALUE3, coin);
+    COutPoint dirty(InsecureRand256(), 0);
+    cache.AddCoin(dirty, std::move(coin), false);
+    cache.Trim(0);
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+    BOOST_CHECK(cache.HaveCoinInCache(dirty));
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_trim_releases_memory)
+{
+    CCoinsView root;
+    CCoinsViewCacheTest base{&root};
+    CCoinsViewCacheTest cache{&base};
+
+    // Fill several chunks of the pool with coins, and push them to the base.
+    std::vector<COutPoint> outpoints;
+    for (uint32_t i = 0; i < 40000; i++) {
+        COutPoint outpoint(InsecureRand256(), i);
+        Coin coin;
+        SetCoinsValue(VALUE1, coin);
+        cache.AddCoin(outpoint, std::move(coin), false);
+        outpoints.push_back(outpoint);
+    }
+    BOOST_CHECK(cache.Sync());
+    const size_t nChunks = cache.resource().NumAllocatedChunks();
+    BOOST_CHECK(nChunks > 4);
+
+    // Spending half of the coins releases their memory on Sync.
+    for (size_t i = 0; i < outpoints.size(); i += 2)
+        cache.SpendCoin(outpoints[i]);
+    BOOST_CHECK(cache.Sync());
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), outpoints.size() / 2);
+    BOOST_CHECK(cache.resource().NumAllocatedChunks() < nChunks);
+
+    // Evicting most of the remaining coins gives the pool back to the system,
+    // down to the target (plus the unused end of the last chunk).
+    const size_t nUsage = cache.DynamicMemoryUsage();
+    const size_t nTarget = nUsage / 10;
+    BOOST_CHECK(cache.Trim(nTarget) > 0);
+    cache.SelfTest();
+    BOOST_CHECK(cache.GetCacheSize() > 0);
+    BOOST_CHECK(cache.DynamicMemoryUsage() < nUsage / 2);
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= nTarget + cache.resource().ChunkSizeBytes());
+    for (const auto& entry : cache.map())
+        BOOST_CHECK(base.HaveCoinInCache(entry.first));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,70 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "masternodeman.h"
+
+#include "netbase.h"
+#include "random.h"
+
+#include "test/test_pivx.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(masternodeman_tests, BasicTestingSetup)
+
+static void AddMasternodes(CMasternodeMan& mnman, const std::vector<CMasternode>& vMasternodes)
+{
+    for (CMasternode mn : vMasternodes)
+        BOOST_CHECK(mnman.Add(mn));
+}
+
+BOOST_AUTO_TEST_CASE(list_digest)
+{
+    std::vector<CMasternode> vMasternodes;
+    for (int i = 0; i < 100; i++) {
+        CMasternode mn;
+        mn.vin = CTxIn(COutPoint(InsecureRand256(), 0));
+        mn.addr = LookupNumeric(strprintf("8.8.%d.%d", i / 256, i % 256).c_str(), 51472);
+        CKey key;
+        key.MakeNewKey(true);
+        mn.pubKeyCollateralAddress = key.GetPubKey();
+        mn.pubKeyMasternode = key.GetPubKey();
+        mn.sigTime = 1000;
+        vMasternodes.push_back(mn);
+    }
+
+    // The digest doesn't depend on the order entries were added in
+    CMasternodeMan mnman1, mnman2;
+    AddMasternodes(mnman1, vMasternodes);
+    std::reverse(vMasternodes.begin(), vMasternodes.end());
+    AddMasternodes(mnman2, vMasternodes);
+    const CMasternodeListDigest digest1 = mnman1.GetListDigest();
+    CMasternodeListDigest digest2 = mnman2.GetListDigest();
+    BOOST_CHECK_EQUAL(digest1.vBucketHashes.size(), MASTERNODES_DIGEST_BUCKETS);
+    BOOST_CHECK(digest1.hashRoot == digest2.hashRoot);
+    BOOST_CHECK(digest1.vBucketHashes == digest2.vBucketHashes);
+
+    // A new broadcast for an entry only changes its bucket
+    mnman2.Find(vMasternodes[0].vin)->sigTime++;
+    digest2 = mnman2.GetListDigest();
+    BOOST_CHECK(digest1.hashRoot != digest2.hashRoot);
+    int nChanged = 0;
+    for (unsigned int i = 0; i < MASTERNODES_DIGEST_BUCKETS; i++)
+        nChanged += digest1.vBucketHashes[i] != digest2.vBucketHashes[i];
+    BOOST_CHECK_EQUAL(nChanged, 1);
+
+    // So does a missing entry
+    mnman2.Find(vMasternodes[0].vin)->sigTime--;
+    mnman2.Remove(vMasternodes[1].vin);
+    digest2 = mnman2.GetListDigest();
+    nChanged = 0;
+    for (unsigned int i = 0; i < MASTERNODES_DIGEST_BUCKETS; i++)
+        nChanged += digest1.vBucketHashes[i] != digest2.vBucketHashes[i];
+    BOOST_CHECK_EQUAL(nChanged, 1);
+
+    mnman1.Clear();
+    mnman2.Clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,47 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "messagesigner.h"
+
+#include "key.h"
+#include "random.h"
+#include "uint256.h"
+
+#include "test/test_pivx.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(messagesigner_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(verify_hash_cached)
+{
+    CKey key1, key2;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(true);
+    const CPubKey pubkey1 = key1.GetPubKey();
+    const CPubKey pubkey2 = key2.GetPubKey();
+
+    const uint256 hash = InsecureRand256();
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(CHashSigner::SignHash(hash, key1, vchSig));
+
+    // The second verification is answered by the cache
+    std::string strError;
+    BOOST_CHECK(CHashSigner::VerifyHash(hash, pubkey1, vchSig, strError));
+    BOOST_CHECK(CHashSigner::VerifyHash(hash, pubkey1, vchSig, strError));
+
+    // A cached signature is only valid for its own hash and key
+    BOOST_CHECK(!CHashSigner::VerifyHash(hash, pubkey2, vchSig, strError));
+    BOOST_CHECK(!CHashSigner::VerifyHash(InsecureRand256(), pubkey1, vchSig, strError));
+
+    std::vector<unsigned char> vchSigBad(vchSig);
+    vchSigBad[10] ^= 0x01;
+    BOOST_CHECK(!CHashSigner::VerifyHash(hash, pubkey1, vchSigBad, strError));
+
+    // Failures aren't cached
+    BOOST_CHECK(!CHashSigner::VerifyHash(hash, pubkey2, vchSig, strError));
+    BOOST_CHECK(CHashSigner::VerifyHash(hash, pubkey1, vchSig, strError));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
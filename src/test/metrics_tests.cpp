@@ -0,0 +1,45 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "metrics.h"
+
+#include "test/test_pivx.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(metrics_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(histogram_text_format)
+{
+    CMetricsHistogram hist({0.01, 0.1, 1});
+    hist.Observe(0.005);
+    hist.Observe(0.01);
+    hist.Observe(0.5);
+    hist.Observe(2);
+
+    // Buckets are cumulative and include their upper bound
+    std::string strOut;
+    hist.Write(strOut, "test_seconds", "stage=\"a\"");
+    BOOST_CHECK_EQUAL(strOut,
+        "test_seconds_bucket{stage=\"a\",le=\"0.01\"} 2\n"
+        "test_seconds_bucket{stage=\"a\",le=\"0.1\"} 2\n"
+        "test_seconds_bucket{stage=\"a\",le=\"1\"} 3\n"
+        "test_seconds_bucket{stage=\"a\",le=\"+Inf\"} 4\n"
+        "test_seconds_sum{stage=\"a\"} 2.515000\n"
+        "test_seconds_count{stage=\"a\"} 4\n");
+
+    strOut.clear();
+    CMetricsHistogram().Write(strOut, "empty_seconds", "");
+    BOOST_CHECK(strOut.find("empty_seconds_bucket{le=\"0.0001\"} 0\n") == 0);
+    BOOST_CHECK(strOut.find("empty_seconds_bucket{le=\"+Inf\"} 0\n") != std::string::npos);
+    BOOST_CHECK(strOut.find("empty_seconds_sum 0.000000\nempty_seconds_count 0\n") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(label_escaping)
+{
+    BOOST_CHECK_EQUAL(MetricsEscapeLabel("bad-txns-inputs-spent"), "bad-txns-inputs-spent");
+    BOOST_CHECK_EQUAL(MetricsEscapeLabel("a\"b\\c\nd"), "a\\\"b\\\\c\\nd");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
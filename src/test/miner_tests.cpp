@@ -82,14 +82,14 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
         CBlock *pblock = &pblocktemplate->block; // pointer for convenience
         pblock->nVersion = 1;
         pblock->nTime = chainActive.Tip()->GetMedianTimePast()+1;
-        CMutableTransaction txCoinbase(pblock->vtx[0]);
+        CMutableTransaction txCoinbase(*pblock->vtx[0]);
         txCoinbase.vin[0].scriptSig = CScript();
         txCoinbase.vin[0].scriptSig.push_back(blockinfo[i].extranonce);
         txCoinbase.vin[0].scriptSig.push_back(chainActive.Height());
         txCoinbase.vout[0].scriptPubKey = CScript();
-        pblock->vtx[0] = CTransaction(txCoinbase);
+        pblock->vtx[0] = MakeTransactionRef(txCoinbase);
         if (txFirst.size() < 2)
-            txFirst.push_back(new CTransaction(pblock->vtx[0]));
+            txFirst.push_back(new CTransaction(*pblock->vtx[0]));
         pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
         pblock->nNonce = blockinfo[i].nonce;
         CValidationState state;
@@ -226,6 +226,8 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     SetMockTime(chainActive.Tip()->GetMedianTimePast()+1);
 
     // height locked
+    // (both spend coins of the chain: the miner ages their priority from there)
+    entry.HadNoDependencies(true);
     tx.vin[0].prevout.hash = txFirst[0]->GetHash();
     tx.vin[0].scriptSig = CScript() << OP_1;
     tx.vin[0].nSequence = 0;
@@ -271,6 +273,47 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     SetMockTime(0);
     mempool.clear();
 
+    // A parent paying no fee is selected with the child paying for both,
+    // a new transaction is appended to the selection of the previous block
+    // and a selected transaction leaving the mempool gets the selection rebuilt
+    mapArgs["-blockprioritysize"] = "0";
+    tx.vin[0].prevout.hash = txFirst[0]->GetHash();
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vin[0].nSequence = CTxIn().nSequence;
+    tx.vout[0].nValue = 4900000000LL;
+    tx.vout[0].scriptPubKey = CScript() << OP_1;
+    tx.nLockTime = 0;
+    uint256 hashParent = tx.GetHash();
+    mempool.addUnchecked(hashParent, entry.Fee(0).Time(GetTime()).SpendsCoinbaseOrCoinstake(true).FromTx(tx));
+    tx.vin[0].prevout.hash = hashParent;
+    tx.vout[0].nValue = 4800000000LL;
+    uint256 hashChild = tx.GetHash();
+    mempool.addUnchecked(hashChild, entry.Fee(100000000LL).Time(GetTime()).SpendsCoinbaseOrCoinstake(false).FromTx(tx));
+    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == hashParent);
+    BOOST_CHECK(pblocktemplate->block.vtx[2]->GetHash() == hashChild);
+    delete pblocktemplate;
+
+    tx.vin[0].prevout.hash = txFirst[1]->GetHash();
+    tx.vout[0].nValue = 4000000000LL;
+    hash = tx.GetHash();
+    mempool.addUnchecked(hash, entry.Fee(1000000000LL).Time(GetTime()).SpendsCoinbaseOrCoinstake(true).FromTx(tx));
+    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 4);
+    BOOST_CHECK(pblocktemplate->block.vtx[3]->GetHash() == hash);
+    delete pblocktemplate;
+
+    std::list<CTransactionRef> removed;
+    mempool.remove(*mempool.get(hashChild), removed);
+    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == hash);
+    delete pblocktemplate;
+
+    mapArgs.erase("-blockprioritysize");
+    mempool.clear();
+
     for (CTransaction *tx : txFirst)
         delete tx;
 
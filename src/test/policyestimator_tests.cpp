@@ -39,7 +39,7 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     for (unsigned int i = 0; i < 128; i++)
         garbage.push_back('X');
     CMutableTransaction tx;
-    std::list<CTransaction> dummyConflicted;
+    std::list<CTransactionRef> dummyConflicted;
     tx.vin.resize(1);
     tx.vin[0].scriptSig = garbage;
     tx.vout.resize(1);
@@ -47,7 +47,7 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     CFeeRate baseRate(basefee, ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
 
     // Create a fake block
-    std::vector<CTransaction> block;
+    std::vector<CTransactionRef> block;
     int blocknum = 0;
 
     // Loop through 200 blocks
@@ -68,8 +68,8 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
             // 9/10 blocks add 2nd highest and so on until ...
             // 1/10 blocks add lowest fee transactions
             while (txHashes[9-h].size()) {
-                CTransaction btx;
-                if (mpool.lookup(txHashes[9-h].back(), btx))
+                CTransactionRef btx = mpool.get(txHashes[9-h].back());
+                if (btx)
                     block.push_back(btx);
                 txHashes[9-h].pop_back();
             }
@@ -145,8 +145,8 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     // Estimates should still not be below original
     for (int j = 0; j < 10; j++) {
         while(txHashes[j].size()) {
-            CTransaction btx;
-            if (mpool.lookup(txHashes[j].back(), btx))
+            CTransactionRef btx = mpool.get(txHashes[j].back());
+            if (btx)
                 block.push_back(btx);
             txHashes[j].pop_back();
         }
@@ -165,8 +165,8 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
                 tx.vin[0].prevout.n = 10000*blocknum+100*j+k;
                 uint256 hash = tx.GetHash();
                 mpool.addUnchecked(hash, entry.Fee(feeV[j]).Time(GetTime()).Priority(0).Height(blocknum).FromTx(tx, &mpool));
-                CTransaction btx;
-                if (mpool.lookup(hash, btx))
+                CTransactionRef btx = mpool.get(hash);
+                if (btx)
                     block.push_back(btx);
             }
         }
@@ -190,4 +190,26 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
     }
 }
 
+BOOST_AUTO_TEST_CASE(FeeFilterRounderTest)
+{
+    FeeFilterRounder feeRounder(CFeeRate(1000));
+
+    // 1000 is between the buckets 974 and 1071, either is announced
+    std::set<CAmount> results;
+    while (results.size() < 2) {
+        results.insert(feeRounder.round(1000));
+    }
+    BOOST_CHECK_EQUAL(*results.begin(), 974);
+    BOOST_CHECK_EQUAL(*++results.begin(), 1071);
+
+    // Bucket boundaries are announced as is, or as the bucket below
+    BOOST_CHECK_EQUAL(feeRounder.round(0), 0);
+    CAmount rounded = feeRounder.round(1);
+    BOOST_CHECK(rounded == 0 || rounded == 500);
+
+    // Feerates above the highest bucket are announced as the highest bucket
+    BOOST_CHECK(feeRounder.round(CAmount(MAX_FEERATE) * 10) > 0);
+    BOOST_CHECK(feeRounder.round(CAmount(MAX_FEERATE) * 10) <= MAX_FEERATE);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
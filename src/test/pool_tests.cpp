@@ -0,0 +1,105 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "memusage.h"
+#include "support/allocators/pool.h"
+#include "test/test_pivx.h"
+
+#include <unordered_map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(pool_reuses_freed_blocks)
+{
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.ChunkSizeBytes(), 1024U);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0U);
+
+    void* a = resource.Allocate(24, 8);
+    void* b = resource.Allocate(24, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    BOOST_CHECK(a != b);
+    BOOST_CHECK_EQUAL(static_cast<char*>(b) - static_cast<char*>(a), 24);
+
+    // A freed block is handed out again for the same size, and only for it
+    resource.Deallocate(a, 24, 8);
+    BOOST_CHECK_EQUAL(resource.FreeListBytes(), 24U);
+    void* c = resource.Allocate(16, 8);
+    BOOST_CHECK(c != a);
+    void* d = resource.Allocate(24, 8);
+    BOOST_CHECK(d == a);
+    BOOST_CHECK_EQUAL(resource.FreeListBytes(), 0U);
+
+    resource.Deallocate(b, 24, 8);
+    resource.Deallocate(c, 16, 8);
+    resource.Deallocate(d, 24, 8);
+    BOOST_CHECK_EQUAL(resource.FreeListBytes(), 64U);
+}
+
+BOOST_AUTO_TEST_CASE(pool_chunks_and_large_blocks)
+{
+    PoolResource<64, 8> resource(256);
+
+    // 256 / 64 blocks fit in a chunk
+    std::vector<void*> blocks;
+    for (int i = 0; i < 4; i++)
+        blocks.push_back(resource.Allocate(64, 8));
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    blocks.push_back(resource.Allocate(64, 8));
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+
+    // The part of a chunk too small for a block goes to the free lists
+    blocks.push_back(resource.Allocate(64, 8));
+    blocks.push_back(resource.Allocate(64, 8));
+    blocks.push_back(resource.Allocate(48, 8));
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    blocks.push_back(resource.Allocate(48, 8));
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 3U);
+    BOOST_CHECK_EQUAL(resource.FreeListBytes(), 16U);
+
+    // Blocks larger than the maximum don't come from the pool
+    void* large = resource.Allocate(65, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 3U);
+    resource.Deallocate(large, 65, 8);
+    BOOST_CHECK_EQUAL(resource.FreeListBytes(), 16U);
+
+    for (size_t i = 0; i < blocks.size(); i++)
+        resource.Deallocate(blocks[i], i < 7 ? 64 : 48, 8);
+}
+
+BOOST_AUTO_TEST_CASE(pool_unordered_map_usage)
+{
+    CCoinsMapMemoryResource resource;
+    CCoinsMap map(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), &resource);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0U);
+
+    for (uint32_t n = 0; n < 10000; n++)
+        map[COutPoint(uint256(), n)].coin.nHeight = n;
+    BOOST_CHECK_EQUAL(map.size(), 10000U);
+    BOOST_CHECK_EQUAL(map[COutPoint(uint256(), 1234)].coin.nHeight, 1234U);
+    BOOST_CHECK(resource.NumAllocatedChunks() > 0);
+
+    // Erased nodes stay allocated in the pool, and are reused by the next insertions
+    size_t nUsage = memusage::DynamicUsage(map);
+    size_t nChunks = resource.NumAllocatedChunks();
+    for (uint32_t n = 0; n < 5000; n++)
+        map.erase(COutPoint(uint256(), n));
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), nUsage);
+    BOOST_CHECK(resource.FreeListBytes() > 0);
+    for (uint32_t n = 10000; n < 15000; n++)
+        map[COutPoint(uint256(), n)];
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), nUsage);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), nChunks);
+
+    map.clear();
+    for (uint32_t n = 0; n < 10000; n++)
+        map[COutPoint(uint256(), n)];
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), nChunks);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,8 +7,10 @@
 
 #include "rpc/server.h"
 #include "rpc/client.h"
+#include "rpc/jsonstream.h"
 
 #include "base58.h"
+#include "main.h"
 #include "netbase.h"
 #include "util.h"
 
@@ -290,4 +292,140 @@ BOOST_AUTO_TEST_CASE(rpc_ban)
     BOOST_CHECK_EQUAL(adr.get_str(), "2001:4d48:ac57:400:cacf:e9ff:fe1d:9c63/128");
 }
 
+BOOST_AUTO_TEST_CASE(rpc_json_stream_writer)
+{
+    UniValue tx(UniValue::VOBJ);
+    tx.push_back(Pair("txid", "ab\"cd"));
+    tx.push_back(Pair("size", 250));
+    UniValue expected(UniValue::VOBJ);
+    expected.push_back(Pair("hash", "00ff"));
+    UniValue txs(UniValue::VARR);
+    txs.push_back(tx);
+    txs.push_back(tx);
+    expected.push_back(Pair("tx", txs));
+    expected.push_back(Pair("empty", UniValue(UniValue::VARR)));
+    expected.push_back(Pair("time", 1234));
+
+    // Flushed in many small pieces, the output is what UniValue writes
+    std::string strOut;
+    size_t nChunks = 0;
+    JSONStreamWriter writer([&](const std::string& strChunk) {
+        strOut += strChunk;
+        nChunks++;
+        return true;
+    }, 8);
+    BOOST_CHECK(writer.IsEmpty());
+    writer.BeginObject();
+    writer.KV("hash", "00ff");
+    writer.Key("tx");
+    writer.BeginArray();
+    writer.Value(tx);
+    writer.Value(tx);
+    writer.EndArray();
+    writer.Key("empty");
+    writer.BeginArray();
+    writer.EndArray();
+    writer.KV("time", 1234);
+    writer.EndObject();
+    writer.Flush();
+    BOOST_CHECK(!writer.IsEmpty());
+    BOOST_CHECK(!writer.IsAborted());
+    BOOST_CHECK(nChunks > 1);
+    BOOST_CHECK_EQUAL(strOut, expected.write());
+
+    // Nothing is written once the sink refused some output
+    strOut.clear();
+    JSONStreamWriter writerAborted([&](const std::string& strChunk) {
+        strOut += strChunk;
+        return false;
+    }, 4);
+    writerAborted.BeginArray();
+    writerAborted.Value("first");
+    writerAborted.Value("second");
+    writerAborted.EndArray();
+    writerAborted.Flush();
+    BOOST_CHECK(writerAborted.IsAborted());
+    BOOST_CHECK_EQUAL(strOut, "[\"first\"");
+}
+
+BOOST_AUTO_TEST_CASE(rpc_json_stream_end_all)
+{
+    // A document cut anywhere is closed into valid JSON
+    std::string strOut;
+    JSONStreamWriter writer([&](const std::string& strChunk) {
+        strOut += strChunk;
+        return true;
+    }, 8);
+    writer.BeginObject();
+    writer.KV("hash", "00ff");
+    writer.Key("tx");
+    writer.BeginArray();
+    writer.Value("first");
+    writer.BeginObject();
+    writer.Key("txid");
+    writer.EndAll();
+    writer.Flush();
+    BOOST_CHECK_EQUAL(strOut, "{\"hash\":\"00ff\",\"tx\":[\"first\",{\"txid\":null}]}");
+
+    // A streamed RPC result failing midway is followed by its error, as httprpc does
+    UniValue reply;
+    BOOST_CHECK(reply.read("{\"result\":" + strOut + ",\"error\":" + JSONRPCError(RPC_MISC_ERROR, "failed").write() + ",\"id\":1}"));
+    BOOST_CHECK(find_value(reply, "error").isObject());
+    BOOST_CHECK_EQUAL(find_value(find_value(reply, "error"), "code").get_int(), RPC_MISC_ERROR);
+    BOOST_CHECK_EQUAL(find_value(reply, "result")["tx"].size(), 2U);
+
+    // Nothing to close
+    strOut.clear();
+    JSONStreamWriter writerDone([&](const std::string& strChunk) {
+        strOut += strChunk;
+        return true;
+    });
+    writerDone.BeginArray();
+    writerDone.EndArray();
+    writerDone.EndAll();
+    writerDone.Flush();
+    BOOST_CHECK_EQUAL(strOut, "[]");
+}
+
+BOOST_AUTO_TEST_CASE(rpc_batch_order)
+{
+    if (RPCIsInWarmup(nullptr))
+        SetRPCWarmupFinished();
+    StartRPC();
+
+    // Runs of concurrent calls, split by calls executed alone
+    UniValue vReq(UniValue::VARR);
+    for (int i = 0; i < 40; i++) {
+        UniValue req(UniValue::VOBJ);
+        UniValue params(UniValue::VARR);
+        if (i % 10 == 9) {
+            req.push_back(Pair("method", "help"));
+            params.push_back("getblockcount");
+        } else {
+            req.push_back(Pair("method", i % 2 ? "getblockcount" : "getbestblockhash"));
+        }
+        req.push_back(Pair("params", params));
+        req.push_back(Pair("id", i));
+        vReq.push_back(req);
+    }
+    UniValue vReply;
+    BOOST_CHECK(vReply.read(JSONRPCExecBatch(vReq)));
+    BOOST_CHECK_EQUAL(vReply.size(), 40U);
+
+    // The replies are in the order of the requests
+    const int nHeight = WITH_LOCK(cs_main, return chainActive.Height());
+    for (int i = 0; i < (int)vReply.size(); i++) {
+        const UniValue& reply = vReply[i];
+        BOOST_CHECK_EQUAL(find_value(reply, "id").get_int(), i);
+        BOOST_CHECK(find_value(reply, "error").isNull());
+        if (i % 10 == 9)
+            BOOST_CHECK(find_value(reply, "result").isStr());
+        else if (i % 2)
+            BOOST_CHECK_EQUAL(find_value(reply, "result").get_int(), nHeight);
+    }
+
+    InterruptRPC();
+    StopRPC();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,126 @@
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "snapshot.h"
+
+#include "chainparams.h"
+#include "coins.h"
+#include "random.h"
+#include "streams.h"
+#include "util.h"
+
+#include "test/test_pivx.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(snapshot_tests, BasicTestingSetup)
+
+static CSnapshotMetadata MakeMetadata()
+{
+    CSnapshotMetadata metadata;
+    memcpy(metadata.pchMessageStart, Params().MessageStart(), sizeof(metadata.pchMessageStart));
+    metadata.hashBaseBlock = InsecureRand256();
+    metadata.nBaseHeight = 1000;
+    metadata.nChainTx = 2345;
+    metadata.vStakeModifier = std::vector<unsigned char>(32, 0x5a);
+    return metadata;
+}
+
+BOOST_AUTO_TEST_CASE(metadata_serialization)
+{
+    CSnapshotMetadata metadata = MakeMetadata();
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << metadata;
+    const size_t nSize = ss.size();
+
+    // dumptxoutset writes the header again once the coins are counted, over the same bytes
+    metadata.nCoinsCount = 1000000;
+    metadata.nMoneySupply = 21000000 * COIN;
+    CDataStream ss2(SER_DISK, CLIENT_VERSION);
+    ss2 << metadata;
+    BOOST_CHECK_EQUAL(ss2.size(), nSize);
+
+    CSnapshotMetadata metadata2;
+    ss2 >> metadata2;
+    BOOST_CHECK_EQUAL(metadata2.nVersion, SNAPSHOT_VERSION);
+    BOOST_CHECK(memcmp(metadata2.pchMessageStart, Params().MessageStart(), sizeof(metadata2.pchMessageStart)) == 0);
+    BOOST_CHECK(metadata2.hashBaseBlock == metadata.hashBaseBlock);
+    BOOST_CHECK_EQUAL(metadata2.nBaseHeight, metadata.nBaseHeight);
+    BOOST_CHECK_EQUAL(metadata2.nChainTx, metadata.nChainTx);
+    BOOST_CHECK_EQUAL(metadata2.nCoinsCount, metadata.nCoinsCount);
+    BOOST_CHECK_EQUAL(metadata2.nMoneySupply, metadata.nMoneySupply);
+    BOOST_CHECK(metadata2.vStakeModifier == metadata.vStakeModifier);
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_hash)
+{
+    const uint256 hashBase = InsecureRand256();
+    const COutPoint out1(InsecureRand256(), 0);
+    const COutPoint out2(InsecureRand256(), 1);
+    const Coin coin1(CTxOut(10 * COIN, CScript() << OP_TRUE), 10, false, false);
+    const Coin coin2(CTxOut(20 * COIN, CScript() << OP_TRUE), 20, false, true);
+
+    CSnapshotHasher hasher(hashBase);
+    hasher.Add(out1, coin1);
+    hasher.Add(out2, coin2);
+    const uint256 hash = hasher.GetHash();
+
+    // Deterministic
+    CSnapshotHasher hasherSame(hashBase);
+    hasherSame.Add(out1, coin1);
+    hasherSame.Add(out2, coin2);
+    BOOST_CHECK(hasherSame.GetHash() == hash);
+
+    // Committing to the base block, the order of the coins and their flags
+    CSnapshotHasher hasherOtherBase(InsecureRand256());
+    hasherOtherBase.Add(out1, coin1);
+    hasherOtherBase.Add(out2, coin2);
+    BOOST_CHECK(hasherOtherBase.GetHash() != hash);
+
+    CSnapshotHasher hasherOtherOrder(hashBase);
+    hasherOtherOrder.Add(out2, coin2);
+    hasherOtherOrder.Add(out1, coin1);
+    BOOST_CHECK(hasherOtherOrder.GetHash() != hash);
+
+    CSnapshotHasher hasherOtherFlags(hashBase);
+    hasherOtherFlags.Add(out1, coin1);
+    hasherOtherFlags.Add(out2, Coin(coin2.out, coin2.nHeight, false, false));
+    BOOST_CHECK(hasherOtherFlags.GetHash() != hash);
+}
+
+BOOST_AUTO_TEST_CASE(read_metadata)
+{
+    const fs::path path = GetTempPath() / fs::unique_path();
+    CSnapshotMetadata metadata = MakeMetadata();
+    {
+        CAutoFile fileout(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        fileout << metadata;
+    }
+
+    CSnapshotMetadata metadataRead;
+    std::string strError;
+    BOOST_CHECK(ReadSnapshotMetadata(path, metadataRead, strError));
+    BOOST_CHECK(metadataRead.hashBaseBlock == metadata.hashBaseBlock);
+
+    // A snapshot of another network
+    metadata.pchMessageStart[0] ^= 0xff;
+    {
+        CAutoFile fileout(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        fileout << metadata;
+    }
+    BOOST_CHECK(!ReadSnapshotMetadata(path, metadataRead, strError));
+    BOOST_CHECK_EQUAL(strError, "the snapshot is of another network");
+
+    // A truncated file
+    {
+        CAutoFile fileout(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        fileout << SNAPSHOT_VERSION;
+    }
+    BOOST_CHECK(!ReadSnapshotMetadata(path, metadataRead, strError));
+
+    fs::remove(path);
+    BOOST_CHECK(!ReadSnapshotMetadata(path, metadataRead, strError));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,9 @@
 
 #include <boost/test/unit_test.hpp>
 
+#include <cstring>
+#include <thread>
+
 namespace {
 template <typename MutexType>
 void TestPotentialDeadLockDetected(MutexType& mutex1, MutexType& mutex2)
@@ -51,4 +54,46 @@ BOOST_AUTO_TEST_CASE(potential_deadlock_detected)
     #endif
 }
 
+BOOST_AUTO_TEST_CASE(lock_site_stats)
+{
+    Mutex lockstats_mutex;
+    auto lock_once = [&lockstats_mutex]() { LOCK(lockstats_mutex); };
+
+    lock_once();
+    CLockSiteStats* site = nullptr;
+    for (CLockSiteStats* s : GetLockSiteStats()) {
+        if (strcmp(s->pszName, "lockstats_mutex") == 0) site = s;
+    }
+    BOOST_REQUIRE(site != nullptr);
+    BOOST_CHECK_EQUAL(site->nAcquisitions.load(), 1U);
+    BOOST_CHECK_EQUAL(site->nContended.load(), 0U);
+    // the first acquisition of a site is always sampled
+    uint64_t nHoldSamples = 0;
+    for (const auto& bucket : site->nHoldHistogram) nHoldSamples += bucket.load();
+    BOOST_CHECK_EQUAL(nHoldSamples, 1U);
+
+    // Acquired while held by another thread
+    lockstats_mutex.lock();
+    std::thread locker(lock_once);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    lockstats_mutex.unlock();
+    locker.join();
+    BOOST_CHECK_EQUAL(site->nAcquisitions.load(), 2U);
+    BOOST_CHECK_EQUAL(site->nContended.load(), 1U);
+    BOOST_CHECK(site->nMaxWaitMicros.load() > 0);
+    BOOST_CHECK_EQUAL(site->nWaitMicros.load(), site->nMaxWaitMicros.load());
+
+    const CLockSiteStats::Counters counters = site->Read(true);
+    BOOST_CHECK_EQUAL(counters.nAcquisitions, 2U);
+    BOOST_CHECK_EQUAL(counters.nContended, 1U);
+    BOOST_CHECK_EQUAL(counters.nWaitMicros, counters.nMaxWaitMicros);
+    BOOST_CHECK_EQUAL(site->nAcquisitions.load(), 0U);
+    BOOST_CHECK_EQUAL(site->nWaitMicros.load(), 0U);
+
+    lock_once();
+    site->Reset();
+    BOOST_CHECK_EQUAL(site->nAcquisitions.load(), 0U);
+    BOOST_CHECK_EQUAL(site->nContended.load(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
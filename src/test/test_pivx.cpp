@@ -5,36 +5,27 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
-#define BOOST_TEST_MODULE Pivx Test Suite
-
 #include "test_pivx.h"
 
 #include "main.h"
+#include "net.h"
 #include "random.h"
 #include "script/sigcache.h"
 #include "txdb.h"
-#include "guiinterface.h"
-
-#include <boost/test/unit_test.hpp>
 
-std::unique_ptr<CConnman> g_connman;
-
-CClientUIInterface uiInterface;
+#include <stdexcept>
 
 uint256 insecure_rand_seed = GetRandHash();
 FastRandomContext insecure_rand_ctx(insecure_rand_seed);
 
-extern bool fPrintToConsole;
-extern void noui_connect();
-
-BasicTestingSetup::BasicTestingSetup()
+BasicTestingSetup::BasicTestingSetup(CBaseChainParams::Network network)
 {
         RandomInit();
         ECC_Start();
         SetupEnvironment();
         InitSignatureCache();
         fCheckBlockIndex = true;
-        SelectParams(CBaseChainParams::MAIN);
+        SelectParams(network);
 }
 BasicTestingSetup::~BasicTestingSetup()
 {
@@ -42,7 +33,7 @@ BasicTestingSetup::~BasicTestingSetup()
         g_connman.reset();
 }
 
-TestingSetup::TestingSetup()
+TestingSetup::TestingSetup(CBaseChainParams::Network network) : BasicTestingSetup(network)
 {
         ClearDatadirCache();
         pathTemp = GetTempPath() / strprintf("test_safedeal_%lu_%i", (unsigned long)GetTime(), (int)(InsecureRandRange(100000)));
@@ -54,8 +45,8 @@ TestingSetup::TestingSetup()
         InitBlockIndex();
         {
             CValidationState state;
-            bool ok = ActivateBestChain(state);
-            BOOST_CHECK(ok);
+            if (!ActivateBestChain(state))
+                throw std::runtime_error("ActivateBestChain failed: " + FormatStateMessage(state));
         }
         nScriptCheckThreads = 3;
         for (int i=0; i < nScriptCheckThreads-1; i++)
@@ -83,21 +74,6 @@ CTxMemPoolEntry TestMemPoolEntryHelper::FromTx(CMutableTransaction &tx, CTxMemPo
     // Hack to assume either its completely dependent on other mempool txs or not at all
     CAmount inChainValue = hasNoDependencies ? txn.GetValueOut() : 0;
 
-    return CTxMemPoolEntry(txn, nFee, nTime, dPriority, nHeight,
+    return CTxMemPoolEntry(MakeTransactionRef(txn), nFee, nTime, dPriority, nHeight,
                            hasNoDependencies, inChainValue, spendsCoinbaseOrCoinstake, sigOpCount);
 }
-
-[[noreturn]] void Shutdown(void* parg)
-{
-    std::exit(0);
-}
-
-[[noreturn]] void StartShutdown()
-{
-    std::exit(0);
-}
-
-bool ShutdownRequested()
-{
-  return false;
-}
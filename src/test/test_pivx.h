@@ -7,6 +7,7 @@
 #ifndef PIVX_TEST_TEST_PIVX_H
 #define PIVX_TEST_TEST_PIVX_H
 
+#include "chainparamsbase.h"
 #include "fs.h"
 #include "txdb.h"
 #include "random.h"
@@ -37,13 +38,13 @@ static inline std::vector<unsigned char> InsecureRandBytes(size_t len) { return
  * This just configures logging and chain parameters.
  */
 struct BasicTestingSetup {
-    BasicTestingSetup();
+    explicit BasicTestingSetup(CBaseChainParams::Network network = CBaseChainParams::MAIN);
     ~BasicTestingSetup();
 };
 
 /** Testing setup that configures a complete environment.
  * Included are data directory, coins database, script check threads
- * and wallet (if enabled) setup.
+ * and wallet (if enabled) setup. The benchmarks run in it too.
  */
 class CConnman;
 struct TestingSetup: public BasicTestingSetup {
@@ -53,7 +54,7 @@ struct TestingSetup: public BasicTestingSetup {
     CConnman* connman;
     ECCVerifyHandle globalVerifyHandle;
 
-    TestingSetup();
+    explicit TestingSetup(CBaseChainParams::Network network = CBaseChainParams::MAIN);
     ~TestingSetup();
 };
 
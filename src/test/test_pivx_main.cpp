@@ -0,0 +1,35 @@
+// Copyright (c) 2011-2013 The Bitcoin Core developers
+// Copyright (c) 2017-2020 The PIVX developers
+// Copyright (c) 2021-2022 The DECENOMY Core Developers
+// Copyright (c) 2022-2023 The SafeDeal Core Developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#define BOOST_TEST_MODULE Pivx Test Suite
+
+#include "guiinterface.h"
+#include "net.h"
+
+#include <boost/test/unit_test.hpp>
+
+std::unique_ptr<CConnman> g_connman;
+
+CClientUIInterface uiInterface;
+
+extern bool fPrintToConsole;
+extern void noui_connect();
+
+[[noreturn]] void Shutdown(void* parg)
+{
+    std::exit(0);
+}
+
+[[noreturn]] void StartShutdown()
+{
+    std::exit(0);
+}
+
+bool ShutdownRequested()
+{
+  return false;
+}
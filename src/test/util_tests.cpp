@@ -8,12 +8,15 @@
 #include "util.h"
 
 #include "clientversion.h"
+#include "logging.h"
 #include "primitives/transaction.h"
 #include "sync.h"
 #include "utilstrencodings.h"
 #include "utilmoneystr.h"
 #include "test/test_pivx.h"
 
+#include <fstream>
+#include <iterator>
 #include <stdint.h>
 #include <vector>
 
@@ -492,4 +495,66 @@ BOOST_AUTO_TEST_CASE(test_ParseFixedPoint)
     BOOST_CHECK(!ParseFixedPoint("1.", 8, &amount));
 }
 
+static std::string ReadLogFile(const fs::path& path)
+{
+    std::ifstream file(path.string());
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+BOOST_AUTO_TEST_CASE(logging_flush_writes_queued_messages)
+{
+    const fs::path path = fs::temp_directory_path() / fs::unique_path();
+    {
+        BCLog::Logger logger;
+        logger.m_print_to_file = true;
+        logger.m_log_timestamps = false;
+        logger.m_file_path = path;
+        BOOST_CHECK(logger.OpenDebugLog());
+        logger.StartWriterThread();
+
+        std::string strExpected;
+        for (int i = 0; i < 1000; i++) {
+            const std::string str = strprintf("message %d\n", i);
+            logger.LogPrintStr(str);
+            strExpected += str;
+        }
+        // every message logged before Flush() is in the file once it returns, in order
+        logger.Flush();
+        BOOST_CHECK_EQUAL(ReadLogFile(path), strExpected);
+        BOOST_CHECK_EQUAL(logger.GetDroppedMessages(), 0U);
+    }
+    fs::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(logging_drops_counted_on_timestamped_size)
+{
+    const fs::path path = fs::temp_directory_path() / fs::unique_path();
+    {
+        BCLog::Logger logger;
+        logger.m_print_to_file = true;
+        logger.m_file_path = path;
+        BOOST_CHECK(logger.OpenDebugLog());
+        const std::string str = "message\n";
+        // the raw message fits, the timestamped one does not
+        logger.m_max_queue_bytes = str.size();
+        logger.StartWriterThread();
+
+        for (int i = 0; i < 3; i++)
+            BOOST_CHECK_EQUAL(logger.LogPrintStr(str), 0);
+        BOOST_CHECK_EQUAL(logger.GetDroppedMessages(), 3U);
+        logger.Flush();
+        logger.StopWriterThread();
+
+        const std::string strLog = ReadLogFile(path);
+        BOOST_CHECK(strLog.find(str) == std::string::npos);
+        BOOST_CHECK(strLog.find("log messages dropped") != std::string::npos);
+
+        // written on the logging thread again once the writer has stopped
+        BOOST_CHECK(logger.LogPrintStr(str) > 0);
+        const std::string strLogAfter = ReadLogFile(path);
+        BOOST_CHECK(strLogAfter.size() > str.size() && strLogAfter.compare(strLogAfter.size() - str.size(), str.size(), str) == 0);
+    }
+    fs::remove(path);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -20,6 +20,7 @@
 
 #include <boost/function.hpp>
 
+class CBlockStats;
 class CCoinsViewDBCursor;
 class uint256;
 
@@ -34,6 +35,10 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -dbbatchsize default (bytes)
+static const int64_t nDefaultDbBatchSize = 16 << 20;
+//! Share (in percent) of the coins cache flush threshold kept warm after a flush.
+static constexpr int COINS_CACHE_RETAIN_PERCENT = 75;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -64,19 +69,20 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
-/** CCoinsView backed by the LevelDB coin database (chainstate/) */
+/** CCoinsView backed by the LevelDB coin database (chainstate/, or strName/ in the data directory) */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
 
 public:
-    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const std::string& strName = "chainstate");
 
     bool GetCoin(const COutPoint& outpoint, Coin& coin) const override;
     bool HaveCoin(const COutPoint& outpoint) const override;
     uint256 GetBestBlock() const override;
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override;
+    std::vector<uint256> GetHeadBlocks() const override;
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, bool fErase = true) override;
     CCoinsViewCursor* Cursor() const override;
 
     //! Attempt to update from an older database format. Returns whether an error occurred.
@@ -129,6 +135,10 @@ public:
     bool ReadFlag(const std::string& name, bool& fValue);
     bool WriteInt(const std::string& name, int nValue);
     bool ReadInt(const std::string& name, int& nValue);
+    bool WriteHash(const std::string& name, const uint256& hash);
+    bool ReadHash(const std::string& name, uint256& hash);
+    bool WriteBlockStats(int nHeight, const CBlockStats& stats);
+    bool ReadBlockStats(int nHeight, CBlockStats& stats);
     bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
 };
 
@@ -287,6 +287,7 @@ void PrintExceptionContinue(const std::exception* pex, const char* pszThread)
     LogPrintf("\n\n************************\n%s\n", message);
     fprintf(stderr, "\n\n************************\n%s\n", message.c_str());
     strMiscWarning = message;
+    g_logger->Flush();
 }
 
 fs::path GetDefaultDataDir()
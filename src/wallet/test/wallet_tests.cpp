@@ -42,7 +42,7 @@ static void add_coin(const CAmount& nValue, int nAge = 6*24, bool fIsFromMe = fa
         // so stop vin being empty, and cache a non-zero Debit to fake out IsFromMe()
         tx.vin.resize(1);
     }
-    CWalletTx* wtx = new CWalletTx(pwalletMain, tx);
+    CWalletTx* wtx = new CWalletTx(pwalletMain, MakeTransactionRef(std::move(tx)));
     if (fIsFromMe) {
         wtx->m_amounts[CWalletTx::DEBIT].Set(ISMINE_SPENDABLE, 1);
     }
@@ -322,7 +322,7 @@ void removeTxFromMempool(CWalletTx& wtx)
 CBlockIndex* SimpleFakeMine(CWalletTx& wtx, CBlockIndex* pprev = nullptr)
 {
     CBlock block;
-    block.vtx.push_back(wtx);
+    block.vtx.push_back(MakeTransactionRef(wtx));
     block.hashMerkleRoot = BlockMerkleRoot(block);
     if (pprev) block.hashPrevBlock = pprev->GetBlockHash();
     CBlockIndex* fakeIndex = new CBlockIndex(block);
@@ -338,7 +338,7 @@ CBlockIndex* SimpleFakeMine(CWalletTx& wtx, CBlockIndex* pprev = nullptr)
 
 void fakeMempoolInsertion(const CWalletTx& wtxCredit)
 {
-    CTxMemPoolEntry entry(wtxCredit, 0, 0, 0, 0, false, 0, false, 0);
+    CTxMemPoolEntry entry(MakeTransactionRef(wtxCredit), 0, 0, 0, 0, false, 0, false, 0);
     LOCK(mempool.cs);
     mempool.mapTx.insert(entry);
 }
@@ -351,7 +351,7 @@ CWalletTx& BuildAndLoadTxToWallet(const std::vector<CTxIn>& vin,
     mTx.vin = vin;
     mTx.vout = vout;
     CTransaction tx(mTx);
-    wallet.LoadToWallet({&wallet, tx});
+    wallet.LoadToWallet({&wallet, MakeTransactionRef(tx)});
     return wallet.mapWallet[tx.GetHash()];
 }
 
@@ -472,4 +472,57 @@ BOOST_AUTO_TEST_CASE(cached_balances_tests)
 
 }
 
+/**
+ * Validates that the wallet balances cache is invalidated by wallet txes,
+ * mempool and chain tip updates and by locking/unlocking coins.
+ */
+BOOST_AUTO_TEST_CASE(wallet_balances_cache_tests)
+{
+    CAmount nCredit = 20 * COIN;
+
+    CWallet &wallet = *pwalletMain;
+    LOCK2(cs_main, wallet.cs_wallet);
+    wallet.SetMinVersion(FEATURE_PRE_SPLIT_KEYPOOL);
+    wallet.SetupSPKM(false);
+    BOOST_CHECK_EQUAL(wallet.GetAvailableBalance(), 0);
+
+    // Unconfirmed and not in the mempool: not part of any balance
+    CTxDestination receivingAddr;
+    BOOST_ASSERT(wallet.getNewAddress(receivingAddr, "receiving_address").result);
+    CTxOut creditOut(nCredit/2, GetScriptForDestination(receivingAddr));
+    CWalletTx& wtxCredit = ReceiveBalanceWith({creditOut, creditOut},wallet);
+    BOOST_CHECK_EQUAL(wallet.GetAvailableBalance(), 0);
+    BOOST_CHECK_EQUAL(wallet.GetUnconfirmedBalance(), 0);
+
+    // Accepted to the mempool, which notifies the wallet
+    fakeMempoolInsertion(wtxCredit);
+    wallet.SyncTransaction(*wtxCredit.tx, nullptr, -1);
+    BOOST_CHECK_EQUAL(wallet.GetUnconfirmedBalance(), nCredit);
+    BOOST_CHECK_EQUAL(wallet.GetAvailableBalance(), 0);
+
+    // Leaving the mempool without a block
+    {
+        LOCK(mempool.cs);
+        mempool.mapTx.erase(wtxCredit.GetHash());
+    }
+    wallet.TransactionRemovedFromMempool(wtxCredit.tx);
+    BOOST_CHECK_EQUAL(wallet.GetUnconfirmedBalance(), 0);
+    fakeMempoolInsertion(wtxCredit);
+    wallet.SyncTransaction(*wtxCredit.tx, nullptr, -1);
+    BOOST_CHECK_EQUAL(wallet.GetUnconfirmedBalance(), nCredit);
+
+    // Confirmed by a new tip
+    SimpleFakeMine(wtxCredit);
+    CWallet::Balances balances = wallet.GetBalances();
+    BOOST_CHECK_EQUAL(balances.nUntrustedPending, 0);
+    BOOST_CHECK_EQUAL(balances.nTrusted, nCredit);
+    BOOST_CHECK_EQUAL(balances.nLocked, 0);
+
+    // Locking and unlocking coins
+    wallet.LockCoin(COutPoint(wtxCredit.GetHash(), 0));
+    BOOST_CHECK_EQUAL(wallet.GetLockedCoins(), nCredit / 2);
+    wallet.UnlockAllCoins();
+    BOOST_CHECK_EQUAL(wallet.GetLockedCoins(), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
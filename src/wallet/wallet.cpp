@@ -16,12 +16,14 @@
 #include "masternode-payments.h"
 #include "masternodeconfig.h"
 #include "policy/policy.h"
+#include "scheduler.h"
 #include "script/sign.h"
 #include "spork.h"
 #include "util.h"
 #include "utilmoneystr.h"
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 
 CWallet* pwalletMain = nullptr;
@@ -68,7 +70,7 @@ struct CompareValueOnly {
 
 std::string COutput::ToString() const
 {
-    return strprintf("COutput(%s, %d, %d) [%s]", tx->GetHash().ToString(), i, nDepth, FormatMoney(tx->vout[i].nValue));
+    return strprintf("COutput(%s, %d, %d) [%s]", tx->GetHash().ToString(), i, nDepth, FormatMoney(tx->tx->vout[i].nValue));
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -319,41 +321,51 @@ bool CWallet::Unlock(const CKeyingMaterial& vMasterKeyIn)
         if (!SetCrypted())
             return false;
 
-        bool keyPass = false;
-        bool keyFail = false;
-        CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
-        for (; mi != mapCryptedKeys.end(); ++mi) {
-            const CPubKey& vchPubKey = (*mi).second.first;
-            const std::vector<unsigned char>& vchCryptedSecret = (*mi).second.second;
-            CKeyingMaterial vchSecret;
-            if (!DecryptSecret(vMasterKeyIn, vchCryptedSecret, vchPubKey.GetHash(), vchSecret)) {
-                keyFail = true;
-                break;
-            }
-            if (vchSecret.size() != 32) {
-                keyFail = true;
-                break;
-            }
-            CKey key;
-            key.Set(vchSecret.begin(), vchSecret.end(), vchPubKey.IsCompressed());
-            if (key.GetPubKey() != vchPubKey) {
-                keyFail = true;
-                break;
+        std::vector<const CryptedKeyMap::mapped_type*> vKeys;
+        int nThreads = 1;
+        if (fDecryptionThoroughlyChecked) {
+            // All the keys were checked in this session, one is enough to check the master key
+            if (!mapCryptedKeys.empty())
+                vKeys.push_back(&mapCryptedKeys.begin()->second);
+        } else {
+            vKeys.reserve(mapCryptedKeys.size());
+            for (const CryptedKeyMap::value_type& mi : mapCryptedKeys)
+                vKeys.push_back(&mi.second);
+            if (fCryptedKeysVerified) {
+                // All the keys were checked by a previous session, spot-check a random sample
+                FastRandomContext rng;
+                for (size_t i = 0; i < vKeys.size() && i < UNLOCK_SPOT_CHECK_KEYS; i++)
+                    std::swap(vKeys[i], vKeys[i + rng.randrange(vKeys.size() - i)]);
+                if (vKeys.size() > UNLOCK_SPOT_CHECK_KEYS)
+                    vKeys.resize(UNLOCK_SPOT_CHECK_KEYS);
+            } else {
+                // The first unlock of the wallet decrypts every key, spread over all cores
+                nThreads = GetNumCores();
             }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
         }
 
-        if (keyPass && keyFail) {
+        if (vKeys.empty())
+            return false;
+
+        const int64_t nTimeStart = GetTimeMillis();
+        size_t nPassed = 0;
+        const bool fPassed = VerifyCryptedKeys(vMasterKeyIn, vKeys, nThreads, nPassed);
+        LogPrint(BCLog::BENCH, "%s: checked %u of %u keys in %dms\n", __func__, vKeys.size(), mapCryptedKeys.size(), GetTimeMillis() - nTimeStart);
+
+        if (!fPassed && nPassed > 0) {
             LogPrintf("The wallet is probably corrupted: Some keys decrypt but not all.\n");
             throw std::runtime_error("Error unlocking wallet: some keys decrypt but not all. Your wallet file may be corrupt.");
         }
 
-        if (keyFail || !keyPass)
+        if (!fPassed)
             return false;
 
         vMasterKey = vMasterKeyIn;
+        if (!fCryptedKeysVerified && !fDecryptionThoroughlyChecked) {
+            fCryptedKeysVerified = true;
+            if (fFileBacked)
+                CWalletDB(strWalletFile).WriteCryptedKeysVerified(true);
+        }
         fDecryptionThoroughlyChecked = true;
     }
 
@@ -467,7 +479,7 @@ std::set<uint256> CWallet::GetConflicts(const uint256& txid) const
 
     std::pair<TxSpends::const_iterator, TxSpends::const_iterator> range;
 
-    for (const CTxIn& txin : wtx.vin) {
+    for (const CTxIn& txin : wtx.tx->vin) {
         if (mapTxSpends.count(txin.prevout) <= 1)
             continue; // No conflict if zero or one spends
         range = mapTxSpends.equal_range(txin.prevout);
@@ -616,6 +628,7 @@ void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(std::make_pair(outpoint, wtxid));
     setLockedCoins.erase(outpoint);
+    MarkBalancesDirty();
 
     std::pair<TxSpends::iterator, TxSpends::iterator> range;
     range = mapTxSpends.equal_range(outpoint);
@@ -630,10 +643,38 @@ void CWallet::AddToSpends(const uint256& wtxid)
     if (thisTx.IsCoinBase()) // Coinbases don't spend anything!
         return;
 
-    for (const CTxIn& txin : thisTx.vin)
+    for (const CTxIn& txin : thisTx.tx->vin)
         AddToSpends(txin.prevout, wtxid);
 }
 
+void CWallet::AddToOutputsByDest(const CWalletTx& wtx, unsigned int n)
+{
+    AssertLockHeld(cs_wallet);
+    if (!fOutputsByDestBuilt)
+        return;
+
+    const CTxOut& txout = wtx.tx->vout[n];
+    if (txout.nValue <= 0 || (IsMine(txout) & ISMINE_SPENDABLE) == ISMINE_NO)
+        return;
+
+    CTxDestination dest;
+    if (!ExtractDestination(txout.scriptPubKey, dest))
+        return;
+
+    mapOutputsByDest[dest].insert(COutPoint(wtx.GetHash(), n));
+}
+
+void CWallet::AddPrevoutsToOutputsByDest(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    // The outputs spent by wtx may be spendable again, if wtx changed state
+    for (const CTxIn& txin : wtx.tx->vin) {
+        std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
+        if (mi != mapWallet.end() && txin.prevout.n < mi->second.tx->vout.size())
+            AddToOutputsByDest(mi->second, txin.prevout.n);
+    }
+}
+
 bool CWallet::GetVinAndKeysFromOutput(COutput out, CTxIn& txinRet, CPubKey& pubKeyRet, CKey& keyRet)
 {
     // wait for reindex and/or import to finish
@@ -642,7 +683,7 @@ bool CWallet::GetVinAndKeysFromOutput(COutput out, CTxIn& txinRet, CPubKey& pubK
     CScript pubScript;
 
     txinRet = CTxIn(out.tx->GetHash(), out.i);
-    pubScript = out.tx->vout[out.i].scriptPubKey; // the inputs PubKey
+    pubScript = out.tx->tx->vout[out.i].scriptPubKey; // the inputs PubKey
 
     CTxDestination address1;
     ExtractDestination(pubScript, address1);
@@ -772,7 +813,7 @@ bool CWallet::IsKeyUsed(const CPubKey& vchPubKey) {
              it != mapWallet.end() && vchPubKey.IsValid();
              ++it) {
             const CWalletTx& wtx = (*it).second;
-            for (const CTxOut& txout : wtx.vout)
+            for (const CTxOut& txout : wtx.tx->vout)
                 if (txout.scriptPubKey == scriptPubKey)
                     return true;
         }
@@ -830,6 +871,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
     wtx.BindWallet(this);
     bool fInsertedNew = ret.second;
     if (fInsertedNew) {
+        WITH_LOCK(cs_walletTxHashes, setWalletTxHashes.insert(hash));
         wtx.nTimeReceived = GetAdjustedTime();
         wtx.nOrderPos = IncOrderPosNext(&walletdb);
         wtxOrdered.insert(std::make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
@@ -873,6 +915,10 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
     // Break debit/credit balance caches:
     wtx.MarkDirty();
 
+    // Index the outputs (again, as keys may have been added since the last time)
+    for (unsigned int i = 0; i < wtx.tx->vout.size(); i++)
+        AddToOutputsByDest(wtx, i);
+
     // Notify UI of new or updated transaction
     NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
 
@@ -890,11 +936,12 @@ bool CWallet::LoadToWallet(const CWalletTx& wtxIn)
 {
     const uint256& hash = wtxIn.GetHash();
     mapWallet[hash] = wtxIn;
+    WITH_LOCK(cs_walletTxHashes, setWalletTxHashes.insert(hash));
     CWalletTx& wtx = mapWallet[hash];
     wtx.BindWallet(this);
     wtxOrdered.insert(std::make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
     AddToSpends(hash);
-    for (const CTxIn& txin : wtx.vin) {
+    for (const CTxIn& txin : wtx.tx->vin) {
         if (mapWallet.count(txin.prevout.hash)) {
             CWalletTx& prevtx = mapWallet[txin.prevout.hash];
             if (prevtx.nIndex == -1 && !prevtx.hashUnset()) {
@@ -943,7 +990,7 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlockIndex
                 m_spk_man->MarkUnusedAddresses(txout.scriptPubKey);
             }
 
-            CWalletTx wtx(this, tx);
+            CWalletTx wtx(this, MakeTransactionRef(tx));
             // Get merkle branch if transaction was found in a block
             if (posInBlock != -1)
                 wtx.SetMerkleBranch(pIndex, posInBlock);
@@ -1000,11 +1047,12 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
             }
             // If a transaction changes 'conflicted' state, that changes the balance
             // available of the outputs it spends. So force those to be recomputed
-            for (const CTxIn& txin: wtx.vin)
+            for (const CTxIn& txin: wtx.tx->vin)
             {
                 if (mapWallet.count(txin.prevout.hash))
                     mapWallet[txin.prevout.hash].MarkDirty();
             }
+            AddPrevoutsToOutputsByDest(wtx);
         }
     }
 
@@ -1062,11 +1110,12 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             }
             // If a transaction changes 'conflicted' state, that changes the balance
             // available of the outputs it spends. So force those to be recomputed
-            for (const CTxIn& txin: wtx.vin)
+            for (const CTxIn& txin: wtx.tx->vin)
             {
                 if (mapWallet.count(txin.prevout.hash))
                     mapWallet[txin.prevout.hash].MarkDirty();
             }
+            AddPrevoutsToOutputsByDest(wtx);
         }
     }
 }
@@ -1084,6 +1133,15 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex,
         if (mapWallet.count(txin.prevout.hash))
             mapWallet[txin.prevout.hash].MarkDirty();
     }
+    AddPrevoutsToOutputsByDest(mapWallet[tx.GetHash()]);
+}
+
+void CWallet::UpdatedBlockTip(const CBlockIndex *pindex)
+{
+    // The automations may create transactions: run them later from the scheduler
+    // thread instead of delaying the processing of the next block.
+    if (fCombineDust || isMultiSendEnabled())
+        ScheduleAutomations();
 }
 
 void CWallet::EraseFromWallet(const uint256& hash)
@@ -1092,8 +1150,11 @@ void CWallet::EraseFromWallet(const uint256& hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        if (mapWallet.erase(hash)) {
+            WITH_LOCK(cs_walletTxHashes, setWalletTxHashes.erase(hash));
             CWalletDB(strWalletFile).EraseTx(hash);
+            MarkBalancesDirty();
+        }
         LogPrintf("%s: Erased wtx %s from wallet\n", __func__, hash.GetHex());
     }
     return;
@@ -1106,8 +1167,8 @@ isminetype CWallet::IsMine(const CTxIn& txin) const
         std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
         if (mi != mapWallet.end()) {
             const CWalletTx& prev = (*mi).second;
-            if (txin.prevout.n < prev.vout.size())
-                return IsMine(prev.vout[txin.prevout.n]);
+            if (txin.prevout.n < prev.tx->vout.size())
+                return IsMine(prev.tx->vout[txin.prevout.n]);
         }
     }
     return ISMINE_NO;
@@ -1126,7 +1187,7 @@ bool CWallet::IsUsed(const CTxDestination address) const
         if (wtx.IsCoinBase()) {
             continue;
         }
-        for (const CTxOut& txout : wtx.vout) {
+        for (const CTxOut& txout : wtx.tx->vout) {
             if (txout.scriptPubKey == scriptPubKey)
                 return true;
         }
@@ -1141,9 +1202,9 @@ CAmount CWallet::GetDebit(const CTxIn& txin, const isminefilter& filter) const
         std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
         if (mi != mapWallet.end()) {
             const CWalletTx& prev = (*mi).second;
-            if (txin.prevout.n < prev.vout.size())
-                if (IsMine(prev.vout[txin.prevout.n]) & filter)
-                    return prev.vout[txin.prevout.n].nValue;
+            if (txin.prevout.n < prev.tx->vout.size())
+                if (IsMine(prev.tx->vout[txin.prevout.n]) & filter)
+                    return prev.tx->vout[txin.prevout.n].nValue;
         }
     }
     return 0;
@@ -1210,7 +1271,7 @@ bool CWalletTx::IsAmountCached(AmountType type, const isminefilter& filter) cons
 //! filter decides which addresses will count towards the debit
 CAmount CWalletTx::GetDebit(const isminefilter& filter) const
 {
-    if (vin.empty())
+    if (tx->vin.empty())
         return 0;
 
     CAmount debit = 0;
@@ -1264,9 +1325,9 @@ CAmount CWalletTx::GetAvailableCredit(bool fUseCache, const isminefilter& filter
 
     CAmount nCredit = 0;
     const uint256& hashTx = GetHash();
-    for (unsigned int i = 0; i < vout.size(); i++) {
+    for (unsigned int i = 0; i < tx->vout.size(); i++) {
         if (!pwallet->IsSpent(hashTx, i)) {
-            const CTxOut &txout = vout[i];
+            const CTxOut &txout = tx->vout[i];
             nCredit += pwallet->GetCredit(txout, filter);
             if (!Params().GetConsensus().MoneyRange(nCredit))
                 throw std::runtime_error(std::string(__func__) + " : value out of range");
@@ -1292,8 +1353,8 @@ CAmount CWalletTx::GetLockedCredit() const
 
     CAmount nCredit = 0;
     uint256 hashTx = GetHash();
-    for (unsigned int i = 0; i < vout.size(); i++) {
-        const CTxOut& txout = vout[i];
+    for (unsigned int i = 0; i < tx->vout.size(); i++) {
+        const CTxOut& txout = tx->vout[i];
 
         // Skip spent coins
         if (pwallet->IsSpent(hashTx, i)) continue;
@@ -1304,7 +1365,7 @@ CAmount CWalletTx::GetLockedCredit() const
         }
 
         // Add masternode collaterals which are handled like locked coins
-        else if (fMasterNode && vout[i].nValue == CMasternode::GetMasternodeNodeCollateral(chainActive.Height())) {
+        else if (fMasterNode && tx->vout[i].nValue == CMasternode::GetMasternodeNodeCollateral(chainActive.Height())) {
             nCredit += pwallet->GetCredit(txout, ISMINE_SPENDABLE);
         }
 
@@ -1345,13 +1406,13 @@ void CWalletTx::GetAmounts(std::list<COutputEntry>& listReceived,
     CAmount nDebit = GetDebit(filter);
     if (nDebit > 0) // debit>0 means we signed/sent this transaction
     {
-        CAmount nValueOut = GetValueOut();
+        CAmount nValueOut = tx->GetValueOut();
         nFee = nDebit - nValueOut;
     }
 
     // Sent/received.
-    for (unsigned int i = 0; i < vout.size(); ++i) {
-        const CTxOut& txout = vout[i];
+    for (unsigned int i = 0; i < tx->vout.size(); ++i) {
+        const CTxOut& txout = tx->vout[i];
         isminetype fIsMine = pwallet->IsMine(txout);
         // Only need to handle txouts if AT LEAST one of these is true:
         //   1) they debit from us (sent)
@@ -1437,7 +1498,7 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, b
             ReadBlockFromDisk(block, pindex);
             int posInBlock;
             for (posInBlock = 0; posInBlock < (int)block.vtx.size(); posInBlock++) {
-                if (AddToWalletIfInvolvingMe(block.vtx[posInBlock], pindex, posInBlock, fUpdate))
+                if (AddToWalletIfInvolvingMe(*block.vtx[posInBlock], pindex, posInBlock, fUpdate))
                     ret++;
             }
 
@@ -1635,10 +1696,69 @@ CAmount CWallet::loopTxsBalance(std::function<void(const uint256&, const CWallet
     return nTotal;
 }
 
+CWallet::BalanceCacheKey CWallet::GetBalanceCacheKey() const
+{
+    AssertLockHeld(cs_main);
+    BalanceCacheKey key;
+    key.nStateVersion = nBalanceStateVersion;
+    key.pindexTip = chainActive.Tip();
+    key.fValid = true;
+    return key;
+}
+
+CWallet::Balances CWallet::ComputeBalances() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    const int nStakeMinDepth = Params().GetConsensus().NetworkUpgradeActive(chainActive.Height(), Consensus::UPGRADE_STAKE_MIN_DEPTH_V2) ?
+            Params().GetConsensus().nStakeMinDepthV2 : Params().GetConsensus().nStakeMinDepth;
+    const isminefilter filter = ISMINE_SPENDABLE;
+
+    Balances ret;
+    for (const auto& it : mapWallet) {
+        const CWalletTx& pcoin = it.second;
+        bool fConflicted = false;
+        int nDepth = 0;
+        if (pcoin.IsTrusted(nDepth, fConflicted)) {
+            ret.nTrusted += pcoin.GetAvailableCredit(true, filter);
+            ret.nWatchOnlyTrusted += pcoin.GetAvailableWatchOnlyCredit();
+            const CAmount nLockedCredit = nDepth > 0 ? pcoin.GetLockedCredit() : 0;
+            if (nDepth > 0) ret.nLocked += nLockedCredit;
+            if (nDepth >= nStakeMinDepth) ret.nStakeable += pcoin.GetAvailableCredit() - nLockedCredit;
+        } else if (pcoin.GetDepthInMainChain() == 0 && pcoin.InMempool()) {
+            ret.nUntrustedPending += pcoin.GetAvailableCredit();
+            ret.nWatchOnlyUntrustedPending += pcoin.GetAvailableWatchOnlyCredit();
+        }
+        ret.nImmature += pcoin.GetImmatureCredit(false);
+        ret.nWatchOnlyImmature += pcoin.GetImmatureWatchOnlyCredit();
+    }
+    ret.nStakeable = std::max(CAmount(0), ret.nStakeable);
+    return ret;
+}
+
+void CWallet::TransactionRemovedFromMempool(const CTransactionRef& ptx)
+{
+    // Additions come through SyncTransaction, and blocks change the tip: this
+    // is for the removals that come alone (expiry, size limit, replacement).
+    LOCK(cs_walletTxHashes);
+    if (setWalletTxHashes.count(ptx->GetHash()))
+        MarkBalancesDirty();
+}
+
+CWallet::Balances CWallet::GetBalances() const
+{
+    LOCK2(cs_main, cs_wallet);
+    const BalanceCacheKey key = GetBalanceCacheKey();
+    if (!(key == balanceCacheKey)) {
+        cachedBalances = ComputeBalances();
+        balanceCacheKey = key;
+    }
+    return cachedBalances;
+}
+
 CAmount CWallet::GetAvailableBalance() const
 {
-    isminefilter filter = ISMINE_SPENDABLE;
-    return GetAvailableBalance(filter, true, 0);
+    return GetBalances().nTrusted;
 }
 
 CAmount CWallet::GetAvailableBalance(isminefilter& filter, bool useCache, int minDepth) const
@@ -1654,66 +1774,39 @@ CAmount CWallet::GetAvailableBalance(isminefilter& filter, bool useCache, int mi
 
 CAmount CWallet::GetStakingBalance() const
 {
-    return std::max(CAmount(0), loopTxsBalance(
-            [](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-        if (pcoin.IsTrusted() && 
-            pcoin.GetDepthInMainChain() 
-                >= 
-            (Params().GetConsensus().NetworkUpgradeActive(chainActive.Height(), Consensus::UPGRADE_STAKE_MIN_DEPTH_V2) ?
-                    Params().GetConsensus().nStakeMinDepthV2 : Params().GetConsensus().nStakeMinDepth)
-        ) {
-            nTotal += pcoin.GetAvailableCredit();       // available coins
-            nTotal -= pcoin.GetLockedCredit();          // minus locked coins, if any
-        }
-    }));
+    return GetBalances().nStakeable;
 }
 
 CAmount CWallet::GetLockedCoins() const
 {
     if (fLiteMode) return 0;
 
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            if (pcoin.IsTrusted() && pcoin.GetDepthInMainChain() > 0)
-                nTotal += pcoin.GetLockedCredit();
-    });
+    return GetBalances().nLocked;
 }
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            if (!pcoin.IsTrusted() && pcoin.GetDepthInMainChain() == 0 && pcoin.InMempool())
-                nTotal += pcoin.GetAvailableCredit();
-    });
+    return GetBalances().nUntrustedPending;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            nTotal += pcoin.GetImmatureCredit(false);
-    });
+    return GetBalances().nImmature;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            if (pcoin.IsTrusted())
-                nTotal += pcoin.GetAvailableWatchOnlyCredit();
-    });
+    return GetBalances().nWatchOnlyTrusted;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            if (!pcoin.IsTrusted() && pcoin.GetDepthInMainChain() == 0 && pcoin.InMempool())
-                nTotal += pcoin.GetAvailableWatchOnlyCredit();
-    });
+    return GetBalances().nWatchOnlyUntrustedPending;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            nTotal += pcoin.GetImmatureWatchOnlyCredit();
-    });
+    return GetBalances().nWatchOnlyImmature;
 }
 
 // Calculate total balance in a different way from GetBalance. The biggest
@@ -1739,7 +1832,7 @@ CAmount CWallet::GetLegacyBalance(const isminefilter& filter, int minDepth, cons
         // treat change outputs specially, as part of the amount debited.
         CAmount debit = wtx.GetDebit(filter);
         const bool outgoing = debit > 0;
-        for (const CTxOut& out : wtx.vout) {
+        for (const CTxOut& out : wtx.tx->vout) {
             if (outgoing && IsChange(out)) {
                 debit -= out.nValue;
             } else if (IsMine(out) & filter && depth >= minDepth && (!account || *account == GetAccountName(out.scriptPubKey))) {
@@ -1807,12 +1900,12 @@ bool CWallet::GetMasternodeVinAndKeys(CTxIn& txinRet, CPubKey& pubKeyRet, CKey&
     const CWalletTx& wtx = mi->second;
 
     // Verify index limits
-    if (nOutputIndex < 0 || nOutputIndex >= (int) wtx.vout.size()) {
+    if (nOutputIndex < 0 || nOutputIndex >= (int) wtx.tx->vout.size()) {
         strError = "Invalid masternode output index";
         return error("%s: output index %d not found in %s", __func__, nOutputIndex, strTxHash);
     }
 
-    CTxOut txOut = wtx.vout[nOutputIndex];
+    CTxOut txOut = wtx.tx->vout[nOutputIndex];
 
     // Masternode collateral value
     if (!CMasternode::CheckMasternodeCollateral(txOut.nValue)) 
@@ -1887,15 +1980,15 @@ bool CWallet::AvailableCoins(std::vector<COutput>* pCoins,      // --> populates
                 (Params().GetConsensus().NetworkUpgradeActive(chainActive.Height(), Consensus::UPGRADE_STAKE_MIN_DEPTH_V2) ?
                     Params().GetConsensus().nStakeMinDepthV2 : Params().GetConsensus().nStakeMinDepth)) continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
+            for (unsigned int i = 0; i < pcoin->tx->vout.size(); i++) {
 
                 // Check for only 10k utxo
-                if (nCoinType == ONLY_10000 && !CMasternode::CheckMasternodeCollateral(pcoin->vout[i].nValue)) continue;
+                if (nCoinType == ONLY_10000 && !CMasternode::CheckMasternodeCollateral(pcoin->tx->vout[i].nValue)) continue;
 
                 // Check if the utxo was spent.
                 if (IsSpent(wtxid, i)) continue;
 
-                isminetype mine = IsMine(pcoin->vout[i]);
+                isminetype mine = IsMine(pcoin->tx->vout[i]);
 
                 // Check If not mine
                 if (mine == ISMINE_NO) continue;
@@ -1910,12 +2003,12 @@ bool CWallet::AvailableCoins(std::vector<COutput>* pCoins,      // --> populates
                 if (masternodeConfig.contains(COutPoint((*it).first, i)) && nCoinType != ONLY_10000) continue;
 
                 // Check if we should include zero value utxo
-                if (pcoin->vout[i].nValue <= 0) continue;
+                if (pcoin->tx->vout[i].nValue <= 0) continue;
 
                 if (fCoinsSelected && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(COutPoint((*it).first, i)))
                     continue;
 
-                bool solvable = IsSolvable(*this, pcoin->vout[i].scriptPubKey);
+                bool solvable = IsSolvable(*this, pcoin->tx->vout[i].scriptPubKey);
 
                 bool spendable = ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
                         (((mine & ISMINE_WATCH_ONLY) != ISMINE_NO) && (coinControl && coinControl->fAllowWatchOnly && solvable));
@@ -1931,23 +2024,46 @@ bool CWallet::AvailableCoins(std::vector<COutput>* pCoins,      // --> populates
 
 std::map<CTxDestination , std::vector<COutput> > CWallet::AvailableCoinsByAddress(bool fConfirmed, CAmount maxCoinValue)
 {
-    std::vector<COutput> vCoins;
-    AvailableCoins(&vCoins,
-            nullptr,            // coin control
-            ALL_COINS,          // coin type
-            fConfirmed);        // only confirmed
-
     std::map<CTxDestination, std::vector<COutput> > mapCoins;
-    for (COutput& out : vCoins) {
-        if (maxCoinValue > 0 && out.tx->vout[out.i].nValue > maxCoinValue)
-            continue;
 
-        CTxDestination address;
-        if (!ExtractDestination(out.tx->vout[out.i].scriptPubKey, address)) {
-            continue;
+    LOCK2(cs_main, cs_wallet);
+    if (!fOutputsByDestBuilt) {
+        fOutputsByDestBuilt = true;
+        for (const auto& item : mapWallet) {
+            for (unsigned int i = 0; i < item.second.tx->vout.size(); i++)
+                AddToOutputsByDest(item.second, i);
+        }
+    }
+
+    for (OutputsByDest::iterator itDest = mapOutputsByDest.begin(); itDest != mapOutputsByDest.end();) {
+        std::set<COutPoint>& setOutputs = itDest->second;
+        for (std::set<COutPoint>::iterator it = setOutputs.begin(); it != setOutputs.end();) {
+            std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(it->hash);
+            // Prune the outputs of erased transactions, and the spent outputs
+            if (mi == mapWallet.end() || IsSpent(*it)) {
+                it = setOutputs.erase(it);
+                continue;
+            }
+
+            const CWalletTx* pcoin = &mi->second;
+            const CTxOut& txout = pcoin->tx->vout[it->n];
+            int nDepth;
+            if ((maxCoinValue > 0 && txout.nValue > maxCoinValue) ||
+                    IsLockedCoin(it->hash, it->n) ||
+                    masternodeConfig.contains(*it) ||
+                    !CheckTXAvailability(pcoin, fConfirmed, nDepth)) {
+                ++it;
+                continue;
+            }
+
+            mapCoins[itDest->first].emplace_back(COutput(pcoin, it->n, nDepth, true, IsSolvable(*this, txout.scriptPubKey)));
+            ++it;
         }
 
-        mapCoins[address].push_back(out);
+        if (setOutputs.empty())
+            itDest = mapOutputsByDest.erase(itDest);
+        else
+            ++itDest;
     }
 
     return mapCoins;
@@ -1995,9 +2111,18 @@ static void ApproximateBestSubset(std::vector<std::pair<CAmount, std::pair<const
 
 bool CWallet::StakeableCoins(std::vector<COutput>* pCoins)
 {
-    return AvailableCoins(pCoins,
-            nullptr,            // coin control
-            STAKEABLE_COINS);  // coin type
+    // The staking loop asks for these on every round: walk the wallet again
+    // only when something the result depends on changed.
+    LOCK2(cs_main, cs_wallet);
+    const BalanceCacheKey key = GetBalanceCacheKey();
+    if (!(key == stakeableCacheKey)) {
+        AvailableCoins(&vCachedStakeableCoins,
+                nullptr,            // coin control
+                STAKEABLE_COINS);  // coin type
+        stakeableCacheKey = key;
+    }
+    if (pCoins) *pCoins = vCachedStakeableCoins;
+    return !vCachedStakeableCoins.empty();
 }
 
 bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet) const
@@ -2024,7 +2149,7 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
             continue;
 
         int i = output.i;
-        CAmount n = pcoin->vout[i].nValue;
+        CAmount n = pcoin->tx->vout[i].nValue;
 
         std::pair<CAmount, std::pair<const CWalletTx*, unsigned int> > coin = std::make_pair(n, std::make_pair(pcoin, i));
 
@@ -2097,7 +2222,7 @@ bool CWallet::SelectCoinsToSpend(const std::vector<COutput>& vAvailableCoins, co
             if (!out.fSpendable)
                 continue;
 
-            nValueRet += out.tx->vout[out.i].nValue;
+            nValueRet += out.tx->tx->vout[out.i].nValue;
             setCoinsRet.insert(std::make_pair(out.tx, out.i));
         }
         return (nValueRet >= nTargetValue);
@@ -2115,9 +2240,9 @@ bool CWallet::SelectCoinsToSpend(const std::vector<COutput>& vAvailableCoins, co
         if (it != mapWallet.end()) {
             const CWalletTx* pcoin = &it->second;
             // Clearly invalid input, fail
-            if (pcoin->vout.size() <= outpoint.n)
+            if (pcoin->tx->vout.size() <= outpoint.n)
                 return false;
-            nValueFromPresetInputs += pcoin->vout[outpoint.n].nValue;
+            nValueFromPresetInputs += pcoin->tx->vout[outpoint.n].nValue;
             setPresetCoins.insert(std::make_pair(pcoin, outpoint.n));
         } else
             return false; // TODO: Allow non-wallet inputs
@@ -2171,10 +2296,10 @@ bool CWallet::FundTransaction(CMutableTransaction& tx, CAmount& nFeeRet, bool ov
         return false;
 
     if (nChangePosInOut != -1)
-        tx.vout.insert(tx.vout.begin() + nChangePosInOut, wtx.vout[nChangePosInOut]);
+        tx.vout.insert(tx.vout.begin() + nChangePosInOut, wtx.tx->vout[nChangePosInOut]);
 
     // Add new txins (keeping original txin scriptSig/order)
-    for (const CTxIn& txin : wtx.vin) {
+    for (const CTxIn& txin : wtx.tx->vin) {
         if (!coinControl.IsSelected(txin.prevout)) {
             tx.vin.push_back(txin);
 
@@ -2284,7 +2409,7 @@ bool CWallet::CreateTransaction(const std::vector<CRecipient>& vecSend,
 
 
                 for (PAIRTYPE(const CWalletTx*, unsigned int) pcoin : setCoins) {
-                    CAmount nCredit = pcoin.first->vout[pcoin.second].nValue;
+                    CAmount nCredit = pcoin.first->tx->vout[pcoin.second].nValue;
                     //The coin age after the next block (depth+1) is used instead of the current,
                     //reflecting an assumption the user would accept a bit more delay for
                     //a chance at a free transaction.
@@ -2374,11 +2499,11 @@ bool CWallet::CreateTransaction(const std::vector<CRecipient>& vecSend,
                 CTransaction txNewConst(txNew);
                 for (const PAIRTYPE(const CWalletTx*, unsigned int) & coin : setCoins) {
                     bool signSuccess;
-                    const CScript& scriptPubKey = coin.first->vout[coin.second].scriptPubKey;
+                    const CScript& scriptPubKey = coin.first->tx->vout[coin.second].scriptPubKey;
                     SignatureData sigdata;
                     if (sign) {
                         signSuccess = ProduceSignature(
-                                TransactionSignatureCreator(this, &txNewConst, nIn, coin.first->vout[coin.second].nValue, SIGHASH_ALL),
+                                TransactionSignatureCreator(this, &txNewConst, nIn, coin.first->tx->vout[coin.second].nValue, SIGHASH_ALL),
                                 scriptPubKey,
                                 sigdata
                         );
@@ -2405,7 +2530,7 @@ bool CWallet::CreateTransaction(const std::vector<CRecipient>& vecSend,
                 }
 
                 // Embed the constructed transaction data in wtxNew.
-                *static_cast<CTransaction*>(&wtxNew) = CTransaction(txNew);
+                wtxNew.SetTx(MakeTransactionRef(txNew));
 
                 // Limit size
                 if (nBytes >= MAX_STANDARD_TX_SIZE) {
@@ -2413,7 +2538,7 @@ bool CWallet::CreateTransaction(const std::vector<CRecipient>& vecSend,
                     return false;
                 }
 
-                dPriority = wtxNew.ComputePriority(dPriority, nBytes);
+                dPriority = wtxNew.tx->ComputePriority(dPriority, nBytes);
 
                 // Can we complete this as a free transaction?
                 if (fSendFreeTransactions && nBytes <= MAX_FREE_TRANSACTION_CREATE_SIZE) {
@@ -2503,7 +2628,7 @@ bool CWallet::CreateCoinStake(
         for (auto it = availableCoins->begin(); it != availableCoins->end();) {
         COutPoint outPoint = COutPoint(it->tx->GetHash(), it->i);
         CPivStake stakeInput;
-        stakeInput.SetPrevout((CTransaction) *it->tx, it->i);
+        stakeInput.SetPrevout(*it->tx->tx, it->i);
 
         //new block came in, move on
         if (WITH_LOCK(cs_main, return chainActive.Height()) != pindexPrev->nHeight) return false;
@@ -2525,6 +2650,7 @@ bool CWallet::CreateCoinStake(
         // update staker status (time, attempts)
         pStakerStatus->SetLastTime(nTxNewTime);
         pStakerStatus->SetLastTries(nAttempts);
+        pStakerStatus->CountTry(fKernelFound);
 
         if (!fKernelFound)
         {
@@ -2632,7 +2758,7 @@ CWallet::CommitResult CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey&
     CommitResult res;
     {
         LOCK2(cs_main, cs_wallet);
-        LogPrintf("%s:\n%s", __func__, wtxNew.ToString());
+        LogPrintf("%s:\n%s", __func__, wtxNew.tx->ToString());
         {
             // Take key pair from key pool so it won't be used again
             reservekey.KeepKey();
@@ -2644,7 +2770,7 @@ CWallet::CommitResult CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey&
             // Notify that old coins are spent
             
             std::set<uint256> updated_hashes;
-            for (const CTxIn& txin : wtxNew.vin) {
+            for (const CTxIn& txin : wtxNew.tx->vin) {
                 // notify only once
                 if (updated_hashes.find(txin.prevout.hash) != updated_hashes.end()) continue;
 
@@ -2906,14 +3032,14 @@ std::map<CTxDestination, CAmount> CWallet::GetAddressBalances()
             if (nDepth < (pcoin->IsFromMe(ISMINE_ALL) ? 0 : 1))
                 continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
+            for (unsigned int i = 0; i < pcoin->tx->vout.size(); i++) {
                 CTxDestination addr;
-                if (!IsMine(pcoin->vout[i]))
+                if (!IsMine(pcoin->tx->vout[i]))
                     continue;
-                if (!ExtractDestination(pcoin->vout[i].scriptPubKey, addr))
+                if (!ExtractDestination(pcoin->tx->vout[i].scriptPubKey, addr))
                     continue;
 
-                CAmount n = IsSpent(walletEntry.first, i) ? 0 : pcoin->vout[i].nValue;
+                CAmount n = IsSpent(walletEntry.first, i) ? 0 : pcoin->tx->vout[i].nValue;
 
                 if (!balances.count(addr))
                     balances[addr] = 0;
@@ -2934,14 +3060,14 @@ std::set<std::set<CTxDestination> > CWallet::GetAddressGroupings()
     for (PAIRTYPE(uint256, CWalletTx) walletEntry : mapWallet) {
         CWalletTx* pcoin = &walletEntry.second;
 
-        if (pcoin->vin.size() > 0) {
+        if (pcoin->tx->vin.size() > 0) {
             bool any_mine = false;
             // group all input addresses with each other
-            for (CTxIn txin : pcoin->vin) {
+            for (CTxIn txin : pcoin->tx->vin) {
                 CTxDestination address;
                 if (!IsMine(txin)) /* If this input isn't mine, ignore it */
                     continue;
-                if (!ExtractDestination(mapWallet[txin.prevout.hash].vout[txin.prevout.n].scriptPubKey, address))
+                if (!ExtractDestination(mapWallet[txin.prevout.hash].tx->vout[txin.prevout.n].scriptPubKey, address))
                     continue;
                 grouping.insert(address);
                 any_mine = true;
@@ -2949,7 +3075,7 @@ std::set<std::set<CTxDestination> > CWallet::GetAddressGroupings()
 
             // group change with input addresses
             if (any_mine) {
-                for (CTxOut txout : pcoin->vout)
+                for (CTxOut txout : pcoin->tx->vout)
                     if (IsChange(txout)) {
                         CTxDestination txoutAddr;
                         if (!ExtractDestination(txout.scriptPubKey, txoutAddr))
@@ -2964,10 +3090,10 @@ std::set<std::set<CTxDestination> > CWallet::GetAddressGroupings()
         }
 
         // group lone addrs by themselves
-        for (unsigned int i = 0; i < pcoin->vout.size(); i++)
-            if (IsMine(pcoin->vout[i])) {
+        for (unsigned int i = 0; i < pcoin->tx->vout.size(); i++)
+            if (IsMine(pcoin->tx->vout[i])) {
                 CTxDestination address;
-                if (!ExtractDestination(pcoin->vout[i].scriptPubKey, address))
+                if (!ExtractDestination(pcoin->tx->vout[i].scriptPubKey, address))
                     continue;
                 grouping.insert(address);
                 groupings.insert(grouping);
@@ -3092,18 +3218,21 @@ void CWallet::LockCoin(const COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.insert(output);
+    MarkBalancesDirty();
 }
 
 void CWallet::UnlockCoin(const COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.erase(output);
+    MarkBalancesDirty();
 }
 
 void CWallet::UnlockAllCoins()
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.clear();
+    MarkBalancesDirty();
 }
 
 bool CWallet::IsLockedCoin(const uint256& hash, unsigned int n) const
@@ -3208,7 +3337,7 @@ void CWallet::GetKeyBirthTimes(std::map<CKeyID, int64_t>& mapKeyBirth) const
         if (blit != mapBlockIndex.end() && chainActive.Contains(blit->second)) {
             // ... which are already in a block
             int nHeight = blit->second->nHeight;
-            for (const CTxOut& txout : wtx.vout) {
+            for (const CTxOut& txout : wtx.tx->vout) {
                 // iterate over all their outputs
                 CAffectedKeysVisitor(*this, vAffected).Process(txout.scriptPubKey);
                 for (const CKeyID& keyid : vAffected) {
@@ -3474,6 +3603,30 @@ bool CWallet::MultiSend()
     */
 }
 
+void CWallet::ScheduleAutomations()
+{
+    CScheduler* scheduler = pAutomationsScheduler;
+    if (!scheduler || fAutomationsScheduled.exchange(true))
+        return;
+    scheduler->scheduleFromNow(boost::bind(&CWallet::RunAutomations, this), WALLET_AUTOMATIONS_DELAY);
+}
+
+void CWallet::RunAutomations()
+{
+    // From now on, a new tip schedules another run
+    fAutomationsScheduled = false;
+
+    /* disable multisend
+    // If turned on MultiSend will send a transaction (or more) on the after maturity of a stake
+    if (isMultiSendEnabled())
+        MultiSend();
+    */
+
+    // If turned on Auto Combine will scan wallet for dust to combine
+    if (fCombineDust)
+        AutoCombineDust(g_connman.get());
+}
+
 std::string CWallet::GetWalletHelpString(bool showDebug)
 {
     std::string strUsage = HelpMessageGroup(_("Wallet options:"));
@@ -3642,6 +3795,7 @@ CWallet* CWallet::CreateWalletFromFile(const std::string walletFile)
     LogPrintf("Wallet completed loading in %15dms\n", GetTimeMillis() - nStart);
 
     RegisterValidationInterface(walletInstance);
+    walletInstance->connMempoolRemoved = mempool.NotifyEntryRemoved.connect(boost::bind(&CWallet::TransactionRemovedFromMempool, walletInstance, _1));
 
     CBlockIndex* pindexRescan = chainActive.Tip();
     if (GetBoolArg("-rescan", false))
@@ -3713,11 +3867,14 @@ bool CWallet::InitLoadWallet()
 
 std::atomic<bool> CWallet::fFlushThreadRunning(false);
 
-void CWallet::postInitProcess(boost::thread_group& threadGroup)
+void CWallet::postInitProcess(boost::thread_group& threadGroup, CScheduler& scheduler)
 {
     // Add wallet transactions that aren't already in a block to mapTransactions
     ReacceptWalletTransactions(/*fFirstLoad*/true);
 
+    // Run the wallet automations (MultiSend, AutoCombineDust) after new tips
+    pAutomationsScheduler = &scheduler;
+
     // Run a thread to flush wallet periodically
     if (!CWallet::fFlushThreadRunning.exchange(true)) {
         threadGroup.create_thread(ThreadFlushWalletDB);
@@ -3808,7 +3965,7 @@ bool CMerkleTx::IsInMainChainImmature() const
 bool CMerkleTx::AcceptToMemoryPool(bool fLimitFree, bool fRejectInsaneFee, bool ignoreFees)
 {
     CValidationState state;
-    bool fAccepted = ::AcceptToMemoryPool(mempool, state, *this, fLimitFree, nullptr, false, fRejectInsaneFee, ignoreFees);
+    bool fAccepted = ::AcceptToMemoryPool(mempool, state, tx, fLimitFree, nullptr, false, fRejectInsaneFee, ignoreFees);
     if (!fAccepted)
         LogPrintf("%s : %s\n", __func__, state.GetRejectReason());
     return fAccepted;
@@ -3994,12 +4151,7 @@ CWalletTx::CWalletTx(const CWallet* pwalletIn)
     Init(pwalletIn);
 }
 
-CWalletTx::CWalletTx(const CWallet* pwalletIn, const CMerkleTx& txIn) : CMerkleTx(txIn)
-{
-    Init(pwalletIn);
-}
-
-CWalletTx::CWalletTx(const CWallet* pwalletIn, const CTransaction& txIn) : CMerkleTx(txIn)
+CWalletTx::CWalletTx(const CWallet* pwalletIn, CTransactionRef arg) : CMerkleTx(std::move(arg))
 {
     Init(pwalletIn);
 }
@@ -4044,12 +4196,12 @@ bool CWalletTx::IsTrusted(int& nDepth, bool& fConflicted) const
         return false;
 
     // Trusted if all inputs are from us and are in the mempool:
-    for (const CTxIn& txin : vin) {
+    for (const CTxIn& txin : tx->vin) {
         // Transactions not sent by us: not trusted
         const CWalletTx* parent = pwallet->GetWalletTx(txin.prevout.hash);
         if (parent == nullptr)
             return false;
-        const CTxOut& parentOut = parent->vout[txin.prevout.n];
+        const CTxOut& parentOut = parent->tx->vout[txin.prevout.n];
         if (pwallet->IsMine(parentOut) != ISMINE_SPENDABLE)
             return false;
     }
@@ -4080,6 +4232,7 @@ void CWalletTx::MarkDirty()
     m_amounts[AVAILABLE_CREDIT].Reset();
     nChangeCached = 0;
     fChangeCached = false;
+    if (pwallet) pwallet->MarkBalancesDirty();
 }
 
 void CWalletTx::BindWallet(CWallet* pwalletIn)
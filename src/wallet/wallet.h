@@ -80,11 +80,16 @@ static const unsigned int DEFAULT_GENERATE_PROCLIMIT = 1;
 static const unsigned int DEFAULT_CREATEWALLETBACKUPS = 10;
 //! Default for -disablewallet
 static const bool DEFAULT_DISABLE_WALLET = false;
+//! Delay (in seconds) between a new tip and the run of the wallet automations, quick successions of tips share a run
+static const int64_t WALLET_AUTOMATIONS_DELAY = 5;
+//! Number of keys decrypted at unlock when a previous session already checked all of them
+static const size_t UNLOCK_SPOT_CHECK_KEYS = 16;
 
 extern const char * DEFAULT_WALLET_DAT;
 
 class CAccountingEntry;
 class CCoinControl;
+class CScheduler;
 class COutput;
 class CReserveKey;
 class CScript;
@@ -178,6 +183,10 @@ private:
     int nTries{0};
     int nCoins{0};
     CAmount nValue{0};
+    // Since startup, across all the attempts. Read by the metrics server thread
+    // while the staker counts, relaxed ordering is enough for counters.
+    std::atomic<uint64_t> nTotalTries{0};
+    std::atomic<uint64_t> nTotalKernels{0};
 
 public:
     // Get
@@ -188,6 +197,8 @@ public:
     int GetLastTries() const { return nTries; }
     int64_t GetLastTime() const { return nTime; }
     CAmount GetLastValue() const { return nValue; }
+    uint64_t GetTotalTries() const { return nTotalTries.load(std::memory_order_relaxed); }
+    uint64_t GetTotalKernels() const { return nTotalKernels.load(std::memory_order_relaxed); }
 
     // Set
     void SetLastCoins(const int coins) { nCoins = coins; }
@@ -195,6 +206,11 @@ public:
     void SetLastTip(const CBlockIndex* lastTip) { tipBlock = lastTip; }
     void SetLastTime(const uint64_t lastTime) { nTime = lastTime; }
     void SetLastValue(CAmount lastValue) { nValue = lastValue; }
+    void CountTry(bool fKernelFound)
+    {
+        nTotalTries.fetch_add(1, std::memory_order_relaxed);
+        if (fKernelFound) nTotalKernels.fetch_add(1, std::memory_order_relaxed);
+    }
 
     void SetNull()
     {
@@ -234,6 +250,9 @@ private:
     //! keeps track of whether Unlock has run a thorough check before
     bool fDecryptionThoroughlyChecked{false};
 
+    //! whether all the encrypted keys were checked by a previous session, persisted in the wallet file
+    bool fCryptedKeysVerified{false};
+
     //! Key manager //
     std::unique_ptr<ScriptPubKeyMan> m_spk_man = MakeUnique<ScriptPubKeyMan>(this);
 
@@ -263,6 +282,24 @@ private:
 
     bool IsKeyUsed(const CPubKey& vchPubKey);
 
+    /**
+     * Outputs the wallet can spend, by destination, used by the wallet automations.
+     * Built on first use, then kept up to date as transactions are added or change
+     * state. Spent outputs are pruned lazily by AvailableCoinsByAddress(), and added
+     * back whenever a transaction spending them changes state (e.g. an orphaned
+     * coinstake), so the index never misses an output.
+     */
+    typedef std::map<CTxDestination, std::set<COutPoint> > OutputsByDest;
+    OutputsByDest mapOutputsByDest;
+    bool fOutputsByDestBuilt{false};
+    void AddToOutputsByDest(const CWalletTx& wtx, unsigned int n);
+    void AddPrevoutsToOutputsByDest(const CWalletTx& wtx);
+
+    //! Scheduler the wallet automations (MultiSend, AutoCombineDust) run in, nullptr until started
+    std::atomic<CScheduler*> pAutomationsScheduler{nullptr};
+    //! Whether a run of the wallet automations is scheduled and not started yet
+    std::atomic<bool> fAutomationsScheduled{false};
+
 
 public:
 
@@ -367,6 +404,7 @@ public:
     //! >> Available coins (staking)
     bool StakeableCoins(std::vector<COutput>* pCoins = nullptr);
 
+    //! Available outputs the wallet can spend, grouped by destination (from the outputs index, not a walk of mapWallet)
     std::map<CTxDestination, std::vector<COutput> > AvailableCoinsByAddress(bool fConfirmed = true, CAmount maxCoinValue = 0);
 
     /// Get collateral output and keys which can be used for the Masternode
@@ -399,6 +437,8 @@ public:
     bool LoadKeyMetadata(const CPubKey& pubkey, const CKeyMetadata& metadata);
 
     bool LoadMinVersion(int nVersion);
+    //! Remember that a previous session checked all the encrypted keys (used by LoadWallet)
+    void LoadCryptedKeysVerified(bool fVerified) { fCryptedKeysVerified = fVerified; }
 
     //! Adds an encrypted key to the store, and saves it to disk.
     bool AddCryptedKey(const CPubKey& vchPubKey, const std::vector<unsigned char>& vchCryptedSecret);
@@ -441,6 +481,7 @@ public:
     bool AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose = true);
     bool LoadToWallet(const CWalletTx& wtxIn);
     void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, int posInBlock);
+    void UpdatedBlockTip(const CBlockIndex *pindex);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlockIndex* pIndex, int posInBlock, bool fUpdate);
     void EraseFromWallet(const uint256& hash);
 
@@ -453,6 +494,58 @@ public:
     void ReacceptWalletTransactions(bool fFirstLoad = false);
     void ResendWalletTransactions(CConnman* connman);
 
+    //! Wallet balances by category, as filled by a single walk of mapWallet
+    struct Balances {
+        CAmount nTrusted{0};                    //!< trusted spendable coins (GetAvailableBalance)
+        CAmount nUntrustedPending{0};           //!< untrusted coins in the mempool (GetUnconfirmedBalance)
+        CAmount nImmature{0};                   //!< immature coinbase/coinstake credit (GetImmatureBalance)
+        CAmount nLocked{0};                     //!< locked coins and masternode collaterals (GetLockedCoins)
+        CAmount nStakeable{0};                  //!< available coins deep enough to stake (GetStakingBalance)
+        CAmount nWatchOnlyTrusted{0};
+        CAmount nWatchOnlyUntrustedPending{0};
+        CAmount nWatchOnlyImmature{0};
+    };
+    /**
+     * Return the wallet balances. They are recomputed only when the wallet
+     * transactions, spends or locked coins, the chain tip or the mempool
+     * state of a wallet transaction changed since the last call.
+     */
+    Balances GetBalances() const;
+    //! Invalidate the cached balances and stakeable coins
+    void MarkBalancesDirty() const { ++nBalanceStateVersion; }
+    //! Mempool notification: a wallet transaction leaving the mempool changes the pending balances
+    void TransactionRemovedFromMempool(const CTransactionRef& ptx);
+
+private:
+    //! Snapshot of what the cached balances and stakeable coins were computed from
+    struct BalanceCacheKey {
+        uint64_t nStateVersion{0};
+        const CBlockIndex* pindexTip{nullptr};
+        bool fValid{false};
+
+        bool operator==(const BalanceCacheKey& other) const
+        {
+            return fValid && other.fValid && nStateVersion == other.nStateVersion &&
+                   pindexTip == other.pindexTip;
+        }
+    };
+    BalanceCacheKey GetBalanceCacheKey() const;
+    Balances ComputeBalances() const;
+
+    //! Bumped on every change of the wallet transactions, spends or locked coins
+    mutable std::atomic<uint64_t> nBalanceStateVersion{0};
+    mutable BalanceCacheKey balanceCacheKey;            // guarded by cs_wallet
+    mutable Balances cachedBalances;                    // guarded by cs_wallet
+    BalanceCacheKey stakeableCacheKey;                  // guarded by cs_wallet
+    std::vector<COutput> vCachedStakeableCoins;         // guarded by cs_wallet
+
+    //! Hashes of the wallet transactions. Mempool notifications come with the
+    //! mempool lock held, they can't take cs_wallet to look up mapWallet.
+    mutable Mutex cs_walletTxHashes;
+    std::set<uint256> setWalletTxHashes GUARDED_BY(cs_walletTxHashes);
+    boost::signals2::scoped_connection connMempoolRemoved;
+
+public:
     CAmount loopTxsBalance(std::function<void(const uint256&, const CWalletTx&, CAmount&)>method) const;
     CAmount GetAvailableBalance() const;
     CAmount GetAvailableBalance(isminefilter& filter, bool useCache = false, int minDepth = 1) const;
@@ -508,6 +601,10 @@ public:
                          std::vector<COutput>* availableCoins);
     bool MultiSend();
     void AutoCombineDust(CConnman* connman);
+    //! Schedule a run of the wallet automations, unless one is already pending
+    void ScheduleAutomations();
+    //! Run the wallet automations that are turned on
+    void RunAutomations();
 
     static CFeeRate minTxFee;
     /**
@@ -599,7 +696,7 @@ public:
      * Wallet post-init setup
      * Gives the wallet a chance to register repetitive tasks and complete post-init tasks
      */
-    void postInitProcess(boost::thread_group& threadGroup);
+    void postInitProcess(boost::thread_group& threadGroup, CScheduler& scheduler);
 
     /**
      * Address book entry changed.
@@ -677,13 +774,14 @@ struct COutputEntry {
 };
 
 /** A transaction with a merkle branch linking it to the block chain. */
-class CMerkleTx : public CTransaction
+class CMerkleTx
 {
 private:
     /** Constant used in hashBlock to indicate tx has been abandoned */
     static const uint256 ABANDON_HASH;
 
 public:
+    CTransactionRef tx;
     uint256 hashBlock;
     /* An nIndex == -1 means that hashBlock (in nonzero) refers to the earliest
      * block in the chain we know this or any in-wallet dependency conflicts
@@ -694,27 +792,37 @@ public:
 
     CMerkleTx()
     {
+        SetTx(MakeTransactionRef());
         Init();
     }
 
-    CMerkleTx(const CTransaction& txIn) : CTransaction(txIn)
+    CMerkleTx(CTransactionRef arg)
     {
+        SetTx(std::move(arg));
         Init();
     }
 
+    /** Helper conversion operator to allow passing CMerkleTx where CTransaction is expected. */
+    operator const CTransaction&() const { return *tx; }
+
     void Init()
     {
         hashBlock = UINT256_ZERO;
         nIndex = -1;
     }
 
+    void SetTx(CTransactionRef arg)
+    {
+        tx = std::move(arg);
+    }
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action)
     {
         std::vector<uint256> vMerkleBranch; // For compatibility with older versions.
-        READWRITE(*(CTransaction*)this);
+        READWRITE(tx);
         READWRITE(hashBlock);
         READWRITE(vMerkleBranch);
         READWRITE(nIndex);
@@ -739,6 +847,10 @@ public:
     bool hashUnset() const { return (hashBlock.IsNull() || hashBlock == ABANDON_HASH); }
     bool isAbandoned() const { return (hashBlock == ABANDON_HASH); }
     void setAbandoned() { hashBlock = ABANDON_HASH; }
+
+    const uint256& GetHash() const { return tx->GetHash(); }
+    bool IsCoinBase() const { return tx->IsCoinBase(); }
+    bool IsCoinStake() const { return tx->IsCoinStake(); }
 };
 
 /**
@@ -774,8 +886,7 @@ public:
 
     CWalletTx();
     CWalletTx(const CWallet* pwalletIn);
-    CWalletTx(const CWallet* pwalletIn, const CMerkleTx& txIn);
-    CWalletTx(const CWallet* pwalletIn, const CTransaction& txIn);
+    CWalletTx(const CWallet* pwalletIn, CTransactionRef arg);
     void Init(const CWallet* pwalletIn);
 
     ADD_SERIALIZE_METHODS;
@@ -874,7 +985,7 @@ public:
     COutput(const CWalletTx* txIn, int iIn, int nDepthIn, bool fSpendableIn, bool fSolvableIn) :
         tx(txIn), i(iIn), nDepth(nDepthIn), fSpendable(fSpendableIn), fSolvable(fSolvableIn) {}
 
-    CAmount Value() const { return tx->vout[i].nValue; }
+    CAmount Value() const { return tx->tx->vout[i].nValue; }
     std::string ToString() const;
 };
 
@@ -291,6 +291,12 @@ bool CWalletDB::WriteMinVersion(int nVersion)
     return Write(std::string("minversion"), nVersion);
 }
 
+bool CWalletDB::WriteCryptedKeysVerified(bool fVerified)
+{
+    nWalletDBUpdateCounter++;
+    return Write(std::string("ckeysverified"), fVerified);
+}
+
 bool CWalletDB::WriteHDChain(const CHDChain& chain)
 {
     nWalletDBUpdateCounter++;
@@ -696,6 +702,10 @@ bool ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue, CW
                 strErr = "Error reading wallet database: LoadDestData failed";
                 return false;
             }
+        } else if (strType == "ckeysverified") {
+            bool fVerified;
+            ssValue >> fVerified;
+            pwallet->LoadCryptedKeysVerified(fVerified);
         } else if (strType == "hdchain") { // Regular key chain counter
             CHDChain chain;
             ssValue >> chain;
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022-2023 The SafeDeal Core Developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test loading a UTXO set snapshot into a fresh node.
+
+- node0 mines a deterministic chain, whose UTXO set at SNAPSHOT_HEIGHT is
+  the one pinned in the regtest chain parameters, and dumps it.
+- node1 gets the block files of node0 but no chainstate, loads the snapshot
+  with -loadtxoutset and validates the blocks up to it in the background.
+  Its -blockfilterindex waits for the undo data of those blocks meanwhile.
+"""
+
+import os
+import shutil
+
+from test_framework.authproxy import JSONRPCException
+from test_framework.blocktools import create_block, create_coinbase
+from test_framework.mininode import COIN, COutPoint, CTransaction, CTxIn, CTxOut
+from test_framework.script import CScript, OP_TRUE
+from test_framework.test_framework import PivxTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_raises_rpc_error,
+    bytes_to_hex_str,
+    wait_until,
+)
+
+# Must match mapSnapshotsRegtest in chainparams.cpp
+SNAPSHOT_HEIGHT = 120
+SNAPSHOT_HASH = '4bbb4cd9f079f5076effcb81f855320b614815caa7005bababd90e51e1bca59f'
+FINAL_HEIGHT = 130
+
+class UTXOSnapshotTest(PivxTestFramework):
+    def set_test_params(self):
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+        self.extra_args = [['-blockfilterindex'], ['-blockfilterindex']]
+
+    def setup_network(self):
+        # The nodes are never connected, node1 gets the blocks of node0 from its block files
+        self.setup_nodes()
+
+    def mine_block(self, node, txs=[]):
+        """Mine a block whose content only depends on the chain, with an anyone-can-spend coinbase."""
+        tip = node.getblock(node.getbestblockhash())
+        block = create_block(int(tip['hash'], 16), create_coinbase(tip['height'] + 1), tip['time'] + 60)
+        block.vtx.extend(txs)
+        block.hashMerkleRoot = block.calc_merkle_root()
+        # Regtest doesn't check the proof of work
+        block.rehash()
+        assert_equal(node.submitblock(bytes_to_hex_str(block.serialize())), None)
+        assert_equal(node.getbestblockhash(), block.hash)
+        return block
+
+    def filter_indexed(self, node, block_hash):
+        """Whether the filter index of node caught up with block_hash."""
+        try:
+            node.getblockfilter(block_hash)
+            return True
+        except JSONRPCException as e:
+            if "still in the process of being indexed" not in e.error['message']:
+                raise
+            return False
+
+    def run_test(self):
+        node0, node1 = self.nodes
+
+        self.log.info("Mine a deterministic chain up to the snapshot height")
+        coinbases = []
+        for height in range(1, SNAPSHOT_HEIGHT + 1):
+            txs = []
+            if height == 102:
+                # Spend a mature coinbase, so the snapshot has more than coinbases
+                value = coinbases[0].vout[0].nValue
+                tx = CTransaction()
+                tx.vin.append(CTxIn(COutPoint(coinbases[0].sha256, 0), b'', 0xffffffff))
+                tx.vout.append(CTxOut(value // 2, CScript([OP_TRUE])))
+                tx.vout.append(CTxOut(value // 2 - COIN, CScript([OP_TRUE])))
+                tx.rehash()
+                txs.append(tx)
+            coinbases.append(self.mine_block(node0, txs).vtx[0])
+
+        self.log.info("Dump the snapshot pinned for regtest")
+        res = node0.dumptxoutset('utxo.dat')
+        snapshot_path = res['path']
+        assert_equal(res['base_height'], SNAPSHOT_HEIGHT)
+        assert_equal(res['txoutset_hash'], SNAPSHOT_HASH)
+        # The chain is past the snapshot, there's nothing to load
+        assert_raises_rpc_error(-1, "the active chain is past the snapshot", node0.loadtxoutset, 'utxo.dat')
+
+        for _ in range(SNAPSHOT_HEIGHT, FINAL_HEIGHT):
+            self.mine_block(node0)
+        best_hash = node0.getbestblockhash()
+        wait_until(lambda: self.filter_indexed(node0, best_hash), timeout=60)
+        filters = [node0.getblockfilter(node0.getblockhash(h))['filter'] for h in range(FINAL_HEIGHT + 1)]
+        utxo_info = node0.gettxoutsetinfo()
+
+        self.log.info("Give the block files of node0 to node1, without its chainstate")
+        self.stop_nodes()
+        node0_regtest = os.path.join(node0.datadir, 'regtest')
+        node1_regtest = os.path.join(node1.datadir, 'regtest')
+        for subdir in ['blocks', 'chainstate', 'indexes']:
+            shutil.rmtree(os.path.join(node1_regtest, subdir), ignore_errors=True)
+        shutil.copytree(os.path.join(node0_regtest, 'blocks'), os.path.join(node1_regtest, 'blocks'))
+
+        self.log.info("Load the snapshot into node1 and validate it in the background")
+        self.start_node(0)
+        self.start_node(1, ['-blockfilterindex', '-loadtxoutset=' + snapshot_path])
+        wait_until(lambda: node1.getbestblockhash() == best_hash, timeout=60)
+        wait_until(lambda: node1.getblockchaininfo()['snapshotheight'] == 0, timeout=60)
+        assert not os.path.exists(os.path.join(node1_regtest, 'chainstate_background'))
+
+        # The coins and the filters are those of a node that validated the chain from the genesis block
+        assert_equal(node1.gettxoutsetinfo(), utxo_info)
+        wait_until(lambda: self.filter_indexed(node1, best_hash), timeout=60)
+        assert_equal([node1.getblockfilter(node1.getblockhash(h))['filter'] for h in range(FINAL_HEIGHT + 1)], filters)
+
+        self.log.info("The validated chain survives a restart")
+        self.restart_node(1, ['-blockfilterindex'])
+        assert_equal(node1.getbestblockhash(), best_hash)
+        assert_equal(node1.getblockchaininfo()['snapshotheight'], 0)
+        assert node1.verifychain(0)
+
+if __name__ == '__main__':
+    UTXOSnapshotTest().main()
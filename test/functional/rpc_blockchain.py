@@ -7,6 +7,7 @@
 Test the following RPCs:
     - getblockchaininfo
     - gettxoutsetinfo
+    - dumptxoutset
     - getdifficulty
     - getbestblockhash
     - getblockhash
@@ -20,6 +21,7 @@ Tests correspond to code in rpc/blockchain.cpp.
 
 from decimal import Decimal
 import http.client
+import os
 import subprocess
 
 from test_framework.test_framework import PivxTestFramework
@@ -40,6 +42,7 @@ class BlockchainTest(PivxTestFramework):
     def run_test(self):
         #self._test_getblockchaininfo()
         self._test_gettxoutsetinfo()
+        self._test_dumptxoutset()
         self._test_getblockheader()
         #self._test_getdifficulty()
         self.nodes[0].verifychain(0)
@@ -76,6 +79,30 @@ class BlockchainTest(PivxTestFramework):
         assert_equal(len(res['bestblock']), 64)
         assert_equal(len(res['hash_serialized_2']), 64)
 
+    def _test_dumptxoutset(self):
+        node = self.nodes[0]
+        res = node.dumptxoutset('utxo.dat')
+        path = os.path.join(node.datadir, 'regtest', 'utxo.dat')
+
+        assert_equal(res['coins_written'], 200)
+        assert_equal(res['base_height'], 200)
+        assert_equal(res['base_hash'], node.getblockhash(200))
+        assert_equal(res['money_supply'], Decimal('50000.00000000'))
+        assert_equal(res['path'], path)
+        assert_is_hash_string(res['txoutset_hash'])
+        assert os.path.isfile(path)
+        assert not os.path.exists(path + '.incomplete')
+
+        # The same coins give the same snapshot
+        res2 = node.dumptxoutset(os.path.join(node.datadir, 'utxo2.dat'))
+        assert_equal(res2['txoutset_hash'], res['txoutset_hash'])
+        with open(path, 'rb') as f1, open(res2['path'], 'rb') as f2:
+            assert f1.read() == f2.read()
+
+        assert_raises_rpc_error(-1, "already exists", node.dumptxoutset, 'utxo.dat')
+        # The only snapshot pinned on regtest is at another height
+        assert_raises_rpc_error(-1, "no snapshot at height 200 is known to this release", node.loadtxoutset, 'utxo.dat')
+
     def _test_getblockheader(self):
         node = self.nodes[0]
 